@@ -0,0 +1,101 @@
+#!/usr/bin/env python
+
+""" CSV vs Parquet archive: size and query time
+
+Writes a synthetic run of raw color rows (three boards, one row per board
+per second) as a scanner CSV, converts it with lpcsb.archive, and times one
+typical question against both: mean lux of one board over one day.
+
+    python bench/archive_bench.py [--days N] [--dir DIR]
+"""
+
+from __future__ import print_function
+
+import csv
+import datetime
+import optparse
+import os
+import random
+import sys
+import tempfile
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+import pyarrow as pa
+import pyarrow.compute as pc
+import pyarrow.parquet as pq
+from lpcsb import archive
+
+HEADER = ["device", "device_id", "received_time", "sequence_no", "rssi", "Color Temp",
+          "Lux", "Red", "Green", "Blue", "Clear", "Max. Ratio", "Min. Ratio", "Comparing Ratios"]
+BOARDS = (("LPCSB_Test", "C098E5405D4C"), ("LPCSB_0", "C098E54034A4"), ("LPCSB_1", "C098E540606C"))
+
+
+def write_csv(filename, days):
+    rng = random.Random(1)
+    start = datetime.datetime(2020, 3, 1)
+    with open(filename, 'w') as f:
+        writer = csv.writer(f)
+        writer.writerow(HEADER)
+        for second in range(days * 86400):
+            t = (start + datetime.timedelta(seconds=second)).strftime("%Y-%m-%dT%H:%M:%S.%fZ")
+            for device, mac in BOARDS:
+                r, g, b = rng.randint(100, 4000), rng.randint(100, 4000), rng.randint(100, 4000)
+                writer.writerow([device, mac, t, second & 0xFFFF, rng.randint(-90, -40),
+                                 rng.randint(2000, 6500), rng.randint(0, 2000), r, g, b, r + g + b,
+                                 1.1, 1.2, 1.3])
+
+
+def query_csv(filename, device, day):
+    total = count = 0
+    with open(filename) as f:
+        for row in csv.DictReader(f):
+            if row['device'] == device and row['received_time'].startswith(day):
+                total += int(row['Lux'])
+                count += 1
+    return total / float(count)
+
+
+def query_parquet(filename, device, lo, hi):
+    lo, hi = [pa.scalar(t, type=archive.SCHEMA.field('time').type) for t in (lo, hi)]
+    table = pq.read_table(filename, columns=['device', 'time', 'lux'],
+                          filters=[('device', '=', device), ('time', '>=', lo), ('time', '<', hi)])
+    return pc.mean(table['lux']).as_py()
+
+
+def main():
+    p = optparse.OptionParser(description="CSV vs Parquet archive benchmark")
+    p.add_option('--days', type='int', default=3, help="Days of data (default 3)")
+    p.add_option('--dir', default=tempfile.gettempdir(), help="Where to write the files")
+    options, _ = p.parse_args()
+
+    csv_name = os.path.join(options.dir, "archive_bench.csv")
+    parquet_name = os.path.join(options.dir, "archive_bench.parquet")
+    write_csv(csv_name, options.days)
+
+    start = time.time()
+    sink = archive.ParquetSink(parquet_name)
+    archive.convert_csv(csv_name, sink, utc=True)
+    sink.close()
+    print("%d rows, converted in %.1f s, %d row groups" %
+          (sink.rows_written, time.time() - start, sink.row_groups))
+    print("  csv     %7.1f MB" % (os.path.getsize(csv_name) / 1e6))
+    print("  parquet %7.1f MB" % (os.path.getsize(parquet_name) / 1e6))
+
+    day = datetime.datetime(2020, 3, 1 + options.days // 2)
+    start = time.time()
+    a = query_csv(csv_name, "LPCSB_1", day.strftime("%Y-%m-%d"))
+    csv_time = time.time() - start
+    start = time.time()
+    b = query_parquet(parquet_name, "LPCSB_1", day, day + datetime.timedelta(days=1))
+    parquet_time = time.time() - start
+    print("mean lux of one board over one day: %.2f vs %.2f" % (a, b))
+    print("  csv     %7.3f s" % csv_time)
+    print("  parquet %7.3f s" % parquet_time)
+
+    os.remove(csv_name)
+    os.remove(parquet_name)
+
+
+if __name__ == '__main__':
+    main()
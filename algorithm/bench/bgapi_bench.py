@@ -0,0 +1,215 @@
+#!/usr/bin/env python
+
+""" Throughput and noise tolerance of the BGAPI parsers
+
+Runs the scanners' original byte-at-a-time bgapi_parse() framing and
+lpcsb.bgapi.BgapiParser over the same stream and reports frames/sec. The
+stream is fed in 4 kB reads like BulkReader delivers it. With noise, bytes
+are randomly flipped, dropped or inserted, and each parser's output is
+checked against the frames that were actually sent:
+
+    good   scan responses delivered exactly as sent
+    bad    scan responses delivered that were never sent (garbage)
+
+    python bench/bgapi_bench.py [--frames N] [--file capture.bin]
+
+--file benchmarks a raw capture of the dongle's serial output instead of
+the synthetic mix; only the clean pass is run on it since there is no
+reference to compare against.
+"""
+
+from __future__ import print_function
+
+import optparse
+import os
+import random
+import struct
+import sys
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+from lpcsb import bgapi
+
+CHUNK = 4096
+
+
+def lpcsb_data(rng, service, seq):
+    if service == 0x31:
+        value = struct.pack('>BB7H', 0x31, 0x44, *([rng.randint(0, 4000) for i in range(6)] + [seq]))
+    elif service == 0x32:
+        value = struct.pack('>BBBH', 0x32, 0x44, rng.choice((0x00, 0x11, 0x22, 0x44)), seq)
+    else:
+        value = struct.pack('>BBBHhIIIHH', 0x33, 0x44, 1, 3000, 7400, seq * 50, seq * 40, seq, 0, 0)
+    return bytearray([0x02, 0x01, 0x06, 3 + len(value), 0xFF, 0xE0, 0x02]) + value
+
+
+def other_data(rng):
+    kind = rng.randint(0, 2)
+    if kind == 0:
+        # iBeacon
+        return bytearray([0x02, 0x01, 0x06, 0x1A, 0xFF, 0x4C, 0x00, 0x02, 0x15]) + \
+               bytearray(rng.getrandbits(8) for i in range(20)) + bytearray([0xC5])
+    if kind == 1:
+        # Eddystone URL
+        url = bytearray(b'\x03lab11')
+        return bytearray([0x02, 0x01, 0x06, 0x03, 0x03, 0xAA, 0xFE, 5 + len(url), 0x16,
+                          0xAA, 0xFE, 0x10, 0xEB]) + url
+    # Name only, as sent in scan responses
+    name = b'LPCSB_TEST'
+    return bytearray([1 + len(name), 0x09]) + bytearray(name)
+
+
+def synthetic(n, seed=1):
+    """ A mix of frames like a busy room produces, and the set of scan
+    responses in it (repeats collapse, the count is n). """
+    rng = random.Random(seed)
+    macs = [bytearray(rng.getrandbits(8) for i in range(6)) for j in range(200)]
+    lpcsb = bytearray([0x4C, 0x5D, 0x40, 0xE5, 0x98, 0xC0])
+
+    frames = [bgapi.frame(bgapi.MSG_RESPONSE, 6, 7, b'\x00\x00'),
+              bgapi.frame(bgapi.MSG_RESPONSE, 6, 2, b'\x00\x00')]
+    sent = set()
+    for i in range(n):
+        r = rng.random()
+        if r < 0.3:
+            sender, ptype = lpcsb, 0
+            data = lpcsb_data(rng, rng.choice((0x31, 0x32, 0x33)), i & 0xFFFF)
+        else:
+            sender, ptype = rng.choice(macs), 0
+            data = other_data(rng)
+            if data[1] == 0x09:
+                ptype = 4
+        rssi = rng.randint(-100, -30)
+        frames.append(bgapi.gap_scan_response(rssi, ptype, sender, 0, 255, data))
+        sent.add((rssi, bytes(sender), bytes(data)))
+    return b''.join(frames), sent
+
+
+def add_noise(stream, rate, seed=2):
+    rng = random.Random(seed)
+    out = bytearray()
+    for b in bytearray(stream):
+        if rng.random() < rate:
+            op = rng.randint(0, 2)
+            if op == 0:
+                out.append(rng.getrandbits(8))          # corrupted
+            elif op == 1:
+                pass                                    # dropped
+            else:
+                out.append(b)
+                out.append(rng.getrandbits(8))          # extra byte
+        else:
+            out.append(b)
+    return bytes(out)
+
+
+class LegacyParser(object):
+    """ The framing and decoding from the original bgapi_parse(). """
+    def __init__(self, handler):
+        self.handler = handler
+        self.rx = []
+        self.expected = 0
+
+    def parse(self, b):
+        rx = self.rx
+        if len(rx) == 0 and (b == 0x00 or b == 0x80):
+            rx.append(b)
+        elif len(rx) == 1:
+            rx.append(b)
+            self.expected = 4 + (rx[0] & 0x07) + rx[1]
+        elif len(rx) > 1:
+            rx.append(b)
+
+        if self.expected > 0 and len(rx) == self.expected:
+            packet_type, payload_length, packet_class, packet_command = rx[:4]
+            payload = bytes(bytearray(rx[4:]))
+            if packet_type & 0x80 and packet_class == 0x06 and packet_command == 0x00 and len(payload) >= 11:
+                rssi, packet_type, sender, address_type, bond, data_len = struct.unpack('<bB6sBBB', payload[:11])
+                sender = list(bytearray(sender))
+                data_data = list(bytearray(payload[11:]))
+
+                ad_fields = []
+                this_field = []
+                bytes_left = 0
+                for b in data_data:
+                    if bytes_left == 0:
+                        bytes_left = b
+                        this_field = []
+                    else:
+                        this_field.append(b)
+                        bytes_left = bytes_left - 1
+                        if bytes_left == 0:
+                            ad_fields.append(this_field)
+                self.handler(rssi, sender, data_data, ad_fields)
+            self.rx = []
+
+    def feed(self, data):
+        parse = self.parse
+        for b in bytearray(data):
+            parse(b)
+
+
+def run_legacy(stream, sent):
+    good = [0, 0]
+
+    def handler(rssi, sender, data, fields):
+        if (rssi, bytes(bytearray(sender)), bytes(bytearray(data))) in sent:
+            good[0] += 1
+        else:
+            good[1] += 1
+
+    parser = LegacyParser(handler)
+    start = time.time()
+    for i in range(0, len(stream), CHUNK):
+        parser.feed(stream[i:i + CHUNK])
+    return time.time() - start, good[0] + good[1], good[0], good[1]
+
+
+def run_new(stream, sent):
+    good = [0, 0]
+
+    def handler(evt):
+        if (evt.rssi, evt.sender.tobytes(), evt.data.tobytes()) in sent:
+            good[0] += 1
+        else:
+            good[1] += 1
+
+    parser = bgapi.BgapiParser(on_scan_response=handler)
+    start = time.time()
+    for i in range(0, len(stream), CHUNK):
+        parser.feed(stream[i:i + CHUNK])
+    return time.time() - start, parser.scan_responses, good[0], good[1]
+
+
+def report(name, result, total):
+    elapsed, frames, good, bad = result
+    print("  %-7s %9.0f frames/sec  %7d good  %5d bad  %5.1f%% recovered" %
+          (name, frames / elapsed, good, bad, 100.0 * good / total if total else 0))
+
+
+def main():
+    p = optparse.OptionParser(description="BGAPI parser benchmark")
+    p.add_option('--frames', type='int', default=50000, help="Synthetic scan responses (default 50000)")
+    p.add_option('--file', help="Raw capture of the serial stream to parse instead")
+    options, _ = p.parse_args()
+
+    if options.file:
+        with open(options.file, 'rb') as f:
+            stream = f.read()
+        print("%s: %d bytes" % (options.file, len(stream)))
+        report("legacy", run_legacy(stream, set()), 0)
+        report("bgapi", run_new(stream, set()), 0)
+        return
+
+    clean, sent = synthetic(options.frames)
+    total = options.frames
+    print("%d synthetic scan responses, %d bytes" % (total, len(clean)))
+    for rate in (0, 1e-4, 1e-3, 1e-2):
+        stream = add_noise(clean, rate) if rate else clean
+        print("noise %g per byte" % rate)
+        report("legacy", run_legacy(stream, sent), total)
+        report("bgapi", run_new(stream, sent), total)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,100 @@
+#!/usr/bin/env python
+
+""" Per-packet cost of LPCSB decoding
+
+Compares the scanners' old path (format the sender and payload as hex,
+compare MAC strings, int() slices at fixed offsets) against
+lpcsb.decode (a dict lookup on the raw address and struct.unpack_from on the
+manufacturer data). Both run inside the same BgapiParser callback over the
+synthetic stream from bgapi_bench, so the difference is only the decoding.
+
+    python bench/decode_bench.py [--frames N]
+"""
+
+from __future__ import print_function
+
+import datetime
+import optparse
+import os
+import sys
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+from lpcsb import bgapi
+from lpcsb.decode import decode, RawColor, LightType
+from lpcsb.devices import load as load_devices
+from bgapi_bench import synthetic
+
+MACS = ('C098E5405D4C', 'C098E54034A4', 'C098E540606C')
+DEVICES = load_devices()
+
+
+def old_decode(evt, out):
+    rssi = evt.rssi
+    sender = list(bytearray(evt.sender))
+    data_data = list(bytearray(evt.data))
+    disp_list = []
+    for c in "trpsabd":
+        if c == 't':
+            disp_list.append(datetime.datetime.now().strftime("%Y-%m-%dT%H:%M:%S.%fZ"))
+        elif c == 'r':
+            disp_list.append("%d" % rssi)
+        elif c == 'p':
+            disp_list.append("%d" % evt.packet_type)
+        elif c == 's':
+            disp_list.append("%s" % ''.join(['%02X' % b for b in sender[::-1]]))
+        elif c == 'a':
+            disp_list.append("%d" % evt.address_type)
+        elif c == 'b':
+            disp_list.append("%d" % evt.bond)
+        elif c == 'd':
+            disp_list.append("%s" % ''.join(['%02X' % b for b in data_data]))
+    if disp_list[3] in MACS:
+        service = int(disp_list[-1][14:16], 16)
+        if int(disp_list[-1][16:18], 16) != 0x44:
+            return
+        if service == 0x31:
+            out.append((int(disp_list[-1][18:22], 16), int(disp_list[-1][22:26], 16),
+                        int(disp_list[-1][26:30], 16), int(disp_list[-1][30:34], 16),
+                        int(disp_list[-1][34:38], 16), int(disp_list[-1][38:42], 16),
+                        int(disp_list[-1][42:46], 16)))
+        elif service == 0x32:
+            out.append((int(disp_list[-1][18:20], 16), int(disp_list[-1][20:24], 16)))
+
+
+def new_decode(evt, out):
+    if DEVICES.get(evt.sender.tobytes()) is None:
+        return
+    record = decode(evt)
+    if isinstance(record, (RawColor, LightType)) and record.sensor_id == 0x44:
+        out.append(record)
+
+
+def baseline(evt, out):
+    pass
+
+
+def run(stream, handler):
+    out = []
+    parser = bgapi.BgapiParser(on_scan_response=lambda evt: handler(evt, out))
+    start = time.time()
+    parser.feed(stream)
+    return time.time() - start, parser.scan_responses, len(out)
+
+
+def main():
+    p = optparse.OptionParser(description="LPCSB decode benchmark")
+    p.add_option('--frames', type='int', default=50000, help="Synthetic scan responses (default 50000)")
+    options, _ = p.parse_args()
+
+    stream, sent = synthetic(options.frames)
+    base, frames, _ = run(stream, baseline)
+    print("%d scan responses, parsing alone %.2f us each" % (frames, base / frames * 1e6))
+    for name, handler in (("hex", old_decode), ("struct", new_decode)):
+        elapsed, frames, decoded = run(stream, handler)
+        print("  %-7s %6.2f us per packet on top of parsing, %d LPCSB records" %
+              (name, (elapsed - base) / frames * 1e6, decoded))
+
+
+if __name__ == '__main__':
+    main()
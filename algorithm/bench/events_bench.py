@@ -0,0 +1,188 @@
+#!/usr/bin/env python
+
+""" Event extraction: how fast it replays an archive, and how little it chatters
+
+Writes a Parquet archive of `days` of 5 s samples from `boards` boards with
+a known schedule: on weekdays lights on some time after 07:30 and off
+after 18:00, daylight through the window around midday on every third
+board, and before both switches five minutes of half light that hovers
+between the thresholds. At the weekend the lights stay off and the
+daylight on those boards comes into a dark room. On top of that come
+flash spikes at night and single samples of the wrong light type. The archive is replayed through an
+EventDetector, and reported are the replay rate, the detector's own rate,
+how many of the scheduled events it found within a minute, and how many
+events a bare threshold with no hysteresis or debounce makes of the same
+samples.
+
+    python bench/events_bench.py [--boards N] [--days N] [--dir DIR]    (needs pyarrow)
+"""
+
+from __future__ import print_function
+
+import optparse
+import os
+import random
+import shutil
+import sys
+import tempfile
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+from lpcsb import events
+from lpcsb.archive import ParquetSink
+from lpcsb.decode import RawColor
+from lpcsb.events import EventDetector
+
+START_NS = 1583020800 * 1000000000
+STEP = 5
+SOURCES = ("LED", "Fluorescent", "Incandescent")
+
+
+def schedule(boards, days, rng):
+    """ [(device, time_ns, kind)] in time order, and a function of
+    (board, second) -> (lux, light type) that follows it. """
+    plan = {}
+    truth = []
+    for b in range(boards):
+        device = "LPCSB_%d" % b
+        for d in range(days):
+            base = d * 86400
+            weekend = d % 7 >= 5
+            on = base + 7 * 3600 + 1800 + rng.randint(0, 3600)
+            off = base + 18 * 3600 + rng.randint(0, 3600)
+            sun = None
+            if b % 3 == 0:
+                sun = (base + 11 * 3600 + rng.randint(0, 1800), base + 14 * 3600 + rng.randint(0, 1800))
+            if weekend:
+                on = off = None
+                if sun:
+                    # bright enough to count as lights on, then Sunlight as the first source
+                    truth += [(device, sun[0], events.ON), (device, sun[0], events.DAYLIGHT_ON),
+                              (device, sun[1], events.OFF)]
+            else:
+                # the lamp is the first source after switching on
+                truth += [(device, on, events.ON), (device, on, events.SOURCE), (device, off, events.OFF)]
+                if sun:
+                    truth += [(device, sun[0], events.DAYLIGHT_ON), (device, sun[1], events.DAYLIGHT_OFF)]
+            plan[b, d] = on, off, sun
+    truth.sort(key=lambda e: e[1])
+
+    def sample(b, second):
+        on, off, sun = plan[b, second // 86400]
+        if on is None:
+            if sun and sun[0] <= second < sun[1]:
+                return rng.gauss(2000, 100), events.DAYLIGHT
+        elif on <= second < off:
+            if sun and sun[0] <= second < sun[1]:
+                return rng.gauss(2000, 100), events.DAYLIGHT
+            light = SOURCES[b % len(SOURCES)]
+            if rng.random() < 0.02:
+                light = rng.choice(SOURCES + (events.DAYLIGHT,))
+            if off - second < 300:
+                # dimmed down before switching off, between the thresholds
+                return max(0.0, rng.gauss(35, 8)), light
+            return rng.gauss(400, 30), light
+        elif 0 <= on - second < 300:
+            # dawn through the blinds before switching on, between them too
+            return max(0.0, rng.gauss(35, 8)), "Unknown"
+        if rng.random() < 0.001:
+            return 300.0, "Unknown"
+        return max(0.0, rng.gauss(3, 2)), "Unknown"
+
+    return truth, sample
+
+
+def write_archive(path, boards, days, sample):
+    sink = ParquetSink(path)
+    for i in range(days * 86400 // STEP):
+        second = i * STEP
+        for b in range(boards):
+            lux, light = sample(b, second)
+            t = START_NS + second * 1000000000 + b * 1000000
+            lux = int(lux)
+            sink.add("LPCSB_%d" % b, "C098E540%04X" % b, i & 0xFFFF, -60,
+                     raw=RawColor(0x44, lux * 4, lux * 2, lux, lux // 2, 3000, lux, i & 0xFFFF), time_ns=t)
+            sink.add("LPCSB_%d" % b, "C098E540%04X" % b, i & 0xFFFF, -60, light_type=light, time_ns=t)
+    sink.close()
+    return sink.rows_written
+
+
+def naive(path, threshold):
+    """ Events from a bare threshold and every change of light type. """
+    lit = {}
+    light = {}
+    count = [0]
+
+    class Bare(object):
+        def add(self, device, time_ns, lux=None, light_type=None):
+            if lux is not None:
+                now = lux >= threshold
+                if lit.get(device, now) != now:
+                    count[0] += 1
+                lit[device] = now
+            if light_type is not None and light_type != "Unknown" and lit.get(device):
+                if light.get(device, light_type) != light_type:
+                    count[0] += 1
+                light[device] = light_type
+
+    events.replay_parquet(path, Bare())
+    return count[0]
+
+
+def main():
+    p = optparse.OptionParser(description="Event extraction benchmark")
+    p.add_option('--boards', type='int', default=20, help="Boards (default 20)")
+    p.add_option('--days', type='int', default=7, help="Days of samples (default 7)")
+    p.add_option('--dir', help="Where to write (default: a temporary directory)")
+    options, _ = p.parse_args()
+
+    directory = options.dir or tempfile.mkdtemp()
+    path = os.path.join(directory, 'archive.parquet')
+    try:
+        truth, sample = schedule(options.boards, options.days, random.Random(1))
+        rows = write_archive(path, options.boards, options.days, sample)
+
+        found = []
+        detector = EventDetector(found.append)
+        start = time.time()
+        events.replay_parquet(path, detector)
+        replay = time.time() - start
+        print("%d boards x %d days: %d archive rows replayed at %.0f rows/s" %
+              (options.boards, options.days, rows, rows / replay))
+
+        # the detector alone, on rows already in memory
+        columns = []
+        events.replay_parquet(path, type('Keep', (), {'add': lambda self, *row: columns.append(row)})())
+        detector = EventDetector(lambda event: None)
+        start = time.time()
+        add = detector.add
+        for row in columns:
+            add(*row)
+        alone = time.time() - start
+        print("  detector alone: %.0f samples/s, %.2f us per sample" % (len(columns) / alone, 1e6 * alone / len(columns)))
+
+        unmatched = list(truth)
+        late = []
+        for event in found:
+            for i, (device, second, kind) in enumerate(unmatched):
+                at = START_NS + second * 1000000000
+                if device == event['device'] and kind == event['event'] and abs(event['time_ns'] - at) <= 60 * 10 ** 9:
+                    late.append((event['time_ns'] - at) / 1e9)
+                    del unmatched[i]
+                    break
+        print("  %d scheduled events, %d found within a minute (mean offset %+.1f s), %d missed, %d extra" %
+              (len(truth), len(late), sum(late) / max(1, len(late)), len(unmatched), len(found) - len(late)))
+        if unmatched:
+            kinds = {}
+            for _, _, kind in unmatched:
+                kinds[kind] = kinds.get(kind, 0) + 1
+            print("  missed: %s" % ', '.join("%d %s" % (n, kind) for kind, n in sorted(kinds.items())))
+        threshold = (detector.on_lux + detector.off_lux) / 2.0
+        print("  a bare %g lux threshold makes %d events of the same samples" % (threshold, naive(path, threshold)))
+    finally:
+        if not options.dir:
+            shutil.rmtree(directory)
+
+
+if __name__ == '__main__':
+    main()
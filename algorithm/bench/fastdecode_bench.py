@@ -0,0 +1,98 @@
+#!/usr/bin/env python
+
+""" Native batch decoding against the Python parser
+
+Writes emulated recordings (lpcsb.emulator --record) for a few loads and
+decodes each with lpcsb.fastdecode.PyParser, i.e. lpcsb.bgapi.BgapiParser
+and the lpcsb.decode layouts, and with the lpcsb._fastdecode extension,
+reporting records per second of both and checking that they return the
+same records and counts. The same is done with a copy of each recording
+with every byte corrupted at random with probability --corrupt, so both
+must also lose and find the stream in the same places.
+
+    python setup.py build_ext --inplace
+    python bench/fastdecode_bench.py [--seconds N] [--corrupt P]
+"""
+
+from __future__ import print_function
+
+import optparse
+import os
+import random
+import shutil
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, '..'))
+from lpcsb import fastdecode
+from lpcsb.emulator import Emulator
+from lpcsb.replay import Recorder, Recording
+
+# (boards, seconds between advertisements; 0 floods)
+LOADS = [(100, 0.5), (1000, 2.5), (50, 0)]
+START = 1600000000.0
+COUNTERS = ('frames', 'scan_responses', 'dropped_bytes', 'resyncs', 'records', 'malformed')
+
+
+def corrupt(source, target, p, rng):
+    """ Copy a recording, replacing each byte with a random one with probability p. """
+    recording = Recording(source)
+    recorder = Recorder(target, recording.names)
+    for when, receiver, data in recording.chunks():
+        data = bytearray(data)
+        i = int(rng.expovariate(p)) if p else len(data)
+        while i < len(data):
+            data[i] = rng.randrange(256)
+            i += 1 + int(rng.expovariate(p))
+        recorder.write(receiver, bytes(data), when)
+    recorder.close()
+    recording.close()
+
+
+def run(path, parser):
+    """ (records/s, all records, counters) """
+    chunks = [data for _, _, data in Recording(path).chunks()]
+    p = parser()
+    start = time.time()
+    batches = [p.feed(data) for data in chunks]
+    seconds = time.time() - start
+    out = b''.join(batches)
+    return len(out) // fastdecode.RECORD.size / seconds, out, tuple(getattr(p, name) for name in COUNTERS)
+
+
+def main():
+    p = optparse.OptionParser(description="Native decoder benchmark")
+    p.add_option('--seconds', type='float', default=60.0, help="Seconds of traffic per recording, a tenth of it when flooding (default 60)")
+    p.add_option('--corrupt', type='float', default=1e-4, help="Share of bytes corrupted in the second run (default 0.0001)")
+    options, _ = p.parse_args()
+    if not fastdecode.NATIVE:
+        raise SystemExit("lpcsb._fastdecode isn't built: python setup.py build_ext --inplace")
+
+    work = tempfile.mkdtemp()
+    rng = random.Random(1)
+    try:
+        for boards, interval in LOADS:
+            recording = os.path.join(work, 'load.lpcsbrec')
+            damaged = os.path.join(work, 'damaged.lpcsbrec')
+            emulator = Emulator(None, boards, interval, sample_period=5.0 if interval else 0)
+            recorder = Recorder(recording, ["emulator"])
+            emulator.record(recorder, options.seconds if interval else options.seconds / 10, start=START)
+            recorder.close()
+            corrupt(recording, damaged, options.corrupt, rng)
+
+            for name, path in (("clean", recording), ("corrupted", damaged)):
+                python_rate, python_out, python_counts = run(path, fastdecode.PyParser)
+                native_rate, native_out, native_counts = run(path, fastdecode.Parser)
+                print("%4d boards, %s, %s: %d records, Python %8.0f records/s, native %10.0f records/s (%.0fx), %s" %
+                      (boards, "flooding" if not interval else "adv every %gs" % interval, name,
+                       native_counts[4], python_rate, native_rate, native_rate / python_rate,
+                       "same records" if python_out == native_out and python_counts == native_counts else
+                       "DIFFERENT: %s vs %s" % (python_counts, native_counts)))
+    finally:
+        shutil.rmtree(work)
+
+
+if __name__ == '__main__':
+    main()
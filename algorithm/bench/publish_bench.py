@@ -0,0 +1,112 @@
+#!/usr/bin/env python
+
+""" Live publishing: what it costs the writer thread, and that a stalled
+subscriber can't hold it up
+
+Publishes `records` raw color records through a Publisher with no
+subscribers, with one that reads everything, and with that one plus one
+that never reads: first flat out, which is what add() costs the writer
+thread, then paced at --rate, well above what a site's boards send.
+Reports records per second and the slowest add() for each, how many
+records the reading subscriber got, and what the stalled one was sent
+and had dropped.
+
+    python bench/publish_bench.py [--records N] [--buffer N] [--rate N]
+"""
+
+from __future__ import print_function
+
+import optparse
+import os
+import socket
+import sys
+import threading
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+from lpcsb.decode import RawColor
+from lpcsb.publish import Publisher, connect
+
+START_NS = 1583020800 * 1000000000
+
+
+class Reader(threading.Thread):
+    """ A subscriber that reads as fast as it can and counts messages. """
+
+    def __init__(self, port):
+        threading.Thread.__init__(self)
+        self.daemon = True
+        self.sock = connect(str(port))
+        self.sock.sendall(b'{}\n')
+        self.messages = 0
+
+    def run(self):
+        rest = b''
+        while True:
+            data = self.sock.recv(1 << 16)
+            if not data:
+                return
+            lines = (rest + data).split(b'\n')
+            rest = lines.pop()
+            self.messages += sum(1 for line in lines if b'"type":"record"' in line)
+
+
+def run(records, buffer, readers, stalled, rate=None):
+    publisher = Publisher(port=0, buffer=buffer)
+    subscribers = [Reader(publisher.port) for _ in range(readers)]
+    stalls = []
+    for _ in range(stalled):
+        sock = connect(str(publisher.port))
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+        sock.sendall(b'\n')
+        stalls.append(sock)
+    while len(publisher.stats()['clients']) < readers + stalled:
+        time.sleep(0.01)
+    time.sleep(0.2)
+    for reader in subscribers:
+        reader.start()
+
+    slowest = 0.0
+    start = time.time()
+    for i in range(records):
+        t = time.time()
+        if rate and i % 100 == 0 and start + i / float(rate) > t:
+            time.sleep(start + i / float(rate) - t)
+            t = time.time()
+        lux = 500 + i % 1000
+        publisher.add("LPCSB_%d" % (i % 20), "C098E540%04X" % (i % 20), i & 0xFFFF, -60,
+                      raw=RawColor(0x44, lux * 4, lux * 2, lux, lux // 2, 3000, lux, i & 0xFFFF),
+                      light_type="LED", time_ns=START_NS + i * 250000000)
+        slowest = max(slowest, time.time() - t)
+    seconds = time.time() - start
+    clients = publisher.stats()['clients']
+    publisher.close()
+    for reader in subscribers:
+        reader.join(5)
+    for sock in stalls:
+        sock.close()
+    return records / seconds, slowest, [r.messages for r in subscribers], \
+        [(c['sent'], c['dropped']) for c in clients if c['protocol'] == 'ndjson' and c['services'] is None][readers:]
+
+
+def main():
+    p = optparse.OptionParser(description="Publisher benchmark")
+    p.add_option('--records', type='int', default=200000, help="Records to publish (default 200000)")
+    p.add_option('--buffer', type='int', default=1000, help="Messages queued per subscriber (default 1000)")
+    p.add_option('--rate', type='int', default=5000, help="Records per second for the paced runs (default 5000)")
+    options, _ = p.parse_args()
+
+    for pace in (None, options.rate):
+        for readers, stalled in ((0, 0), (1, 0), (1, 1)):
+            rate, slowest, received, stalls = run(options.records, options.buffer, readers, stalled, pace)
+            line = "%s, %d reading, %d stalled: %7.0f records/s, slowest add() %5.2f ms" % (
+                "paced" if pace else "flat out", readers, stalled, rate, 1e3 * slowest)
+            if received:
+                line += ", reader got %d of %d" % (received[0], options.records)
+            for sent, dropped in stalls:
+                line += ", stalled one sent %d and dropped %d" % (sent, dropped)
+            print(line)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,183 @@
+#!/usr/bin/env python
+
+""" Offline re-classification: throughput, memory, and agreement with the scanner
+
+Writes a synthetic recording (boards interleaved as they arrive, with seq
+resets, dark channels and light type rows in between) as a scanner CSV and
+as Parquet, re-classifies both with lpcsb.reclassify in a child process and
+reports rows per second and the child's peak memory. The child is started
+by a bare interpreter, not forked from this one, so its peak is not this
+process's (a Linux child inherits the peak of what it was forked from). The first rows are
+also run through the scanner's own classifiers (lpcsb.classify) one at a
+time, and the labels and ratios must come out the same.
+
+    python bench/reclassify_bench.py [--rows N] [--boards N] [--check N] [--dir DIR]
+"""
+
+from __future__ import print_function
+
+import optparse
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, '..'))
+import numpy as np
+import pyarrow as pa
+import pyarrow.compute as pc
+import pyarrow.csv as pcsv
+import pyarrow.parquet as pq
+from lpcsb import classify
+from lpcsb.decode import RawColor
+
+# typical (red, green, blue) per clear count of the control bulbs, roughly
+PROFILES = np.array([[0.50, 0.30, 0.20], [0.30, 0.42, 0.28], [0.34, 0.33, 0.33], [0.28, 0.33, 0.39]])
+
+
+def synthetic(rows, boards, seed=1):
+    """ Columns of a recording, in arrival order. """
+    rng = np.random.default_rng(seed)
+    board = rng.integers(0, boards, rows)
+    profile = PROFILES[rng.integers(0, len(PROFILES), boards)][board]
+    brightness = rng.choice([300.0, 1500.0, 8000.0, 30000.0], boards)[board]
+    clear = np.clip(brightness * rng.normal(1, 0.05, rows), 0, 65535).astype(np.int64)
+    colors = np.clip(clear[:, None] * profile * rng.normal(1, 0.03, (rows, 3)), 0, 65535).astype(np.int64)
+    colors[rng.random(rows) < 0.001, rng.integers(0, 3)] = 0
+    lux = np.clip(clear * 0.3, 0, 65535).astype(np.int64)
+
+    # per board sequence numbers, with the odd restart
+    seq = np.zeros(rows, dtype=np.int64)
+    order = np.argsort(board, kind='stable')
+    counts = np.bincount(board, minlength=boards)
+    starts = np.concatenate([[0], np.cumsum(counts)[:-1]])
+    position = np.arange(rows) - np.repeat(starts, counts)
+    seq[order] = position % 5000 + 1
+    light_type_row = rng.random(rows) < 0.1
+    return {
+        'device': np.array(['LPCSB_%d' % i for i in range(boards)], dtype=object)[board],
+        'seq': seq,
+        'clear': clear, 'red': colors[:, 0], 'green': colors[:, 1], 'blue': colors[:, 2],
+        'lux': lux, 'color_temp': np.full(rows, 3000),
+        'light_type_row': light_type_row,
+    }
+
+
+def write_parquet(path, data):
+    raw = ~data['light_type_row']
+    columns = {
+        'device': pa.array(data['device']).dictionary_encode(),
+        'seq': pa.array(data['seq'], type=pa.uint16()),
+    }
+    for name in ('clear', 'red', 'green', 'blue', 'color_temp', 'lux'):
+        columns[name] = pa.array(data[name], type=pa.uint16(), mask=~raw)
+    table = pa.table(columns)
+    pq.write_table(table, path, compression='zstd', row_group_size=1 << 20)
+
+
+def write_csv(path, data):
+    """ The Ceiling ID layout: numbers as text, 'N/A' on light type rows. """
+    raw = ~data['light_type_row']
+    na = pa.scalar("N/A")
+
+    def text(name):
+        return pc.if_else(pa.array(raw), pc.cast(pa.array(data[name]), pa.string()), na)
+
+    rows = len(raw)
+    table = pa.table([
+        pa.array(data['device']), pa.array(np.full(rows, 'C098E5405D4C', dtype=object)),
+        pa.array(np.full(rows, '2020-03-01T00:00:00.000000Z', dtype=object)),
+        pc.cast(pa.array(data['seq']), pa.string()), pa.array(np.full(rows, '-60', dtype=object)),
+        pa.array(np.where(raw, 'Unknown', 'LED').astype(object)),
+        text('color_temp'), text('lux'), text('red'), text('green'), text('blue'), text('clear'),
+    ], names=["device", "device_id", "received_time", "sequence_no", "rssi", "Light Type",
+              "Color Temp", "Lux", "Red", "Green", "Blue", "Clear"])
+    pcsv.write_csv(table, path, pcsv.WriteOptions(quoting_style='none'))
+
+
+def scanner_labels(data, count):
+    """ Labels and ratio_compare from the scanner's classifiers, row by row. """
+    rules = classify.BulbRules()
+    ratios = classify.ColorRatios()
+    labels = []
+    compare = []
+    start = time.time()
+    for i in range(count):
+        if data['light_type_row'][i]:
+            labels.append(None)
+            compare.append(None)
+            continue
+        record = RawColor(0x44, int(data['clear'][i]), int(data['red'][i]), int(data['green'][i]),
+                          int(data['blue'][i]), 3000, int(data['lux'][i]), int(data['seq'][i]))
+        row = {}
+        ratios.classify(data['device'][i], record, row)
+        rules.classify(data['device'][i], record, row)
+        labels.append(row['light_type'])
+        compare.append(row['ratio_compare'])
+    return labels, compare, time.time() - start
+
+
+# runs the command in argv and prints its exit status and peak RSS in kB
+LAUNCHER = ("import os, sys\n"
+            "pid = os.fork()\n"
+            "if pid == 0:\n"
+            "    os.execv(sys.argv[1], sys.argv[1:])\n"
+            "_, status, usage = os.wait4(pid, 0)\n"
+            "print(status, usage.ru_maxrss)\n")
+
+
+def run(source, output, chunk_rows):
+    """ Re-classify in a child process: (seconds, peak RSS in MB). """
+    start = time.time()
+    proc = subprocess.Popen([sys.executable, '-c', LAUNCHER,
+                             sys.executable, '-m', 'lpcsb.reclassify', '-o', output, '--chunk-rows', str(chunk_rows),
+                             '--label-column', 'label', source],
+                            cwd=os.path.join(HERE, '..'), stdout=subprocess.PIPE)
+    out = proc.communicate()[0].split()
+    status, peak = int(out[-2]), int(out[-1])
+    if proc.returncode != 0 or status != 0:
+        raise SystemExit("reclassify failed on %s" % source)
+    return time.time() - start, peak / 1024.0
+
+
+def main():
+    p = optparse.OptionParser(description="Offline re-classification benchmark")
+    p.add_option('--rows', type='int', default=5000000, help="Rows of data (default 5000000)")
+    p.add_option('--boards', type='int', default=100, help="Boards (default 100)")
+    p.add_option('--check', type='int', default=200000, help="Rows to compare with the scanner's classifiers (default 200000)")
+    p.add_option('--chunk-rows', type='int', default=1 << 18, help="Rows per chunk (default 262144)")
+    p.add_option('--dir', default=tempfile.gettempdir(), help="Where to write the files")
+    options, _ = p.parse_args()
+
+    data = synthetic(options.rows, options.boards)
+    csv_name = os.path.join(options.dir, "reclassify_bench.csv")
+    parquet_name = os.path.join(options.dir, "reclassify_bench.parquet")
+    out_name = os.path.join(options.dir, "reclassify_bench.out.parquet")
+    write_csv(csv_name, data)
+    write_parquet(parquet_name, data)
+    print("%d rows from %d boards: csv %.0f MB, parquet %.0f MB" %
+          (options.rows, options.boards, os.path.getsize(csv_name) / 1e6, os.path.getsize(parquet_name) / 1e6))
+
+    check = min(options.check, options.rows)
+    expected, expected_compare, scalar_time = scanner_labels(data, check)
+    print("  scanner classifiers, one row at a time  %9.0f rows/s" % (check / scalar_time))
+
+    for name, source in (("csv", csv_name), ("parquet", parquet_name)):
+        seconds, peak = run(source, out_name, options.chunk_rows)
+        table = pq.read_table(out_name, columns=['label', 'ratio_compare'])
+        labels = table['label'].slice(0, check).to_pylist()
+        compare = np.array(table['ratio_compare'].slice(0, check).to_pylist(), dtype=float)
+        want = np.array([np.nan if c is None else c for c in expected_compare])
+        mismatches = sum(1 for a, b in zip(labels, expected) if a != b)
+        ratio_error = np.nanmax(np.abs(compare - want)) if check else 0.0
+        print("  reclassify %-7s  %9.0f rows/s  peak %4.0f MB  %d/%d labels differ, ratios within %.1g" %
+              (name, options.rows / seconds, peak, mismatches, check, ratio_error))
+
+    for name in (csv_name, parquet_name, out_name):
+        os.remove(name)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,93 @@
+#!/usr/bin/env python
+
+""" Replay throughput of the scanner, and that replays repeat exactly
+
+Writes emulated recordings (lpcsb.emulator --record) for a few loads,
+replays each through the scanner as fast as it goes (--replay --speed 0)
+twice, the second time against the first one's CSV as --baseline, and
+reports scan responses and rows per second and whether the two runs gave
+the same CSV. With no dongle or pty in the way, this is the ceiling of
+everything after the serial port: parsing, decoding, de-duplication,
+classification and the writer. The same traffic is also written as a
+btsnoop file (lpcsb.emulator --btsnoop) and replayed through the HCI
+parser, which must give the BGAPI run's CSV.
+
+    python bench/replay_bench.py [--python PYTHON] [--profile NAME] [--seconds N]
+
+The scanners are Python 2 scripts, so --python defaults to python2.
+"""
+
+from __future__ import print_function
+
+import optparse
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, '..'))
+from lpcsb.emulator import Emulator
+from lpcsb.hci import BtsnoopWriter
+from lpcsb.replay import Recorder
+
+# (boards, seconds between advertisements; 0 floods)
+LOADS = [(100, 0.5), (1000, 2.5), (50, 0)]
+START = 1600000000.0
+
+
+def replay(options, recording, output, baseline=None):
+    """ Run the scanner over `recording`: (scan responses/s, rows/s, whether it matched the baseline). """
+    args = [options.python, '-m', 'lpcsb.scanner', '--replay', recording, '--speed', '0', '-q', '--any-device',
+            '--profile', options.profile, '-o', output]
+    if baseline:
+        args += ['--baseline', baseline]
+    proc = subprocess.Popen(args, cwd=os.path.join(HERE, '..'), stdout=subprocess.PIPE, universal_newlines=True)
+    report = proc.stdout.read()
+    status = proc.wait()
+    found = re.search(r'Throughput:\s+(\d+) scan responses/s, (\d+) rows/s', report)
+    if found is None:
+        raise SystemExit("replay failed:\n%s" % report)
+    return int(found.group(1)), int(found.group(2)), status == 0 and 'identical' in report
+
+
+def main():
+    p = optparse.OptionParser(description="Scanner replay benchmark")
+    p.add_option('--python', default='python2', help="Interpreter for the scanner (default python2)")
+    p.add_option('--profile', default='all', help="Scanner profile (default all)")
+    p.add_option('--seconds', type='float', default=60.0, help="Seconds of traffic per recording, a tenth of it when flooding (default 60)")
+    options, _ = p.parse_args()
+
+    work = tempfile.mkdtemp()
+    try:
+        for boards, interval in LOADS:
+            recording = os.path.join(work, 'load.lpcsbrec')
+            snoop = os.path.join(work, 'load.btsnoop')
+            seconds = options.seconds if interval else options.seconds / 10
+            for path, hci in ((recording, False), (snoop, True)):
+                emulator = Emulator(None, boards, interval, sample_period=5.0 if interval else 0, hci=hci)
+                recorder = BtsnoopWriter(path) if hci else Recorder(path, ["emulator"])
+                emulator.record(recorder, seconds, start=START)
+                recorder.close()
+
+            first = os.path.join(work, 'first.csv')
+            second = os.path.join(work, 'second.csv')
+            third = os.path.join(work, 'third.csv')
+            responses, rows, _ = replay(options, recording, first)
+            _, _, same = replay(options, recording, second, baseline=first)
+            hci_responses, _, hci_same = replay(options, snoop, third, baseline=first)
+            print("%5d boards %-9s %7d scan responses in %4.0f s: %8d scan responses/s %7d rows/s  %s" %
+                  (boards, "every %gs" % interval if interval else "flooding", emulator.sent, seconds,
+                   responses, rows, "repeats exactly" if same else "RUNS DIFFER"))
+            print("%47s btsnoop: %8d scan responses/s %14s  %s" %
+                  ("", hci_responses, "", "same CSV" if hci_same else "CSV DIFFERS"))
+            for name in (recording, snoop, first, second, third):
+                os.remove(name)
+    finally:
+        shutil.rmtree(work)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,100 @@
+#!/usr/bin/env python
+
+""" Rollups: what they cost to keep, and what they save on reads and disk
+
+Writes `days` of 5 s samples from `boards` boards into a SqliteSink
+database, and separately through a RollupSink into a rollup database, and
+reports the rollup rate, the sizes of both files, a month-style query
+(hourly mean lux of one board over the whole range) on the raw rows
+against the same from the rollups, and what pruning all but the last day
+of raw rows leaves of the raw database.
+
+    python bench/rollup_bench.py [--boards N] [--days N] [--dir DIR]
+"""
+
+from __future__ import print_function
+
+import optparse
+import os
+import shutil
+import sqlite3
+import sys
+import tempfile
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+from lpcsb import rollup
+from lpcsb.decode import RawColor
+from lpcsb.rollup import RollupSink
+from lpcsb.sqlite_sink import SqliteSink
+
+START_NS = 1583020800 * 1000000000
+STEP_NS = 5 * 1000000000
+LIGHTS = ("LED", "Fluorescent", "Incandescent", "Sunlight")
+
+
+def records(boards, days):
+    """ Every board every 5 s, the light type changing every couple of hours. """
+    steps = days * 86400 * 1000000000 // STEP_NS
+    for i in range(steps):
+        t = START_NS + i * STEP_NS
+        for b in range(boards):
+            lux = 500 + (i + 97 * b) % 1000
+            light = LIGHTS[(i // 1500 + b) % len(LIGHTS)]
+            yield "LPCSB_%d" % b, "C098E540%04X" % b, i & 0xFFFF, -60, \
+                RawColor(0x44, lux * 4, lux * 2, lux, lux // 2, 3000, lux, i & 0xFFFF), light, t + b * 1000000
+
+
+def main():
+    p = optparse.OptionParser(description="Rollup benchmark")
+    p.add_option('--boards', type='int', default=20, help="Boards (default 20)")
+    p.add_option('--days', type='int', default=7, help="Days of samples (default 7)")
+    p.add_option('--dir', help="Where to write (default: a temporary directory)")
+    options, _ = p.parse_args()
+
+    directory = options.dir or tempfile.mkdtemp()
+    raw_path = os.path.join(directory, 'raw.db')
+    rollup_path = os.path.join(directory, 'rollups.db')
+    try:
+        raw = SqliteSink(raw_path, batch_rows=5000)
+        for device, mac, seq, rssi, record, light, t in records(options.boards, options.days):
+            raw.add(device, mac, seq, rssi, raw=record, light_type=light, time_ns=t)
+        raw.close()
+
+        sink = RollupSink(rollup_path)
+        n = 0
+        start = time.time()
+        for device, mac, seq, rssi, record, light, t in records(options.boards, options.days):
+            sink.add(device, mac, seq, rssi, raw=record, light_type=light, time_ns=t)
+            n += 1
+        sink.close()
+        seconds = time.time() - start
+        print("%d boards x %d days: %d samples rolled up at %.0f samples/s into %d windows" %
+              (options.boards, options.days, n, n / seconds, sink.windows_written))
+        raw_size = os.path.getsize(raw_path)
+        print("  raw SQLite %8.1f MB, rollups %6.1f MB" % (raw_size / 1e6, os.path.getsize(rollup_path) / 1e6))
+
+        until = START_NS + options.days * rollup.DAY_NS
+        db = sqlite3.connect(raw_path)
+        start = time.time()
+        from_raw = db.execute("SELECT time / 3600000000000, avg(lux) FROM raw_color WHERE device = 'LPCSB_1'"
+                              " AND time BETWEEN ? AND ? GROUP BY 1", (START_NS, until)).fetchall()
+        raw_query = time.time() - start
+        db.close()
+        start = time.time()
+        resolution, from_rollups = rollup.query(rollup_path, 'LPCSB_1', START_NS, until, resolution=3600)
+        rollup_query = time.time() - start
+        same = len(from_raw) == len(from_rollups) and all(
+            abs(a[1] - b['lux_mean']) < 1e-9 for a, b in zip(from_raw, from_rollups))
+        print("  hourly mean lux of one board: raw rows %7.1f ms, rollups %5.1f ms, %s" %
+              (1e3 * raw_query, 1e3 * rollup_query, "same means" if same else "MEANS DIFFER"))
+
+        deleted, before, after = rollup.prune(raw_path, 1, rollups=rollup_path, now=until)
+        print("  prune to the last day: %d raw rows deleted, %.1f MB -> %.1f MB" % (deleted, before / 1e6, after / 1e6))
+    finally:
+        if not options.dir:
+            shutil.rmtree(directory)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,94 @@
+#!/usr/bin/env python
+
+""" Adaptive scan window: the duty cycle it settles on and what it costs
+
+Runs the emulator's boards in simulated time through the BGAPI parser, the
+decoders and a SeqTracker into a ScanController, whose window changes go
+straight back to the emulator, which only lets through the advertisements
+inside the window. For a few board timings it reports the average duty
+cycle, the share of samples captured against a fixed full window, and how
+often the window was changed.
+
+    python bench/scan_control_bench.py [--hours H] [--target SHARE] [--period SECONDS]
+"""
+
+from __future__ import print_function
+
+import optparse
+import os
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, '..'))
+from lpcsb.bgapi import BgapiParser
+from lpcsb.decode import lookup
+from lpcsb.emulator import Emulator
+from lpcsb.scan_control import ScanController
+from lpcsb.seqstats import SeqTracker
+
+# (boards, seconds between advertisements, seconds between samples)
+LOADS = [(40, 2.5, 5.0), (40, 0.5, 5.0), (40, 0.23, 2.0), (40, 0.1, 10.0)]
+INTERVAL = 200
+START = 1600000000.0
+
+
+def run(boards, adv_interval, sample_period, seconds, target=None, period=60.0, min_duty=0.1, step=0.05):
+    """ (samples captured, samples due, average duty, window changes) """
+    emulator = Emulator(None, boards, adv_interval, sample_period)
+    emulator.scan_parameters = (INTERVAL, INTERVAL, 0)
+    tracker = SeqTracker()
+    clock = [START]
+
+    def handle(evt):
+        decoder, record = lookup(evt)
+        if record is not None:
+            tracker.update(evt.sender.tobytes(), decoder.name, record.seq, clock[0])
+
+    def apply(interval, window):
+        emulator.scan_parameters = (interval, window, 0)
+        emulator._start(clock[0])
+
+    parser = BgapiParser(on_scan_response=handle)
+    emulator._start(START)
+    controller = None
+    if target is not None:
+        controller = ScanController(tracker, apply, INTERVAL, INTERVAL, target=target, period=period,
+                                    min_duty=min_duty, verbose=False, now=START)
+    listened = 0.0
+    now = START
+    while now < START + seconds:
+        now = clock[0] = now + step
+        parser.feed(emulator._due(now))
+        listened += step * emulator.scan_parameters[1] / emulator.scan_parameters[0]
+        if controller is not None:
+            controller.tick(now)
+
+    samples = lost = 0
+    for stream in tracker.streams.values():
+        samples += stream.total.samples
+        lost += stream.total.lost - stream.total.late
+    return samples, samples + lost, listened / seconds, controller.changes if controller else 0
+
+
+def main():
+    p = optparse.OptionParser(description="Adaptive scan window benchmark")
+    p.add_option('--hours', type='float', default=1.0, help="Simulated hours per load (default 1)")
+    p.add_option('--target', type='float', default=0.95, help="Share of samples to capture (default 0.95)")
+    p.add_option('--period', type='float', default=60.0, help="Seconds per decision (default 60)")
+    p.add_option('--min-duty', type='float', default=0.1, help="Narrowest window as a share of the interval (default 0.1)")
+    options, _ = p.parse_args()
+
+    seconds = options.hours * 3600
+    # the boards are the same in both runs, so any difference is the window
+    print("target %.0f%% of samples, %g s periods, %g h per load" % (100 * options.target, options.period, options.hours))
+    for boards, adv_interval, sample_period in LOADS:
+        fixed, due, _, _ = run(boards, adv_interval, sample_period, seconds)
+        got, adaptive_due, duty, changes = run(boards, adv_interval, sample_period, seconds, options.target,
+                                               options.period, options.min_duty)
+        print("%4d boards, adv every %4gs, sample every %4gs: %5.1f%% duty, %5.1f%% of samples (full window %5.1f%%), "
+              "%d window changes" % (boards, adv_interval, sample_period, 100 * duty, 100.0 * got / adaptive_due,
+                                     100.0 * fixed / due, changes))
+
+
+if __name__ == '__main__':
+    main()
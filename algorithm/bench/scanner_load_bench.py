@@ -0,0 +1,115 @@
+#!/usr/bin/env python
+
+""" Load test a scanner script against the BLED112 emulator
+
+Runs lpcsb.emulator in a child process and the real scanner on the other
+end of the pty, for 10, 100 and 1000 simulated boards at the firmware's
+advertising rate and then flooding, and reports for each run the scan
+responses the emulator sent and the scanner took in per second (from the
+scanner's --stats file) and the scanner's CPU use.
+
+    python bench/scanner_load_bench.py [--script PATH] [--python PYTHON] [--seconds N]
+
+The scanners are Python 2 scripts, so --python defaults to python2. POSIX
+only (pty, /proc).
+"""
+
+from __future__ import print_function
+
+import json
+import optparse
+import os
+import shutil
+import signal
+import subprocess
+import sys
+import tempfile
+import time
+from multiprocessing import Process, Value
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, '..'))
+from lpcsb.emulator import Emulator, open_pty
+
+DEFAULT_SCRIPT = os.path.join(HERE, '..', 'Data Processing software', 'bled112_LPCSB_scanner.py')
+
+
+def emulate(master, devices, adv_interval, seconds, sent):
+    emulator = Emulator(master, devices, adv_interval, sample_period=5.0 if adv_interval else 0)
+    start = time.time()
+    while time.time() - start < seconds:
+        emulator.run(0.2)
+        sent.value = emulator.sent
+
+
+def cpu_seconds(pid):
+    with open('/proc/%d/stat' % pid) as f:
+        fields = f.read().rsplit(')', 1)[1].split()
+    return (int(fields[11]) + int(fields[12])) / float(os.sysconf('SC_CLK_TCK'))
+
+
+def received(stats_file):
+    try:
+        with open(stats_file) as f:
+            stats = json.load(f)
+    except (IOError, ValueError):
+        return None, 0
+    return stats['time'], stats['capture']['receivers'][0]['received']
+
+
+def run(options, devices, adv_interval):
+    directory = tempfile.mkdtemp()
+    stats_file = os.path.join(directory, 'stats.json')
+    master, name = open_pty()
+    sent = Value('l', 0)
+    dongle = Process(target=emulate, args=(master, devices, adv_interval, options.seconds + 10, sent))
+    dongle.start()
+    scanner = subprocess.Popen([options.python, options.script, '-p', name, '-q',
+                                '-o', os.path.join(directory, 'out.csv'),
+                                '--stats', stats_file, '--stats-secs', '0.5'],
+                               stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+    try:
+        # let it get through setup and into steady state
+        deadline = time.time() + 10
+        while received(stats_file)[1] == 0 and time.time() < deadline:
+            time.sleep(0.2)
+        time.sleep(1)
+
+        t0, n0 = received(stats_file)
+        s0, c0 = sent.value, cpu_seconds(scanner.pid)
+        time.sleep(options.seconds)
+        t1, n1 = received(stats_file)
+        s1, c1 = sent.value, cpu_seconds(scanner.pid)
+    finally:
+        scanner.send_signal(signal.SIGINT)
+        scanner.wait()
+        dongle.terminate()
+        dongle.join()
+        os.close(master)
+        shutil.rmtree(directory)
+
+    if t0 is None or t1 is None or t1 <= t0:
+        return None
+    return (s1 - s0) / float(options.seconds), (n1 - n0) / (t1 - t0), 100 * (c1 - c0) / options.seconds
+
+
+def main():
+    p = optparse.OptionParser(description="Scanner load test against the BLED112 emulator")
+    p.add_option('--script', default=DEFAULT_SCRIPT, help="Scanner script to test")
+    p.add_option('--python', default='python2', help="Interpreter for the scanner (default python2)")
+    p.add_option('--seconds', type='float', default=5.0, help="Measured seconds per run (default 5)")
+    options, _ = p.parse_args()
+
+    print("%s" % os.path.relpath(options.script))
+    print("  boards  adv interval  sent/sec  scanned/sec  scanner CPU")
+    for devices, adv_interval in ((10, 2.5), (100, 2.5), (1000, 2.5), (1000, 0.1), (1000, 0)):
+        result = run(options, devices, adv_interval)
+        label = "%.1f s" % adv_interval if adv_interval else "flood"
+        if result is None:
+            print("  %6d  %12s  scanner produced no statistics" % (devices, label))
+        else:
+            print("  %6d  %12s  %8.0f  %11.0f  %9.0f %%" % ((devices, label) + result))
+
+
+if __name__ == '__main__':
+    main()
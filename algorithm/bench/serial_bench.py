@@ -0,0 +1,141 @@
+#!/usr/bin/env python
+
+""" Compare the old byte-at-a-time serial loop against BulkReader
+
+A child process plays the dongle on one end of a pseudo terminal and writes
+synthetic LPCSB gap_scan_response events at a fixed rate. The scanner side
+opens the other end with pyserial, exactly like a real BLED112, and counts
+complete frames. Both loops use the same per-byte framer, so the difference
+is only in how the port is read.
+
+For each loop this reports frames/sec, how far the reader fell behind, and
+the reader's CPU time, plus CPU time spent on an idle port.
+
+    python bench/serial_bench.py [--rate FRAMES_PER_SEC] [--seconds N]
+
+POSIX only, since it needs a pty.
+"""
+
+from __future__ import print_function
+
+import optparse
+import os
+import struct
+import sys
+import time
+from multiprocessing import Process
+
+import serial
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+from lpcsb import bgapi
+from lpcsb.serial_reader import BulkReader, byte_feeder
+
+SENDER = bytearray([0x4C, 0x5D, 0x40, 0xE5, 0x98, 0xC0])
+
+
+def lpcsb_frame(seq):
+    data = bytearray([0x02, 0x01, 0x06, 0x13, 0xFF, 0xE0, 0x02, 0x31, 0x44])
+    data += struct.pack('>7H', 1200, 500, 400, 300, 3500, 250, seq & 0xFFFF)
+    return bgapi.gap_scan_response(-60, 0, SENDER, 0, 255, data)
+
+
+def dongle(fd, rate, seconds):
+    # Write in ~1 ms bursts the way the USB CDC endpoint delivers them
+    frames = int(rate * seconds)
+    per_tick = max(1, rate // 1000)
+    start = time.time()
+    sent = 0
+    while sent < frames:
+        burst = b''.join(lpcsb_frame(sent + i) for i in range(min(per_tick, frames - sent)))
+        os.write(fd, burst)
+        sent += per_tick
+        delay = start + float(sent) / rate - time.time()
+        if delay > 0:
+            time.sleep(delay)
+
+
+class Framer(object):
+    """ Minimal stand-in for bgapi_parse(): one call per byte, counts frames. """
+    def __init__(self):
+        self.frames = 0
+        self.buf = []
+        self.expected = 0
+
+    def parse(self, b):
+        if not self.buf and b not in (0x00, 0x80):
+            return
+        self.buf.append(b)
+        if len(self.buf) == 2:
+            self.expected = 4 + (self.buf[0] & 0x07) + self.buf[1]
+        if len(self.buf) == self.expected:
+            self.frames += 1
+            self.buf = []
+
+
+def cpu():
+    t = os.times()
+    return t[0] + t[1]
+
+
+def loop_poll(ser, framer, until):
+    while time.time() < until:
+        while (ser.inWaiting()): framer.parse(ord(ser.read()))
+        time.sleep(0.01)
+
+
+def loop_bulk(ser, framer, until):
+    reader = BulkReader(ser, byte_feeder(framer.parse), timeout=0.1)
+    while time.time() < until:
+        reader.poll()
+
+
+def run(name, loop, rate, seconds):
+    master, slave = os.openpty()
+    ser = serial.Serial(os.ttyname(slave), 115200, timeout=1)
+    framer = Framer()
+
+    child = Process(target=dongle, args=(master, rate, seconds))
+    cpu_start = cpu()
+    wall_start = time.time()
+    child.start()
+    loop(ser, framer, wall_start + seconds)
+    received = framer.frames
+    cpu_busy = cpu() - cpu_start
+
+    # Keep draining so the dongle never blocks on a full pty, then measure
+    # a quiet port
+    while child.is_alive():
+        loop(ser, framer, time.time() + 0.1)
+    child.join()
+    loop(ser, framer, time.time() + 0.2)
+    behind = framer.frames - received
+    cpu_start = cpu()
+    loop(ser, Framer(), time.time() + 1.0)
+    cpu_idle = cpu() - cpu_start
+
+    print("%-6s %8.0f frames/sec  %6d frames behind  %6.2f s CPU busy  %5.1f ms CPU per idle second" %
+          (name, received / float(seconds), behind, cpu_busy, cpu_idle * 1000))
+    sys.stdout.flush()
+
+    ser.close()
+    os.close(master)
+    os.close(slave)
+    return framer.frames
+
+
+def main():
+    p = optparse.OptionParser(description=__doc__.split('\n')[1])
+    p.add_option('--rate', type='int', default=5000, help="Frames per second from the fake dongle (default 5000)")
+    p.add_option('--seconds', type='float', default=3, help="Length of each run (default 3)")
+    options, _ = p.parse_args()
+
+    print("%d frames/sec for %.1f s, %d bytes per frame" %
+          (options.rate, options.seconds, len(lpcsb_frame(0))))
+    sys.stdout.flush()
+    run("poll", loop_poll, options.rate, options.seconds)
+    run("bulk", loop_bulk, options.rate, options.seconds)
+
+
+if __name__ == '__main__':
+    main()
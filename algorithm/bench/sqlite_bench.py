@@ -0,0 +1,106 @@
+#!/usr/bin/env python
+
+""" Sustained insert rate of the SQLite sink against the CSV paths
+
+Pushes N raw color records through:
+
+    csv-open     the scanners' old path: exists/open/append/close per row
+    csv          lpcsb.output.RotatingCsvWriter
+    sqlite-1     SqliteSink committing every record
+    sqlite       SqliteSink with the scanners' defaults (100 records / 5 s)
+
+and then times a one-board, one-hour lux query on the database. For scale:
+ten boards advertising every 100 ms is 100 records/sec.
+
+    python bench/sqlite_bench.py [--records N] [--dir DIR]
+"""
+
+from __future__ import print_function
+
+import csv
+import optparse
+import os
+import shutil
+import sys
+import tempfile
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+from lpcsb.decode import RawColor
+from lpcsb.output import RotatingCsvWriter
+from lpcsb.sqlite_sink import SqliteSink
+
+BOARDS = (("LPCSB_Test", "C098E5405D4C"), ("LPCSB_0", "C098E54034A4"), ("LPCSB_1", "C098E540606C"))
+START_NS = 1583020800 * 1000000000
+STEP_NS = 100000000
+
+
+def records(n):
+    for i in range(n):
+        device, mac = BOARDS[i % len(BOARDS)]
+        yield device, mac, i & 0xFFFF, -60, RawColor(0x44, i & 0xFFF, 400, 300, 200, 3000, i % 2000, i & 0xFFFF), \
+            START_NS + i * STEP_NS
+
+
+def row(device, mac, seq, rssi, raw, time_ns):
+    return [device, mac, time_ns, seq, rssi, raw.color_temp, raw.lux, raw.red, raw.green, raw.blue, raw.clear]
+
+
+def csv_open(directory, n):
+    name = os.path.join(directory, "open.csv")
+    for r in records(n):
+        if not os.path.exists(name):
+            with open(name, "w") as f:
+                csv.writer(f).writerow(["header"])
+        with open(name, "a") as f:
+            csv.writer(f).writerow(row(*r))
+
+
+def csv_buffered(directory, n):
+    writer = RotatingCsvWriter(os.path.join(directory, "buffered.csv"), ["header"])
+    for r in records(n):
+        writer.writerow(row(*r))
+    writer.close()
+
+
+def sqlite(directory, n, batch_rows, name):
+    sink = SqliteSink(os.path.join(directory, name), batch_rows=batch_rows, batch_secs=5.0)
+    for device, mac, seq, rssi, raw, time_ns in records(n):
+        sink.add(device, mac, seq, rssi, raw=raw, time_ns=time_ns)
+    sink.close()
+
+
+def main():
+    p = optparse.OptionParser(description="SQLite sink benchmark")
+    p.add_option('--records', type='int', default=200000, help="Records to insert (default 200000)")
+    p.add_option('--dir', help="Where to write (default: a temporary directory)")
+    options, _ = p.parse_args()
+
+    directory = options.dir or tempfile.mkdtemp()
+    n = options.records
+    runs = (("csv-open", lambda: csv_open(directory, n // 10), n // 10),
+            ("csv", lambda: csv_buffered(directory, n), n),
+            ("sqlite-1", lambda: sqlite(directory, n // 10, 1, "single.db"), n // 10),
+            ("sqlite", lambda: sqlite(directory, n, 100, "batched.db"), n))
+    for name, run, count in runs:
+        start = time.time()
+        run()
+        elapsed = time.time() - start
+        print("  %-9s %9.0f records/sec  (%d records)" % (name, count / elapsed, count))
+
+    import sqlite3
+    db = sqlite3.connect(os.path.join(directory, "batched.db"))
+    lo = START_NS + n // 2 * STEP_NS
+    hi = lo + 3600 * 1000000000
+    start = time.time()
+    count, mean = db.execute("SELECT count(*), avg(lux) FROM raw_color WHERE device = ? AND time BETWEEN ? AND ?",
+                             ("LPCSB_1", lo, hi)).fetchone()
+    print("one board, one hour: %d rows, mean lux %.1f in %.2f ms" % (count, mean, (time.time() - start) * 1e3))
+    db.close()
+
+    if not options.dir:
+        shutil.rmtree(directory)
+
+
+if __name__ == '__main__':
+    main()
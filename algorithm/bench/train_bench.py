@@ -0,0 +1,159 @@
+#!/usr/bin/env python
+
+""" Training a light type model: time, and the same labels everywhere
+
+Writes synthetic recordings of the four bulb types (scanner CSVs named for
+the bulb), trains with lpcsb.train in a child process and times it. The
+model written out must then give the same labels on the first rows of
+every file through the scanner's 'model' classifier (with the generated
+Python module) and through the generated C header, compiled with the
+host's cc if there is one; and the trainer's vectorized features must be
+the scanner's.
+
+    python bench/train_bench.py [--rows N] [--boards N] [--check N] [--dir DIR]
+"""
+
+from __future__ import print_function
+
+import importlib.util
+import optparse
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, '..'))
+import numpy as np
+import pyarrow as pa
+import pyarrow.csv as pcsv
+from lpcsb import classify, train
+from lpcsb.decode import RawColor
+
+# bulb -> (red, green, blue) share, lux per clear count, brightness, sample to sample wobble
+BULBS = {
+    "Incandescent": ((0.52, 0.29, 0.19), 0.25, 1500.0, 0.02),
+    "Fluorescent": ((0.31, 0.40, 0.29), 0.35, 4000.0, 0.04),
+    "LED": ((0.36, 0.35, 0.29), 0.30, 900.0, 0.01),
+    "Sunlight": ((0.30, 0.33, 0.37), 0.40, 20000.0, 0.08),
+}
+
+C_MAIN = r'''
+#include <stdio.h>
+#include "light_model.h"
+int main (void) {
+    unsigned r, g, b, lux, drift;
+    while(scanf("%u %u %u %u %u", &r, &g, &b, &lux, &drift) == 5){
+        printf("%u\n", light_model_classify(r, g, b, lux, drift));
+    }
+    return 0;
+}
+'''
+
+
+def recording(bulb, rows, boards, rng):
+    share, lux_per_clear, brightness, wobble = BULBS[bulb]
+    board = rng.integers(0, boards, rows)
+    level = brightness * rng.uniform(0.3, 2.0, boards)[board] * rng.normal(1, wobble, rows)
+    clear = np.clip(level, 0, 65535).astype(np.int64)
+    colors = np.clip(clear[:, None] * np.array(share) * rng.normal(1, 0.04, (rows, 3)), 0, 65535).astype(np.int64)
+    seq = np.zeros(rows, dtype=np.int64)
+    for b in range(boards):
+        mine = board == b
+        seq[mine] = np.arange(1, mine.sum() + 1) % 65536
+    names = np.array(['LPCSB_%d' % i for i in range(boards)], dtype=object)[board]
+    return pa.table([
+        pa.array(names), pa.array(seq.astype(str).astype(object)),
+        pa.array(np.clip(clear * lux_per_clear, 0, 65535).astype(np.int64).astype(str).astype(object)),
+        pa.array(colors[:, 0].astype(str).astype(object)), pa.array(colors[:, 1].astype(str).astype(object)),
+        pa.array(colors[:, 2].astype(str).astype(object)), pa.array(clear.astype(str).astype(object)),
+    ], names=["device", "sequence_no", "Lux", "Red", "Green", "Blue", "Clear"])
+
+
+def main():
+    p = optparse.OptionParser(description="Light type model training benchmark")
+    p.add_option('--rows', type='int', default=1000000, help="Rows per bulb type (default 1000000)")
+    p.add_option('--boards', type='int', default=20, help="Boards per recording (default 20)")
+    p.add_option('--check', type='int', default=20000, help="Rows per file to compare labels on (default 20000)")
+    p.add_option('--dir', default=tempfile.gettempdir(), help="Where to write the files")
+    options, _ = p.parse_args()
+
+    work = tempfile.mkdtemp(dir=options.dir)
+    rng = np.random.default_rng(1)
+    paths = []
+    tables = []
+    for bulb in sorted(BULBS):
+        path = os.path.join(work, "20200301 %s bench.csv" % bulb)
+        table = recording(bulb, options.rows, options.boards, rng)
+        pcsv.write_csv(table, path, pcsv.WriteOptions(quoting_style='none'))
+        paths.append(path)
+        tables.append(table)
+    print("%d bulb types x %d rows: %.0f MB of CSV" %
+          (len(paths), options.rows, sum(os.path.getsize(p) for p in paths) / 1e6))
+
+    module = os.path.join(work, 'light_model.py')
+    header = os.path.join(work, 'light_model.h')
+    start = time.time()
+    proc = subprocess.Popen([sys.executable, '-m', 'lpcsb.train', '--python', module, '--header', header] + paths,
+                            cwd=os.path.join(HERE, '..'), stdout=subprocess.PIPE, universal_newlines=True)
+    report = proc.stdout.read()
+    if proc.wait() != 0:
+        raise SystemExit("training failed")
+    seconds = time.time() - start
+    held_out = [line for line in report.splitlines() if line.startswith(("model, held", "rules version"))]
+    print("  train  %9.0f rows/s  %.1f s\n  %s" % (len(paths) * options.rows / seconds, seconds, '\n  '.join(held_out)))
+
+    # the generated module, behind the scanner's classifier, one row at a time
+    spec = importlib.util.spec_from_file_location('lpcsb.light_model', module)
+    light_model = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(light_model)
+    sys.modules['lpcsb.light_model'] = light_model
+    inputs = []
+    python_labels = []
+    for table in tables:
+        model = classify.LightModel()
+        columns = dict((name, np.array(table[name].slice(0, options.check).to_pylist(), dtype=np.int64))
+                       for name in ("sequence_no", "Lux", "Red", "Green", "Blue", "Clear"))
+        first = {}
+        for i, device in enumerate(table['device'].slice(0, options.check).to_pylist()):
+            r, g, b = int(columns['Red'][i]), int(columns['Green'][i]), int(columns['Blue'][i])
+            record = RawColor(0x44, int(columns['Clear'][i]), r, g, b, 0, int(columns['Lux'][i]),
+                              int(columns['sequence_no'][i]))
+            row = {}
+            model.classify(device, record, row)
+            python_labels.append(row['light_type'])
+            if device not in first or record.seq == 1:
+                first[device] = (r, g, b)
+            drift = max(abs(c - f) for c, f in zip((r, g, b), first[device]))
+            inputs.append("%d %d %d %d %d" % (r, g, b, record.lux, drift))
+
+    samples = np.array([line.split() for line in inputs], dtype=np.int64)
+    vectorized = train.model_features(samples[:, 0], samples[:, 1], samples[:, 2], samples[:, 3],
+                                      np.column_stack([np.zeros(len(samples), dtype=np.int64), samples[:, 4:5]]))
+    scalar = np.array([classify.model_features(*(int(v) for v in s)) for s in samples], dtype=np.int64)
+    print("  vectorized vs scalar features: %d/%d rows differ" % ((vectorized != scalar).any(axis=1).sum(), len(samples)))
+
+    cc = shutil.which('cc') or shutil.which('gcc')
+    if cc is None:
+        print("  no C compiler; header not checked")
+    else:
+        binary = os.path.join(work, 'light_model_check')
+        with open(binary + '.c', 'w') as f:
+            f.write(C_MAIN)
+        subprocess.check_call([cc, '-O2', '-I', work, '-I', os.path.dirname(train.DEFAULT_HEADER), '-o', binary, binary + '.c'])
+        out = subprocess.run([binary], input='\n'.join(inputs) + '\n', stdout=subprocess.PIPE,
+                             universal_newlines=True, check=True).stdout.split()
+        c_labels = [dict((v, k) for k, v in train.LIGHT_TYPE_CODES.items())[int(code)] for code in out]
+        differ = sum(1 for a, b in zip(python_labels, c_labels) if a != b)
+        print("  C header vs Python module: %d/%d labels differ" % (differ, len(python_labels)))
+
+    truth = np.repeat(sorted(BULBS), min(options.check, options.rows))
+    right = sum(1 for a, b in zip(python_labels, truth) if a == b)
+    print("  scanner 'model' classifier: %.1f%% of %d first rows right" % (100.0 * right / len(truth), len(truth)))
+    shutil.rmtree(work)
+
+
+if __name__ == '__main__':
+    main()
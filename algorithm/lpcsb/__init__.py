@@ -0,0 +1,6 @@
+""" Shared pieces of the BLED112 LPCSB scanners
+
+The scanner scripts in "Data Processing software" and "Light Classification
+Software" import these modules instead of each carrying its own copy. They
+work on both Python 2.7 and Python 3.
+"""
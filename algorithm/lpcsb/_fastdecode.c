@@ -0,0 +1,425 @@
+/* Native batch decoder for BGAPI traffic carrying LPCSB advertisements.
+ *
+ * Parser.feed(bytes) does what lpcsb.bgapi.BgapiParser and lpcsb.decode.lookup()
+ * do for every scan response: split and check the BGAPI frames (dropping a
+ * byte and trying again when a header doesn't fit), walk the AD structures,
+ * find the first manufacturer data of a known LPCSB service, unpack it and
+ * apply the sensor ID check of its lpcsb.decode Decoder. The decisions are
+ * the same ones, in the same order, so both parsers find the same frames
+ * and records in the same stream, corrupt or not.
+ *
+ * Instead of calling back per scan response, feed() returns the records of
+ * the LPCSB payloads it found as one bytes object of packed lpcsb_record_t,
+ * which lpcsb/fastdecode.py turns into a NumPy structured array or into the
+ * usual record namedtuples.
+ *
+ * The payload layouts come from the firmware's lpcsb_packet.h and
+ * telemetry.h; see setup.py for the include path.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <structmember.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lpcsb_packet.h"
+#include "telemetry.h"
+
+#define MSG_RESPONSE 0x00
+#define MSG_EVENT    0x80
+#define CLASS_GAP    0x06
+
+#define MAX_CLASS         0x08
+#define MAX_OTHER_PAYLOAD 64
+#define MAX_AD_DATA       31
+#define AD_MANUFACTURER   0xFF
+
+/* BgapiParser parses after every half of its 64 kB buffer */
+#define FEED_STEP 32768
+
+/* One decoded payload. Native byte order; fastdecode.RECORD mirrors it. */
+typedef struct {
+    uint8_t service;
+    int8_t rssi;
+    uint8_t packet_type;
+    uint8_t address_type;
+    uint8_t bond;
+    uint8_t sensor_id;
+    uint8_t sender[6];      /* air order, as in the scan response */
+    uint16_t seq;           /* 0 for telemetry */
+    uint16_t reserved;
+    int64_t values[8];      /* the record's fields between sensor_id and seq */
+} lpcsb_record_t;
+
+typedef struct {
+    PyObject_HEAD
+    unsigned char *buf;
+    Py_ssize_t len;
+    Py_ssize_t cap;
+    int in_sync;
+    char *out;
+    Py_ssize_t out_len;
+    Py_ssize_t out_cap;
+    Py_ssize_t frames;
+    Py_ssize_t scan_responses;
+    Py_ssize_t dropped_bytes;
+    Py_ssize_t resyncs;
+    Py_ssize_t records;
+    Py_ssize_t malformed;
+} Parser;
+
+static unsigned be16(const unsigned char *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t be32(const unsigned char *p)
+{
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+/* Payload length after the service byte, or 0 for a service we don't know */
+static Py_ssize_t payload_len(unsigned service)
+{
+    switch (service) {
+    case UVA_RAW_COLOR_SERVICE:
+        return sizeof(lpcsb_raw_color_t);
+    case UVA_LIGHT_COLOR_SERVICE:
+        return sizeof(lpcsb_light_type_t);
+    case UVA_TELEMETRY_SERVICE:
+        return TELEMETRY_FRAME_LEN;
+    }
+    return 0;
+}
+
+/* Length check of a message with a known payload size, -1 if there is none */
+static int known_length(unsigned msg_type, unsigned cls, unsigned cmd)
+{
+    if (msg_type == MSG_RESPONSE) {
+        if (cls == 0x03 && cmd == 0x00)
+            return 3;       /* connection_disconnect */
+        if (cls == CLASS_GAP && (cmd == 0x01 || cmd == 0x02 || cmd == 0x04 || cmd == 0x07))
+            return 2;       /* gap_set_mode, gap_discover, gap_end_procedure, gap_set_scan_parameters */
+    }
+    else if (cls == 0x00 && cmd == 0x00) {
+        return 12;          /* system_boot */
+    }
+    return -1;
+}
+
+static void skip(Parser *self)
+{
+    self->dropped_bytes++;
+    if (self->in_sync) {
+        self->in_sync = 0;
+        self->resyncs++;
+    }
+}
+
+static int emit(Parser *self, const lpcsb_record_t *record)
+{
+    if (self->out_len + (Py_ssize_t) sizeof(*record) > self->out_cap) {
+        Py_ssize_t cap = self->out_cap ? 2 * self->out_cap : 64 * (Py_ssize_t) sizeof(*record);
+        char *out = PyMem_Realloc(self->out, cap);
+        if (out == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        self->out = out;
+        self->out_cap = cap;
+    }
+    memcpy(self->out + self->out_len, record, sizeof(*record));
+    self->out_len += sizeof(*record);
+    self->records++;
+    return 0;
+}
+
+static void unpack(lpcsb_record_t *record, unsigned service, const unsigned char *p)
+{
+    const lpcsb_raw_color_t *raw;
+    const lpcsb_light_type_t *light;
+
+    switch (service) {
+    case UVA_RAW_COLOR_SERVICE:
+        raw = (const lpcsb_raw_color_t *) p;
+        record->sensor_id = raw->sensorID;
+        record->values[0] = (raw->clearTempL << 8) | raw->clearTempR;
+        record->values[1] = (raw->redTempL << 8) | raw->redTempR;
+        record->values[2] = (raw->greenTempL << 8) | raw->greenTempR;
+        record->values[3] = (raw->blueTempL << 8) | raw->blueTempR;
+        record->values[4] = (raw->colorTempL << 8) | raw->colorTempR;
+        record->values[5] = (raw->luxL << 8) | raw->luxR;
+        record->seq = (raw->packetNumL << 8) | raw->packetNumR;
+        break;
+    case UVA_LIGHT_COLOR_SERVICE:
+        light = (const lpcsb_light_type_t *) p;
+        record->sensor_id = light->sensorID;
+        record->values[0] = light->LightType;
+        record->seq = (light->packetNumL << 8) | light->packetNumR;
+        break;
+    case UVA_TELEMETRY_SERVICE:
+        /* frame layout in telemetry.h */
+        record->sensor_id = p[0];
+        record->values[0] = p[1];
+        record->values[1] = be16(p + 2);
+        record->values[2] = (int16_t) be16(p + 4);
+        record->values[3] = be32(p + 6);
+        record->values[4] = be32(p + 10);
+        record->values[5] = be32(p + 14);
+        record->values[6] = be16(p + 18);
+        record->values[7] = be16(p + 20);
+        break;
+    }
+}
+
+/* The checks lpcsb.decode registers: samples come from a TCS34725, and
+ * telemetry may also say 0, from a board whose sensor never answered */
+static int sensor_ok(const lpcsb_record_t *record)
+{
+    if (record->sensor_id == LPCSB_SENSOR_ID)
+        return 1;
+    return record->service == UVA_TELEMETRY_SERVICE && record->sensor_id == 0;
+}
+
+/* 1 for a good scan response (decoded if it is ours), 0 to resync, -1 on error */
+static int scan_response(Parser *self, const unsigned char *p, Py_ssize_t length)
+{
+    unsigned packet_type = p[1], address_type = p[8], bond = p[9], data_len = p[10];
+    const unsigned char *ad = p + 11, *stop = ad + data_len, *found = NULL;
+    Py_ssize_t found_len = 0;
+    lpcsb_record_t record;
+
+    if (length != 11 + data_len || (packet_type & ~6u) != 0 || address_type > 1 || (bond > 15 && bond != 0xFF))
+        return 0;
+
+    /* Every AD structure is checked before anything is decoded, as the
+     * Python parser does, so a bad one later on still rejects the frame. */
+    while (ad < stop) {
+        unsigned n = ad[0];
+        if (n == 0)
+            break;
+        if (ad + 1 + n > stop)
+            return 0;
+        if (found == NULL && ad[1] == AD_MANUFACTURER && n - 1 >= 3 &&
+            (ad[2] | (ad[3] << 8)) == UVA_COMPANY_IDENTIFIER && payload_len(ad[4]) != 0) {
+            found = ad + 4;
+            found_len = n - 3;
+        }
+        ad += 1 + n;
+    }
+
+    self->scan_responses++;
+    if (found == NULL)
+        return 1;
+    if (found_len < 1 + payload_len(found[0])) {
+        self->malformed++;
+        return 1;
+    }
+
+    memset(&record, 0, sizeof(record));
+    record.service = found[0];
+    record.rssi = (int8_t) p[0];
+    record.packet_type = packet_type;
+    record.address_type = address_type;
+    record.bond = bond;
+    memcpy(record.sender, p + 2, 6);
+    unpack(&record, found[0], found + 1);
+    if (!sensor_ok(&record)) {
+        self->malformed++;
+        return 1;
+    }
+    return emit(self, &record) < 0 ? -1 : 1;
+}
+
+static int parse(Parser *self)
+{
+    unsigned char *buf = self->buf;
+    Py_ssize_t pos = 0, end = self->len;
+
+    while (end - pos >= 4) {
+        unsigned b0 = buf[pos], msg_type, cls, cmd;
+        Py_ssize_t length;
+        int known, ok, scan;
+
+        if (b0 & 0x78) {
+            pos++;
+            skip(self);
+            continue;
+        }
+        msg_type = b0 & 0x80;
+        length = ((b0 & 0x07) << 8) | buf[pos + 1];
+        cls = buf[pos + 2];
+        cmd = buf[pos + 3];
+        scan = msg_type == MSG_EVENT && cls == CLASS_GAP && cmd == 0x00;
+        known = known_length(msg_type, cls, cmd);
+
+        if (scan)
+            ok = 11 <= length && length <= 11 + MAX_AD_DATA;
+        else if (known >= 0)
+            ok = length == known;
+        else if (msg_type == MSG_RESPONSE)
+            ok = 0;
+        else
+            ok = cls <= MAX_CLASS && length <= MAX_OTHER_PAYLOAD;
+        if (!ok) {
+            pos++;
+            skip(self);
+            continue;
+        }
+        if (end - pos < 4 + length)
+            break;
+
+        if (scan) {
+            int status = scan_response(self, buf + pos + 4, length);
+            if (status < 0)
+                return -1;
+            if (status == 0) {
+                pos++;
+                skip(self);
+                continue;
+            }
+        }
+        else if (known < 0 && pos + 4 + length < end && (buf[pos + 4 + length] & 0x78)) {
+            pos++;
+            skip(self);
+            continue;
+        }
+
+        self->frames++;
+        self->in_sync = 1;
+        pos += 4 + length;
+    }
+
+    memmove(buf, buf + pos, end - pos);
+    self->len = end - pos;
+    return 0;
+}
+
+static int append(Parser *self, const char *data, Py_ssize_t n)
+{
+    if (self->len + n > self->cap) {
+        Py_ssize_t cap = self->cap ? self->cap : 65536;
+        unsigned char *buf;
+        while (cap < self->len + n)
+            cap *= 2;
+        buf = PyMem_Realloc(self->buf, cap);
+        if (buf == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        self->buf = buf;
+        self->cap = cap;
+    }
+    memcpy(self->buf + self->len, data, n);
+    self->len += n;
+    return 0;
+}
+
+PyDoc_STRVAR(feed_doc,
+"feed(data) -> bytes\n\n"
+"Add bytes from the dongle; returns the packed records of every LPCSB\n"
+"payload in the frames completed by them.");
+
+static PyObject *Parser_feed(Parser *self, PyObject *args)
+{
+    Py_buffer view;
+    Py_ssize_t i;
+    PyObject *result;
+
+    if (!PyArg_ParseTuple(args, "s*:feed", &view))
+        return NULL;
+    self->out_len = 0;
+    for (i = 0; i < view.len; i += FEED_STEP) {
+        Py_ssize_t n = view.len - i < FEED_STEP ? view.len - i : FEED_STEP;
+        if (append(self, (const char *) view.buf + i, n) < 0 || parse(self) < 0) {
+            PyBuffer_Release(&view);
+            return NULL;
+        }
+    }
+    PyBuffer_Release(&view);
+    result = PyBytes_FromStringAndSize(self->out, self->out_len);
+    self->out_len = 0;
+    return result;
+}
+
+static PyObject *Parser_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    Parser *self = (Parser *) type->tp_alloc(type, 0);
+    if (self != NULL)
+        self->in_sync = 1;
+    return (PyObject *) self;
+}
+
+static void Parser_dealloc(Parser *self)
+{
+    PyMem_Free(self->buf);
+    PyMem_Free(self->out);
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyMethodDef Parser_methods[] = {
+    {"feed", (PyCFunction) Parser_feed, METH_VARARGS, feed_doc},
+    {NULL}
+};
+
+static PyMemberDef Parser_members[] = {
+    {"frames", T_PYSSIZET, offsetof(Parser, frames), READONLY, "BGAPI frames accepted"},
+    {"scan_responses", T_PYSSIZET, offsetof(Parser, scan_responses), READONLY, "gap_scan_response events"},
+    {"dropped_bytes", T_PYSSIZET, offsetof(Parser, dropped_bytes), READONLY, "bytes skipped to find the next frame"},
+    {"resyncs", T_PYSSIZET, offsetof(Parser, resyncs), READONLY, "times the stream was lost and found again"},
+    {"records", T_PYSSIZET, offsetof(Parser, records), READONLY, "LPCSB payloads decoded"},
+    {"malformed", T_PYSSIZET, offsetof(Parser, malformed), READONLY, "LPCSB payloads too short to decode or with a bad sensor ID"},
+    {NULL}
+};
+
+static PyTypeObject ParserType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "lpcsb._fastdecode.Parser",     /* tp_name */
+    sizeof(Parser),                 /* tp_basicsize */
+};
+
+PyDoc_STRVAR(module_doc, "Native batch decoder for LPCSB advertisements in BGAPI traffic, see lpcsb/fastdecode.py");
+
+#if PY_MAJOR_VERSION >= 3
+static struct PyModuleDef moduledef = {
+    PyModuleDef_HEAD_INIT, "_fastdecode", module_doc, -1, NULL
+};
+#define INIT_ERROR return NULL
+PyMODINIT_FUNC PyInit__fastdecode(void)
+#else
+#define INIT_ERROR return
+PyMODINIT_FUNC init_fastdecode(void)
+#endif
+{
+    PyObject *module;
+
+    ParserType.tp_dealloc = (destructor) Parser_dealloc;
+    ParserType.tp_flags = Py_TPFLAGS_DEFAULT;
+    ParserType.tp_doc = "Streaming BGAPI parser that returns LPCSB records in batches";
+    ParserType.tp_methods = Parser_methods;
+    ParserType.tp_members = Parser_members;
+    ParserType.tp_new = Parser_new;
+    if (PyType_Ready(&ParserType) < 0)
+        INIT_ERROR;
+
+#if PY_MAJOR_VERSION >= 3
+    module = PyModule_Create(&moduledef);
+#else
+    module = Py_InitModule3("_fastdecode", NULL, module_doc);
+#endif
+    if (module == NULL)
+        INIT_ERROR;
+    Py_INCREF(&ParserType);
+    PyModule_AddObject(module, "Parser", (PyObject *) &ParserType);
+    PyModule_AddIntConstant(module, "RECORD_SIZE", sizeof(lpcsb_record_t));
+    PyModule_AddIntConstant(module, "COMPANY", UVA_COMPANY_IDENTIFIER);
+    PyModule_AddIntConstant(module, "RAW_COLOR_SERVICE", UVA_RAW_COLOR_SERVICE);
+    PyModule_AddIntConstant(module, "LIGHT_TYPE_SERVICE", UVA_LIGHT_COLOR_SERVICE);
+    PyModule_AddIntConstant(module, "TELEMETRY_SERVICE", UVA_TELEMETRY_SERVICE);
+#if PY_MAJOR_VERSION >= 3
+    return module;
+#endif
+}
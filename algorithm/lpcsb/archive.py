@@ -0,0 +1,187 @@
+""" Columnar (Parquet) archive of LPCSB records
+
+The CSVs are fine for a quick look but slow to load once a run spans
+months: every number is text and every timestamp a string. ParquetSink
+writes the same records with typed columns:
+
+    device       dictionary<string>   board name from the device registry
+    mac          dictionary<string>   'C098E5405D4C'
+    time         timestamp[ns, UTC]   int64 nanoseconds since the epoch
+    seq          uint16
+    rssi         int8
+    clear red green blue color_temp lux        uint16, null on light type rows
+    light_type   dictionary<string>   'LED', ..., null when not classified
+
+Rows are gathered into one row group per `window_secs` of receive time (an
+hour by default), so a query over a few days only touches the row groups
+and columns it needs. A row group is also cut at `max_rows` to bound memory.
+The Parquet footer is only written by close(), so the sink registers with
+lpcsb.output and close_all() on Ctrl-C finishes the file.
+
+Needs pyarrow. Existing CSVs from any of the scanners convert with
+
+    python -m lpcsb.archive [--utc] -o archive.parquet a.csv b.csv ...
+
+The CSV timestamps come from datetime.now(), i.e. local time despite the
+trailing 'Z'; they are read as local time unless --utc is given.
+"""
+
+from __future__ import print_function
+
+import calendar
+import csv
+import datetime
+import optparse
+import time
+
+import pyarrow as pa
+import pyarrow.parquet as pq
+
+from lpcsb import output
+
+CHANNELS = ('clear', 'red', 'green', 'blue', 'color_temp', 'lux')
+
+SCHEMA = pa.schema([
+    ('device', pa.dictionary(pa.int32(), pa.string())),
+    ('mac', pa.dictionary(pa.int32(), pa.string())),
+    ('time', pa.timestamp('ns', tz='UTC')),
+    ('seq', pa.uint16()),
+    ('rssi', pa.int8()),
+] + [(name, pa.uint16()) for name in CHANNELS] + [
+    ('light_type', pa.dictionary(pa.int32(), pa.string())),
+])
+
+if hasattr(time, 'time_ns'):
+    _now_ns = time.time_ns
+else:
+    def _now_ns():
+        return int(time.time() * 1e9)
+
+
+class ParquetSink(object):
+    def __init__(self, path, window_secs=3600, max_rows=1000000, compression='zstd'):
+        self.path = path
+        self.window_ns = int(window_secs * 1e9)
+        self.max_rows = max_rows
+        self.rows_written = 0
+        self.row_groups = 0
+
+        self._writer = pq.ParquetWriter(path, SCHEMA, compression=compression,
+                                        use_dictionary=['device', 'mac', 'light_type'])
+        self._window = None
+        self._clear_columns()
+        output.register(self)
+
+    def _clear_columns(self):
+        self._columns = dict((field.name, []) for field in SCHEMA)
+
+    def add(self, device, mac, seq, rssi, raw=None, light_type=None, time_ns=None):
+        """ One record. `raw` is a RawColor (or anything with the channel
+        attributes), `light_type` a name; either may be None. """
+        if time_ns is None:
+            time_ns = _now_ns()
+        window = time_ns // self.window_ns
+        if window != self._window:
+            self.flush()
+            self._window = window
+
+        columns = self._columns
+        columns['device'].append(device)
+        columns['mac'].append(mac)
+        columns['time'].append(time_ns)
+        columns['seq'].append(seq)
+        columns['rssi'].append(rssi)
+        for name in CHANNELS:
+            columns[name].append(None if raw is None else getattr(raw, name))
+        columns['light_type'].append(light_type)
+
+        if len(columns['seq']) >= self.max_rows:
+            self.flush()
+
+    def tick(self):
+        """ Nothing to do until the window closes; here for tick_all(). """
+        pass
+
+    def flush(self):
+        """ Write buffered records out as a row group. """
+        count = len(self._columns['seq'])
+        if count == 0:
+            return
+        arrays = [pa.array(self._columns[field.name], type=field.type) for field in SCHEMA]
+        self._writer.write_table(pa.Table.from_arrays(arrays, schema=SCHEMA), row_group_size=count)
+        self.rows_written += count
+        self.row_groups += 1
+        self._clear_columns()
+
+    def close(self):
+        if self._writer is None:
+            return
+        self.flush()
+        self._writer.close()
+        self._writer = None
+        output.unregister(self)
+
+
+class _Channels(object):
+    """ Lets a CSV row stand in for a RawColor in ParquetSink.add(). """
+    def __init__(self, **values):
+        self.__dict__.update(values)
+
+
+# CSV column -> channel, as written by all three scanners
+CSV_CHANNELS = (('Clear', 'clear'), ('Red', 'red'), ('Green', 'green'), ('Blue', 'blue'),
+                ('Color Temp', 'color_temp'), ('Lux', 'lux'))
+
+
+def csv_time_ns(text, utc=False):
+    """ '2020-03-12T14:01:02.123456Z' -> ns since the epoch """
+    t = datetime.datetime.strptime(text, "%Y-%m-%dT%H:%M:%S.%fZ")
+    if utc:
+        seconds = calendar.timegm(t.timetuple())
+    else:
+        seconds = int(time.mktime(t.timetuple()))
+    return seconds * 1000000000 + t.microsecond * 1000
+
+
+def convert_csv(filename, sink, utc=False):
+    """ Append one scanner CSV to `sink`. Returns the number of rows. """
+    count = 0
+    with open(filename) as f:
+        reader = csv.DictReader(f)
+        # The multiservice scanner writes 'Unknown' on raw rows as a filler;
+        # the LightID scanner writes it as a classification result
+        filler_unknown = 'Light Type' in reader.fieldnames and \
+                         'Comparing Ratios' not in reader.fieldnames
+        for row in reader:
+            raw = None
+            if row.get('Lux', 'N/A') != 'N/A':
+                raw = _Channels(**dict((name, int(float(row[column]))) for column, name in CSV_CHANNELS))
+            light_type = row.get('Light Type') or None
+            if filler_unknown and raw is not None and light_type == 'Unknown':
+                light_type = None
+            sink.add(row['device'], row['device_id'], int(row['sequence_no']), int(row['rssi']),
+                     raw=raw, light_type=light_type,
+                     time_ns=csv_time_ns(row['received_time'], utc))
+            count += 1
+    return count
+
+
+def main():
+    p = optparse.OptionParser(usage="%prog [options] FILE.csv ...",
+                              description="Convert LPCSB scanner CSVs to a Parquet archive")
+    p.add_option('--output', '-o', help="Parquet file to write")
+    p.add_option('--window', type='float', default=3600, help="Seconds of data per row group (default 3600)")
+    p.add_option('--utc', action='store_true', default=False, help="CSV timestamps are UTC, not local time")
+    options, args = p.parse_args()
+    if not options.output or not args:
+        p.error("need --output and at least one CSV")
+
+    sink = ParquetSink(options.output, window_secs=options.window)
+    for filename in args:
+        print("%s: %d rows" % (filename, convert_csv(filename, sink, options.utc)))
+    sink.close()
+    print("%s: %d rows in %d row groups" % (options.output, sink.rows_written, sink.row_groups))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,288 @@
+""" BGAPI framing for the BLED112
+
+Every BGAPI message is a 4 byte header followed by the payload:
+
+    byte 0   message type (0x00 response, 0x80 event) | technology | len high bits
+    byte 1   payload length, low 8 bits
+    byte 2   class
+    byte 3   command
+
+The only event the scanners care about is gap_scan_response (class 6,
+command 0), whose payload is
+
+    int8 rssi, uint8 packet_type, bd_addr sender[6], uint8 address_type,
+    uint8 bond, uint8array data (length prefixed)
+"""
+
+import struct
+
+MSG_RESPONSE = 0x00
+MSG_EVENT = 0x80
+
+CLASS_GAP = 0x06
+EVT_GAP_SCAN_RESPONSE = 0x00
+
+SCAN_RESPONSE_HEADER = struct.Struct('<bB6sBBB')
+
+
+def frame(msg_type, cls, cmd, payload=b''):
+    """ Wrap a payload in a BGAPI header. """
+    n = len(payload)
+    return struct.pack('4B', msg_type | ((n >> 8) & 0x07), n & 0xFF, cls, cmd) + payload
+
+
+def gap_scan_response(rssi, packet_type, sender, address_type, bond, data):
+    """ Build a gap_scan_response event as the dongle would send it. `sender`
+    is the 6 byte address in air order (least significant byte first).
+    """
+    payload = SCAN_RESPONSE_HEADER.pack(rssi, packet_type, bytes(bytearray(sender)),
+                                        address_type, bond, len(data)) + bytes(bytearray(data))
+    return frame(MSG_EVENT, CLASS_GAP, EVT_GAP_SCAN_RESPONSE, payload)
+
+
+# Commands the scanners send and the payload length of their responses, plus
+# the events we know the size of. Responses to anything else are rejected and
+# other events are only accepted if they are short, so a corrupt header can't
+# swallow a long run of good frames. Add to this table when sending new
+# commands.
+SYSTEM_BOOT = (MSG_EVENT, 0x00, 0x00)
+SCAN_RESPONSE = (MSG_EVENT, CLASS_GAP, EVT_GAP_SCAN_RESPONSE)
+KNOWN_LENGTHS = {
+    (MSG_RESPONSE, 0x03, 0x00): 3,    # connection_disconnect
+    (MSG_RESPONSE, 0x06, 0x01): 2,    # gap_set_mode
+    (MSG_RESPONSE, 0x06, 0x02): 2,    # gap_discover
+    (MSG_RESPONSE, 0x06, 0x04): 2,    # gap_end_procedure
+    (MSG_RESPONSE, 0x06, 0x07): 2,    # gap_set_scan_parameters
+    SYSTEM_BOOT: 12,
+}
+MAX_CLASS = 0x08
+MAX_OTHER_PAYLOAD = 64
+
+# Advertising data is at most 31 bytes on a 4.0 controller like the BLED112
+MAX_AD_DATA = 31
+SCAN_PACKET_TYPES = (0, 2, 4, 6)
+
+AD_FLAGS = 0x01
+AD_SHORT_NAME = 0x08
+AD_COMPLETE_NAME = 0x09
+AD_MANUFACTURER = 0xFF
+
+
+class ScanResponse(object):
+    """ One gap_scan_response, decoded in place. `sender` and `data` are
+    memoryviews into the parser's buffer and are only valid until the
+    handler returns; copy() the event, or bytes() of a field, to keep them.
+    """
+    __slots__ = ('rssi', 'packet_type', 'sender', 'address_type', 'bond',
+                 'data', '_buf', '_view', '_base', '_fields')
+
+    def copy(self, into=None):
+        """ A copy that owns its bytes and stays valid after the handler
+        returns. `into` is an empty ScanResponse (or subclass) to fill in. """
+        evt = ScanResponse() if into is None else into
+        buf = bytearray(self.sender.tobytes() + self.data.tobytes())
+        view = memoryview(buf)
+        shift = 6 - self._base
+        evt.rssi = self.rssi
+        evt.packet_type = self.packet_type
+        evt.sender = view[0:6]
+        evt.address_type = self.address_type
+        evt.bond = self.bond
+        evt.data = view[6:]
+        evt._buf = buf
+        evt._view = view
+        evt._base = 6
+        evt._fields = [(t, start + shift, stop + shift) for t, start, stop in self._fields]
+        return evt
+
+    def fields(self):
+        """ Yield (ad_type, value) for every AD structure, value as a
+        memoryview without the type byte. """
+        view = self._view
+        for ad_type, start, stop in self._fields:
+            yield ad_type, view[start:stop]
+
+    def field(self, ad_type):
+        """ Value of the first AD structure of the given type, or None. """
+        for t, start, stop in self._fields:
+            if t == ad_type:
+                return self._view[start:stop]
+        return None
+
+    def manufacturer(self, company_id):
+        """ Manufacturer specific data for one company without the company
+        identifier, or None. """
+        buf = self._buf
+        for t, start, stop in self._fields:
+            if t == AD_MANUFACTURER and stop - start >= 2 and \
+               buf[start] | (buf[start + 1] << 8) == company_id:
+                return self._view[start + 2:stop]
+        return None
+
+    def manufacturers(self):
+        """ Yield (company_id, data without the identifier) for every
+        manufacturer specific AD structure. """
+        buf = self._buf
+        view = self._view
+        for t, start, stop in self._fields:
+            if t == AD_MANUFACTURER and stop - start >= 2:
+                yield buf[start] | (buf[start + 1] << 8), view[start + 2:stop]
+
+
+class BgapiParser(object):
+    """ Streaming BGAPI parser.
+
+    Bytes from feed() go into a fixed bytearray and are decoded there with
+    struct.unpack_from and offsets, without building per-byte lists or
+    intermediate strings. Every header is checked against what the message
+    can look like (known lengths, class range, and for scan responses the
+    inner data length and AD structure layout). When something doesn't fit
+    the parser drops a single byte and tries again from the next one, so a
+    lost or corrupted byte costs the frames around it rather than the rest
+    of the session.
+    """
+
+    def __init__(self, on_scan_response=None, on_message=None, size=1 << 16):
+        self.on_scan_response = on_scan_response
+        self.on_message = on_message
+
+        self.buf = bytearray(size)
+        self.view = memoryview(self.buf)
+        self.start = 0
+        self.end = 0
+
+        self.frames = 0
+        self.scan_responses = 0
+        self.dropped_bytes = 0
+        self.resyncs = 0
+        self._in_sync = True
+
+    def feed(self, data):
+        """ Add bytes from the port and handle every complete frame. """
+        step = len(self.buf) // 2
+        for i in range(0, len(data), step):
+            chunk = data[i:i + step]
+            n = len(chunk)
+            if self.end + n > len(self.buf):
+                self._compact()
+            self.buf[self.end:self.end + n] = chunk
+            self.end += n
+            self._parse()
+
+    def _compact(self):
+        # Same-size slice assignment, so the exported memoryview stays valid
+        n = self.end - self.start
+        self.buf[0:n] = self.buf[self.start:self.end]
+        self.start = 0
+        self.end = n
+
+    def _skip(self):
+        self.dropped_bytes += 1
+        if self._in_sync:
+            self._in_sync = False
+            self.resyncs += 1
+
+    def _parse(self):
+        buf = self.buf
+        pos = self.start
+        end = self.end
+
+        while end - pos >= 4:
+            b0 = buf[pos]
+            if b0 & 0x78:
+                # Technology bits are always 0 (Bluetooth Smart)
+                pos += 1
+                self._skip()
+                continue
+
+            msg_type = b0 & 0x80
+            length = ((b0 & 0x07) << 8) | buf[pos + 1]
+            cls = buf[pos + 2]
+            cmd = buf[pos + 3]
+            key = (msg_type, cls, cmd)
+
+            if key == SCAN_RESPONSE:
+                ok = 11 <= length <= 11 + MAX_AD_DATA
+            elif key in KNOWN_LENGTHS:
+                ok = length == KNOWN_LENGTHS[key]
+            elif msg_type == MSG_RESPONSE:
+                # Responses only ever answer commands we sent
+                ok = False
+            else:
+                ok = cls <= MAX_CLASS and length <= MAX_OTHER_PAYLOAD
+            if not ok:
+                pos += 1
+                self._skip()
+                continue
+
+            if end - pos < 4 + length:
+                break
+
+            p = pos + 4
+            if key == SCAN_RESPONSE:
+                evt = self._scan_response(p, length)
+                if evt is None:
+                    pos += 1
+                    self._skip()
+                    continue
+                self.scan_responses += 1
+                if self.on_scan_response:
+                    self.on_scan_response(evt)
+            else:
+                # An unknown event has nothing to check inside it, so at least
+                # require the byte after it to look like the next header
+                nxt = p + length
+                if key not in KNOWN_LENGTHS and nxt < end and buf[nxt] & 0x78:
+                    pos += 1
+                    self._skip()
+                    continue
+                if self.on_message:
+                    self.on_message(msg_type, cls, cmd, self.view[p:p + length])
+
+            self.frames += 1
+            self._in_sync = True
+            pos += 4 + length
+
+        if pos == end:
+            pos = end = 0
+        self.start = pos
+        self.end = end
+
+    def _scan_response(self, p, length):
+        buf = self.buf
+        rssi, packet_type, address_type, bond, data_len = \
+            _SCAN_FIXED.unpack_from(buf, p)
+        if length != 11 + data_len or packet_type not in SCAN_PACKET_TYPES \
+           or address_type > 1 or (bond > 15 and bond != 0xFF):
+            return None
+
+        # Walk the AD structures: each is a length byte covering the type byte
+        # and value. A zero length ends the data (the rest is padding).
+        fields = []
+        i = p + 11
+        stop = i + data_len
+        while i < stop:
+            n = buf[i]
+            if n == 0:
+                break
+            if i + 1 + n > stop:
+                return None
+            fields.append((buf[i + 1], i + 2, i + 1 + n))
+            i += 1 + n
+
+        evt = ScanResponse()
+        evt.rssi = rssi
+        evt.packet_type = packet_type
+        evt.sender = self.view[p + 2:p + 8]
+        evt.address_type = address_type
+        evt.bond = bond
+        evt.data = self.view[p + 11:stop]
+        evt._buf = buf
+        evt._view = self.view
+        evt._base = p + 11
+        evt._fields = fields
+        return evt
+
+
+# rssi, packet_type, (sender skipped), address_type, bond, data_len
+_SCAN_FIXED = struct.Struct('<bB6xBBB')
@@ -0,0 +1,230 @@
+""" Scanning with several dongles at once
+
+One BLED112 covers one area and drops packets when the air is busy.
+MultiCapture reads any number of dongles, each on its own thread with its
+own BulkReader and BgapiParser, and hands their scan responses to one
+handler on the caller's thread, so decoding and output stay single threaded.
+
+With more than one dongle the same advertisement usually arrives several
+times. Copies are recognised by sender and advertisement data; for LPCSB
+boards the data carries the service and sequence number, so this is the
+(MAC, seq) of the sample. The first copy is held for `hold` seconds to
+collect the others and is then delivered once, with `rssi` set to the best
+RSSI and `receiver_rssi` listing what each dongle heard (None where it
+heard nothing). Later copies of a delivered advertisement, such as the
+firmware re-advertising the same sample, are dropped for `memory` seconds.
+
+With a single dongle nothing is held or dropped; every event is delivered
+as it arrives, with `receiver_rssi` = [rssi].
+
+Delivered events are Capture objects, ScanResponses that own their bytes
+and also carry `time` (time.time() of the first copy) and `receiver` (the
+index of the dongle that heard it first).
+
+The reader threads hand events over through a bounded intake queue that
+drops (and counts) what doesn't fit, so a stalled handler never stops the
+ports being drained; see lpcsb/pipeline.py.
+
+A port named like hci0 is a Linux Bluetooth controller rather than a
+dongle: it is read with lpcsb.hci's HciReader and HciParser, which only
+build events for advertisements from `companies`, and the rest is the
+same.
+
+With a `recorder` (lpcsb.replay.Recorder) every read is also saved as it
+came off the port. A MultiCapture made without ports replays such reads
+instead: feed() parses them on the caller's thread with the recorded time
+standing in for the clock.
+"""
+
+import threading
+import time
+from collections import deque
+
+from lpcsb.bgapi import BgapiParser, ScanResponse
+from lpcsb.hci import HciParser, HciReader, HciSocket, is_hci
+from lpcsb.pipeline import BoundedQueue, Empty, Timing, DROP
+from lpcsb.serial_reader import BulkReader
+
+
+class Capture(ScanResponse):
+    __slots__ = ('time', 'receiver', 'receiver_rssi')
+
+
+class ReceiverStats(object):
+    def __init__(self, name):
+        self.name = name
+        self.received = 0       # scan responses from this dongle
+        self.first = 0          # ... that were the first copy
+        self.best = 0           # ... that had the best RSSI
+        self.error = None       # why the reader thread stopped, if it did
+
+
+def make_parser(name, on_scan_response, companies=None):
+    """ The parser for the byte stream from port `name`. """
+    if is_hci(name):
+        return HciParser(on_scan_response=on_scan_response, companies=companies)
+    return BgapiParser(on_scan_response=on_scan_response)
+
+
+class MultiCapture(object):
+    def __init__(self, ports, handler, names=None, hold=0.25, memory=15.0, queue_size=10000, recorder=None,
+                 companies=None):
+        """ `ports` are open pyserial ports or HciSockets that are already
+        scanning, or None to replay reads from the ports in `names` with
+        feed(). `handler(evt)` gets every delivered Capture from poll() or
+        feed(). """
+        self.handler = handler
+        self.hold = hold
+        self.memory = memory
+        self.recorder = recorder
+        self.companies = companies
+        count = len(names) if ports is None else len(ports)
+        self.receivers = [ReceiverStats(names[i] if names else str(i)) for i in range(count)]
+
+        self.unique = 0
+        self.duplicates = 0
+
+        self.handler_time = Timing()
+
+        self._queue = BoundedQueue(queue_size, DROP)
+        self._pending = {}          # key -> Capture waiting for other copies
+        self._pending_order = deque()   # (deadline, key)
+        self._recent = {}           # key -> time until which copies are dropped
+        self._recent_order = deque()    # (expiry, key)
+
+        self._parsers = {}          # dongle index -> BgapiParser, when replaying
+        self._now = None            # the recorded time, when replaying
+
+        for index, ser in enumerate(ports or ()):
+            thread = threading.Thread(target=self._reader, args=(index, ser))
+            thread.daemon = True
+            thread.start()
+
+    def _reader(self, index, ser):
+        put = self._queue.put
+        record = self.recorder.write if self.recorder is not None else None
+        now = [0.0]
+
+        def on_scan_response(evt):
+            c = evt.copy(Capture())
+            c.time = now[0]
+            c.receiver = index
+            put(c)
+
+        parse = make_parser(self.receivers[index].name, on_scan_response, self.companies).feed
+
+        def feed(data):
+            # one time per read, to the microsecond, so a replay gets the same
+            now[0] = round(time.time(), 6)
+            if record is not None:
+                record(index, data, now[0])
+            parse(data)
+
+        try:
+            if isinstance(ser, HciSocket):
+                HciReader(ser, feed).run()
+            else:
+                BulkReader(ser, feed).run()
+        except Exception as e:
+            self.receivers[index].error = e
+
+    def poll(self, timeout=0.5):
+        """ Deliver what has arrived, waiting up to `timeout` for something
+        to happen. """
+        if self._pending_order:
+            timeout = max(0, min(timeout, self._pending_order[0][0] - time.time()))
+        try:
+            c = self._queue.get(timeout=timeout)
+            while True:
+                self._arrive(c)
+                c = self._queue.get_nowait()
+        except Empty:
+            pass
+        self._expire(time.time())
+
+    def feed(self, index, data, now):
+        """ Parse `data` as if dongle `index` had read it at time `now`, and
+        deliver what is due by then. For replaying, on the caller's thread. """
+        parser = self._parsers.get(index)
+        if parser is None:
+            def on_scan_response(evt):
+                c = evt.copy(Capture())
+                c.time = self._now
+                c.receiver = index
+                self._arrive(c)
+            parser = self._parsers[index] = make_parser(self.receivers[index].name, on_scan_response, self.companies)
+        self._now = now
+        self._expire(now)
+        parser.feed(data)
+
+    def parser_stats(self):
+        """ Totals of the replay parsers' counters. """
+        parsers = self._parsers.values()
+        return dict((name, sum(getattr(p, name, 0) for p in parsers))
+                    for name in ('frames', 'scan_responses', 'filtered', 'dropped_bytes', 'resyncs'))
+
+    def _arrive(self, c):
+        stats = self.receivers[c.receiver]
+        stats.received += 1
+
+        if len(self.receivers) == 1:
+            c.receiver_rssi = [c.rssi]
+            stats.first += 1
+            stats.best += 1
+            self.unique += 1
+            self._deliver(c)
+            return
+
+        key = (c.sender.tobytes(), c.data.tobytes())
+        held = self._pending.get(key)
+        if held is not None:
+            self.duplicates += 1
+            previous = held.receiver_rssi[c.receiver]
+            if previous is None or c.rssi > previous:
+                held.receiver_rssi[c.receiver] = c.rssi
+            if c.rssi > held.rssi:
+                held.rssi = c.rssi
+            return
+        if key in self._recent:
+            self.duplicates += 1
+            return
+
+        c.receiver_rssi = [None] * len(self.receivers)
+        c.receiver_rssi[c.receiver] = c.rssi
+        stats.first += 1
+        self._pending[key] = c
+        self._pending_order.append((c.time + self.hold, key))
+
+    def _expire(self, now):
+        recent = self._recent
+        while self._recent_order and self._recent_order[0][0] <= now:
+            recent.pop(self._recent_order.popleft()[1], None)
+
+        while self._pending_order and self._pending_order[0][0] <= now:
+            key = self._pending_order.popleft()[1]
+            c = self._pending.pop(key)
+            recent[key] = now + self.memory
+            self._recent_order.append((now + self.memory, key))
+            self.receivers[c.receiver_rssi.index(c.rssi)].best += 1
+            self.unique += 1
+            self._deliver(c)
+
+    def _deliver(self, c):
+        start = time.time()
+        self.handler(c)
+        self.handler_time.add(time.time() - start)
+
+    def stats(self):
+        """ Per-dongle counters as plain data, e.g. for lpcsb.seqstats. """
+        return {
+            'receivers': [{'name': r.name, 'received': r.received, 'first': r.first, 'best': r.best,
+                           'error': None if r.error is None else str(r.error)} for r in self.receivers],
+            'unique': self.unique,
+            'duplicates': self.duplicates,
+            'intake': self._queue.stats(),
+            'handler': self.handler_time.stats(),
+        }
+
+    def flush(self):
+        """ Deliver everything still held, e.g. before exiting. """
+        self._expire(float('inf'))
@@ -0,0 +1,215 @@
+""" Light source classifiers for raw color samples
+
+The scanner runs every sample through a chain of classifiers, named with
+--classifiers and applied in that order. Each one looks at the decoded
+record and adds fields to the row being built, which the CSV columns then
+pick from:
+
+    ratios   max_ratio, min_ratio, ratio_compare     the "LED Data" ratios
+    rules    light_type                              the "Ceiling ID" rules
+    model    light_type                              a model from lpcsb/train.py
+
+Classifiers keep whatever per-board state they need (the rules follow how
+much each channel has drifted since the board's last reset), so they must
+see a board's samples in order and each sample once; the scanner runs them
+after duplicates are dropped.
+
+A new classifier is a Classifier subclass with a `name`, the `fields` it
+sets and a classify() method, passed to register().
+
+The thresholds of the rules are versioned in RULES, so recordings can be
+classified again offline (lpcsb/reclassify.py) with the thresholds the
+scanner used, or with new ones, and the results compared. The 'model'
+classifier replaces the rules with a decision tree fitted on recordings of
+known bulbs (lpcsb/train.py), which writes it to lpcsb/light_model.py and
+to a header for the Light ID firmware.
+"""
+
+from collections import namedtuple
+
+from lpcsb.decode import RawColor
+
+CLASSIFIERS = {}
+
+
+def register(cls):
+    CLASSIFIERS[cls.name] = cls
+    return cls
+
+
+def chain(names):
+    """ One new instance of each named classifier, in order. Raises
+    ValueError for a name that isn't registered. """
+    unknown = [n for n in names if n not in CLASSIFIERS]
+    if unknown:
+        raise ValueError("unknown classifier %s (have %s)" % (', '.join(unknown), ', '.join(sorted(CLASSIFIERS))))
+    return [CLASSIFIERS[n]() for n in names]
+
+
+class Classifier(object):
+    name = None
+    fields = ()
+
+    def classify(self, device, record, row):
+        """ Add fields to the dict `row` for one record from `device`. """
+        raise NotImplementedError
+
+
+def median(values):
+    ordered = sorted(values)
+    quotient, remainder = divmod(len(ordered), 2)
+    if remainder:
+        return ordered[quotient]
+    return sum(ordered[quotient - 1:quotient + 1]) / 2.
+
+
+def color_ratios(red, green, blue):
+    """ (maximum / median, median / minimum, larger of the two / smaller)
+    of the three color channels; Nones if a channel is dark. """
+    values = (float(red), float(green), float(blue))
+    mid = median(values)
+    low = min(values)
+    if low <= 0:
+        return None, None, None
+    max_ratio = max(values) / mid
+    min_ratio = mid / low
+    return max_ratio, min_ratio, max(max_ratio, min_ratio) / min(max_ratio, min_ratio)
+
+
+@register
+class ColorRatios(Classifier):
+    """ How far apart the color channels are, for telling sources apart by
+    eye in the CSV. """
+    name = 'ratios'
+    fields = ('max_ratio', 'min_ratio', 'ratio_compare')
+
+    def classify(self, device, record, row):
+        if isinstance(record, RawColor):
+            row['max_ratio'], row['min_ratio'], row['ratio_compare'] = \
+                color_ratios(record.red, record.green, record.blue)
+
+
+class _Drift(object):
+    __slots__ = ('previous', 'net')
+
+    def __init__(self):
+        self.previous = (0.0, 0.0, 0.0, 0.0)
+        self.net = [0.0, 0.0, 0.0, 0.0]
+
+
+RuleThresholds = namedtuple('RuleThresholds', 'incandescent_max_ratio incandescent_min_ratio '
+                                               'fluorescent_max_ratio fluorescent_max_top '
+                                               'led_max_drift led_max_lux sunlight_max_ratio')
+
+# Version 1 is what the Ceiling ID scanner shipped with, read off the color
+# graphs of the control bulbs
+RULES = {
+    '1': RuleThresholds(incandescent_max_ratio=1.15, incandescent_min_ratio=1.05,
+                        fluorescent_max_ratio=1.10, fluorescent_max_top=10000,
+                        led_max_drift=200, led_max_lux=2000, sunlight_max_ratio=1.05),
+}
+DEFAULT_RULES = '1'
+
+
+@register
+class BulbRules(Classifier):
+    """ Incandescent, fluorescent, LED or sunlight from the channel ratios,
+    the brightness and how much the channels drift since the board's last
+    reset, with the thresholds of one RULES version. """
+    name = 'rules'
+    fields = ('light_type',)
+
+    def __init__(self, thresholds=RULES[DEFAULT_RULES]):
+        self.thresholds = thresholds
+        self._drift = {}
+
+    def classify(self, device, record, row):
+        if not isinstance(record, RawColor):
+            return
+
+        values = (float(record.clear), float(record.red), float(record.green), float(record.blue))
+        drift = self._drift.get(device)
+        if drift is None or record.seq == 1:
+            # first sample since the board (or the scanner) started
+            drift = self._drift[device] = _Drift()
+        else:
+            for i in range(4):
+                drift.net[i] += values[i] - drift.previous[i]
+        drift.previous = values
+
+        clear, red, green, blue = values
+        colors = (red, green, blue)
+        top = max(colors)
+        mid = median(colors)
+        max_ratio, min_ratio, _ = color_ratios(red, green, blue)
+        have_ratios = max_ratio is not None
+        t = self.thresholds
+
+        # red on top and green and blue almost on top of each other
+        if red == top and have_ratios and max_ratio >= t.incandescent_max_ratio \
+                and min_ratio <= t.incandescent_min_ratio:
+            light_type = "Incandescent"
+        elif (green == top or (red == top and green == mid and have_ratios and max_ratio <= t.fluorescent_max_ratio)) \
+                and top < t.fluorescent_max_top:
+            light_type = "Fluorescent"
+        # steady channels, and the dimmest of the sources measured so far
+        elif all(abs(change) <= t.led_max_drift for change in drift.net[1:]) and record.lux <= t.led_max_lux:
+            light_type = "LED"
+        # brighter than any artificial light and the only one where blue leads
+        elif blue == top or (blue == mid and have_ratios and max_ratio <= t.sunlight_max_ratio):
+            light_type = "Sunlight"
+        else:
+            light_type = "Unknown"
+        row['light_type'] = light_type
+
+
+# The model's features are whole numbers so that the firmware computes the
+# same ones; see lpcsb/train.py
+MODEL_FEATURES = ('max_ratio', 'min_ratio', 'ratio_compare', 'red_share', 'green_share', 'blue_share', 'lux', 'drift')
+MODEL_RATIO_SCALE = 1000
+MODEL_RATIO_CAP = 65535
+
+
+def _model_ratio(a, b):
+    """ a / b times MODEL_RATIO_SCALE, capped; 0 / 0 is 1. """
+    if b == 0:
+        return MODEL_RATIO_CAP if a else MODEL_RATIO_SCALE
+    return min(a * MODEL_RATIO_SCALE // b, MODEL_RATIO_CAP)
+
+
+def model_features(red, green, blue, lux, drift):
+    """ MODEL_FEATURES for one sample; `drift` is the largest change of
+    red, green or blue since the board's last reset. """
+    top = max(red, green, blue)
+    low = min(red, green, blue)
+    total = red + green + blue
+    max_ratio = _model_ratio(top, total - top - low)
+    min_ratio = _model_ratio(total - top - low, low)
+    compare = _model_ratio(max(max_ratio, min_ratio), min(max_ratio, min_ratio))
+    shares = tuple(c * 1000 // total if total else 0 for c in (red, green, blue))
+    return (max_ratio, min_ratio, compare) + shares + (lux, drift)
+
+
+@register
+class LightModel(Classifier):
+    """ Light type from the decision tree in lpcsb/light_model.py. """
+    name = 'model'
+    fields = ('light_type',)
+
+    def __init__(self):
+        try:
+            from lpcsb import light_model
+        except ImportError:
+            raise ValueError("no trained model in lpcsb/light_model.py; make one with python -m lpcsb.train")
+        self.predict = light_model.predict
+        self._first = {}
+
+    def classify(self, device, record, row):
+        if not isinstance(record, RawColor):
+            return
+        colors = (int(record.red), int(record.green), int(record.blue))
+        first = self._first.get(device)
+        if first is None or record.seq == 1:
+            first = self._first[device] = colors
+        drift = max(abs(c - f) for c, f in zip(colors, first))
+        row['light_type'] = self.predict(model_features(colors[0], colors[1], colors[2], int(record.lux), drift))
@@ -0,0 +1,136 @@
+""" LPCSB advertisement payloads
+
+The board advertises manufacturer specific data under the UVA company
+identifier. The first byte after the identifier names the service, the rest
+is big-endian:
+
+    0x31 raw color    sensorID, clear, red, green, blue, colorTemp, lux, seq
+    0x32 light type   sensorID, lightType, seq
+    0x33 telemetry    sensorID, version, battery mV, temperature (8.8 C),
+                      uptime (0.1 s), adverts, samples, I2C errors, retries
+
+Payload variants are looked up in a registry keyed by (company identifier,
+service byte), so a new service or another manufacturer's board only needs
+a register() call with its record type and struct layout. lookup() finds
+the decoder for a ScanResponse from lpcsb.bgapi and decodes it straight
+from the advertisement bytes; decode() returns just the record.
+"""
+
+import struct
+from collections import namedtuple
+
+UVA_COMPANY_IDENTIFIER = 0x02E0
+
+RAW_COLOR_SERVICE = 0x31
+LIGHT_TYPE_SERVICE = 0x32
+TELEMETRY_SERVICE = 0x33
+
+# Every TCS34725 reports this ID; anything else means a garbled payload
+TCS34725_ID = 0x44
+
+RawColor = namedtuple('RawColor', 'sensor_id clear red green blue color_temp lux seq')
+LightType = namedtuple('LightType', 'sensor_id light_type seq')
+Telemetry = namedtuple('Telemetry', 'sensor_id version battery_mv temperature uptime_ds '
+                                    'adv_count sample_count twi_errors twi_retries')
+
+LIGHT_TYPE_NAMES = {
+    0x00: "Incandescent",
+    0x11: "LED",
+    0x22: "Fluorescent",
+    0x33: "Sunlight",
+}
+
+
+class Decoder(object):
+    """ One payload variant: manufacturer data from `company` whose first
+    byte is `service`, unpacked with `layout` into a `record`. `name` is how
+    the scanner's --services option and CSVs refer to it. `check(record)`,
+    if given, returns False for a payload that decodes but can't be right. """
+    __slots__ = ('company', 'service', 'name', 'record', 'layout', 'check')
+
+    def __init__(self, company, service, name, record, layout, check=None):
+        self.company = company
+        self.service = service
+        self.name = name
+        self.record = record
+        self.layout = layout
+        self.check = check
+
+    def decode(self, data):
+        """ Record from manufacturer data (service byte first), or None if
+        it is too short. """
+        if len(data) < 1 + self.layout.size:
+            return None
+        return self.record._make(self.layout.unpack_from(data, 1))
+
+
+# (company, service) -> Decoder
+DECODERS = {}
+
+
+def register(company, service, name, record, layout, check=None):
+    """ Add (or replace) the decoder for one payload variant. """
+    decoder = Decoder(company, service, name, record, layout, check)
+    DECODERS[(company, service)] = decoder
+    return decoder
+
+
+def decoder_names():
+    return sorted(set(d.name for d in DECODERS.values()))
+
+
+def _tcs34725(record):
+    return record.sensor_id == TCS34725_ID
+
+
+def _tcs34725_or_none(record):
+    # telemetry carries the ID the board last read, 0 if the sensor never
+    # answered; that board is the one telemetry is there to show
+    return record.sensor_id in (TCS34725_ID, 0)
+
+
+register(UVA_COMPANY_IDENTIFIER, RAW_COLOR_SERVICE, 'raw_color', RawColor, struct.Struct('>B7H'), _tcs34725)
+register(UVA_COMPANY_IDENTIFIER, LIGHT_TYPE_SERVICE, 'light_type', LightType, struct.Struct('>BBH'), _tcs34725)
+register(UVA_COMPANY_IDENTIFIER, TELEMETRY_SERVICE, 'telemetry', Telemetry, struct.Struct('>BBHhIIIHH'), _tcs34725_or_none)
+
+
+def mac_bytes(mac):
+    """ 'C0:98:E5:40:5D:4C' -> the 6 byte address in air order """
+    return bytes(bytearray.fromhex(mac.replace(':', '')))[::-1]
+
+
+def mac_str(sender):
+    """ Air order address -> 'C098E5405D4C', the form used in the CSVs """
+    return ''.join('%02X' % b for b in bytearray(sender)[::-1])
+
+
+def lookup(evt):
+    """ (Decoder, record) for the first manufacturer data in a scan
+    response that has a registered decoder; (None, None) if there is none,
+    (Decoder, None) if the payload is too short for it. """
+    for company, data in evt.manufacturers():
+        if len(data) < 1:
+            continue
+        decoder = DECODERS.get((company, bytearray(data[0:1])[0]))
+        if decoder is not None:
+            return decoder, decoder.decode(data)
+    return None, None
+
+
+def decode(evt):
+    """ Decode an LPCSB scan response. Returns a RawColor, LightType or
+    Telemetry record (or whatever else is registered), or None if this
+    isn't a known data payload. """
+    return lookup(evt)[1]
+
+
+def decode_payload(data, company=UVA_COMPANY_IDENTIFIER):
+    """ Same as decode() for manufacturer data without the company ID. """
+    decoder = DECODERS.get((company, bytearray(data[0:1])[0])) if len(data) else None
+    if decoder is None:
+        return None
+    return decoder.decode(data)
+
+
+def light_type_name(light_type):
+    return LIGHT_TYPE_NAMES.get(light_type, "Unknown")
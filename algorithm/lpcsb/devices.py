@@ -0,0 +1,87 @@
+""" Registry of the boards a scanner logs
+
+The boards used to be a MAC list in every script. They now live in an INI
+file with one section per board address:
+
+    [C0:98:E5:40:5D:4C]
+    name = LPCSB_Test
+    location = Lab, bench 2
+
+`name` is required and is what goes in the device column; any other keys
+end up in Device.info. lpcsb/devices.ini lists the lab's boards and is
+what load() reads by default.
+
+Boards are keyed by address as it comes off the air (LSB first), so the
+per-packet lookup needs no formatting.
+"""
+
+import os
+import re
+
+try:
+    from configparser import RawConfigParser, Error as ConfigError
+except ImportError:
+    from ConfigParser import RawConfigParser, Error as ConfigError
+
+from lpcsb.decode import mac_bytes, mac_str
+
+DEFAULT_FILE = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'devices.ini')
+
+_MAC = re.compile(r'^[0-9A-Fa-f]{2}(:?[0-9A-Fa-f]{2}){5}$')
+
+
+class Device(object):
+    __slots__ = ('address', 'mac', 'name', 'info')
+
+    def __init__(self, address, name, info=None):
+        self.address = address          # 6 bytes, air order
+        self.mac = mac_str(address)     # 'C098E5405D4C'
+        self.name = name
+        self.info = info or {}
+
+
+class DeviceRegistry(object):
+    def __init__(self, devices=(), path=None):
+        self.path = path
+        self._by_address = {}
+        for device in devices:
+            self.add(device)
+
+    def add(self, device):
+        self._by_address[device.address] = device
+
+    def get(self, address):
+        """ Device for a 6 byte air order address, or None. """
+        return self._by_address.get(address)
+
+    def __iter__(self):
+        return iter(sorted(self._by_address.values(), key=lambda d: d.name))
+
+    def __len__(self):
+        return len(self._by_address)
+
+
+def load(path=DEFAULT_FILE):
+    """ Read a registry file. Raises ValueError with the reason if it can't
+    be read or a section is not a usable board. """
+    parser = RawConfigParser()
+    try:
+        if not parser.read([path]):
+            raise ValueError("%s: cannot read file" % path)
+    except ConfigError as e:
+        raise ValueError("%s: %s" % (path, e))
+
+    registry = DeviceRegistry(path=path)
+    names = set()
+    for section in parser.sections():
+        if not _MAC.match(section):
+            raise ValueError("%s: [%s] is not a board address like C0:98:E5:40:5D:4C" % (path, section))
+        if not parser.has_option(section, 'name'):
+            raise ValueError("%s: [%s] has no name" % (path, section))
+        name = parser.get(section, 'name').strip()
+        if name in names:
+            raise ValueError("%s: name %s is used twice" % (path, name))
+        names.add(name)
+        info = dict((k, v) for k, v in parser.items(section) if k != 'name')
+        registry.add(Device(mac_bytes(section), name, info))
+    return registry
@@ -0,0 +1,370 @@
+""" BLED112 emulator on a pseudo terminal
+
+Plays the dongle end of a pty so the scanners can be load tested without a
+room full of boards. It answers the commands the scanners send during setup
+with the responses a BLED112 gives:
+
+    connection_disconnect   (3, 0)   connection, result
+    gap_set_mode            (6, 1)   result
+    gap_discover            (6, 2)   result, and scanning starts
+    gap_end_procedure       (6, 4)   result, and scanning stops
+    gap_set_scan_parameters (6, 7)   result
+    system_reset            (0, 0)   no response, a system_boot event
+
+and while scanning streams gap_scan_response events for `devices` simulated
+LPCSBs. Like the firmware, each board takes a sample every `sample_period`
+seconds and advertises every `adv_interval` seconds (with +-10 % jitter),
+so each sample goes out about sample_period / adv_interval times. A
+`raw_fraction` of the advertisements carry raw color (0x31), the rest the
+light type (0x32). Every board has a fixed mean RSSI with some noise on
+each packet. `loss` drops that fraction of advertisements, `corrupt` flips
+one byte in that fraction of the frames on the serial line.
+
+Once the scanner has set scan parameters, an advertisement is only heard
+if it falls inside the scan window: `(t - start of discovery) % interval
+< window`, so a narrower window costs samples the way it does on air. The
+boards keep their timeline when discovery is restarted.
+
+The first boards use the addresses in lpcsb/devices.ini, so the scanners
+log them; the rest get random C0:98:E5 addresses.
+
+With adv_interval=0 the emulator floods: it writes as fast as the reader
+drains the pty, which measures the reader's ceiling.
+
+    python -m lpcsb.emulator [--devices N] [--adv-interval S] ...
+
+prints the pty name to give the scanner with -p. POSIX only.
+
+    python -m lpcsb.emulator --record FILE --seconds S [--devices N] ...
+
+instead writes S seconds of the same traffic straight to a recording for
+the scanner's --replay (lpcsb/replay.py), as one dongle would have read
+it, without a pty or waiting.
+
+    python -m lpcsb.emulator --btsnoop FILE --seconds S [--devices N] ...
+
+writes the same advertisements as HCI LE advertising reports to a btsnoop
+file instead, as a Linux controller would have received them (see
+lpcsb/hci.py); with the same --seed and --start, both replay to the same
+CSV.
+"""
+
+from __future__ import print_function
+
+import errno
+import heapq
+import math
+import optparse
+import os
+import random
+import select
+import struct
+import time
+import tty
+
+from lpcsb import bgapi, hci
+from lpcsb.devices import load as load_devices
+from lpcsb.hci import BtsnoopWriter
+from lpcsb.replay import Recorder
+from lpcsb.decode import TCS34725_ID, UVA_COMPANY_IDENTIFIER, \
+    RAW_COLOR_SERVICE, LIGHT_TYPE_SERVICE
+
+# (class, command) -> response payload for a successful command
+RESPONSES = {
+    (0x03, 0x00): lambda payload: struct.pack('<BH', bytearray(payload)[0], 0),
+    (0x06, 0x01): lambda payload: struct.pack('<H', 0),
+    (0x06, 0x02): lambda payload: struct.pack('<H', 0),
+    (0x06, 0x04): lambda payload: struct.pack('<H', 0),
+    (0x06, 0x07): lambda payload: struct.pack('<H', 0),
+}
+
+# major, minor, patch, build, ll_version, protocol_version, hw
+SYSTEM_BOOT = bgapi.frame(bgapi.MSG_EVENT, 0x00, 0x00, struct.pack('<HHHHHBB', 1, 3, 2, 122, 6, 1, 1))
+
+_AD_HEADER = bytearray([0x02, 0x01, 0x06])
+_RAW = struct.Struct('>BB7H')
+_LIGHT = struct.Struct('>BBBH')
+_COMPANY = struct.pack('<H', UVA_COMPANY_IDENTIFIER)
+
+
+class Board(object):
+    def __init__(self, rng, sender):
+        self.sender = sender
+        self.rssi = rng.uniform(-95, -45)
+        self.start = rng.uniform(0, 5)
+        self.light_type = rng.choice((0x00, 0x11, 0x22, 0x33))
+        self.lux = rng.randint(50, 2000)
+        self.adverts = 0
+
+
+class Emulator(object):
+    def __init__(self, fd, devices=10, adv_interval=2.5, sample_period=5.0, raw_fraction=0.5,
+                 loss=0.0, corrupt=0.0, seed=1, hci=False):
+        """ `fd` is the master side of a pty (or any file descriptor).
+        With `hci` the advertisements are HCI events instead of BGAPI
+        frames. """
+        self.fd = fd
+        self.hci = hci
+        self.adv_interval = adv_interval
+        self.sample_period = sample_period
+        self.raw_fraction = raw_fraction
+        self.loss = loss
+        self.corrupt = corrupt
+        self.rng = random.Random(seed)
+
+        known = sorted(d.address for d in load_devices())
+        self.boards = []
+        for i in range(devices):
+            if i < len(known):
+                sender = bytearray(known[i])
+            else:
+                sender = bytearray([self.rng.getrandbits(8) for j in range(3)]) + bytearray([0xE5, 0x98, 0xC0])
+            self.boards.append(Board(self.rng, sender))
+
+        self.scanning = False
+        self.scan_parameters = None
+        self.commands = 0
+        self.unknown_commands = 0
+        self.sent = 0
+        self.dropped = 0
+        self.unheard = 0        # outside the scan window
+        self.corrupted = 0
+
+        self._rx = bytearray()
+        self._queue = []        # (due, board index)
+        self._next = 0          # next board when flooding
+        self._epoch = None
+        self._scan_start = None
+
+    # serial line, scanner -> dongle
+
+    def _receive(self, data):
+        self._rx += data
+        rx = self._rx
+        while len(rx) >= 4:
+            length = ((rx[0] & 0x07) << 8) | rx[1]
+            if len(rx) < 4 + length:
+                break
+            cls, cmd = rx[2], rx[3]
+            payload = bytes(rx[4:4 + length])
+            del rx[:4 + length]
+            self._command(cls, cmd, payload)
+
+    def _command(self, cls, cmd, payload):
+        self.commands += 1
+        if (cls, cmd) == (0x00, 0x00):
+            self.scanning = False
+            self._write(SYSTEM_BOOT)
+            return
+        response = RESPONSES.get((cls, cmd))
+        if response is None:
+            self.unknown_commands += 1
+            return
+        self._write(bgapi.frame(bgapi.MSG_RESPONSE, cls, cmd, response(payload)))
+        if (cls, cmd) == (0x06, 0x07):
+            self.scan_parameters = struct.unpack('<HHB', payload[:5])
+        elif (cls, cmd) == (0x06, 0x02):
+            self._start()
+        elif (cls, cmd) == (0x06, 0x04):
+            self.scanning = False
+
+    # dongle -> scanner
+
+    def _write(self, data):
+        view = memoryview(data)
+        while len(view):
+            try:
+                n = os.write(self.fd, view)
+            except OSError as e:
+                if e.errno in (errno.EAGAIN, errno.EINTR):
+                    select.select([], [self.fd], [], 0.1)
+                    continue
+                raise
+            view = view[n:]
+
+    def _start(self, now=None):
+        self.scanning = True
+        now = time.time() if now is None else now
+        self._scan_start = now
+        if self._epoch is None:
+            self._epoch = now
+            self._queue = [(self._epoch + b.start % (self.adv_interval or 1), i)
+                           for i, b in enumerate(self.boards)]
+        elif self.adv_interval:
+            # the boards went on advertising while nobody listened
+            self._queue = [(t + math.ceil((now - t) / self.adv_interval) * self.adv_interval if t < now else t, i)
+                           for t, i in self._queue]
+        heapq.heapify(self._queue)
+
+    def _heard(self, t):
+        """ Whether an advertisement at `t` falls in the scan window. """
+        if self.scan_parameters is None:
+            return True
+        interval, window, _ = self.scan_parameters
+        if window >= interval:
+            return True
+        return (t - self._scan_start) % (interval * 0.000625) < window * 0.000625
+
+    def _advertisement(self, board, now):
+        rng = self.rng
+        board.adverts += 1
+        if self.sample_period:
+            seq = int((now - self._epoch + board.start) / self.sample_period) + 1
+        else:
+            seq = board.adverts
+        seq &= 0xFFFF
+        if rng.random() < self.raw_fraction:
+            lux = max(0, int(board.lux * rng.uniform(0.9, 1.1)))
+            value = _RAW.pack(RAW_COLOR_SERVICE, TCS34725_ID, lux * 4, lux * 2, lux, lux // 2, 3000, lux, seq)
+        else:
+            value = _LIGHT.pack(LIGHT_TYPE_SERVICE, TCS34725_ID, board.light_type, seq)
+        data = _AD_HEADER + bytearray([3 + len(value), bgapi.AD_MANUFACTURER]) + bytearray(_COMPANY) + bytearray(value)
+        rssi = max(-127, min(-20, int(round(board.rssi + rng.gauss(0, 3)))))
+        if self.hci:
+            return hci.le_advertising_report(0, 0, board.sender, data, rssi)
+        return bgapi.gap_scan_response(rssi, 0, board.sender, 0, 255, data)
+
+    def _due(self, now):
+        """ Bytes of every advertisement due by `now`. """
+        return b''.join(self._frames(now))
+
+    def _frames(self, now):
+        """ Frames for every advertisement due by `now`; when flooding, the
+        next 256 boards in turn. """
+        rng = self.rng
+        if self.adv_interval:
+            queue = self._queue
+            due = []
+            while queue and queue[0][0] <= now:
+                t, i = queue[0]
+                heapq.heapreplace(queue, (t + self.adv_interval * rng.uniform(0.9, 1.1), i))
+                if self._heard(t):
+                    due.append(i)
+                else:
+                    self.unheard += 1
+        else:
+            n = len(self.boards)
+            due = [(self._next + k) % n for k in range(256)]
+            self._next = (self._next + 256) % n
+
+        frames = []
+        for i in due:
+            if self.loss and rng.random() < self.loss:
+                self.dropped += 1
+                continue
+            frame = self._advertisement(self.boards[i], now)
+            if self.corrupt and rng.random() < self.corrupt:
+                frame = bytearray(frame)
+                frame[rng.randrange(len(frame))] ^= 1 << rng.randrange(8)
+                frame = bytes(frame)
+                self.corrupted += 1
+            frames.append(frame)
+        self.sent += len(frames)
+        return frames
+
+    def run(self, seconds=None):
+        """ Serve until `seconds` have passed (forever with None). """
+        stop = None if seconds is None else time.time() + seconds
+        while stop is None or time.time() < stop:
+            now = time.time()
+            if self.scanning and not self.adv_interval:
+                timeout = 0
+            elif self.scanning and self._queue:
+                timeout = max(0, self._queue[0][0] - now)
+            else:
+                timeout = 0.1
+            if stop is not None:
+                timeout = min(timeout, max(0, stop - now))
+            readable, _, _ = select.select([self.fd], [], [], timeout)
+            if readable:
+                try:
+                    data = os.read(self.fd, 4096)
+                except OSError as e:
+                    if e.errno == errno.EIO:
+                        # the scanner closed its end; wait for it to come back
+                        time.sleep(0.1)
+                        continue
+                    raise
+                self._receive(bytearray(data))
+            if self.scanning:
+                burst = self._due(time.time())
+                if burst:
+                    self._write(burst)
+
+
+    def record(self, recorder, seconds, step=0.01, start=None):
+        """ Write `seconds` of scanning from `start` (default now) to an
+        lpcsb.replay.Recorder, in reads every `step` seconds of simulated
+        time; with `hci`, to an lpcsb.hci.BtsnoopWriter, one event per
+        packet. """
+        self._start(start)
+        now = start = self._epoch
+        while now < start + seconds:
+            now += step
+            if self.hci:
+                for frame in self._frames(now):
+                    recorder.write(0, frame, round(now, 6))
+                continue
+            burst = self._due(now)
+            for i in range(0, len(burst), 4096):
+                recorder.write(0, burst[i:i + 4096], round(now, 6))
+
+
+def open_pty():
+    """ Returns (master fd, slave name). The slave is left open so the pty
+    survives the scanner closing and reopening it; it is put in raw mode so
+    the line discipline passes BGAPI bytes through unchanged. """
+    master, slave = os.openpty()
+    tty.setraw(master)
+    tty.setraw(slave)
+    return master, os.ttyname(slave)
+
+
+def main():
+    p = optparse.OptionParser(description="BLED112 emulator for load testing the LPCSB scanners")
+    p.add_option('--devices', '-n', type='int', default=10, help="Simulated boards (default 10)")
+    p.add_option('--adv-interval', type='float', default=2.5, help="Seconds between advertisements of one board, 0 to flood (default 2.5)")
+    p.add_option('--sample-period', type='float', default=5.0, help="Seconds between samples, i.e. seq increments; 0 for a new seq on every advertisement (default 5)")
+    p.add_option('--raw-fraction', type='float', default=0.5, help="Share of 0x31 raw color advertisements, rest 0x32 (default 0.5)")
+    p.add_option('--loss', type='float', default=0.0, help="Share of advertisements that are never sent (default 0)")
+    p.add_option('--corrupt', type='float', default=0.0, help="Share of frames with a flipped bit (default 0)")
+    p.add_option('--seconds', type='float', help="Stop after this long (default: run until Ctrl-C)")
+    p.add_option('--seed', type='int', default=1)
+    p.add_option('--record', help="Write --seconds of traffic to this recording (see lpcsb/replay.py) instead of serving a pty")
+    p.add_option('--btsnoop', help="Write --seconds of traffic as HCI events to this btsnoop file (see lpcsb/hci.py) instead of serving a pty")
+    p.add_option('--start', type='float', help="Time the --record or --btsnoop traffic starts at, seconds since the epoch (default now)")
+    options, _ = p.parse_args()
+
+    path = options.record or options.btsnoop
+    if path:
+        if options.record and options.btsnoop:
+            p.error("--record and --btsnoop don't go together")
+        if not options.seconds:
+            p.error("--%s needs --seconds" % ('record' if options.record else 'btsnoop'))
+        emulator = Emulator(None, options.devices, options.adv_interval, options.sample_period,
+                            options.raw_fraction, options.loss, options.corrupt, options.seed,
+                            hci=bool(options.btsnoop))
+        recorder = BtsnoopWriter(path) if options.btsnoop else Recorder(path, ["emulator"])
+        emulator.record(recorder, options.seconds, start=options.start)
+        recorder.close()
+        print("%d scan responses, %d reads, %.1f kB to %s" %
+              (emulator.sent, recorder.chunks, recorder.bytes / 1e3, path))
+        return
+
+    master, name = open_pty()
+    emulator = Emulator(master, options.devices, options.adv_interval, options.sample_period,
+                        options.raw_fraction, options.loss, options.corrupt, options.seed)
+    print("BLED112 emulator on %s with %d boards" % (name, options.devices))
+    start = time.time()
+    try:
+        emulator.run(options.seconds)
+    except KeyboardInterrupt:
+        pass
+    elapsed = time.time() - start
+    print("%d commands (%d unknown), %d scan responses (%.0f/sec), %d dropped, %d outside the scan window, %d corrupted" %
+          (emulator.commands, emulator.unknown_commands, emulator.sent, emulator.sent / elapsed,
+           emulator.dropped, emulator.unheard, emulator.corrupted))
+
+
+if __name__ == '__main__':
+    main()
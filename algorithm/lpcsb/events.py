@@ -0,0 +1,300 @@
+""" Lights on and off, and light source changes, as events
+
+Occupancy and energy questions are about transitions, not 5 s samples.
+EventDetector follows every board's lux and light type and reports:
+
+    on, off         the lights were switched on or off
+    source          the light type changed while the lights were on
+    daylight_on     ... to Sunlight
+    daylight_off    ... from Sunlight
+
+The first type confirmed after the lights come on is reported the same
+way, with no type before it: a source event for a lamp, and daylight_on
+when daylight arrives in a dark room.
+
+Lux goes through hysteresis: a sample is bright at `on_lux` or more, dark
+at `off_lux` or less, and anything between leaves the state as it is. A
+change must then hold for `debounce` samples in a row before it counts, so
+a flicker or a shadow near a threshold makes no events. The light type,
+from the board or the scanner's classifiers, is debounced the same way
+with `source_debounce`. A board whose lux rows come classified is
+followed on those labels only, not on the type it advertises itself, so
+two opinions that disagree don't make a change every other sample.
+'Unknown' neither confirms nor breaks a change,
+and the type is not followed while the lights are off, when there is
+nothing to classify.
+
+An event is timed at the first sample of the change and sent once the
+change is confirmed. It carries a summary of the state before (since
+when, how many samples, mean lux) and of the confirming samples after:
+
+    {"time": "2020-03-02T08:00:05.000000Z", "time_ns": ..., "device": "LPCSB_1", "event": "on",
+     "before": {"lit": false, "light_type": null, "since": "...", "seconds": 50400.0, "samples": 10080, "lux": 3.1},
+     "after": {"lit": true, "light_type": null, "samples": 3, "lux": 412.0}}
+
+Each sample costs a few comparisons and additions on its board's state,
+whatever the history. The first state of a board is learned, not
+reported.
+
+EventSink writes the events as JSON lines, one sink among the scanner's
+(--events FILE), flushed every `flush_secs`. Archives made earlier replay
+through the same detector (reading them needs pyarrow, as for
+lpcsb/archive.py; the sink doesn't):
+
+    python -m lpcsb.events -o events.jsonl archive.parquet "20200301 LPCSB Scanner.csv" ...
+"""
+
+from __future__ import print_function
+
+import datetime
+import json
+import optparse
+import time
+
+from lpcsb import output
+
+ON, OFF, SOURCE, DAYLIGHT_ON, DAYLIGHT_OFF = 'on', 'off', 'source', 'daylight_on', 'daylight_off'
+DAYLIGHT = "Sunlight"
+UNKNOWN = "Unknown"
+
+if hasattr(time, 'time_ns'):
+    _now_ns = time.time_ns
+else:
+    def _now_ns():
+        return int(time.time() * 1e9)
+
+
+def iso(time_ns):
+    return datetime.datetime.utcfromtimestamp(time_ns // 1000000000).strftime("%Y-%m-%dT%H:%M:%S") + \
+        ".%06dZ" % (time_ns % 1000000000 // 1000)
+
+
+class _Segment(object):
+    """ Samples since a state began: when, how many, lux total. """
+    __slots__ = ('start', 'samples', 'lux')
+
+    def __init__(self, start):
+        self.start = start
+        self.samples = 0
+        self.lux = 0
+
+    def summary(self, now=None):
+        out = {'since': iso(self.start), 'samples': self.samples,
+               'lux': round(float(self.lux) / self.samples, 1) if self.samples else None}
+        if now is not None:
+            out['seconds'] = round((now - self.start) / 1e9, 3)
+        return out
+
+
+class _Board(object):
+    __slots__ = ('lit', 'segment', 'candidate', 'light', 'light_candidate', 'light_count', 'light_start', 'classified')
+
+    def __init__(self):
+        self.lit = None             # confirmed state; None until the first is learned
+        self.segment = None         # samples of the confirmed state
+        self.candidate = None       # samples of a change not confirmed yet
+        self.light = None           # confirmed light type while lit
+        self.light_candidate = None
+        self.light_count = 0
+        self.light_start = None
+        self.classified = False     # its lux rows carry a light type
+
+
+class EventDetector(object):
+    def __init__(self, on_event, on_lux=50, off_lux=20, debounce=3, source_debounce=3):
+        """ `on_event(event)` gets every event as a dict. """
+        if off_lux >= on_lux:
+            raise ValueError("off_lux must be below on_lux")
+        self.on_event = on_event
+        self.on_lux = on_lux
+        self.off_lux = off_lux
+        self.debounce = debounce
+        self.source_debounce = source_debounce
+        self.samples = 0
+        self.events = {}            # kind -> count
+        self._boards = {}
+
+    def add(self, device, time_ns, lux=None, light_type=None):
+        """ One sample; either may be None. """
+        self.samples += 1
+        board = self._boards.get(device)
+        if board is None:
+            board = self._boards[device] = _Board()
+        if lux is not None:
+            self._lux(device, board, time_ns, lux)
+            if light_type is not None:
+                board.classified = True
+        elif board.classified:
+            light_type = None
+        if light_type is not None and board.lit:
+            self._light(device, board, time_ns, light_type)
+
+    def _lux(self, device, board, t, lux):
+        if lux >= self.on_lux:
+            bright = True
+        elif lux <= self.off_lux:
+            bright = False
+        else:
+            bright = board.lit
+        if bright is None or bright == board.lit:
+            # holds the state: any change in progress was a blip
+            board.candidate = None
+            if board.segment is not None:
+                board.segment.samples += 1
+                board.segment.lux += lux
+            return
+
+        candidate = board.candidate
+        if candidate is None:
+            candidate = board.candidate = _Segment(t)
+        candidate.samples += 1
+        candidate.lux += lux
+        if candidate.samples < self.debounce:
+            return
+
+        before = board.segment
+        was = board.lit
+        board.lit = bright
+        board.segment = candidate
+        board.candidate = None
+        if was is None:
+            return
+        light = board.light
+        board.light = None
+        board.light_candidate = None
+        self._emit(ON if bright else OFF, device, candidate.start,
+                   dict(before.summary(candidate.start), lit=was, light_type=light),
+                   dict(samples=candidate.samples, lux=round(float(candidate.lux) / candidate.samples, 1),
+                        lit=bright, light_type=None))
+
+    def _light(self, device, board, t, light_type):
+        if light_type == UNKNOWN:
+            return
+        if light_type == board.light:
+            board.light_candidate = None
+            return
+        if light_type != board.light_candidate:
+            board.light_candidate = light_type
+            board.light_count = 0
+            board.light_start = t
+        board.light_count += 1
+        if board.light_count < self.source_debounce:
+            return
+
+        was = board.light
+        board.light = light_type
+        board.light_candidate = None
+        if light_type == DAYLIGHT:
+            kind = DAYLIGHT_ON
+        elif was == DAYLIGHT:
+            kind = DAYLIGHT_OFF
+        else:
+            kind = SOURCE
+        segment = board.segment
+        self._emit(kind, device, board.light_start,
+                   dict(segment.summary(board.light_start), lit=True, light_type=was),
+                   dict(samples=board.light_count, lux=None, lit=True, light_type=light_type))
+
+    def _emit(self, kind, device, t, before, after):
+        self.events[kind] = self.events.get(kind, 0) + 1
+        self.on_event({'time': iso(t), 'time_ns': t, 'device': device, 'event': kind,
+                       'before': before, 'after': after})
+
+
+class EventSink(object):
+    """ Runs an EventDetector on the scanner's records and appends its
+    events to `path` as JSON lines. """
+
+    def __init__(self, path, flush_secs=5.0, **detector):
+        self.path = path
+        self.flush_secs = flush_secs
+        self.detector = EventDetector(self._event, **detector)
+        self.written = 0
+        self._pending = []
+        self._file = open(path, 'a')
+        self._last_flush = time.time()
+        output.register(self)
+
+    def _event(self, event):
+        self._pending.append(json.dumps(event, sort_keys=True, separators=(',', ':')))
+
+    def add(self, device, mac, seq, rssi, raw=None, light_type=None, time_ns=None):
+        """ One record, as for lpcsb.sqlite_sink.SqliteSink.add(). """
+        if time_ns is None:
+            time_ns = _now_ns()
+        self.detector.add(device, time_ns, None if raw is None else raw.lux, light_type)
+
+    def tick(self):
+        if self._pending and time.time() - self._last_flush >= self.flush_secs:
+            self.flush()
+
+    def flush(self):
+        self._last_flush = time.time()
+        if not self._pending:
+            return
+        self._file.write('\n'.join(self._pending) + '\n')
+        self._file.flush()
+        self.written += len(self._pending)
+        self._pending = []
+
+    def close(self):
+        if self._file is None:
+            return
+        self.flush()
+        self._file.close()
+        self._file = None
+        output.unregister(self)
+
+
+def replay_parquet(path, detector, batch_rows=1 << 16):
+    """ Feed an lpcsb.archive Parquet file through `detector`, in file order. """
+    import pyarrow.parquet as pq
+    rows = 0
+    for batch in pq.ParquetFile(path).iter_batches(batch_size=batch_rows, columns=['device', 'time', 'lux', 'light_type']):
+        add = detector.add
+        for device, t, lux, light_type in zip(batch.column('device').to_pylist(), batch.column('time').cast('int64').to_pylist(),
+                                              batch.column('lux').to_pylist(), batch.column('light_type').to_pylist()):
+            add(device, t, lux, light_type)
+        rows += batch.num_rows
+    return rows
+
+
+def main():
+    p = optparse.OptionParser(usage="%prog [options] ARCHIVE.parquet|SCANNER.csv ...",
+                              description="Lights on/off and light source events from LPCSB archives")
+    p.add_option('--output', '-o', help="JSON lines file to append the events to")
+    p.add_option('--on-lux', type='float', default=50, help="Lux at which lights count as on (default 50)")
+    p.add_option('--off-lux', type='float', default=20, help="Lux at which lights count as off (default 20)")
+    p.add_option('--debounce', type='int', default=3, help="Samples a lux change must hold (default 3)")
+    p.add_option('--source-debounce', type='int', default=3, help="Samples a light type change must hold (default 3)")
+    p.add_option('--utc', action='store_true', default=False, help="CSV timestamps are UTC, not local time")
+    options, args = p.parse_args()
+    if not options.output or not args:
+        p.error("need --output and at least one archive or CSV")
+    try:
+        from lpcsb.archive import convert_csv
+    except ImportError:
+        p.error("reading archives needs pyarrow, which could not be imported")
+
+    try:
+        sink = EventSink(options.output, on_lux=options.on_lux, off_lux=options.off_lux,
+                         debounce=options.debounce, source_debounce=options.source_debounce)
+    except ValueError as e:
+        p.error(str(e))
+    start = time.time()
+    for path in args:
+        if path.endswith('.parquet'):
+            rows = replay_parquet(path, sink.detector)
+        else:
+            rows = convert_csv(path, sink, options.utc)
+        print("%s: %d rows" % (path, rows))
+    sink.close()
+    seconds = time.time() - start
+    detector = sink.detector
+    print("%d events (%s) from %d samples in %.1f s (%.0f samples/s) to %s" %
+          (sink.written, ', '.join("%d %s" % (n, kind) for kind, n in sorted(detector.events.items())) or "none",
+           detector.samples, seconds, detector.samples / max(seconds, 1e-9), options.output))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,210 @@
+""" Batch decoding of LPCSB records from BGAPI traffic
+
+The scanner handles one ScanResponse at a time because it filters, prints
+and de-duplicates each of them, but going through a recording or a day's
+capture only needs the records, and there the per-byte and per-field work
+in Python is most of the cost. lpcsb._fastdecode, a C extension built
+with
+
+    python setup.py build_ext --inplace
+
+does the framing, AD structure walk, company and service match and
+unpacking of lpcsb.bgapi.BgapiParser and lpcsb.decode.lookup(), and the
+sensor ID check the scanner applies after them, in one pass, making the
+same decisions. Payloads that fail it count as malformed, as in the
+scanner. Every other LPCSB payload of a feed() comes back in one packed
+buffer:
+
+    parser = Parser()
+    batch = parser.feed(data)           # bytes, RECORD.size per record
+    table = to_numpy(batch)             # structured array of record_dtype()
+    for sender, rssi, record in records(batch): ...   # RawColor, LightType, Telemetry
+
+`values` holds the record's fields after sensor_id and before seq, in
+their order in lpcsb.decode (telemetry has no seq, so it is 0 there).
+The payload layouts come from the firmware's lpcsb_packet.h, which
+_fastdecode.c includes, so the two sides are built from one definition.
+Only the built-in UVA services are decoded; payloads added with
+lpcsb.decode.register() need the Python parser.
+
+Without the extension Parser is PyParser, the same thing on top of the
+Python parser, so callers don't need to care beyond speed (NATIVE tells).
+Recordings decode from the command line, into a .npz of the records and
+the time each one's chunk was read:
+
+    python -m lpcsb.fastdecode [-o site.npz] site.lpcsbrec ...
+
+See bench/fastdecode_bench.py for the speed of both.
+"""
+
+from __future__ import print_function
+
+import optparse
+import struct
+import time
+
+from lpcsb.bgapi import BgapiParser
+from lpcsb.decode import (RawColor, LightType, Telemetry, UVA_COMPANY_IDENTIFIER,
+                          RAW_COLOR_SERVICE, LIGHT_TYPE_SERVICE, TELEMETRY_SERVICE, DECODERS)
+
+# lpcsb_record_t in _fastdecode.c
+RECORD = struct.Struct('=BbBBBB6sHH8q')
+RECORD_FIELDS = [('service', 'u1'), ('rssi', 'i1'), ('packet_type', 'u1'), ('address_type', 'u1'),
+                 ('bond', 'u1'), ('sensor_id', 'u1'), ('sender', 'u1', (6,)), ('seq', '=u2'),
+                 ('reserved', '=u2'), ('values', '=i8', (8,))]
+
+# service -> (record type, number of values)
+SERVICES = {
+    RAW_COLOR_SERVICE: (RawColor, 6),
+    LIGHT_TYPE_SERVICE: (LightType, 1),
+    TELEMETRY_SERVICE: (Telemetry, 8),
+}
+
+try:
+    from lpcsb import _fastdecode
+    NATIVE = True
+except ImportError:
+    _fastdecode = None
+    NATIVE = False
+
+
+class PyParser(object):
+    """ Parser on top of lpcsb.bgapi.BgapiParser, for when the extension
+    isn't built, and to check it against. """
+
+    def __init__(self):
+        self._parser = BgapiParser(on_scan_response=self._scan_response)
+        self._out = []
+        self.records = 0
+        self.malformed = 0
+
+    def __getattr__(self, name):
+        # frames, scan_responses, dropped_bytes, resyncs
+        return getattr(self._parser, name)
+
+    def _scan_response(self, evt):
+        # the first manufacturer data of a known service, as lookup() does
+        for company, data in evt.manufacturers():
+            if company != UVA_COMPANY_IDENTIFIER or len(data) < 1:
+                continue
+            service = bytearray(data[0:1])[0]
+            if service not in SERVICES:
+                continue
+            decoder = DECODERS[(company, service)]
+            record = decoder.decode(data)
+            if record is None or (decoder.check is not None and not decoder.check(record)):
+                self.malformed += 1
+                return
+            values = list(record[1:1 + SERVICES[service][1]])
+            self._out.append(RECORD.pack(service, evt.rssi, evt.packet_type, evt.address_type, evt.bond,
+                                         record.sensor_id, evt.sender.tobytes(),
+                                         0 if service == TELEMETRY_SERVICE else record.seq, 0,
+                                         *(values + [0] * (8 - len(values)))))
+            self.records += 1
+            return
+
+    def feed(self, data):
+        self._parser.feed(data)
+        out = b''.join(self._out)
+        self._out = []
+        return out
+
+
+Parser = _fastdecode.Parser if NATIVE else PyParser
+
+
+def record_dtype():
+    import numpy
+    return numpy.dtype(RECORD_FIELDS)
+
+
+def to_numpy(batch):
+    """ Structured array over a batch from feed(), without copying. """
+    import numpy
+    return numpy.frombuffer(batch, dtype=record_dtype())
+
+
+def records(batch):
+    """ Yield (sender in air order, rssi, record) for a batch from feed(). """
+    size = RECORD.size
+    unpack_from = RECORD.unpack_from
+    for offset in range(0, len(batch), size):
+        fields = unpack_from(batch, offset)
+        service = fields[0]
+        record_type, n = SERVICES[service]
+        values = fields[9:9 + n]
+        if service == TELEMETRY_SERVICE:
+            yield fields[6], fields[1], record_type(fields[5], *values)
+        else:
+            yield fields[6], fields[1], record_type(fields[5], *(values + (fields[7],)))
+
+
+def decode_recording(path, parser=None):
+    """ (batches, times, parsers) for a BGAPI recording from the scanner's
+    --record: the records of every chunk that had some, (time read, number
+    of records) for each of those, and the parser of every dongle. """
+    from lpcsb.replay import Recording
+    recording = Recording(path)
+    try:
+        if recording._btsnoop is not None:
+            raise ValueError("%s: a btsnoop file carries HCI, not BGAPI" % path)
+        parsers = {}
+        batches = []
+        times = []
+        for when, receiver, data in recording.chunks():
+            # every dongle is a stream of its own
+            p = parsers.get(receiver)
+            if p is None:
+                p = parsers[receiver] = parser() if parser else Parser()
+            batch = p.feed(data)
+            if batch:
+                batches.append(batch)
+                times.append((when, len(batch) // RECORD.size))
+        return batches, times, list(parsers.values())
+    finally:
+        recording.close()
+
+
+def main():
+    p = optparse.OptionParser(usage="%prog [options] RECORDING ...",
+                              description="Decode LPCSB records from scanner recordings in bulk")
+    p.add_option('--output', '-o', help="Write the records and their times to this .npz (needs numpy)")
+    p.add_option('--python', action='store_true', default=False, help="Use the Python parser even if the extension is built")
+    options, args = p.parse_args()
+    if not args:
+        p.error("no recordings")
+    if options.output:
+        try:
+            import numpy
+        except ImportError:
+            p.error("--output needs numpy, which could not be imported")
+
+    parser = PyParser if options.python else Parser
+    print("Decoder:\t%s" % ("native (lpcsb._fastdecode)" if parser is not PyParser else "Python"))
+    all_batches = []
+    all_times = []
+    for path in args:
+        start = time.time()
+        try:
+            batches, times, parsers = decode_recording(path, parser)
+        except (IOError, ValueError) as e:
+            raise SystemExit(str(e))
+        seconds = time.time() - start
+        count = sum(n for _, n in times)
+        print("%s: %d records from %d scan responses (%d malformed), %d frames, %d bytes dropped, "
+              "%.2f s, %.0f records/s" % (path, count, sum(q.scan_responses for q in parsers),
+                                          sum(q.malformed for q in parsers), sum(q.frames for q in parsers),
+                                          sum(q.dropped_bytes for q in parsers), seconds, count / max(seconds, 1e-9)))
+        all_batches += batches
+        all_times += times
+
+    if options.output:
+        table = to_numpy(b''.join(all_batches))
+        when = numpy.repeat(numpy.array([t for t, _ in all_times], dtype='f8'),
+                            numpy.array([n for _, n in all_times], dtype='i8'))
+        numpy.savez(options.output, records=table, time=when)
+        print("%d records to %s" % (len(table), options.output))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,447 @@
+""" Scanning through a Linux Bluetooth controller instead of a BLED112
+
+A gateway with a built in or USB Bluetooth controller can scan without the
+BLED112: HciSocket opens a raw HCI socket on the controller (hci0, hci1,
+... as hciconfig lists them), sets the LE scan parameters, starts scanning
+and then only lets LE advertising reports through the socket's filter.
+HciReader drains every report waiting on the socket in one go, and
+HciParser turns them into the same ScanResponse events BgapiParser makes,
+so everything after the capture is unchanged:
+
+    python -m lpcsb.scanner -p hci0 [options]
+
+HCI event layout (one advertising report per event from most controllers,
+but up to 25 are allowed):
+
+    byte 0    0x04, an HCI event packet
+    byte 1    event code, 0x3E for LE Meta
+    byte 2    parameter length
+    byte 3    LE subevent, 0x02 for an advertising report
+    byte 4    number of reports, then for each
+              event type, address type, address[6], data length, data, int8 rssi
+
+The event type values match the BGAPI packet types (0 connectable, 2 and 3
+not, 4 scan response). With `companies` the parser only builds events for
+advertisements with manufacturer data from those companies and counts the
+rest as `filtered`; the scanner passes the companies of its decoders.
+
+Needs Linux, a controller that is up (hciconfig hci0 up) and CAP_NET_RAW
+(root, or setcap on the interpreter). bluetoothd may be running but should
+not be scanning itself.
+
+For testing without a radio, the scanner's --replay also reads btsnoop
+files (btmon -w, or Android's HCI snoop log) and plays their advertising
+reports through HciParser, and the emulator can write btsnoop files of its
+simulated boards (python -m lpcsb.emulator --btsnoop FILE --seconds S).
+"""
+
+import errno
+import re
+import select
+import socket
+import struct
+import time
+
+from lpcsb.bgapi import ScanResponse, AD_MANUFACTURER
+
+# socket constants, for Pythons built without Bluetooth headers
+AF_BLUETOOTH = getattr(socket, 'AF_BLUETOOTH', 31)
+BTPROTO_HCI = getattr(socket, 'BTPROTO_HCI', 1)
+SOL_HCI = getattr(socket, 'SOL_HCI', 0)
+HCI_FILTER = getattr(socket, 'HCI_FILTER', 2)
+
+HCI_COMMAND_PKT = 0x01
+HCI_EVENT_PKT = 0x04
+
+EVT_CMD_COMPLETE = 0x0E
+EVT_CMD_STATUS = 0x0F
+EVT_LE_META = 0x3E
+EVT_LE_ADVERTISING_REPORT = 0x02
+
+# OGF 0x08, LE controller commands
+LE_SET_SCAN_PARAMETERS = 0x200B
+LE_SET_SCAN_ENABLE = 0x200C
+
+STATUS_COMMAND_DISALLOWED = 0x0C
+
+MAX_REPORTS = 25
+MAX_AD_DATA = 31
+ADDRESS_TYPES = 4
+
+_REPORT_FIXED = struct.Struct('<BB6sB')
+_FILTER = struct.Struct('<IIIH2x')
+
+
+def is_hci(name):
+    """ True for a controller name like 'hci0' rather than a serial port. """
+    return re.match(r'hci\d+$', name) is not None
+
+
+def command(opcode, params=b''):
+    """ An HCI command packet. """
+    return struct.pack('<BHB', HCI_COMMAND_PKT, opcode, len(params)) + params
+
+
+def le_advertising_report(event_type, address_type, address, data, rssi):
+    """ An LE advertising report event with one report, as the socket
+    delivers it. `address` is in air order (least significant byte first),
+    like a BGAPI sender. """
+    data = bytes(bytearray(data))
+    params = struct.pack('<BB', EVT_LE_ADVERTISING_REPORT, 1) + \
+        _REPORT_FIXED.pack(event_type, address_type, bytes(bytearray(address)), len(data)) + \
+        data + struct.pack('<b', rssi)
+    return struct.pack('<BBB', HCI_EVENT_PKT, EVT_LE_META, len(params)) + params
+
+
+class HciError(IOError):
+    pass
+
+
+class HciSocket(object):
+    """ A raw HCI socket on controller `dev_id`, scanning with BGAPI style
+    parameters: interval and window in 0.625 ms units, active 0 or 1. """
+
+    def __init__(self, dev_id, interval, window, active, timeout=2.0):
+        self.name = 'hci%d' % dev_id
+        self.timeout = timeout
+        self.sock = socket.socket(AF_BLUETOOTH, socket.SOCK_RAW, BTPROTO_HCI)
+        try:
+            self.sock.bind((dev_id,))
+            self._filter(command_events=True)
+            # stop whatever scan is running; "disallowed" means there was none
+            self._command(LE_SET_SCAN_ENABLE, b'\x00\x00', allowed=(STATUS_COMMAND_DISALLOWED,))
+            self._command(LE_SET_SCAN_PARAMETERS, struct.pack('<BHHBB', active, interval, window, 0, 0))
+            # every copy is wanted, the scanner drops repeats itself
+            self._command(LE_SET_SCAN_ENABLE, b'\x01\x00')
+            self._filter(command_events=False)
+        except Exception:
+            self.sock.close()
+            raise
+
+    def _filter(self, command_events):
+        """ Let LE Meta events through, and command completion while setting up. """
+        events = [0, 1 << (EVT_LE_META - 32)]
+        if command_events:
+            events[0] |= (1 << EVT_CMD_COMPLETE) | (1 << EVT_CMD_STATUS)
+        self.sock.setsockopt(SOL_HCI, HCI_FILTER, _FILTER.pack(1 << HCI_EVENT_PKT, events[0], events[1], 0))
+
+    def _command(self, opcode, params, allowed=()):
+        """ Send a command and wait for its completion; HciError on failure. """
+        self.sock.sendall(command(opcode, params))
+        deadline = time.time() + self.timeout
+        while True:
+            left = deadline - time.time()
+            if left <= 0 or not select.select([self.sock], [], [], left)[0]:
+                raise HciError("%s: no answer to command 0x%04X" % (self.name, opcode))
+            packet = bytearray(self.sock.recv(260))
+            if len(packet) < 7 or packet[0] != HCI_EVENT_PKT:
+                continue
+            if packet[1] == EVT_CMD_COMPLETE and packet[4] | (packet[5] << 8) == opcode:
+                status = packet[6]
+            elif packet[1] == EVT_CMD_STATUS and packet[5] | (packet[6] << 8) == opcode:
+                status = packet[3]
+            else:
+                continue
+            if status and status not in allowed:
+                raise HciError("%s: command 0x%04X failed with status 0x%02X" % (self.name, opcode, status))
+            return status
+
+    def rescan(self, interval, window, active):
+        """ Restart the scan with new parameters while HciReader owns the
+        socket. The filter no longer lets command completions through, so
+        the commands are sent without waiting; the kernel still queues
+        each one until the controller takes it. """
+        for opcode, params in ((LE_SET_SCAN_ENABLE, b'\x00\x00'),
+                               (LE_SET_SCAN_PARAMETERS, struct.pack('<BHHBB', active, interval, window, 0, 0)),
+                               (LE_SET_SCAN_ENABLE, b'\x01\x00')):
+            self.sock.sendall(command(opcode, params))
+
+    def fileno(self):
+        return self.sock.fileno()
+
+    def close(self):
+        """ Stop scanning and close the socket. """
+        try:
+            self.sock.sendall(command(LE_SET_SCAN_ENABLE, b'\x00\x00'))
+        except socket.error:
+            pass
+        self.sock.close()
+
+
+class HciReader(object):
+    """ Waits for the socket and hands everything queued on it, up to
+    `max_events` events, to `handler(data)` in one call; the events are
+    self delimiting, so the handler sees one byte stream as from a serial
+    port. Same interface as serial_reader.BulkReader. """
+
+    def __init__(self, sock, handler, timeout=0.5, max_events=256):
+        self.sock = sock
+        self.handler = handler
+        self.timeout = timeout
+        self.max_events = max_events
+
+        self.reads = 0
+        self.events = 0
+        self.bytes = 0
+
+    def poll(self):
+        try:
+            ready, _, _ = select.select([self.sock], [], [], self.timeout)
+        except (select.error, OSError) as e:
+            if e.args[0] == errno.EINTR:
+                return 0
+            raise
+        if not ready:
+            return 0
+        recv = self.sock.sock.recv
+        events = []
+        while len(events) < self.max_events:
+            try:
+                events.append(recv(260, socket.MSG_DONTWAIT))
+            except socket.error as e:
+                if e.args[0] in (errno.EAGAIN, errno.EWOULDBLOCK, errno.EINTR):
+                    break
+                raise
+        if not events:
+            return 0
+        data = b''.join(events)
+        self.reads += 1
+        self.events += len(events)
+        self.bytes += len(data)
+        self.handler(data)
+        return len(data)
+
+    def run(self):
+        """ Read until interrupted. """
+        while True:
+            self.poll()
+
+
+class HciParser(object):
+    """ Streaming parser for HCI event packets, with the counters and
+    feed() of bgapi.BgapiParser. Advertising reports become ScanResponse
+    events for `on_scan_response`; other events are counted and skipped.
+    A byte that can't start an event is dropped, as BgapiParser does. """
+
+    def __init__(self, on_scan_response=None, companies=None, size=1 << 16):
+        self.on_scan_response = on_scan_response
+        self.companies = None if companies is None else \
+            frozenset(struct.pack('<H', c) for c in companies)
+
+        self.buf = bytearray(size)
+        self.view = memoryview(self.buf)
+        self.start = 0
+        self.end = 0
+
+        self.frames = 0
+        self.scan_responses = 0
+        self.filtered = 0
+        self.dropped_bytes = 0
+        self.resyncs = 0
+        self._in_sync = True
+
+    def feed(self, data):
+        """ Add bytes from the socket and handle every complete event. """
+        step = len(self.buf) // 2
+        for i in range(0, len(data), step):
+            chunk = data[i:i + step]
+            n = len(chunk)
+            if self.end + n > len(self.buf):
+                self._compact()
+            self.buf[self.end:self.end + n] = chunk
+            self.end += n
+            self._parse()
+
+    def _compact(self):
+        # Same-size slice assignment, so the exported memoryview stays valid
+        n = self.end - self.start
+        self.buf[0:n] = self.buf[self.start:self.end]
+        self.start = 0
+        self.end = n
+
+    def _skip(self):
+        self.dropped_bytes += 1
+        if self._in_sync:
+            self._in_sync = False
+            self.resyncs += 1
+
+    def _parse(self):
+        buf = self.buf
+        pos = self.start
+        end = self.end
+
+        while end - pos >= 3:
+            if buf[pos] != HCI_EVENT_PKT:
+                pos += 1
+                self._skip()
+                continue
+            length = buf[pos + 2]
+            if end - pos < 3 + length:
+                break
+
+            p = pos + 3
+            if buf[pos + 1] == EVT_LE_META and length >= 2 and buf[p] == EVT_LE_ADVERTISING_REPORT:
+                if not self._reports(p + 1, p + length):
+                    pos += 1
+                    self._skip()
+                    continue
+
+            self.frames += 1
+            self._in_sync = True
+            pos += 3 + length
+
+        if pos == end:
+            pos = end = 0
+        self.start = pos
+        self.end = end
+
+    def _reports(self, p, stop):
+        """ Check and hand on the reports of one event; False if they don't
+        add up to the event's length. """
+        buf = self.buf
+        count = buf[p]
+        p += 1
+        reports = []
+        for _ in range(count):
+            if p + 10 > stop:
+                return False
+            data_len = buf[p + 8]
+            if buf[p + 1] >= ADDRESS_TYPES or data_len > MAX_AD_DATA or p + 10 + data_len > stop:
+                return False
+            reports.append(p)
+            p += 10 + data_len
+        if count == 0 or count > MAX_REPORTS or p != stop:
+            return False
+
+        for p in reports:
+            evt = self._scan_response(p)
+            if evt is None:
+                continue
+            self.scan_responses += 1
+            if self.on_scan_response:
+                self.on_scan_response(evt)
+        return True
+
+    def _scan_response(self, p):
+        buf = self.buf
+        data_len = buf[p + 8]
+        start = p + 9
+        stop = start + data_len
+
+        # the AD structures, as in BgapiParser; a zero length ends the data
+        fields = []
+        wanted = self.companies is None
+        i = start
+        while i < stop:
+            n = buf[i]
+            if n == 0:
+                break
+            if i + 1 + n > stop:
+                self.filtered += 1
+                return None
+            ad_type = buf[i + 1]
+            fields.append((ad_type, i + 2, i + 1 + n))
+            if not wanted and ad_type == AD_MANUFACTURER and n >= 3 and bytes(buf[i + 2:i + 4]) in self.companies:
+                wanted = True
+            i += 1 + n
+        if not wanted:
+            self.filtered += 1
+            return None
+
+        evt = ScanResponse()
+        rssi = buf[stop]
+        evt.rssi = rssi - 256 if rssi > 127 else rssi
+        evt.packet_type = buf[p]
+        evt.sender = self.view[p + 2:p + 8]
+        evt.address_type = buf[p + 1]
+        evt.bond = 0xFF
+        evt.data = self.view[start:stop]
+        evt._buf = buf
+        evt._view = self.view
+        evt._base = start
+        evt._fields = fields
+        return evt
+
+
+# btsnoop, as written by btmon -w and Android: a file header, then per packet
+# original length, included length, flags, cumulative drops (4 bytes each)
+# and a timestamp in microseconds since year 0 (8 bytes), big endian
+BTSNOOP_MAGIC = b'btsnoop\0'
+BTSNOOP_HEADER = struct.Struct('>8sII')
+BTSNOOP_RECORD = struct.Struct('>IIIIq')
+BTSNOOP_EPOCH = 0x00dcddb30f2f8000      # 1970-01-01 in btsnoop microseconds
+DATALINK_HCI = 1001         # packets without the H4 type byte; flag bit 1 marks commands and events
+DATALINK_H4 = 1002          # packets with the H4 type byte
+DATALINK_MONITOR = 2001     # btmon: flags are controller index << 16 | opcode
+MONITOR_EVENT = 3
+
+
+class Btsnoop(object):
+    """ The received HCI events of a btsnoop file, as H4 packets. With a
+    btmon capture of several controllers, `names` lists them and packets()
+    gives each one's index in that list. """
+
+    def __init__(self, path):
+        self.path = path
+        with open(path, 'rb') as f:
+            header = f.read(BTSNOOP_HEADER.size)
+        if len(header) < BTSNOOP_HEADER.size or not header.startswith(BTSNOOP_MAGIC):
+            raise ValueError("%s: not a btsnoop file" % path)
+        _, version, self.datalink = BTSNOOP_HEADER.unpack(header)
+        if version != 1 or self.datalink not in (DATALINK_HCI, DATALINK_H4, DATALINK_MONITOR):
+            raise ValueError("%s: btsnoop version %d, datalink %d not supported" % (path, version, self.datalink))
+        self._controllers = [0]
+        if self.datalink == DATALINK_MONITOR:
+            self._controllers = sorted(set(flags >> 16 for flags, _, _ in self._records() if flags & 0xFFFF == MONITOR_EVENT)) or [0]
+        self.names = ['hci%d' % i for i in self._controllers]
+
+    def _records(self):
+        with open(self.path, 'rb') as f:
+            f.seek(BTSNOOP_HEADER.size)
+            while True:
+                head = f.read(BTSNOOP_RECORD.size)
+                if len(head) < BTSNOOP_RECORD.size:
+                    return
+                _, included, flags, _, stamp = BTSNOOP_RECORD.unpack(head)
+                packet = f.read(included)
+                if len(packet) < included:
+                    return
+                yield flags, (stamp - BTSNOOP_EPOCH) / 1e6, packet
+
+    def packets(self):
+        """ Yield (time, controller index, H4 event packet). """
+        index = dict((c, i) for i, c in enumerate(self._controllers))
+        event = struct.pack('B', HCI_EVENT_PKT)
+        for flags, when, packet in self._records():
+            if self.datalink == DATALINK_H4:
+                if flags & 1 and packet[:1] == event:
+                    yield when, 0, packet
+            elif self.datalink == DATALINK_HCI:
+                if flags & 3 == 3:
+                    yield when, 0, event + packet
+            elif flags & 0xFFFF == MONITOR_EVENT:
+                yield when, index[flags >> 16], event + packet
+
+
+class BtsnoopWriter(object):
+    """ Writes H4 event packets to a btsnoop file, with the write() of
+    replay.Recorder (one packet per call). """
+
+    def __init__(self, path):
+        self.path = path
+        self.chunks = 0
+        self.bytes = 0
+        self._file = open(path, 'wb')
+        self._file.write(BTSNOOP_HEADER.pack(BTSNOOP_MAGIC, 1, DATALINK_H4))
+
+    def write(self, receiver, packet, now=None):
+        if now is None:
+            now = time.time()
+        stamp = int(round(now * 1e6)) + BTSNOOP_EPOCH
+        # received, and an event
+        self._file.write(BTSNOOP_RECORD.pack(len(packet), len(packet), 3, 0, stamp) + bytes(packet))
+        self.chunks += 1
+        self.bytes += len(packet)
+
+    def close(self):
+        self._file.close()
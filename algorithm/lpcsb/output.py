@@ -0,0 +1,145 @@
+""" Buffered, rotating CSV output
+
+The scanners used to check for, open, append to and close their CSV for
+every packet. RotatingCsvWriter keeps the file open and buffers rows,
+writing them out once `flush_rows` have queued up or `flush_secs` have passed
+since the last write, whichever comes first. Call tick() from the main loop
+so a quiet stream still gets flushed, and close() on the way out.
+
+The file name is a strftime() template, so the time rotation comes from the
+template itself: "%Y%m%d LPCSB.csv" starts a new file every day and
+"%Y%m%d-%H LPCSB.csv" every hour. With `rotate_bytes` set, a file that has
+grown past that size is continued in "name-1.csv", "name-2.csv" and so on.
+Rotation is checked when a batch is written, so a file can end up one batch
+over the limit and rows stay in the file that was current when they were
+flushed.
+
+A new (empty) file always gets the header first. Appending to an existing
+file does not repeat it.
+"""
+
+import csv
+import os
+import sys
+import time
+
+_open_writers = []
+
+
+def parse_size(text):
+    """ '500k', '10M', '1G' or a plain byte count -> bytes """
+    text = text.strip().upper().rstrip('B')
+    scale = 1
+    if text and text[-1] in 'KMG':
+        scale = 1024 ** ('KMG'.index(text[-1]) + 1)
+        text = text[:-1]
+    return int(float(text) * scale)
+
+
+class RotatingCsvWriter(object):
+    def __init__(self, template, header, rotate_bytes=0, flush_rows=100, flush_secs=5.0):
+        self.template = template
+        self.header = header
+        self.rotate_bytes = rotate_bytes
+        self.flush_rows = flush_rows
+        self.flush_secs = flush_secs
+
+        self.rows = []
+        self.last_flush = time.time()
+        self.path = None
+        self.size = 0
+        self._name = None
+        self._index = 0
+        self._file = None
+        self._writer = None
+
+        register(self)
+
+    def writerow(self, row):
+        self.rows.append(row)
+        if len(self.rows) >= self.flush_rows or time.time() - self.last_flush >= self.flush_secs:
+            self.flush()
+
+    def tick(self):
+        """ Flush rows that have waited long enough. Cheap to call often. """
+        if self.rows and time.time() - self.last_flush >= self.flush_secs:
+            self.flush()
+
+    def flush(self):
+        self.last_flush = time.time()
+        if not self.rows:
+            return
+
+        name = time.strftime(self.template)
+        if self._file is None or name != self._name or \
+           (self.rotate_bytes and self.size >= self.rotate_bytes):
+            self._open(name)
+
+        self._writer.writerows(self.rows)
+        self._file.flush()
+        self.size = self._file.tell()
+        self.rows = []
+
+    def close(self):
+        self.flush()
+        if self._file is not None:
+            self._file.close()
+            self._file = None
+        unregister(self)
+
+    def _numbered(self, name, index):
+        if index == 0:
+            return name
+        root, ext = os.path.splitext(name)
+        return "%s-%d%s" % (root, index, ext)
+
+    def _open(self, name):
+        if self._file is not None:
+            self._file.close()
+
+        if name != self._name:
+            self._name = name
+            self._index = 0
+        elif self._file is not None:
+            self._index += 1
+
+        # Skip over files a previous run already filled up
+        path = self._numbered(name, self._index)
+        while self.rotate_bytes and os.path.exists(path) and \
+              os.path.getsize(path) >= self.rotate_bytes:
+            self._index += 1
+            path = self._numbered(name, self._index)
+
+        if sys.version_info[0] < 3:
+            self._file = open(path, 'ab')
+        else:
+            self._file = open(path, 'a', newline='')
+        self._file.seek(0, os.SEEK_END)
+        self._writer = csv.writer(self._file, delimiter=',')
+        if self._file.tell() == 0:
+            self._writer.writerow(self.header)
+        self.path = path
+        self.size = self._file.tell()
+
+
+def register(writer):
+    """ Have tick_all() and close_all() cover `writer` too; anything with
+    tick() and close(). """
+    _open_writers.append(writer)
+
+
+def unregister(writer):
+    if writer in _open_writers:
+        _open_writers.remove(writer)
+
+
+def tick_all():
+    """ tick() every registered writer; call once per main loop pass. """
+    for writer in _open_writers:
+        writer.tick()
+
+
+def close_all():
+    """ Flush and close every writer that is still open, e.g. on SIGINT. """
+    for writer in list(_open_writers):
+        writer.close()
@@ -0,0 +1,177 @@
+""" Bounded queues and worker threads between scanner stages
+
+The scanners run as a small pipeline:
+
+    reader thread per dongle   serial read, BGAPI framing      lpcsb.capture
+        | intake queue (always drops when full)
+    main thread                dedup, decode, seq tracking,
+                               classification, printing         the script
+        | sink queue (drops or blocks, --backpressure)
+    writer thread              CSV, Parquet, SQLite              SinkWorker
+
+so a slow disk or a burst of output never stops the serial port being
+drained. With "block" a full sink queue holds up the main thread, which in
+turn fills the intake queue; only there are packets dropped, and counted,
+since holding up the reader would overflow the dongle instead.
+
+Every BoundedQueue counts what went through it, what it dropped, its
+current and largest depth, and how long items waited in it; workers also
+time their own processing. stats() on either returns plain data for the
+--stats file.
+"""
+
+import threading
+import time
+
+try:
+    import queue
+except ImportError:
+    import Queue as queue
+
+DROP = 'drop'
+BLOCK = 'block'
+
+_STOP = object()
+
+
+class Timing(object):
+    """ Count, mean and max of a duration, in milliseconds when reported. """
+    __slots__ = ('count', 'total', 'max')
+
+    def __init__(self):
+        self.count = 0
+        self.total = 0.0
+        self.max = 0.0
+
+    def add(self, seconds):
+        self.count += 1
+        self.total += seconds
+        if seconds > self.max:
+            self.max = seconds
+
+    def stats(self):
+        return {'count': self.count,
+                'mean_ms': 1e3 * self.total / self.count if self.count else 0.0,
+                'max_ms': 1e3 * self.max}
+
+
+class BoundedQueue(object):
+    def __init__(self, maxsize=10000, policy=BLOCK):
+        if policy not in (DROP, BLOCK):
+            raise ValueError("policy must be '%s' or '%s'" % (DROP, BLOCK))
+        self.maxsize = maxsize
+        self.policy = policy
+        self.put_count = 0
+        self.dropped = 0
+        self.max_depth = 0
+        self.wait = Timing()
+        self._queue = queue.Queue(maxsize)
+
+    def put(self, item):
+        """ Queue `item`; returns False if it was dropped. """
+        entry = (time.time(), item)
+        if self.policy == DROP:
+            try:
+                self._queue.put_nowait(entry)
+            except queue.Full:
+                self.dropped += 1
+                return False
+        else:
+            # in slices, so Ctrl-C still gets through on Python 2
+            while True:
+                try:
+                    self._queue.put(entry, timeout=0.5)
+                    break
+                except queue.Full:
+                    pass
+        self.put_count += 1
+        depth = self._queue.qsize()
+        if depth > self.max_depth:
+            self.max_depth = depth
+        return True
+
+    def get(self, timeout=None):
+        """ Next item, waiting up to `timeout`; raises queue.Empty. """
+        t, item = self._queue.get(timeout=timeout)
+        self.wait.add(time.time() - t)
+        return item
+
+    def get_nowait(self):
+        t, item = self._queue.get_nowait()
+        self.wait.add(time.time() - t)
+        return item
+
+    def put_stop(self):
+        """ Wake the consumer for shutdown, regardless of the policy. """
+        self._queue.put((time.time(), _STOP))
+
+    def stats(self):
+        return {'policy': self.policy, 'capacity': self.maxsize, 'depth': self._queue.qsize(),
+                'max_depth': self.max_depth, 'put': self.put_count, 'dropped': self.dropped,
+                'wait': self.wait.stats()}
+
+
+Empty = queue.Empty
+
+
+class SinkWorker(object):
+    """ Writer thread for the scanners: takes (row, record) pairs from a
+    bounded queue and hands them to the CSV writer and the other sinks,
+    which are only ever touched from this thread. """
+
+    def __init__(self, csv_writer, sinks, maxsize=10000, policy=BLOCK, idle=0.5):
+        self.csv_writer = csv_writer
+        self.sinks = sinks
+        self.queue = BoundedQueue(maxsize, policy)
+        self.busy = Timing()
+        self.idle = idle
+        self.error = None
+        self._thread = threading.Thread(target=self._run)
+        self._thread.daemon = True
+        self._thread.start()
+
+    def put(self, row, device, mac, seq, rssi, **fields):
+        """ Queue one CSV row and the record for the other sinks
+        (`fields` as for ParquetSink.add()). Re-raises whatever stopped the
+        writer thread, rather than queueing into a queue nobody reads. """
+        if self.error is not None:
+            raise self.error
+        return self.queue.put((row, device, mac, seq, rssi, fields))
+
+    def _tick(self):
+        self.csv_writer.tick()
+        for sink in self.sinks:
+            sink.tick()
+
+    def _run(self):
+        get = self.queue.get
+        try:
+            while True:
+                try:
+                    item = get(timeout=self.idle)
+                except Empty:
+                    self._tick()
+                    continue
+                if item is _STOP:
+                    break
+                start = time.time()
+                row, device, mac, seq, rssi, fields = item
+                self.csv_writer.writerow(row)
+                for sink in self.sinks:
+                    sink.add(device, mac, seq, rssi, **fields)
+                self._tick()
+                self.busy.add(time.time() - start)
+        except Exception as e:
+            self.error = e
+            raise
+
+    def close(self):
+        """ Write everything still queued and stop the thread; the writers
+        themselves are closed by lpcsb.output.close_all(). """
+        if self._thread.is_alive():
+            self.queue.put_stop()
+            self._thread.join()
+
+    def stats(self):
+        return {'queue': self.queue.stats(), 'busy': self.busy.stats(),
+                'error': None if self.error is None else str(self.error)}
@@ -0,0 +1,500 @@
+""" Live decoded records and rollups for local subscribers
+
+Dashboards used to tail the CSV. Publisher is one more sink on the
+scanner's writer thread (--publish) that hands every record, and every
+rollup window as it closes (with --rollup), to whoever is connected, as
+one JSON object per message:
+
+    {"type": "record", "service": "raw_color", "device": "LPCSB_1", "mac": "C098E5405D4C",
+     "time": "2020-03-01T08:00:05.000000Z", "time_ns": ..., "seq": 17, "rssi": -61,
+     "clear": 1630, "red": 620, "green": 540, "blue": 410, "color_temp": 3000, "lux": 412,
+     "light_type": "LED"}
+    {"type": "rollup", "service": "rollup", "device": "LPCSB_1", "resolution": 60,
+     "time": "...", "start": ..., "count": 12, "lux_mean": 410.5, ... "dwell": {"LED": 60.0}}
+
+A light type row has "service": "light_type" and no channels. It listens
+on 127.0.0.1:PORT (or HOST:PORT), or on a Unix-domain socket at a path,
+which must not be anything but a socket left from an earlier run, and
+speaks two protocols on the same port:
+
+    newline-delimited JSON  send a subscription line, then read one message
+                            per line; another subscription line replaces it
+    WebSocket               GET ws://127.0.0.1:PORT/?device=LPCSB_1&service=raw_color,
+                            one text frame per message; a text frame with a
+                            subscription replaces it
+
+A subscription is {"devices": [...], "services": [...]}, devices by name
+or MAC and services among raw_color, light_type and rollup. A missing or
+empty list means all, so an empty line subscribes to everything. A
+subscriber first gets {"type": "hello", ...} with its subscription, and
+{"type": "error", ...} for one that doesn't parse.
+
+The writer thread only encodes a message (once, and only if someone wants
+it) and appends it to each interested subscriber's queue. A server thread
+sends from there. Every queue holds at most `buffer` messages; when a
+subscriber falls that far behind, its oldest messages are dropped and it
+gets {"type": "dropped", "count": N} before the next ones, so a slow
+subscriber loses data but never holds up the scanner. The server thread
+polls every `poll` seconds for new messages, which bounds the latency.
+
+    python -m lpcsb.scanner ... --publish 8765 [--publish-buffer 1000]
+    python -m lpcsb.publish 8765 [--device LPCSB_1] [--service raw_color]     (prints what it gets)
+"""
+
+from __future__ import print_function
+
+import base64
+import errno
+import hashlib
+import json
+import optparse
+import os
+import select
+import socket
+import stat
+import sys
+import threading
+import time
+from collections import deque
+
+from lpcsb import output
+from lpcsb.events import iso
+
+try:
+    from urllib.parse import urlsplit, parse_qs
+except ImportError:
+    from urlparse import urlsplit, parse_qs
+
+SERVICES = ('raw_color', 'light_type', 'rollup')
+CHANNELS = ('clear', 'red', 'green', 'blue', 'color_temp', 'lux')
+
+WEBSOCKET_GUID = b'258EAFA5-E914-47DA-95CA-C5AB0DC11B65'
+MAX_REQUEST = 8192
+SEND_BYTES = 1 << 16
+
+if hasattr(time, 'time_ns'):
+    _now_ns = time.time_ns
+else:
+    def _now_ns():
+        return int(time.time() * 1e9)
+
+
+def encode(message):
+    return json.dumps(message, sort_keys=True, separators=(',', ':')).encode('utf-8')
+
+
+def parse_subscription(text):
+    """ (devices, services) from a subscription, None for all; ValueError if it is wrong. """
+    text = text.strip()
+    if not text:
+        return None, None
+    try:
+        spec = json.loads(text)
+    except ValueError:
+        raise ValueError("subscription is not JSON")
+    if not isinstance(spec, dict):
+        raise ValueError("subscription is not an object")
+    devices = spec.get('devices') or None
+    services = spec.get('services') or None
+    for name, value in (('devices', devices), ('services', services)):
+        if value is not None and not isinstance(value, list):
+            raise ValueError("%s is not a list" % name)
+    unknown = set(services or ()) - set(SERVICES)
+    if unknown:
+        raise ValueError("unknown services: %s" % ', '.join(sorted(unknown)))
+    return (frozenset(devices) if devices else None), (frozenset(services) if services else None)
+
+
+def ws_frame(payload, opcode=0x1):
+    """ An unmasked, unfragmented WebSocket frame, as a server sends. """
+    n = len(payload)
+    if n < 126:
+        head = bytearray((0x80 | opcode, n))
+    elif n < 1 << 16:
+        head = bytearray((0x80 | opcode, 126, n >> 8, n & 0xFF))
+    else:
+        head = bytearray([0x80 | opcode, 127] + [(n >> s) & 0xFF for s in range(56, -8, -8)])
+    return bytes(head) + payload
+
+
+class _Client(object):
+    def __init__(self, sock, address, buffer):
+        self.sock = sock
+        self.address = address
+        self.queue = deque(maxlen=buffer)   # appended by the writer thread, emptied by the server
+        self.inbox = bytearray()
+        self.out = b''
+        self.websocket = False
+        self.ready = False      # subscribed, so messages are queued
+        self.devices = None
+        self.services = None
+        self.sent = 0
+        self.dropped = 0        # only written by the writer thread
+        self.reported = 0
+        self.since = time.time()
+
+    def wants(self, device, mac, service):
+        return self.ready and (self.devices is None or device in self.devices or mac in self.devices) and \
+            (self.services is None or service in self.services)
+
+    def frame(self, message):
+        return ws_frame(message) if self.websocket else message + b'\n'
+
+    def subscribe(self, text):
+        try:
+            self.devices, self.services = parse_subscription(text)
+        except ValueError as e:
+            self.out += self.frame(encode({'type': 'error', 'error': str(e)}))
+            return
+        self.out += self.frame(encode({'type': 'hello', 'buffer': self.queue.maxlen,
+                                       'devices': sorted(self.devices) if self.devices else None,
+                                       'services': sorted(self.services) if self.services else None}))
+        self.ready = True
+
+    def stats(self):
+        return {'address': self.address, 'protocol': 'websocket' if self.websocket else 'ndjson',
+                'devices': sorted(self.devices) if self.devices else None,
+                'services': sorted(self.services) if self.services else None,
+                'sent': self.sent, 'dropped': self.dropped, 'queued': len(self.queue),
+                'seconds': round(time.time() - self.since, 1)}
+
+
+class Publisher(object):
+    def __init__(self, port=None, path=None, buffer=1000, host='127.0.0.1', poll=0.05):
+        """ Listen on `host`:`port` and/or the Unix socket `path`. Raises
+        socket.error if either can't be bound. """
+        self.buffer = buffer
+        self.poll = poll
+        self.published = 0      # messages some subscriber wanted
+        self.addresses = []
+        self._listeners = []
+        self._clients = ()      # replaced whole, so the writer thread can iterate it
+        self._path = None
+        self._stop = False
+        try:
+            if port is not None:
+                sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+                sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+                sock.bind((host, port))
+                self._listen(sock, "%s:%d" % (host, sock.getsockname()[1]))
+            if path is not None:
+                if not hasattr(socket, 'AF_UNIX'):
+                    raise socket.error("Unix-domain sockets aren't available here")
+                if os.path.lexists(path):
+                    if not stat.S_ISSOCK(os.lstat(path).st_mode):
+                        raise socket.error("%s exists and is not a socket" % path)
+                    # left behind by an earlier run
+                    os.remove(path)
+                sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+                sock.bind(path)
+                self._path = path
+                self._listen(sock, path)
+        except Exception:
+            for sock in self._listeners:
+                sock.close()
+            raise
+        self._thread = threading.Thread(target=self._serve)
+        self._thread.daemon = True
+        self._thread.start()
+        output.register(self)
+
+    def _listen(self, sock, address):
+        sock.listen(16)
+        sock.setblocking(False)
+        self._listeners.append(sock)
+        self.addresses.append(address)
+
+    @property
+    def port(self):
+        for sock in self._listeners:
+            if sock.family == socket.AF_INET:
+                return sock.getsockname()[1]
+        return None
+
+    # -- writer thread
+
+    def publish(self, device, mac, service, message):
+        """ Queue `message` (a dict) for every subscriber that wants it. """
+        data = None
+        for client in self._clients:
+            if client.wants(device, mac, service):
+                if data is None:
+                    data = encode(message)
+                    self.published += 1
+                queue = client.queue
+                if len(queue) == queue.maxlen:
+                    client.dropped += 1
+                queue.append(data)
+
+    def add(self, device, mac, seq, rssi, raw=None, light_type=None, time_ns=None):
+        """ One record, as for lpcsb.sqlite_sink.SqliteSink.add(). """
+        if not self._clients:
+            return
+        if time_ns is None:
+            time_ns = _now_ns()
+        service = 'light_type' if raw is None else 'raw_color'
+        message = {'type': 'record', 'service': service, 'device': device, 'mac': mac, 'seq': seq,
+                   'rssi': rssi, 'time': iso(time_ns), 'time_ns': time_ns, 'light_type': light_type}
+        if raw is not None:
+            for name in CHANNELS:
+                message[name] = getattr(raw, name)
+        self.publish(device, mac, service, message)
+
+    def rollup(self, device, window, dwell):
+        """ lpcsb.rollup.RollupSink's on_window: a window that just closed. """
+        if not self._clients:
+            return
+        message = dict(window, type='rollup', service='rollup', time=iso(window['start']), dwell=dwell)
+        self.publish(device, None, 'rollup', message)
+
+    def tick(self):
+        pass
+
+    def stats(self):
+        clients = self._clients
+        return {'addresses': self.addresses, 'buffer': self.buffer, 'published': self.published,
+                'clients': [c.stats() for c in clients]}
+
+    def close(self):
+        if self._stop:
+            return
+        # let the server thread send what's queued, briefly
+        deadline = time.time() + 1.0
+        while time.time() < deadline and any(c.queue or c.out for c in self._clients):
+            time.sleep(self.poll)
+        self._stop = True
+        self._thread.join(2 * self.poll + 1)
+        for client in self._clients:
+            client.sock.close()
+        self._clients = ()
+        for sock in self._listeners:
+            sock.close()
+        if self._path is not None and os.path.exists(self._path):
+            os.remove(self._path)
+        output.unregister(self)
+
+    # -- server thread
+
+    def _serve(self):
+        while not self._stop:
+            clients = self._clients
+            readers = self._listeners + [c.sock for c in clients]
+            writers = [c.sock for c in clients if c.out or (c.ready and (c.queue or c.dropped > c.reported))]
+            try:
+                readable, writable, _ = select.select(readers, writers, [], self.poll)
+            except (select.error, socket.error, ValueError):
+                # a socket closed under us on the way out
+                continue
+            by_sock = dict((c.sock, c) for c in clients)
+            for sock in readable:
+                if sock in by_sock:
+                    self._read(by_sock[sock])
+                else:
+                    self._accept(sock)
+            for sock in writable:
+                client = by_sock.get(sock)
+                if client is not None and client in self._clients:
+                    self._write(client)
+
+    def _accept(self, listener):
+        try:
+            sock, address = listener.accept()
+        except socket.error:
+            return
+        sock.setblocking(False)
+        if isinstance(address, tuple):
+            address = "%s:%d" % address[:2]
+        self._clients = self._clients + (_Client(sock, address or 'unix', self.buffer),)
+
+    def _drop(self, client):
+        self._clients = tuple(c for c in self._clients if c is not client)
+        try:
+            client.sock.close()
+        except socket.error:
+            pass
+
+    def _read(self, client):
+        try:
+            data = client.sock.recv(4096)
+        except socket.error as e:
+            if e.args[0] in (errno.EAGAIN, errno.EWOULDBLOCK):
+                return
+            data = b''
+        if not data:
+            self._drop(client)
+            return
+        client.inbox += data
+        if client.websocket:
+            self._ws_frames(client)
+        elif not client.ready and client.inbox.startswith(b'GET '):
+            if b'\r\n\r\n' in client.inbox:
+                self._handshake(client)
+            elif len(client.inbox) > MAX_REQUEST:
+                self._drop(client)
+        else:
+            while b'\n' in client.inbox:
+                line, _, rest = bytes(client.inbox).partition(b'\n')
+                client.inbox = bytearray(rest)
+                client.subscribe(line.decode('utf-8', 'replace'))
+            if len(client.inbox) > MAX_REQUEST:
+                self._drop(client)
+
+    def _handshake(self, client):
+        request, _, rest = bytes(client.inbox).partition(b'\r\n\r\n')
+        client.inbox = bytearray(rest)
+        lines = request.decode('latin-1').split('\r\n')
+        headers = dict((k.strip().lower(), v.strip()) for k, _, v in (h.partition(':') for h in lines[1:]))
+        key = headers.get('sec-websocket-key')
+        if key is None or 'websocket' not in headers.get('upgrade', '').lower():
+            client.sock.sendall(b"HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n")
+            self._drop(client)
+            return
+        accept = base64.b64encode(hashlib.sha1(key.encode('latin-1') + WEBSOCKET_GUID).digest())
+        client.out = (b"HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                      b"Sec-WebSocket-Accept: " + accept + b"\r\n\r\n")
+        client.websocket = True
+
+        # ?device=A,B&service=raw_color, or repeated parameters
+        query = parse_qs(urlsplit(lines[0].split(' ')[1] if ' ' in lines[0] else '').query)
+        spec = {}
+        for name, field in (('device', 'devices'), ('service', 'services')):
+            values = [v for value in query.get(name, []) for v in value.split(',') if v]
+            if values:
+                spec[field] = values
+        client.subscribe(json.dumps(spec))
+        self._ws_frames(client)
+
+    def _ws_frames(self, client):
+        """ Handle whole frames from the client: text is a new
+        subscription, close closes, ping gets a pong. """
+        inbox = client.inbox
+        while len(inbox) >= 2:
+            opcode = inbox[0] & 0x0F
+            n = inbox[1] & 0x7F
+            i = 2
+            if n == 126:
+                if len(inbox) < 4:
+                    return
+                n = (inbox[2] << 8) | inbox[3]
+                i = 4
+            elif n == 127:
+                if len(inbox) < 10:
+                    return
+                n = 0
+                for b in inbox[2:10]:
+                    n = (n << 8) | b
+                i = 10
+            masked = inbox[1] & 0x80
+            if len(inbox) < i + (4 if masked else 0) + n:
+                if n > MAX_REQUEST:
+                    self._drop(client)
+                return
+            payload = inbox[i + 4:i + 4 + n] if masked else inbox[i:i + n]
+            if masked:
+                mask = inbox[i:i + 4]
+                payload = bytearray(b ^ mask[j % 4] for j, b in enumerate(payload))
+            del inbox[:i + (4 if masked else 0) + n]
+            if opcode == 0x1:
+                client.subscribe(bytes(payload).decode('utf-8', 'replace'))
+            elif opcode == 0x8:
+                try:
+                    client.sock.sendall(ws_frame(b'', 0x8))
+                except socket.error:
+                    pass
+                self._drop(client)
+                return
+            elif opcode == 0x9:
+                client.out += ws_frame(bytes(payload), 0xA)
+
+    def _write(self, client):
+        if not client.out:
+            parts = []
+            if client.dropped > client.reported:
+                dropped = client.dropped
+                parts.append(client.frame(encode({'type': 'dropped', 'count': dropped - client.reported})))
+                client.reported = dropped
+            size = 0
+            queue = client.queue
+            while queue and size < SEND_BYTES:
+                try:
+                    message = queue.popleft()
+                except IndexError:
+                    break
+                parts.append(client.frame(message))
+                size += len(message)
+                client.sent += 1
+            client.out = b''.join(parts)
+        try:
+            n = client.sock.send(client.out)
+        except socket.error as e:
+            if e.args[0] in (errno.EAGAIN, errno.EWOULDBLOCK):
+                return
+            self._drop(client)
+            return
+        client.out = client.out[n:]
+
+
+def parse_address(address):
+    """ (host, port, None) for a port number or HOST:PORT, the host
+    127.0.0.1 if not given, or (None, None, path) for a Unix socket path,
+    which is anything with a / or without a port. ValueError for a port
+    out of range. The scanner's --publish and connect() both use this. """
+    host, _, port = address.rpartition(':')
+    if '/' in address or not port.isdigit():
+        return None, None, address
+    port = int(port)
+    if port > 65535:
+        raise ValueError("port %d is out of range" % port)
+    return host or '127.0.0.1', port, None
+
+
+def connect(address):
+    """ A socket to a Publisher: a port number, host:port, or a Unix socket path. """
+    host, port, path = parse_address(address)
+    if path is None:
+        return socket.create_connection((host, port))
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(path)
+    return sock
+
+
+def main():
+    p = optparse.OptionParser(usage="%prog [options] PORT|HOST:PORT|SOCKET",
+                              description="Print what a scanner run with --publish sends, one JSON message per line")
+    p.add_option('--device', '-d', action='append', default=[], help="Only this board, by name or MAC (repeatable)")
+    p.add_option('--service', '-s', action='append', default=[], choices=SERVICES,
+                 help="Only this service: %s (repeatable)" % ', '.join(SERVICES))
+    options, args = p.parse_args()
+    if len(args) != 1:
+        p.error("need the port or socket to connect to")
+
+    try:
+        sock = connect(args[0])
+    except (socket.error, ValueError) as e:
+        raise SystemExit("%s: %s" % (args[0], e))
+    spec = {}
+    if options.device:
+        spec['devices'] = options.device
+    if options.service:
+        spec['services'] = options.service
+    sock.sendall(encode(spec) + b'\n')
+    out = getattr(sys.stdout, 'buffer', sys.stdout)
+    try:
+        while True:
+            data = sock.recv(SEND_BYTES)
+            if not data:
+                break
+            out.write(data)
+            out.flush()
+    except KeyboardInterrupt:
+        pass
+    except IOError as e:
+        # stdout closed, as by | head
+        if e.errno != errno.EPIPE:
+            raise
+    finally:
+        sock.close()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,365 @@
+""" Offline re-classification of recorded samples
+
+The scanner classifies each sample once, as it arrives, and the result is
+frozen into the CSV. This tool runs the same features and rules again over
+recordings, so new thresholds can be tried on months of data:
+
+    python -m lpcsb.reclassify [--rules VERSION] -o out.csv  in1.csv in2.csv ...
+    python -m lpcsb.reclassify -o out.parquet archive.parquet
+
+Inputs are scanner CSVs (any profile with the color columns) or Parquet
+archives from lpcsb.archive, read in chunks of about --chunk-rows rows so
+memory stays bounded whatever the input size. Files are processed in the
+order given and each board's drift is carried from one chunk and file to
+the next, so pass daily files oldest first. All inputs must have the same
+columns. The output has every input column plus
+
+    max_ratio min_ratio ratio_compare       as the 'ratios' classifier
+    net_clear ... net_blue                  drift since the board's last reset
+    total_clear ... total_blue              same, summing absolute changes
+    light_type_rules_VERSION                the 'rules' classifier's label
+
+Rows without color values (light type and telemetry rows) keep their
+columns and get empty features. The labels are what classify.BulbRules
+with the same RULES version gives when it sees the rows in the same order;
+bench/reclassify_bench.py checks that.
+
+Everything is done with NumPy on whole chunks: rows are sorted by board,
+changes come from shifted arrays, and the per-board running sums with
+resets are one cumulative sum anchored at each reset and chunk boundary.
+Needs numpy and pyarrow.
+"""
+
+from __future__ import print_function
+
+import optparse
+import os
+import sys
+import time
+
+import numpy as np
+import pyarrow as pa
+import pyarrow.compute as pc
+import pyarrow.csv as pcsv
+import pyarrow.parquet as pq
+
+from lpcsb.classify import RULES, DEFAULT_RULES
+
+CHANNELS = ('clear', 'red', 'green', 'blue')
+
+# field -> column name in an archive, then in a scanner CSV
+COLUMNS = {
+    'device': ('device', 'device'),
+    'seq': ('seq', 'sequence_no'),
+    'clear': ('clear', 'Clear'),
+    'red': ('red', 'Red'),
+    'green': ('green', 'Green'),
+    'blue': ('blue', 'Blue'),
+    'lux': ('lux', 'Lux'),
+}
+
+LABELS = ("Incandescent", "Fluorescent", "LED", "Sunlight", "Unknown")
+
+# roughly what one row of a scanner CSV takes, to size CSV blocks by rows
+CSV_ROW_BYTES = 100
+
+
+def find_columns(names):
+    """ field -> column name for an input with these column names. """
+    found = {}
+    for field, candidates in COLUMNS.items():
+        for candidate in candidates:
+            if candidate in names:
+                found[field] = candidate
+                break
+        else:
+            raise ValueError("no %s column (looked for %s)" % (field, ' or '.join(candidates)))
+    return found
+
+
+def _numbers(column):
+    """ Column -> float64 NumPy array with NaN for missing values; CSV
+    columns are read as text and 'N/A' marks a value the row doesn't have. """
+    if pa.types.is_string(column.type) or pa.types.is_large_string(column.type):
+        column = pc.if_else(pc.is_in(column, value_set=pa.array(["N/A", ""])),
+                            pa.scalar(None, column.type), column)
+    return np.asarray(pc.cast(column, pa.float64()).to_numpy(zero_copy_only=False), dtype=np.float64)
+
+
+def color_ratios(red, green, blue):
+    """ Vector version of classify.color_ratios(); NaN where a channel is
+    dark. Also returns the top and middle channel values. """
+    top = np.maximum(np.maximum(red, green), blue)
+    low = np.minimum(np.minimum(red, green), blue)
+    mid = red + green + blue - top - low
+    with np.errstate(divide='ignore', invalid='ignore'):
+        lit = low > 0
+        max_ratio = np.where(lit, top / mid, np.nan)
+        min_ratio = np.where(lit, mid / low, np.nan)
+        compare = np.maximum(max_ratio, min_ratio) / np.minimum(max_ratio, min_ratio)
+    return max_ratio, min_ratio, compare, top, mid
+
+
+def rule_labels(red, green, blue, lux, net, max_ratio, min_ratio, top, mid, t):
+    """ Vector version of classify.BulbRules: index into LABELS per row.
+    Comparisons with NaN are false, as the scalar rules skip the ratio
+    tests without ratios. """
+    incandescent = (red == top) & (max_ratio >= t.incandescent_max_ratio) & (min_ratio <= t.incandescent_min_ratio)
+    fluorescent = ((green == top) | ((red == top) & (green == mid) & (max_ratio <= t.fluorescent_max_ratio))) & \
+                  (top < t.fluorescent_max_top)
+    led = (np.abs(net[:, 1:]) <= t.led_max_drift).all(axis=1) & (lux <= t.led_max_lux)
+    sunlight = (blue == top) | ((blue == mid) & (max_ratio <= t.sunlight_max_ratio))
+    return np.select([incandescent, fluorescent, led, sunlight], [0, 1, 2, 3], 4).astype(np.int8)
+
+
+class DriftState(object):
+    """ Per board, carried across chunks: the last values, the values at
+    the last reset (net drift is the distance from those) and the total
+    drift. """
+
+    def __init__(self):
+        self.ids = {}
+        self.previous = np.zeros((0, 4))
+        self.base = np.zeros((0, 4))
+        self.total = np.zeros((0, 4))
+        self.known = np.zeros(0, dtype=bool)
+
+    def lookup(self, names):
+        """ Global board ids for a chunk's device dictionary. """
+        ids = np.empty(len(names), dtype=np.int64)
+        for i, name in enumerate(names):
+            index = self.ids.get(name)
+            if index is None:
+                index = self.ids[name] = len(self.ids)
+            ids[i] = index
+        grow = len(self.ids) - len(self.known)
+        if grow > 0:
+            zeros = np.zeros((grow, 4))
+            self.previous = np.vstack([self.previous, zeros])
+            self.base = np.vstack([self.base, zeros])
+            self.total = np.vstack([self.total, zeros])
+            self.known = np.concatenate([self.known, np.zeros(grow, dtype=bool)])
+        return ids
+
+
+def drift(board, rows, seq, values, state):
+    """ Net and total drift of each channel since each board's last reset.
+    `values` is (rows, 4) clear/red/green/blue in arrival order; `rows` are
+    the rows that have them and `board` the global board id of each. A
+    board resets when seq is 1 and on its first row ever. Returns two
+    arrays shaped like `values`, NaN on the other rows, and updates
+    `state`. """
+    net = np.full(values.shape, np.nan)
+    total = np.full(values.shape, np.nan)
+    n = len(rows)
+    if n == 0:
+        return net, total
+
+    # a stable sort of 16 bit keys is a radix sort
+    key = board.astype(np.uint16) if len(state.known) <= 0x10000 else board
+    order = np.argsort(key, kind='stable')
+    b = board[order]
+    rows = rows[order]
+    v = values[rows]
+    first = np.ones(n, dtype=bool)
+    first[1:] = b[1:] != b[:-1]
+    last = np.ones(n, dtype=bool)
+    last[:-1] = first[1:]
+    reset = (seq[rows] == 1) | (first & ~state.known[b])
+    carry = first & ~reset
+
+    # every row belongs to an anchor: a reset, or the board's first row in
+    # this chunk, which continues from the state
+    index = np.maximum.accumulate(np.where(reset | first, np.arange(n), 0))
+
+    # the changes add up to the distance from the values at the last reset
+    base = v.copy()
+    base[carry] = state.base[b[carry]]
+    base = base[index]
+    net[rows] = v - base
+
+    # absolute changes need a running sum, restarted at each anchor
+    step = np.empty_like(v)
+    np.subtract(v[1:], v[:-1], out=step[1:])
+    step[first] = v[first] - state.previous[b[first]]
+    np.abs(step, out=step)
+    step[reset] = 0
+    step[carry] += state.total[b[carry]]
+    running = np.cumsum(step, axis=0)
+    running -= (running - step)[index]
+    total[rows] = running
+
+    ends = b[last]
+    state.previous[ends] = v[last]
+    state.base[ends] = base[last]
+    state.total[ends] = running[last]
+    state.known[ends] = True
+    return net, total
+
+
+class Reclassifier(object):
+    def __init__(self, thresholds=RULES[DEFAULT_RULES], label_column=None):
+        self.thresholds = thresholds
+        self.label_column = label_column or 'light_type_rules'
+        self.state = DriftState()
+        self.counts = np.zeros(len(LABELS), dtype=np.int64)
+        self.rows = 0
+
+    def process(self, batch, columns):
+        """ `batch` with the feature and label columns appended. `columns`
+        is find_columns() for its schema. """
+        n = batch.num_rows
+        devices = batch.column(columns['device'])
+        if not pa.types.is_dictionary(devices.type):
+            devices = pc.dictionary_encode(devices)
+        codes = devices.indices.to_numpy(zero_copy_only=False)
+        values = np.column_stack([_numbers(batch.column(columns[c])) for c in CHANNELS])
+        lux = _numbers(batch.column(columns['lux']))
+        seq = _numbers(batch.column(columns['seq']))
+        valid = ~np.isnan(values).any(axis=1) & devices.is_valid().to_numpy(zero_copy_only=False)
+
+        rows = np.flatnonzero(valid)
+        board = self.state.lookup(devices.dictionary.to_pylist())[codes[rows].astype(np.int64)]
+        net, total = drift(board, rows, seq, values, self.state)
+
+        clear, red, green, blue = values.T
+        max_ratio, min_ratio, compare, top, mid = color_ratios(red, green, blue)
+        labels = rule_labels(red, green, blue, lux, net, max_ratio, min_ratio, top, mid, self.thresholds)
+        self.counts += np.bincount(labels[valid], minlength=len(LABELS))
+        self.rows += n
+
+        arrays = list(batch.columns)
+        names = list(batch.schema.names)
+        for name, array in (('max_ratio', max_ratio), ('min_ratio', min_ratio), ('ratio_compare', compare)):
+            arrays.append(pa.array(array.astype(np.float32), from_pandas=True))
+            names.append(name)
+        # whole numbers, since the channels are
+        invalid = ~valid
+        for prefix, array, dtype in (('net', net, np.int32), ('total', total, np.int64)):
+            array[invalid] = 0
+            array = array.astype(dtype)
+            for i, channel in enumerate(CHANNELS):
+                arrays.append(pa.array(array[:, i], mask=invalid))
+                names.append('%s_%s' % (prefix, channel))
+        arrays.append(pa.DictionaryArray.from_arrays(pa.array(labels, mask=invalid), pa.array(LABELS)))
+        names.append(self.label_column)
+        return pa.RecordBatch.from_arrays(arrays, names=names)
+
+
+def _csv_blocks(f, size):
+    """ Yield pieces of about `size` bytes of an open binary file, each
+    ending at a line end. Rows never span lines in a scanner CSV. """
+    rest = b''
+    while True:
+        data = f.read(size)
+        if not data:
+            break
+        if rest:
+            data = rest + data
+        cut = data.rfind(b'\n') + 1
+        rest = data[cut:]
+        if cut:
+            yield memoryview(data)[:cut]
+    if rest.strip():
+        yield memoryview(rest)
+
+
+def read_batches(path, chunk_rows):
+    """ Yield RecordBatches of about `chunk_rows` rows from a CSV (every
+    column as text, as written) or a Parquet file. """
+    if path.lower().endswith('.parquet'):
+        for batch in pq.ParquetFile(path).iter_batches(batch_size=chunk_rows):
+            yield batch
+        return
+
+    # pyarrow's streaming CSV reader reads ahead of a slow consumer without
+    # a limit, so the file is cut into blocks here and each parsed on its own
+    size = max(1 << 20, chunk_rows * CSV_ROW_BYTES)
+    with open(path, 'rb') as f:
+        header = [h.strip('"') for h in f.readline().decode('utf-8').strip('\r\n').split(',')]
+        convert = pcsv.ConvertOptions(column_types=dict((h, pa.string()) for h in header), strings_can_be_null=False)
+        for block in _csv_blocks(f, size):
+            table = pcsv.read_csv(pa.BufferReader(pa.py_buffer(block)),
+                                  read_options=pcsv.ReadOptions(column_names=header, block_size=len(block) + 1),
+                                  convert_options=convert)
+            for batch in table.to_batches():
+                yield batch
+
+
+class _Writer(object):
+    """ CSV or Parquet output by file extension, opened on the first batch. """
+
+    def __init__(self, path):
+        self.path = path
+        self._writer = None
+
+    def write(self, batch):
+        if self._writer is None:
+            if self.path.lower().endswith('.parquet'):
+                # dictionaries only pay off for the text columns, and cost
+                # as much time as the rest of the writing on the numbers
+                text = [f.name for f in batch.schema
+                        if pa.types.is_dictionary(f.type) or pa.types.is_string(f.type) or pa.types.is_large_string(f.type)]
+                self._writer = pq.ParquetWriter(self.path, batch.schema, compression='zstd', use_dictionary=text)
+            else:
+                self._writer = pcsv.CSVWriter(self.path, batch.schema)
+        if isinstance(self._writer, pq.ParquetWriter):
+            self._writer.write_table(pa.Table.from_batches([batch]))
+        else:
+            self._writer.write_batch(batch)
+
+    def close(self):
+        if self._writer is not None:
+            self._writer.close()
+
+
+def reclassify(inputs, output, thresholds=RULES[DEFAULT_RULES], label_column=None, chunk_rows=1 << 18):
+    """ Re-classify `inputs` in order into `output`. Returns the Reclassifier
+    for its counts. """
+    reclassifier = Reclassifier(thresholds, label_column)
+    writer = _Writer(output)
+    names = None
+    try:
+        for path in inputs:
+            for batch in read_batches(path, chunk_rows):
+                if names is None:
+                    names = batch.schema.names
+                    columns = find_columns(names)
+                elif batch.schema.names != names:
+                    raise ValueError("%s: columns differ from %s; re-classify it separately" % (path, inputs[0]))
+                writer.write(reclassifier.process(batch, columns))
+    finally:
+        writer.close()
+    return reclassifier
+
+
+def main():
+    p = optparse.OptionParser(usage="%prog [options] -o OUTPUT INPUT ...",
+                              description="Re-classify recorded LPCSB samples (scanner CSVs or Parquet archives) with a "
+                                          "version of the light type rules")
+    p.add_option('--output', '-o', help="File to write, .csv or .parquet")
+    p.add_option('--rules', type='choice', choices=sorted(RULES), default=DEFAULT_RULES,
+                 help="Version of the thresholds in lpcsb/classify.py RULES (default %s)" % DEFAULT_RULES)
+    p.add_option('--label-column', help="Name of the label column (default light_type_rules_VERSION)")
+    p.add_option('--chunk-rows', type='int', default=1 << 18, help="Rows per chunk, roughly for CSV (default 262144)")
+    options, args = p.parse_args()
+    if not options.output or not args:
+        p.error("need --output and at least one input")
+    if os.path.abspath(options.output) in [os.path.abspath(a) for a in args]:
+        p.error("the output can't be one of the inputs")
+
+    start = time.time()
+    try:
+        result = reclassify(args, options.output, RULES[options.rules],
+                            options.label_column or 'light_type_rules_%s' % options.rules, options.chunk_rows)
+    except (ValueError, IOError, pa.ArrowException) as e:
+        print("error: %s" % e, file=sys.stderr)
+        sys.exit(1)
+    elapsed = time.time() - start
+    print("%d rows in %.1f s (%.0f rows/s) to %s" % (result.rows, elapsed, result.rows / max(elapsed, 1e-9), options.output))
+    for label, count in zip(LABELS, result.counts):
+        print("  %-12s %d" % (label, count))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,259 @@
+""" Recording and replaying what the dongles send
+
+A recording is the raw BGAPI byte stream of every dongle, as the reader
+threads got it, so a capture can be fed through the parser, decoders,
+classifiers and sinks again after any of them has changed:
+
+    python -m lpcsb.scanner -p COM13 --record site.lpcsbrec ...
+    python -m lpcsb.scanner --replay site.lpcsbrec --speed 0 -o new.csv --baseline old.csv
+
+Replaying uses the same options as scanning. Every chunk keeps the time it
+was read, which becomes the received time of its scan responses, so the
+de-duplication across dongles and the CSV come out as they did live.
+--speed 1 plays it back at the pace it was recorded, 10 ten times faster
+and 0 as fast as the scanner takes it. --baseline compares the CSV written
+with an earlier one, row by row.
+
+The file is a header and then one record per read:
+
+    "LPCSBREC" version (1 byte) length of the port names (2 bytes) port names, comma separated
+    time (8 bytes, microseconds since the epoch) dongle index (1 byte) length (2 bytes) bytes
+
+little endian. Reads are at most BulkReader.max_read bytes, so a busy
+dongle costs 11 bytes of framing per few kB.
+
+A btsnoop file of a Linux controller (see lpcsb/hci.py) replays too, as
+if its events had been read from hci0.
+"""
+
+from __future__ import print_function
+
+import csv
+import struct
+import sys
+import threading
+import time
+from collections import Counter
+
+from lpcsb.hci import Btsnoop, BTSNOOP_MAGIC
+
+MAGIC = b'LPCSBREC'
+VERSION = 1
+HEADER = struct.Struct('<8sBH')
+CHUNK = struct.Struct('<qBH')
+
+
+class Recorder(object):
+    """ Appends reads to a recording; write() may be called from every
+    reader thread. """
+
+    def __init__(self, path, names, flush_secs=1.0):
+        self.path = path
+        self.flush_secs = flush_secs
+        self.chunks = 0
+        self.bytes = 0
+        self._flushed = time.time()
+        self._lock = threading.Lock()
+        self._file = open(path, 'wb')
+        names = ','.join(names).encode('utf-8')
+        self._file.write(HEADER.pack(MAGIC, VERSION, len(names)) + names)
+
+    def write(self, receiver, data, now=None):
+        if now is None:
+            now = time.time()
+        record = CHUNK.pack(int(round(now * 1e6)), receiver, len(data)) + bytes(data)
+        with self._lock:
+            if self._file is None:
+                return
+            self._file.write(record)
+            self.chunks += 1
+            self.bytes += len(data)
+
+    def tick(self):
+        """ Flush what was written, at most every `flush_secs`. """
+        if time.time() - self._flushed < self.flush_secs:
+            return
+        self._flushed = time.time()
+        with self._lock:
+            if self._file is not None:
+                self._file.flush()
+
+    def close(self):
+        with self._lock:
+            if self._file is not None:
+                self._file.close()
+                self._file = None
+
+
+class Recording(object):
+    """ A recording (or btsnoop file) opened for reading: `names` of the
+    dongles, then chunks() for (time, dongle index, bytes) in the order
+    they were read. """
+
+    def __init__(self, path):
+        self.path = path
+        self._btsnoop = None
+        self._file = open(path, 'rb')
+        header = self._file.read(HEADER.size)
+        if header.startswith(BTSNOOP_MAGIC):
+            self._btsnoop = Btsnoop(path)
+            self.names = self._btsnoop.names
+            return
+        if len(header) < HEADER.size:
+            raise ValueError("%s: not a recording (too short)" % path)
+        magic, version, length = HEADER.unpack(header)
+        if magic != MAGIC:
+            raise ValueError("%s: not a recording" % path)
+        if version != VERSION:
+            raise ValueError("%s: recording version %d, this reads %d" % (path, version, VERSION))
+        self.names = self._file.read(length).decode('utf-8').split(',')
+
+    def chunks(self):
+        if self._btsnoop is not None:
+            for chunk in self._btsnoop.packets():
+                yield chunk
+            return
+        read = self._file.read
+        while True:
+            head = read(CHUNK.size)
+            if len(head) < CHUNK.size:
+                # a recording cut short ends with a partial record
+                return
+            when, receiver, length = CHUNK.unpack(head)
+            data = read(length)
+            if len(data) < length:
+                return
+            yield when / 1e6, receiver, data
+
+    def close(self):
+        self._file.close()
+
+
+class Replayer(object):
+    """ Feeds a Recording to `feed(dongle index, bytes, time)`, paced at
+    `speed` times the recorded rate, or flat out with speed 0. """
+
+    def __init__(self, recording, speed=1.0):
+        self.recording = recording
+        self.speed = speed
+        self.chunks = 0
+        self.bytes = 0
+        self.first = None       # recorded time of the first and last chunk
+        self.last = None
+        self.wall = 0.0         # seconds it took
+
+    def run(self, feed, tick=None, tick_secs=0.5, stop=None):
+        """ Replay everything, or until `stop()` is true. `tick()` is called
+        about every `tick_secs` of wall time, for periodic work such as
+        statistics. """
+        start = time.time()
+        next_tick = start + tick_secs
+        for when, receiver, data in self.recording.chunks():
+            if stop is not None and stop():
+                break
+            if self.first is None:
+                self.first = when
+            self.last = when
+            if self.speed > 0:
+                delay = start + (when - self.first) / self.speed - time.time()
+                if delay > 0:
+                    time.sleep(delay)
+            feed(receiver, data, when)
+            self.chunks += 1
+            self.bytes += len(data)
+            if tick is not None and time.time() >= next_tick:
+                tick()
+                next_tick = time.time() + tick_secs
+        self.wall = time.time() - start
+
+    def span(self):
+        """ Seconds between the first and the last recorded read. """
+        return 0.0 if self.first is None else self.last - self.first
+
+
+# a row is matched with the baseline by these columns, where the CSV has them
+KEY_COLUMNS = ("device", "Service", "sequence_no", "received_time")
+
+
+def _read_csv(path):
+    if sys.version_info[0] < 3:
+        f = open(path, 'rb')
+    else:
+        f = open(path, newline='')
+    with f:
+        rows = list(csv.reader(f))
+    if not rows:
+        raise ValueError("%s: empty" % path)
+    return rows[0], rows[1:]
+
+
+class CsvDiff(object):
+    """ How a scanner CSV differs from a baseline written from the same
+    capture: rows only in one of them, and per column how many matched
+    rows have another value. """
+
+    def __init__(self, baseline, output, examples=5):
+        base_header, base_rows = _read_csv(baseline)
+        header, rows = _read_csv(output)
+        self.baseline = baseline
+        self.output = output
+        self.baseline_rows = len(base_rows)
+        self.rows = len(rows)
+        self.added_columns = [c for c in header if c not in base_header]
+        self.removed_columns = [c for c in base_header if c not in header]
+        common = [c for c in header if c in base_header]
+        key = [c for c in KEY_COLUMNS if c in common] or common
+
+        def index(hdr, table):
+            """ key -> row, with a repeated key numbered (--keep-duplicates) """
+            positions = [hdr.index(c) for c in key]
+            seen = Counter()
+            out = {}
+            for row in table:
+                k = tuple(row[i] if i < len(row) else '' for i in positions)
+                seen[k] += 1
+                out[k + (seen[k],)] = row
+            return out
+
+        base = index(base_header, base_rows)
+        new = index(header, rows)
+        self.missing = [k for k in base if k not in new]
+        self.extra = [k for k in new if k not in base]
+        self.changed = Counter()
+        self.examples = []
+        self.changed_rows = 0
+        pairs = [(c, base_header.index(c), header.index(c)) for c in common if c not in key]
+        for k, row in new.items():
+            old = base.get(k)
+            if old is None:
+                continue
+            differs = False
+            for column, i, j in pairs:
+                a = old[i] if i < len(old) else ''
+                b = row[j] if j < len(row) else ''
+                if a != b:
+                    differs = True
+                    self.changed[column] += 1
+                    if len(self.examples) < examples:
+                        self.examples.append((k[:-1], column, a, b))
+            self.changed_rows += differs
+        self.key = key
+
+    def same(self):
+        return not (self.missing or self.extra or self.changed_rows or self.added_columns or self.removed_columns)
+
+    def report(self):
+        lines = ["Baseline %s: %d rows, this run %d rows" % (self.baseline, self.baseline_rows, self.rows)]
+        if self.same():
+            lines.append("  identical, matched on %s" % ', '.join(self.key))
+            return lines
+        if self.added_columns or self.removed_columns:
+            lines.append("  columns added: %s; removed: %s" % (', '.join(self.added_columns) or "none",
+                                                              ', '.join(self.removed_columns) or "none"))
+        lines.append("  %d rows only in the baseline, %d only in this run, %d changed (matched on %s)" %
+                     (len(self.missing), len(self.extra), self.changed_rows, ', '.join(self.key)))
+        for column, count in self.changed.most_common():
+            lines.append("    %-20s %d rows" % (column, count))
+        for key, column, a, b in self.examples:
+            lines.append("  e.g. %s %s: %r -> %r" % (' '.join(key), column, a, b))
+        return lines
@@ -0,0 +1,483 @@
+""" Minute, quarter hour, hour and day aggregates per board
+
+Every sample of every board is a row in the CSV and in SQLite, so a chart
+of a month has to read half a million rows per board. RollupSink keeps
+tumbling windows per board instead, at each of `resolutions` (1 min,
+15 min, 1 h and 1 day by default, aligned to UTC), and writes each window
+once, when it closes:
+
+    rollup          device, resolution (seconds), start (ns since the epoch),
+                    count of raw color samples, last_time, and for each of
+                    lux, color_temp, red, green, blue and clear:
+                    _mean, _min, _max, _last
+    rollup_dwell    device, resolution, start, light_type, seconds
+
+Dwell is the time a board's light spent as each type: the time from one
+light type (the board's own, or the scanner's classification) to the
+next is credited to the first, for at most `max_gap` seconds, so a board
+that goes quiet stops accruing. A window with no raw color sample but some
+dwell has a count of 0 and no channel values.
+
+Windows close on the time of the data rather than the clock: a board's
+windows close when its next sample is past them, and tick() closes those
+of quiet boards once the newest sample seen, plus the wall time since, is
+`grace` seconds past their end. A replay rolls up the same as the live
+run did. close() writes the windows still open, and a later run merges
+into those rows (counts and dwell add up, means are weighted), so
+restarting the scanner neither loses nor duplicates a window.
+
+RollupSink takes the same add() calls as lpcsb.sqlite_sink.SqliteSink and
+runs beside it on the writer thread:
+
+    python -m lpcsb.scanner ... --sqlite lpcsb.db --rollup lpcsb.db
+
+Rollups of an existing database, queries that read them instead of the raw
+rows, and dropping raw rows the rollups already cover:
+
+    python -m lpcsb.rollup build lpcsb.db [--into rollups.db]
+    python -m lpcsb.rollup query rollups.db --device LPCSB_1 [--since T] [--until T] [--points N]
+    python -m lpcsb.rollup prune lpcsb.db --keep-days 30 [--rollups rollups.db]
+
+query picks the finest resolution that gives at most `points` windows over
+the range, so a year is read as days and an afternoon as minutes.
+"""
+
+from __future__ import print_function
+
+import calendar
+import csv
+import datetime
+import optparse
+import os
+import sqlite3
+import sys
+import time
+
+from lpcsb import output
+
+RESOLUTIONS = (60, 900, 3600, 86400)
+CHANNELS = ('lux', 'color_temp', 'red', 'green', 'blue', 'clear')
+STATS = ('mean', 'min', 'max', 'last')
+
+SECOND_NS = 1000000000
+DAY_NS = 86400 * SECOND_NS
+
+SCHEMA = """
+CREATE TABLE IF NOT EXISTS rollup (
+    device      TEXT NOT NULL,
+    resolution  INTEGER NOT NULL,
+    start       INTEGER NOT NULL,
+    count       INTEGER NOT NULL,
+    last_time   INTEGER,
+    %s,
+    PRIMARY KEY (device, resolution, start)
+) WITHOUT ROWID;
+
+CREATE TABLE IF NOT EXISTS rollup_dwell (
+    device      TEXT NOT NULL,
+    resolution  INTEGER NOT NULL,
+    start       INTEGER NOT NULL,
+    light_type  TEXT NOT NULL,
+    seconds     REAL NOT NULL,
+    PRIMARY KEY (device, resolution, start, light_type)
+) WITHOUT ROWID;
+""" % ',\n    '.join("%s_%s %s" % (c, s, 'REAL' if s == 'mean' else 'INTEGER') for c in CHANNELS for s in STATS)
+
+COLUMNS = ['device', 'resolution', 'start', 'count', 'last_time'] + ['%s_%s' % (c, s) for c in CHANNELS for s in STATS]
+
+
+def _merge(channel, stat):
+    """ How a window written before combines with more of it. """
+    column = '%s_%s' % (channel, stat)
+    if stat == 'mean':
+        return ("%(c)s = (coalesce(%(c)s * count, 0) + coalesce(excluded.%(c)s * excluded.count, 0))"
+                " / nullif(count + excluded.count, 0)" % {'c': column})
+    if stat in ('min', 'max'):
+        return "%(c)s = %(f)s(coalesce(%(c)s, excluded.%(c)s), coalesce(excluded.%(c)s, %(c)s))" % {'c': column, 'f': stat}
+    return ("%(c)s = CASE WHEN excluded.count > 0 AND (count = 0 OR excluded.last_time >= last_time)"
+            " THEN excluded.%(c)s ELSE %(c)s END" % {'c': column})
+
+
+# every expression in the SET reads the row as it was before
+UPSERT = "INSERT INTO rollup VALUES (%s) ON CONFLICT (device, resolution, start) DO UPDATE SET %s" % (
+    ', '.join('?' * len(COLUMNS)),
+    ', '.join([_merge(c, s) for c in CHANNELS for s in STATS] +
+              ["last_time = max(coalesce(last_time, excluded.last_time), coalesce(excluded.last_time, last_time))",
+               "count = count + excluded.count"]))
+UPSERT_DWELL = ("INSERT INTO rollup_dwell VALUES (?, ?, ?, ?, ?) ON CONFLICT (device, resolution, start, light_type)"
+                " DO UPDATE SET seconds = seconds + excluded.seconds")
+
+if hasattr(time, 'time_ns'):
+    _now_ns = time.time_ns
+else:
+    def _now_ns():
+        return int(time.time() * 1e9)
+
+
+class _Window(object):
+    __slots__ = ('start', 'end', 'count', 'last_time', 'sums', 'mins', 'maxs', 'lasts', 'dwell')
+
+    def __init__(self, start, length):
+        self.start = start
+        self.end = start + length
+        self.count = 0
+        self.last_time = None
+        self.sums = [0] * len(CHANNELS)
+        self.mins = [None] * len(CHANNELS)
+        self.maxs = [None] * len(CHANNELS)
+        self.lasts = [None] * len(CHANNELS)
+        self.dwell = {}         # light type -> ns
+
+
+class _Board(object):
+    __slots__ = ('windows', 'cursor', 'light', 'seen')
+
+    def __init__(self, count):
+        self.windows = [None] * count      # open window per resolution
+        self.cursor = None      # dwell is credited up to here
+        self.light = None       # last light type, and when it was seen
+        self.seen = None
+
+
+class RollupSink(object):
+    def __init__(self, path, resolutions=RESOLUTIONS, max_gap=30.0, grace=10.0, batch_secs=5.0, on_window=None):
+        """ `on_window(device, window, dwell)`, if given, gets every window
+        as it is written: a dict of its COLUMNS, and light type -> seconds. """
+        self.path = path
+        self.on_window = on_window
+        self.resolutions = tuple(resolutions)
+        self.lengths = [r * SECOND_NS for r in self.resolutions]
+        self.max_gap_ns = int(max_gap * SECOND_NS)
+        self.grace_ns = int(grace * SECOND_NS)
+        self.batch_secs = batch_secs
+        self.windows_written = 0
+        self.reordered = 0      # samples older than their board's last, counted as of then
+        self.commits = 0
+
+        # used on the writer thread, like SqliteSink's
+        self._db = sqlite3.connect(path, isolation_level=None, check_same_thread=False)
+        self._db.execute("PRAGMA journal_mode=WAL")
+        self._db.execute("PRAGMA synchronous=NORMAL")
+        self._db.executescript(SCHEMA)
+
+        self._boards = {}
+        self._rows = []
+        self._dwell = []
+        self._clock = None          # newest sample time seen, and the wall time then
+        self._clock_wall = None
+        self._next_close = None     # earliest end of any open window
+        self._last_commit = time.time()
+        output.register(self)
+
+    def add(self, device, mac, seq, rssi, raw=None, light_type=None, time_ns=None):
+        """ One record, as for SqliteSink.add(). """
+        if time_ns is None:
+            time_ns = _now_ns()
+        board = self._boards.get(device)
+        if board is None:
+            board = self._boards[device] = _Board(len(self.lengths))
+            board.cursor = time_ns
+        if time_ns < board.cursor:
+            # a copy held up by de-duplication; its window may be gone
+            self.reordered += 1
+            time_ns = board.cursor
+        if self._clock is None or time_ns > self._clock:
+            self._clock = time_ns
+            self._clock_wall = time.time()
+
+        self._advance(device, board, time_ns)
+        windows = board.windows
+        for i, length in enumerate(self.lengths):
+            if windows[i] is None:
+                windows[i] = self._open(time_ns - time_ns % length, length)
+        if raw is not None:
+            values = [getattr(raw, c) for c in CHANNELS]
+            for w in windows:
+                w.count += 1
+                w.last_time = time_ns
+                sums, mins, maxs = w.sums, w.mins, w.maxs
+                for j, v in enumerate(values):
+                    sums[j] += v
+                    if mins[j] is None or v < mins[j]:
+                        mins[j] = v
+                    if maxs[j] is None or v > maxs[j]:
+                        maxs[j] = v
+                w.lasts = values
+        if light_type is not None:
+            board.light = light_type
+            board.seen = time_ns
+
+    def _open(self, start, length):
+        w = _Window(start, length)
+        if self._next_close is None or w.end < self._next_close:
+            self._next_close = w.end
+        return w
+
+    def _credit(self, board, upto):
+        """ Dwell from the cursor to `upto`, for at most max_gap after the
+        light type was seen, to every open window. """
+        if board.light is not None:
+            end = min(upto, board.seen + self.max_gap_ns)
+            if end > board.cursor:
+                light = board.light
+                for w in board.windows:
+                    if w is not None:
+                        w.dwell[light] = w.dwell.get(light, 0) + end - board.cursor
+        if upto > board.cursor:
+            board.cursor = upto
+
+    def _advance(self, device, board, now):
+        """ Close the board's windows that end by `now`, oldest first. """
+        windows = board.windows
+        while True:
+            ends = [w.end for w in windows if w is not None]
+            if not ends or min(ends) > now:
+                break
+            end = min(ends)
+            self._credit(board, end)
+            for i, w in enumerate(windows):
+                if w is not None and w.end == end:
+                    self._emit(device, self.resolutions[i], w)
+                    # dwell still running goes on into the next window
+                    running = board.light is not None and board.seen + self.max_gap_ns > end
+                    windows[i] = self._open(end, self.lengths[i]) if running else None
+        self._credit(board, now)
+
+    def _emit(self, device, resolution, w):
+        if w.count:
+            row = [device, resolution, w.start, w.count, w.last_time]
+            for j in range(len(CHANNELS)):
+                row += [float(w.sums[j]) / w.count, w.mins[j], w.maxs[j], w.lasts[j]]
+        elif w.dwell:
+            row = [device, resolution, w.start, 0, None] + [None] * (len(CHANNELS) * len(STATS))
+        else:
+            return
+        self._rows.append(row)
+        for light, ns in w.dwell.items():
+            self._dwell.append((device, resolution, w.start, light, ns / 1e9))
+        if self.on_window is not None:
+            self.on_window(device, dict(zip(COLUMNS, row)), dict((light, ns / 1e9) for light, ns in w.dwell.items()))
+
+    def tick(self):
+        """ Close the windows of quiet boards, and write closed windows
+        that have waited long enough. Cheap to call often. """
+        if self._next_close is not None and self._clock is not None:
+            now = self._clock + int((time.time() - self._clock_wall) * 1e9) - self.grace_ns
+            if now >= self._next_close:
+                self._next_close = None
+                for device, board in self._boards.items():
+                    self._advance(device, board, now)
+                    for w in board.windows:
+                        if w is not None and (self._next_close is None or w.end < self._next_close):
+                            self._next_close = w.end
+        if (self._rows or self._dwell) and time.time() - self._last_commit >= self.batch_secs:
+            self.flush()
+
+    def flush(self):
+        self._last_commit = time.time()
+        if not (self._rows or self._dwell):
+            return
+        db = self._db
+        db.execute("BEGIN")
+        db.executemany(UPSERT, self._rows)
+        db.executemany(UPSERT_DWELL, self._dwell)
+        db.execute("COMMIT")
+        self.windows_written += len(self._rows)
+        self.commits += 1
+        self._rows = []
+        self._dwell = []
+
+    def close(self):
+        """ Write every window, open ones included. """
+        if self._db is None:
+            return
+        for device, board in self._boards.items():
+            for i, w in enumerate(board.windows):
+                if w is not None:
+                    self._emit(device, self.resolutions[i], w)
+            board.windows = [None] * len(self.lengths)
+        self.flush()
+        self._db.close()
+        self._db = None
+        output.unregister(self)
+
+
+def build(source, into, resolutions=RESOLUTIONS):
+    """ Roll up the raw_color and light_type tables of an lpcsb.sqlite_sink
+    database into `into`, replacing the rollups from the first raw day on;
+    older ones, whose raw rows may have been pruned, are kept. Returns the
+    number of raw rows read. """
+    db = sqlite3.connect(source)
+    first = db.execute("SELECT min(t) FROM (SELECT min(time) AS t FROM raw_color"
+                       " UNION ALL SELECT min(time) FROM light_type)").fetchone()[0]
+    sink = RollupSink(into, resolutions, grace=0)
+    if first is not None:
+        start = first - first % DAY_NS
+        sink._db.execute("DELETE FROM rollup WHERE start >= ?", (start,))
+        sink._db.execute("DELETE FROM rollup_dwell WHERE start >= ?", (start,))
+
+    class Raw(object):
+        __slots__ = CHANNELS
+
+    rows = 0
+    query = ("SELECT device, time, %s, NULL FROM raw_color UNION ALL "
+             "SELECT device, time, %s, light_type FROM light_type ORDER BY time" %
+             (', '.join(CHANNELS), ', '.join(['NULL'] * len(CHANNELS))))
+    for row in db.execute(query):
+        raw = None
+        if row[2] is not None:
+            raw = Raw()
+            for name, value in zip(CHANNELS, row[2:2 + len(CHANNELS)]):
+                setattr(raw, name, value)
+        sink.add(row[0], None, None, None, raw=raw, light_type=row[-1], time_ns=row[1])
+        rows += 1
+    db.close()
+    sink.close()
+    return rows
+
+
+def pick_resolution(since_ns, until_ns, points, resolutions=RESOLUTIONS):
+    """ The finest resolution giving at most `points` windows over the range. """
+    span = max(0, until_ns - since_ns)
+    for r in sorted(resolutions):
+        if span <= points * r * SECOND_NS:
+            return r
+    return max(resolutions)
+
+
+def query(path, device, since_ns, until_ns, points=500, resolution=None):
+    """ (resolution, rows as dicts with a 'dwell' dict of light type ->
+    seconds) for the windows of `device` starting in [since, until). """
+    if resolution is None:
+        resolution = pick_resolution(since_ns, until_ns, points)
+    db = sqlite3.connect(path)
+    try:
+        rows = [dict(zip(COLUMNS, r)) for r in db.execute(
+            "SELECT %s FROM rollup WHERE device = ? AND resolution = ? AND start >= ? AND start < ? ORDER BY start"
+            % ', '.join(COLUMNS), (device, resolution, since_ns, until_ns))]
+        dwell = {}
+        for start, light, seconds in db.execute(
+                "SELECT start, light_type, seconds FROM rollup_dwell"
+                " WHERE device = ? AND resolution = ? AND start >= ? AND start < ?",
+                (device, resolution, since_ns, until_ns)):
+            dwell.setdefault(start, {})[light] = seconds
+    finally:
+        db.close()
+    for row in rows:
+        row['dwell'] = dwell.get(row['start'], {})
+    return resolution, rows
+
+
+def prune(path, keep_days, rollups=None, vacuum=True, now=None):
+    """ Delete raw rows from before the UTC day `keep_days` ago, once every
+    board day in that range has its day rollup in `rollups` (default the
+    same database). Returns (rows deleted, bytes before, bytes after);
+    raises ValueError naming what isn't rolled up yet. """
+    if now is None:
+        now = _now_ns()
+    cutoff = now - now % DAY_NS - keep_days * DAY_NS
+    before = os.path.getsize(path)
+    db = sqlite3.connect(path, isolation_level=None)
+    try:
+        if rollups is not None and os.path.abspath(rollups) != os.path.abspath(path):
+            db.execute("ATTACH DATABASE ? AS r", (rollups,))
+            prefix = "r."
+        else:
+            prefix = ""
+        if not db.execute("SELECT 1 FROM %ssqlite_master WHERE name = 'rollup'" % prefix).fetchone():
+            raise ValueError("no rollups in %s (run 'build' first)" % (rollups or path))
+        missing = db.execute(
+            "SELECT b.device, b.day FROM (SELECT device, time / %(day)d AS day FROM raw_color WHERE time < ?"
+            " UNION SELECT device, time / %(day)d FROM light_type WHERE time < ?) b"
+            " WHERE NOT EXISTS (SELECT 1 FROM %(r)srollup x WHERE x.device = b.device AND x.resolution = 86400"
+            " AND x.start = b.day * %(day)d)"
+            " AND NOT EXISTS (SELECT 1 FROM %(r)srollup_dwell x WHERE x.device = b.device AND x.resolution = 86400"
+            " AND x.start = b.day * %(day)d) ORDER BY b.day LIMIT 5"
+            % {'day': DAY_NS, 'r': prefix}, (cutoff, cutoff)).fetchall()
+        if missing:
+            raise ValueError("not rolled up yet (run 'build' first): %s" % ', '.join(
+                "%s on %s" % (device, datetime.datetime.utcfromtimestamp(day * 86400).date()) for device, day in missing))
+        db.execute("BEGIN")
+        deleted = db.execute("DELETE FROM raw_color WHERE time < ?", (cutoff,)).rowcount
+        deleted += db.execute("DELETE FROM light_type WHERE time < ?", (cutoff,)).rowcount
+        db.execute("COMMIT")
+        if vacuum and deleted:
+            if prefix:
+                db.execute("DETACH DATABASE r")
+            db.execute("VACUUM")
+        db.execute("PRAGMA wal_checkpoint(TRUNCATE)")
+    finally:
+        db.close()
+    return deleted, before, os.path.getsize(path)
+
+
+def parse_time(text):
+    """ '2020-03-12', '2020-03-12T14:00' (UTC) or seconds since the epoch -> ns """
+    try:
+        return int(float(text) * SECOND_NS)
+    except ValueError:
+        pass
+    for fmt in ("%Y-%m-%dT%H:%M:%S", "%Y-%m-%dT%H:%M", "%Y-%m-%d"):
+        try:
+            t = datetime.datetime.strptime(text, fmt)
+        except ValueError:
+            continue
+        return calendar.timegm(t.timetuple()) * SECOND_NS
+    raise ValueError("can't read time '%s'" % text)
+
+
+def main():
+    usage = "%prog build DB [--into ROLLUPS] | query ROLLUPS --device NAME [...] | prune DB --keep-days N [...]"
+    p = optparse.OptionParser(usage=usage, description="Rollups of the LPCSB SQLite store")
+    p.add_option('--into', help="build: database for the rollups (default the same one)")
+    p.add_option('--device', help="query: board name")
+    p.add_option('--since', help="query: from this UTC time, e.g. 2020-03-01 (default 30 days ago)")
+    p.add_option('--until', help="query: up to this UTC time (default now)")
+    p.add_option('--points', type='int', default=500, help="query: at most this many windows (default 500)")
+    p.add_option('--resolution', type='int', help="query: window length in seconds, instead of by --points")
+    p.add_option('--keep-days', type='int', help="prune: raw rows of this many days back are kept")
+    p.add_option('--rollups', help="prune: database with the rollups (default the same one)")
+    p.add_option('--no-vacuum', action='store_true', help="prune: leave the file size alone")
+    options, args = p.parse_args()
+    if len(args) != 2 or args[0] not in ('build', 'query', 'prune'):
+        p.error("give a command and a database")
+    command, path = args
+    try:
+        _run(command, path, options, p)
+    except sqlite3.DatabaseError as e:
+        raise SystemExit("%s: %s" % (path, e))
+
+
+def _run(command, path, options, p):
+    if command == 'build':
+        start = time.time()
+        rows = build(path, options.into or path)
+        print("%d raw rows rolled up in %.1f s into %s" % (rows, time.time() - start, options.into or path))
+    elif command == 'query':
+        if not options.device:
+            p.error("query needs --device")
+        try:
+            until = parse_time(options.until) if options.until else _now_ns()
+            since = parse_time(options.since) if options.since else until - 30 * DAY_NS
+        except ValueError as e:
+            p.error(str(e))
+        resolution, rows = query(path, options.device, since, until, options.points, options.resolution)
+        out = csv.writer(sys.stdout)
+        lights = sorted(set(light for row in rows for light in row['dwell']))
+        out.writerow(["start", "resolution"] + COLUMNS[3:] + ["dwell %s" % light for light in lights])
+        for row in rows:
+            start = datetime.datetime.utcfromtimestamp(row['start'] // SECOND_NS).strftime("%Y-%m-%dT%H:%M:%SZ")
+            out.writerow([start, resolution] + ['' if row[c] is None else row[c] for c in COLUMNS[3:]] +
+                         ["%.1f" % row['dwell'].get(light, 0) for light in lights])
+    else:
+        if options.keep_days is None:
+            p.error("prune needs --keep-days")
+        try:
+            deleted, before, after = prune(path, options.keep_days, options.rollups, not options.no_vacuum)
+        except ValueError as e:
+            raise SystemExit("%s: %s" % (path, e))
+        print("%d raw rows deleted, %.1f MB -> %.1f MB" % (deleted, before / 1e6, after / 1e6))
+
+
+if __name__ == '__main__':
+    main()
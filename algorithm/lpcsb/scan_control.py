@@ -0,0 +1,156 @@
+""" Adapting the scan duty cycle to what the boards need
+
+A dongle scanning with window == interval listens all the time, which is
+right for a gateway on mains power. On battery, or on a USB hub shared
+with other radios, listening less is worth some loss, and the boards leave
+slack: each sample is advertised several times (sample period over
+advertising interval), so a scan that hears only part of the
+advertisements still gets most of the samples.
+
+ScanController keeps the scan interval and moves the window down a ladder
+of rungs, each listening about 70 % as long as the one above. It starts
+at the configured window and goes no lower than `min_duty` of the
+interval (and no lower than 4, i.e. 2.5 ms). Every `period` seconds it
+works out, per board, the samples captured and the ones lost over that
+period, from lpcsb.seqstats.SeqTracker's sequence gaps. It then looks at
+the board at the `quantile` of those capture rates, so one board at the
+edge of range doesn't hold the others at full duty. Boards with fewer
+than `min_samples` samples due are left out.
+
+    below `target`      up two rungs at once, and the rung that failed is
+                        barred for `backoff` periods
+    at or above it      down one rung after `hold` such periods in a row,
+                        unless the rung below is barred
+
+Changing the window restarts discovery (gap_end_procedure,
+gap_set_scan_parameters, gap_discover, or the HCI equivalents), so that
+only happens on a change, through the `apply(interval, window)` callback.
+Each period is counted from the end of the one before, so a period after
+a change mostly measures the new rung.
+
+Neither BGAPI nor the HCI LE Set Scan Parameters command takes a channel
+map for scanning, so all three advertising channels are always scanned.
+
+The scanner runs it with --scan-target; see lpcsb/scanner.py.
+"""
+
+from __future__ import print_function
+
+import time
+from collections import deque
+
+# each rung listens about this share of the one above
+RUNG_STEP = 2 ** -0.5
+
+# BGAPI's and HCI's smallest scan window, 2.5 ms
+MIN_WINDOW = 4
+
+
+class ScanController(object):
+    def __init__(self, tracker, apply, interval, window, target=0.95, period=60.0, min_duty=0.1,
+                 quantile=0.1, min_samples=3, hold=2, backoff=10, verbose=True, now=None):
+        """ `apply(interval, window)` restarts every dongle's scan with the
+        new window; both are in 0.625 ms units. With `verbose` every
+        change is printed. """
+        self.tracker = tracker
+        self.apply = apply
+        self.interval = interval
+        self.target = target
+        self.period = period
+        self.quantile = quantile
+        self.min_samples = min_samples
+        self.hold = hold
+        self.backoff = backoff
+        self.verbose = verbose
+
+        # windows from the configured one down
+        floor = max(MIN_WINDOW, min_duty * interval)
+        self.windows = [window]
+        while True:
+            lower = int(round(self.windows[-1] * RUNG_STEP))
+            if lower < floor or lower == self.windows[-1]:
+                break
+            self.windows.append(lower)
+
+        self.rung = 0
+        self.periods = 0
+        self.changes = 0
+        self.capture = None     # rate the last decision was made on, and over how many boards
+        self.boards = 0
+        self.history = deque(maxlen=20)
+        self._good = 0
+        self._barred = {}       # rung -> period it may be tried again
+        self._base = self._counts()
+        self._next = (time.time() if now is None else now) + period
+
+    @property
+    def window(self):
+        return self.windows[self.rung]
+
+    def _counts(self):
+        """ device -> (samples received, samples missing) since start """
+        counts = {}
+        for (device, service), stream in self.tracker.streams.items():
+            samples, missing = counts.get(device, (0, 0))
+            total = stream.total
+            counts[device] = (samples + total.samples, missing + total.lost - total.late)
+        return counts
+
+    def tick(self, now=None):
+        if now is None:
+            now = time.time()
+        if now < self._next:
+            return
+        self._next = now + self.period
+        self.evaluate(now)
+
+    def evaluate(self, now=None):
+        """ Decide on the period just ended; returns the window, changed or not. """
+        counts = self._counts()
+        rates = []
+        for device, (samples, missing) in counts.items():
+            samples0, missing0 = self._base.get(device, (0, 0))
+            got = samples - samples0
+            due = got + max(0, missing - missing0)
+            if due >= self.min_samples:
+                rates.append(got / float(due))
+        self._base = counts
+        self.periods += 1
+        if not rates:
+            # nothing to go on: no boards, or all too quiet
+            return self.window
+
+        rates.sort()
+        capture = rates[int(self.quantile * (len(rates) - 1))]
+        self.capture = capture
+        self.boards = len(rates)
+        if capture < self.target:
+            self._good = 0
+            if self.rung > 0:
+                self._barred[self.rung] = self.periods + self.backoff
+                self._move(max(0, self.rung - 2), now)
+        elif self.rung + 1 < len(self.windows) and self._barred.get(self.rung + 1, 0) <= self.periods:
+            self._good += 1
+            if self._good >= self.hold:
+                self._good = 0
+                self._move(self.rung + 1, now)
+        return self.window
+
+    def _move(self, rung, now):
+        before = self.window
+        self.rung = rung
+        self.changes += 1
+        self.history.append((now, self.window, self.capture))
+        if self.verbose:
+            print("Scan window %d -> %d of %d (%.0f%% duty): %.1f%% of samples captured at the %s over %d boards, target %.1f%%" %
+                  (before, self.window, self.interval, 100.0 * self.window / self.interval, 100 * self.capture,
+                   "worst" if self.quantile == 0 else "%gth percentile" % (100 * self.quantile),
+                   self.boards, 100 * self.target))
+        self.apply(self.interval, self.window)
+
+    def stats(self):
+        return {'interval': self.interval, 'window': self.window,
+                'duty': float(self.window) / self.interval, 'rung': self.rung,
+                'windows': list(self.windows), 'target': self.target, 'capture': self.capture,
+                'boards': self.boards, 'periods': self.periods, 'changes': self.changes,
+                'history': [{'time': t, 'window': w, 'capture': c} for t, w, c in self.history]}
@@ -0,0 +1,834 @@
+#!/usr/bin/env python
+
+""" LPCSB scanner for the Bluegiga BLED112
+
+One scanner for every LPCSB service. It reads one or more BLED112 dongles
+(lpcsb.capture), decodes each advertisement with the decoder registered for
+its (company, service) (lpcsb.decode), keeps the boards listed in the device
+registry (lpcsb.devices), drops repeated samples (lpcsb.seqstats), runs the
+samples through a chain of classifiers (lpcsb.classify) and hands one row
+per sample to the writer thread (lpcsb.pipeline), which writes the CSV and
+any Parquet or SQLite sinks.
+
+    python -m lpcsb.scanner -p /dev/ttyACM0 [--profile NAME] [options]
+
+A profile picks the services, the classifiers, the CSV columns and the
+default file name:
+
+    all            every service, ratios and rules; the default here
+    led-data       raw color with the channel ratios ("LPCSB LED Data.csv")
+    ceiling-id     raw color classified by the rules ("LPCSB Ceiling ID.csv")
+    multiservice   raw color and the board's light type ("LPCSB MultiService.csv")
+
+The last three are the CSVs of the scanner scripts this replaced, which are
+now thin wrappers that run it with their profile. --services and
+--classifiers override the profile's choice; "--profile ceiling-id
+--classifiers model,ratios" labels with a model from lpcsb/train.py
+instead of the rules.
+
+-p hci0 scans with a Linux Bluetooth controller instead of a dongle, over
+a raw HCI socket; see lpcsb/hci.py.
+
+--scan-target 0.95 narrows the scan window for as long as the boards still
+get 95 % of their samples through, to save power; see lpcsb/scan_control.py.
+
+--record saves the raw bytes from the dongles and --replay feeds such a
+recording through everything after the serial port again, at the recorded
+pace or faster, for regression tests and profiling; see lpcsb/replay.py.
+
+Based on Jeff Rowberg's BGAPI scanner for the BLED112, which is where the
+serial port, scan and filter options come from.
+"""
+
+from __future__ import print_function
+
+__author__ = "Jeff Rowberg, modified by Alexander Sarris"
+__license__ = "MIT"
+__version__ = "2013-04-07"
+__email__ = "jeff@rowberg.net"
+
+import datetime
+import optparse
+import re
+import signal
+import struct
+import sys
+from collections import namedtuple
+
+import socket
+
+import serial
+
+from lpcsb import classify
+from lpcsb.capture import MultiCapture
+from lpcsb.decode import lookup, decoder_names, mac_str, light_type_name, LightType, Telemetry, DECODERS
+from lpcsb.hci import HciSocket, HciError, is_hci
+from lpcsb.devices import Device, load as load_devices, DEFAULT_FILE as DEFAULT_DEVICES
+from lpcsb.events import EventSink
+from lpcsb.output import RotatingCsvWriter, parse_size, close_all
+from lpcsb.pipeline import SinkWorker, BLOCK, DROP
+from lpcsb.publish import Publisher, parse_address
+from lpcsb.replay import CsvDiff, Recorder, Recording, Replayer
+from lpcsb.scan_control import ScanController
+from lpcsb.seqstats import SeqTracker, StatsReporter, DUPLICATE
+from lpcsb.rollup import RollupSink
+from lpcsb.sqlite_sink import SqliteSink
+
+# A CSV column: header, row field, and what to write when a record doesn't
+# have that field (a light type row has no color channels)
+Column = namedtuple('Column', 'header field missing')
+Profile = namedtuple('Profile', 'output services classifiers columns')
+
+BASE_COLUMNS = [Column("device", 'device', ''), Column("device_id", 'device_id', ''),
+                Column("received_time", 'received_time', ''), Column("sequence_no", 'seq', ''),
+                Column("rssi", 'rssi', '')]
+COLOR_COLUMNS = [Column("Color Temp", 'color_temp', "N/A"), Column("Lux", 'lux', "N/A"),
+                 Column("Red", 'red', "N/A"), Column("Green", 'green', "N/A"),
+                 Column("Blue", 'blue', "N/A"), Column("Clear", 'clear', "N/A")]
+RATIO_COLUMNS = [Column("Max. Ratio", 'max_ratio', "N/A"), Column("Min. Ratio", 'min_ratio', "N/A"),
+                 Column("Comparing Ratios", 'ratio_compare', "N/A")]
+LIGHT_TYPE_COLUMN = Column("Light Type", 'light_type', "Unknown")
+
+PROFILES = {
+    'all': Profile("%Y%m%d LPCSB Scanner.csv", ('raw_color', 'light_type', 'telemetry'), ('ratios', 'rules'),
+                   BASE_COLUMNS + [Column("Service", 'service', '')] + COLOR_COLUMNS +
+                   [LIGHT_TYPE_COLUMN] + RATIO_COLUMNS),
+    'led-data': Profile("%Y%m%d LPCSB LED Data.csv", ('raw_color',), ('ratios',),
+                        BASE_COLUMNS + COLOR_COLUMNS + RATIO_COLUMNS),
+    'ceiling-id': Profile("%Y%m%d LPCSB Ceiling ID.csv", ('raw_color',), ('rules', 'ratios'),
+                          BASE_COLUMNS + [LIGHT_TYPE_COLUMN] + COLOR_COLUMNS + RATIO_COLUMNS[2:]),
+    'multiservice': Profile("%Y%m%d LPCSB MultiService.csv", ('raw_color', 'light_type', 'telemetry'), (),
+                            BASE_COLUMNS + COLOR_COLUMNS + [LIGHT_TYPE_COLUMN]),
+}
+
+
+class IndentedHelpFormatterWithNL(optparse.IndentedHelpFormatter):
+    def format_description(self, description):
+        if not description: return ""
+        desc_width = self.width - self.current_indent
+        indent = " "*self.current_indent
+        bits = description.split('\n')
+        formatted_bits = [
+            optparse.textwrap.fill(bit,
+                desc_width,
+                initial_indent=indent,
+                subsequent_indent=indent)
+            for bit in bits]
+        result = "\n".join(formatted_bits) + "\n"
+        return result
+
+    def format_option(self, option):
+        result = []
+        opts = self.option_strings[option]
+        opt_width = self.help_position - self.current_indent - 2
+        if len(opts) > opt_width:
+            opts = "%*s%s\n" % (self.current_indent, "", opts)
+            indent_first = self.help_position
+        else: # start help on same line as opts
+            opts = "%*s%-*s  " % (self.current_indent, "", opt_width, opts)
+            indent_first = 0
+        result.append(opts)
+        if option.help:
+            help_text = self.expand_default(option)
+            help_lines = []
+            for para in help_text.split("\n"):
+                help_lines.extend(optparse.textwrap.wrap(para, self.help_width))
+            result.append("%*s%s\n" % (
+                indent_first, "", help_lines[0]))
+            result.extend(["%*s%s\n" % (self.help_position, "", line)
+                for line in help_lines[1:]])
+        elif opts[-1] != "\n":
+            result.append("\n")
+        return "".join(result)
+
+
+class MyParser(optparse.OptionParser):
+    def format_epilog(self, formatter=None):
+        return self.epilog
+
+    def format_option_help(self, formatter=None):
+        formatter = IndentedHelpFormatterWithNL()
+        formatter.store_option_strings(self)
+        result = []
+        result.append(formatter.format_heading(optparse._("Options")))
+        formatter.indent()
+        if self.option_list:
+            result.append(optparse.OptionContainer.format_option_help(self, formatter))
+            result.append("\n")
+        for group in self.option_groups:
+            result.append(group.format_help(formatter))
+            result.append("\n")
+        formatter.dedent()
+        # Drop the last "\n", or the header if no options or option groups:
+        return "".join(result[:-1])
+
+
+EPILOG = """Examples:
+
+    python -m lpcsb.scanner -p /dev/ttyACM0
+
+\tEvery LPCSB service from the boards in lpcsb/devices.ini, raw color
+\tclassified on the fly, into "YYYYMMDD LPCSB Scanner.csv"
+
+    python -m lpcsb.scanner -p COM13,COM14 --profile multiservice
+
+\tTwo dongles, the MultiService CSV layout
+
+    python -m lpcsb.scanner -p /dev/ttyUSB0 --devices site.ini --any-device
+
+\tNames from site.ini, and boards not listed there logged under their address
+
+    python -m lpcsb.scanner -m 00:07:80 -m 08:57:82:bb:27:37
+
+\tOnly devices with a Bluetooth address (MAC) starting with the
+\tBluegiga OUI (00:07:80), or exactly matching 08:57:82:bb:27:37
+
+"""
+
+
+def fail(p, message, show_help=True):
+    if show_help:
+        p.print_help()
+    print("\n================================================================")
+    print(message)
+    print("================================================================")
+    sys.exit(1)
+
+
+def parse_options(default_profile):
+    p = MyParser(description='LPCSB scanner for Bluegiga BLED112 v2013-03-30', epilog=EPILOG)
+
+    # set all defaults for options
+    p.set_defaults(port="COM13", baud=115200, interval=0xC8, window=0xC8, dedup_hold=0.25, display="trpsabd", uuid=[], mac=[], rssi=0, active=False, quiet=False, friendly=False,
+                   profile=default_profile, services=None, classifiers=None, devices=DEFAULT_DEVICES, any_device=False,
+                   output=None, rotate_size=None, flush_rows=100, flush_secs=5.0, archive=None, sqlite=None, rollup=None, events=None,
+                   publish=None, publish_buffer=1000,
+                   keep_duplicates=False, stats=None, stats_http=None, stats_secs=10.0,
+                   queue_size=10000, backpressure=BLOCK, record=None, replay=None, speed=1.0, baseline=None,
+                   scan_target=None, scan_period=60.0, scan_min_duty=0.1)
+
+    # create serial port options argument group
+    group = optparse.OptionGroup(p, "Serial Port Options")
+    group.add_option('--port', '-p', type="string", help="Serial port device name (default %s)\n"
+        "Several dongles can scan together, e.g. COM13,COM14; see lpcsb/capture.py\n"
+        "A Linux Bluetooth controller such as hci0 can stand in for a dongle; see lpcsb/hci.py" % p.defaults['port'], metavar="PORT[,PORT...]")
+    group.add_option('--baud', '-b', type="int", help="Serial port baud rate (default 115200)", metavar="BAUD")
+    group.add_option('--dedup-hold', type="float", help="With several ports, how long the first copy of an advertisement waits "
+        "for copies from the other dongles (default %.2f)" % p.defaults['dedup_hold'], metavar="SECONDS")
+    p.add_option_group(group)
+
+    # create scan options argument group
+    group = optparse.OptionGroup(p, "Scan Options")
+    group.add_option('--interval', '-i', type="int", help="Scan interval width in units of 0.625ms (default 200)", metavar="INTERVAL")
+    group.add_option('--window', '-w', type="int", help="Scan window width in units of 0.625ms (default 200)", metavar="WINDOW")
+    group.add_option('--active', '-a', action="store_true", help="Perform active scan (default passive)\nNOTE: active scans result "
+                                                                 "in a 'scan response' request being sent to the slave device, which "
+                                                                 "should send a follow-up scan response packet. This will result in "
+                                                                 "increased power consumption on the slave device, except for LPCSB "
+                                                                 "firmware built with ADV_ACK_MODE, which treats the request as an "
+                                                                 "acknowledgement and stops repeating the sample.")
+    group.add_option('--scan-target', type="float", help="Narrow the scan window, at most down to --scan-min-duty, while boards still "
+        "deliver this share of their samples, e.g. 0.95; --window is then the widest (default: fixed window); "
+        "see lpcsb/scan_control.py", metavar="SHARE")
+    group.add_option('--scan-period', type="float", help="Seconds of traffic each --scan-target decision is made on (default %g)" %
+        p.defaults['scan_period'], metavar="SECONDS")
+    group.add_option('--scan-min-duty', type="float", help="Narrowest window for --scan-target, as a share of the interval (default %g)" %
+        p.defaults['scan_min_duty'], metavar="SHARE")
+    p.add_option_group(group)
+
+    # create decoding options argument group
+    group = optparse.OptionGroup(p, "Decoding Options")
+    group.add_option('--profile', type="choice", choices=sorted(PROFILES), help="Services, classifiers, CSV columns and file name "
+        "to start from: %s (default %s)" % (', '.join(sorted(PROFILES)), default_profile), metavar="NAME")
+    group.add_option('--services', type="string", help="Comma separated services to log, of %s "
+        "(default: the profile's)" % ', '.join(decoder_names()), metavar="LIST")
+    group.add_option('--classifiers', type="string", help="Comma separated classifiers to run on each sample, in order, of %s; "
+        "'none' for none (default: the profile's); see lpcsb/classify.py" % ', '.join(sorted(classify.CLASSIFIERS)), metavar="LIST")
+    group.add_option('--devices', type="string", help="Device registry naming the boards to log (default lpcsb/devices.ini); "
+        "see lpcsb/devices.py", metavar="FILE")
+    group.add_option('--any-device', action="store_true", help="Also log boards that aren't in the registry, named by their address")
+    p.add_option_group(group)
+
+    # create filter options argument group
+    group = optparse.OptionGroup(p, "Filter Options")
+    group.add_option('--uuid', '-u', type="string", action="append", help="Service UUID(s) to match", metavar="UUID")
+    group.add_option('--mac', '-m', type="string", action="append", help="MAC address(es) to match", metavar="ADDRESS")
+    group.add_option('--rssi', '-r', type="int", help="RSSI minimum filter (-110 to -20), omit to disable", metavar="RSSI")
+    p.add_option_group(group)
+
+    # create output options argument group
+    group = optparse.OptionGroup(p, "Output Options")
+    group.add_option('--quiet', '-q', action="store_true", help="Quiet mode (suppress initial scan parameter display)")
+    group.add_option('--friendly', '-f', action="store_true", help="Friendly mode (output in human-readable format)")
+    group.add_option('--display', '-d', type="string", help="Display fields and order (default '%s')\n"
+        "  t = Unix time, with milliseconds\n"
+        "  r = RSSI measurement (signed integer)\n"
+        "  p = Packet type (0 = normal, 4 = scan response)\n"
+        "  s = Sender MAC address (hexadecimal)\n"
+        "  a = Address type (0 = public, 1 = random)\n"
+        "  b = Bonding status (255 = no bond, else bond handle)\n"
+        "  d = Advertisement data payload (hexadecimal)" % p.defaults['display'], metavar="FIELDS")
+    group.add_option('--output', '-o', type="string", help="CSV file name, strftime() codes allowed (default: the profile's, "
+        "e.g. '%s')\n"
+        "A new file is started whenever the name changes, so '%%Y%%m%%d' rotates daily "
+        "and '%%Y%%m%%d-%%H' hourly" % PROFILES[default_profile].output.replace('%', '%%'), metavar="TEMPLATE")
+    group.add_option('--rotate-size', type="string", help="Also start a new numbered file once this size is reached (e.g. 10M)", metavar="SIZE")
+    group.add_option('--flush-rows', type="int", help="Write buffered CSV/SQLite rows once this many are queued (default 100)", metavar="ROWS")
+    group.add_option('--flush-secs', type="float", help="Write buffered CSV/SQLite rows at least this often (default 5)", metavar="SECONDS")
+    group.add_option('--archive', type="string", help="Also write records to this Parquet file, see lpcsb/archive.py (needs pyarrow)", metavar="FILE")
+    group.add_option('--sqlite', type="string", help="Also write records to this SQLite database, see lpcsb/sqlite_sink.py", metavar="FILE")
+    group.add_option('--rollup', type="string", help="Also keep minute, quarter hour, hour and day aggregates per board in this SQLite "
+        "database, which may be the --sqlite one; see lpcsb/rollup.py", metavar="FILE")
+    group.add_option('--events', type="string", help="Also append lights on/off and light source change events to this JSON lines file, "
+        "see lpcsb/events.py", metavar="FILE")
+    group.add_option('--publish', type="string", help="Serve records, and rollups with --rollup, live to subscribers on 127.0.0.1:PORT, HOST:PORT "
+        "(newline-delimited JSON or WebSocket) or a Unix socket at PATH; see lpcsb/publish.py", metavar="PORT|HOST:PORT|PATH")
+    group.add_option('--publish-buffer', type="int", help="Messages queued per subscriber before its oldest are dropped (default %d)" %
+        p.defaults['publish_buffer'], metavar="N")
+    group.add_option('--keep-duplicates', action="store_true", help="Log every copy of a sample, not just the first (the board repeats each one)")
+    group.add_option('--stats', type="string", help="Write per-board packet loss, duplicate and timing statistics to this JSON file, see lpcsb/seqstats.py", metavar="FILE")
+    group.add_option('--stats-http', type="int", help="Serve the same statistics at http://127.0.0.1:PORT/", metavar="PORT")
+    group.add_option('--stats-secs', type="float", help="How often the statistics are refreshed (default 10)", metavar="SECONDS")
+    group.add_option('--queue-size', type="int", help="Capacity of the queues between the serial readers, decoding and the writer thread (default %d)" % p.defaults['queue_size'], metavar="N")
+    group.add_option('--backpressure', type="choice", choices=[BLOCK, DROP], help="When the writer falls behind, '%s' holds up decoding (packets are then dropped at the serial intake instead) "
+        "and '%s' drops rows (default %s); see lpcsb/pipeline.py" % (BLOCK, DROP, p.defaults['backpressure']), metavar="block|drop")
+    p.add_option_group(group)
+
+    # create record and replay options argument group
+    group = optparse.OptionGroup(p, "Record and Replay Options")
+    group.add_option('--record', type="string", help="Also save the raw bytes from the dongles, with their times, to this file; see lpcsb/replay.py", metavar="FILE")
+    group.add_option('--replay', type="string", help="Read this recording instead of the serial ports, then report and exit", metavar="FILE")
+    group.add_option('--speed', type="float", help="Replay at this many times the recorded pace, 0 for as fast as possible (default 1)", metavar="FACTOR")
+    group.add_option('--baseline', type="string", help="After replaying, compare the CSV written with this one from an earlier run", metavar="CSV")
+    p.add_option_group(group)
+
+    # actually parse all of the arguments
+    options, arguments = p.parse_args()
+    profile = PROFILES[options.profile]
+
+    # validate any supplied MAC address filters
+    options.filter_mac = []
+    for arg in options.mac:
+        if re.search('[^a-fA-F0-9:]', arg):
+            fail(p, "Invalid MAC filter argument '%s'\n-->must be in the form AA:BB:CC:DD:EE:FF" % arg)
+        arg2 = arg.replace(":", "").upper()
+        if (len(arg2) % 2) == 1:
+            fail(p, "Invalid MAC filter argument '%s'\n--> must be 1-6 full bytes in 0-padded hex form (00:01:02:03:04:05)" % arg)
+        options.filter_mac.append([int(arg2[i : i + 2], 16) for i in range(0, len(arg2), 2)])
+
+    # validate any supplied UUID filters
+    options.filter_uuid = []
+    for arg in options.uuid:
+        arg2 = arg.replace(":", "").upper()
+        if re.search('[^a-fA-F0-9:]', arg) or (len(arg2) != 4 and len(arg2) != 32):
+            fail(p, "Invalid UUID filter argument '%s'\n--> must be 2 or 16 full bytes in 0-padded hex form (180B or 0123456789abcdef0123456789abcdef)" % arg)
+        options.filter_uuid.append([int(arg2[i : i + 2], 16) for i in range(0, len(arg2), 2)])
+
+    # validate RSSI filter argument
+    options.filter_rssi = abs(int(options.rssi))
+    if options.filter_rssi > 0 and (options.filter_rssi < 20 or options.filter_rssi > 110):
+        fail(p, "Invalid RSSI filter argument '%s'\n--> must be between 20 and 110" % options.filter_rssi)
+
+    # validate scan parameters; both are in 0.625 ms units, 2.5 ms to 10.24 s
+    if not (4 <= options.interval <= 0x4000 and 4 <= options.window <= options.interval):
+        fail(p, "Invalid scan interval %d and window %d\n--> must be 4 to 16384, the window no longer than the interval" %
+             (options.interval, options.window))
+    if options.scan_target is not None:
+        if not 0 < options.scan_target <= 1:
+            fail(p, "Invalid scan target '%s'\n--> must be a share of samples, more than 0 and at most 1" % options.scan_target)
+        if not 0 < options.scan_min_duty <= 1 or options.scan_period <= 0:
+            fail(p, "Invalid --scan-min-duty or --scan-period\n--> the duty must be more than 0 and at most 1, the period more than 0")
+        if options.replay:
+            fail(p, "--scan-target is for scanning, a recording can't be heard again with another window")
+
+    # validate field output options
+    options.display = options.display.lower()
+    if re.search('[^trpsabd]', options.display):
+        fail(p, "Invalid display options '%s'\n--> must be some combination of 't', 'r', 'p', 's', 'a', 'b', 'd'" % options.display)
+
+    # services, classifiers and devices
+    if options.services is None:
+        options.services = list(profile.services)
+    else:
+        options.services = [s.strip() for s in options.services.split(',') if s.strip()]
+        unknown = [s for s in options.services if s not in decoder_names()]
+        if unknown or not options.services:
+            fail(p, "Invalid services '%s'\n--> must be some of %s" % (', '.join(unknown), ', '.join(decoder_names())))
+
+    if options.classifiers is None:
+        options.classifiers = list(profile.classifiers)
+    elif options.classifiers.strip().lower() == 'none':
+        options.classifiers = []
+    else:
+        options.classifiers = [c.strip() for c in options.classifiers.split(',') if c.strip()]
+    try:
+        classify.chain(options.classifiers)
+    except ValueError as e:
+        fail(p, "Invalid classifiers\n--> %s" % e)
+
+    try:
+        options.registry = load_devices(options.devices)
+    except ValueError as e:
+        fail(p, "Invalid device registry\n--> %s" % e, show_help=False)
+
+    if options.output is None:
+        options.output = profile.output
+
+    # validate output file options
+    options.rotate_bytes = 0
+    if options.rotate_size:
+        try:
+            options.rotate_bytes = parse_size(options.rotate_size)
+        except ValueError:
+            fail(p, "Invalid rotate size '%s'\n--> must be a byte count, optionally with a k, M or G suffix" % options.rotate_size)
+
+    if options.replay:
+        try:
+            options.recording = Recording(options.replay)
+        except (IOError, ValueError) as e:
+            fail(p, "Invalid recording\n--> %s" % e, show_help=False)
+        if options.record:
+            fail(p, "--record and --replay don't go together")
+        if options.speed < 0:
+            fail(p, "Invalid replay speed '%s'\n--> must be 0 (as fast as possible) or more" % options.speed)
+    elif options.baseline:
+        fail(p, "--baseline is for --replay")
+
+    if options.publish:
+        try:
+            parse_address(options.publish)
+        except ValueError as e:
+            fail(p, "Invalid publish address %s\n--> %s" % (options.publish, e))
+    if options.publish_buffer < 1:
+        fail(p, "Invalid publish buffer %d\n--> must be at least 1 message" % options.publish_buffer)
+
+    if options.archive:
+        try:
+            from lpcsb.archive import ParquetSink
+        except ImportError:
+            fail(p, "--archive needs pyarrow, which could not be imported")
+
+    return options
+
+
+def print_summary(options):
+    print("================================================================")
+    print("BLED112 Scanner for Python v%s" % __version__)
+    print("================================================================")
+    if options.replay:
+        print("Replaying:\t%s from %s, %s" % (options.replay, ', '.join(options.recording.names),
+                                             "%gx speed" % options.speed if options.speed else "as fast as possible"))
+    else:
+        if all(is_hci(port) for port in options.port.split(',')):
+            print("HCI device:\t%s" % options.port)
+        else:
+            print("Serial port:\t%s" % options.port)
+            print("Baud rate:\t%s" % options.baud)
+    print("Scan interval:\t%d (%.02f ms)" % (options.interval, options.interval * 0.625))
+    print("Scan window:\t%d (%.02f ms)" % (options.window, options.window * 0.625))
+    if options.scan_target is not None:
+        print("Adaptive scan:\t%.1f%% of samples, down to %.0f%% duty, every %g s" %
+              (100 * options.scan_target, 100 * options.scan_min_duty, options.scan_period))
+    print("Scan type:\t%s" % ['Passive', 'Active'][options.active])
+    print("Profile:\t%s" % options.profile)
+    print("Services:\t%s" % ', '.join(options.services))
+    print("Classifiers:\t%s" % (', '.join(options.classifiers) or "None"))
+    print("Devices:\t%d from %s%s" % (len(options.registry), options.registry.path,
+                                      ", and any other board" if options.any_device else ""))
+    print("UUID filters:\t%s" % (", ".join("0x" + ''.join('%02X' % b for b in uuid) for uuid in options.filter_uuid) or "None"))
+    print("MAC filter(s):\t%s" % (", ".join(':'.join('%02X' % b for b in mac) for mac in options.filter_mac) or "None"))
+    print("RSSI filter:\t%s" % ("-%d dBm minimum" % options.filter_rssi if options.filter_rssi > 0 else "None"))
+    field_dict = { 't':'Time', 'r':'RSSI', 'p':'Packet type', 's':'Sender MAC', 'a':'Address type', 'b':'Bond status', 'd':'Payload data' }
+    print("Display fields:\t- " + "\n\t\t- ".join([field_dict[c] for c in options.display]))
+    print("Friendly mode:\t%s" % ['Disabled', 'Enabled'][options.friendly])
+    print("Output file:\t%s" % options.output)
+    if options.archive:
+        print("Archive file:\t%s" % options.archive)
+    if options.sqlite:
+        print("SQLite file:\t%s" % options.sqlite)
+    if options.rollup:
+        print("Rollups:\t%s" % options.rollup)
+    if options.events:
+        print("Events file:\t%s" % options.events)
+    if options.publish:
+        print("Publishing:\t%s (%d messages per subscriber)" % (options.publish, options.publish_buffer))
+    print("Duplicates:\t%s" % ['Dropped', 'Kept'][options.keep_duplicates])
+    if options.record:
+        print("Recording:\t%s" % options.record)
+    if options.stats or options.stats_http:
+        print("Statistics:\t%s" % ', '.join(([options.stats] if options.stats else []) +
+                                            (["http://127.0.0.1:%d/" % options.stats_http] if options.stats_http else [])))
+    print("----------------------------------------------------------------")
+    print("Replaying..." if options.replay else "Starting scan for BLE advertisements...")
+
+
+# define API commands we might use for this script
+def ble_cmd_system_reset(p, boot_in_dfu):
+    p.write(struct.pack('5B', 0, 1, 0, 0, boot_in_dfu))
+def ble_cmd_connection_disconnect(p, connection):
+    p.write(struct.pack('5B', 0, 1, 3, 0, connection))
+def ble_cmd_gap_set_mode(p, discover, connect):
+    p.write(struct.pack('6B', 0, 2, 6, 1, discover, connect))
+def ble_cmd_gap_end_procedure(p):
+    p.write(struct.pack('4B', 0, 0, 6, 4))
+def ble_cmd_gap_set_scan_parameters(p, scan_interval, scan_window, active):
+    p.write(struct.pack('<4BHHB', 0, 5, 6, 7, scan_interval, scan_window, active))
+def ble_cmd_gap_discover(p, mode):
+    p.write(struct.pack('5B', 0, 1, 6, 2, mode))
+
+
+def open_port(port, options):
+    """ Open a dongle for BGAPI access, or a Linux controller for HCI
+    access, and start it scanning. """
+    if is_hci(port):
+        try:
+            return HciSocket(int(port[3:]), options.interval, options.window, options.active)
+        except (socket.error, HciError) as e:
+            print("\n================================================================")
+            print("HCI error (name='%s'): %s" % (port, e))
+            print("Is the controller up (hciconfig %s up), and do we have CAP_NET_RAW (root)?" % port)
+            print("================================================================")
+            sys.exit(2)
+
+    try:
+        ser = serial.Serial(port=port, baudrate=options.baud, timeout=1)
+    except serial.SerialException as e:
+        print("\n================================================================")
+        print("Port error (name='%s', baud='%ld'): %s" % (port, options.baud, e))
+        print("================================================================")
+        sys.exit(2)
+
+    # flush buffers
+    ser.flushInput()
+    ser.flushOutput()
+
+    # disconnect if we are connected already
+    ble_cmd_connection_disconnect(ser, 0)
+    ser.read(7) # 7-byte response
+
+    # stop advertising if we are advertising already
+    ble_cmd_gap_set_mode(ser, 0, 0)
+    ser.read(6) # 6-byte response
+
+    # stop scanning if we are scanning already
+    ble_cmd_gap_end_procedure(ser)
+    ser.read(6) # 6-byte response
+
+    # set scan parameters
+    ble_cmd_gap_set_scan_parameters(ser, options.interval, options.window, options.active)
+    ser.read(6) # 6-byte response
+
+    # start scanning now
+    # Note: In 'gap_discover_limited' (0) and 'gap_discover_generic' (1) modes
+    # all 'non-conforming' (without 'flags' or with incorrect 'flags' value)
+    # adverizing packets are silently discarded. All packets are visible in
+    # 'gap_discover_observation' (2) mode. It is helpfull for debugging.
+    ble_cmd_gap_discover(ser, 2)
+    return ser
+
+
+def rescan(source, interval, window, active):
+    """ Restart a scanning dongle or controller with a new interval and
+    window. The reader thread owns the port by now, so the responses are
+    left to the parser, which skips them. """
+    if isinstance(source, HciSocket):
+        source.rescan(interval, window, active)
+        return
+    # the new parameters only take effect on the next gap_discover
+    ble_cmd_gap_end_procedure(source)
+    ble_cmd_gap_set_scan_parameters(source, interval, window, active)
+    ble_cmd_gap_discover(source, 2)
+
+
+class Scanner(object):
+    """ Turns delivered scan responses into rows: everything on the main
+    thread between lpcsb.capture and the writer thread. """
+
+    def __init__(self, options, columns, writer, tracker):
+        self.options = options
+        self.registry = options.registry
+        self.services = frozenset(options.services)
+        self.classifiers = classify.chain(options.classifiers)
+        self.columns = columns
+        self.writer = writer
+        self.tracker = tracker
+        self.unknown_devices = {}   # address -> Device for --any-device
+        self.malformed = 0
+        self.decoded = {}           # decoder name -> well formed records
+        self.rows = 0
+
+    def _matches_filters(self, evt):
+        options = self.options
+        if options.filter_mac:
+            sender = list(bytearray(evt.sender))
+            if not any(mac == sender[:-len(mac) - 1:-1] for mac in options.filter_mac):
+                return False
+
+        if options.filter_uuid:
+            # collect advertised service UUIDs; the parser has already split
+            # the data into AD structures
+            ad_services = []
+            for ad_type, value in evt.fields():
+                this_field = [ad_type] + list(bytearray(value))
+                if this_field[0] == 0x02 or this_field[0] == 0x03: # partial or complete list of 16-bit UUIDs
+                    for i in range((len(this_field) - 1) // 2):
+                        ad_services.append(this_field[-1 - i*2 : -3 - i*2 : -1])
+                if this_field[0] == 0x04 or this_field[0] == 0x05: # partial or complete list of 32-bit UUIDs
+                    for i in range((len(this_field) - 1) // 4):
+                        ad_services.append(this_field[-1 - i*4 : -5 - i*4 : -1])
+                if this_field[0] == 0x06 or this_field[0] == 0x07: # partial or complete list of 128-bit UUIDs
+                    for i in range((len(this_field) - 1) // 16):
+                        ad_services.append(this_field[-1 - i*16 : -17 - i*16 : -1])
+            if not [i for i in options.filter_uuid if i in ad_services]:
+                return False
+
+        if options.filter_rssi > 0 and -options.filter_rssi > evt.rssi:
+            return False
+        return True
+
+    def _device(self, sender):
+        address = sender.tobytes()
+        device = self.registry.get(address)
+        if device is None and self.options.any_device:
+            device = self.unknown_devices.get(address)
+            if device is None:
+                device = self.unknown_devices[address] = Device(address, mac_str(address))
+        return device
+
+    def handle(self, evt):
+        """ gap_scan_response handler for MultiCapture. """
+        if self.options.filter_mac or self.options.filter_uuid or self.options.filter_rssi:
+            if not self._matches_filters(evt):
+                return
+
+        # Only our boards, looked up by address without formatting it first.
+        # Scan responses (packet type 4, only seen with --active) carry the name, not data
+        device = self._device(evt.sender)
+        if device is None or evt.packet_type == 4:
+            return
+
+        decoder, record = lookup(evt)
+        if decoder is None or decoder.name not in self.services:
+            return
+        if record is None or (decoder.check is not None and not decoder.check(record)):
+            self.malformed += 1
+            print("Malformed packet!")
+            return
+        self.decoded[decoder.name] = self.decoded.get(decoder.name, 0) + 1
+
+        if isinstance(record, Telemetry):
+            # board telemetry: report it, but keep it out of the light data CSV
+            print("Telemetry %s: %d mV, %.1f C, up %.1f s, %d adv, %d samples, %d I2C errors, %d retries%s" %
+                  (device.name, record.battery_mv, record.temperature / 256.0, record.uptime_ds / 10.0,
+                   record.adv_count, record.sample_count, record.twi_errors, record.twi_retries,
+                   ", no color sensor" if record.sensor_id == 0 else ""))
+            return
+
+        # one row per sample rather than per copy; also counts loss and repeats
+        if self.tracker.update(device.name, type(record).__name__, record.seq, evt.time) == DUPLICATE \
+           and not self.options.keep_duplicates:
+            return
+
+        row = dict(zip(record._fields, record))
+        if isinstance(record, LightType):
+            # the board's own classification
+            row['light_type'] = light_type_name(record.light_type)
+        row['device'] = device.name
+        row['device_id'] = device.mac
+        row['received_time'] = datetime.datetime.fromtimestamp(evt.time).strftime("%Y-%m-%dT%H:%M:%S.%fZ")
+        row['rssi'] = evt.rssi
+        row['service'] = decoder.name
+        for classifier in self.classifiers:
+            classifier.classify(device.name, record, row)
+
+        line = []
+        for c in self.columns:
+            value = row.get(c.field)
+            line.append(c.missing if value is None else value)
+        if self.options.friendly:
+            print("%s #%d: %s" % (device.name, record.seq, ", ".join(
+                "%s %s" % (c.header, v) for c, v in zip(self.columns[5:], line[5:]))))
+        if len(evt.receiver_rssi) > 1:
+            line.append(';'.join('' if r is None else str(r) for r in evt.receiver_rssi))
+
+        # written out on the writer thread
+        self.rows += 1
+        self.writer.put(line, device.name, device.mac, record.seq, evt.rssi,
+                        raw=record if decoder.name == 'raw_color' else None,
+                        light_type=row.get('light_type'), time_ns=int(evt.time * 1e9))
+
+    def stats(self):
+        return {'malformed': self.malformed, 'unknown_devices': len(self.unknown_devices),
+                'decoded': dict(self.decoded), 'rows': self.rows}
+
+
+# set up by main(), for shutdown()
+capture = None
+writer = None
+recorder = None
+sources = []
+
+# set by Ctrl-C; main() and the replay stop when they next look
+interrupted = False
+
+
+# gracefully exit without a big exception message if possible. The handler
+# runs on the main thread wherever it is, usually in the middle of
+# delivering a capture, so it only asks to stop
+def ctrl_c_handler(signal, frame):
+    global interrupted
+    interrupted = True
+
+
+def shutdown():
+    """ Write out whatever is still held or buffered before leaving. """
+    if capture is not None:
+        capture.flush()
+    if writer is not None:
+        writer.close()
+    if recorder is not None:
+        recorder.close()
+    # a controller keeps scanning until told to stop; a dongle is reset by the next run
+    for source in sources:
+        if isinstance(source, HciSocket):
+            source.close()
+    close_all()
+
+
+def replay(options, capture, writer, output, scanner, reporter):
+    """ Feed the recording through and report what came out. """
+    replayer = Replayer(options.recording, options.speed)
+    replayer.run(capture.feed, tick=reporter.tick if reporter is not None else None, stop=lambda: interrupted)
+    capture.flush()
+    writer.close()
+    close_all()
+    wall = max(replayer.wall, 1e-9)
+    parsed = capture.parser_stats()
+    stats = scanner.stats()
+
+    print("----------------------------------------------------------------")
+    print("Replayed %d reads, %.1f kB, recorded over %.1f s, in %.2f s (%.1fx)" %
+          (replayer.chunks, replayer.bytes / 1e3, replayer.span(), wall, replayer.span() / wall))
+    print("Parsed:\t\t%d frames, %d scan responses (%d from other companies skipped), %d bytes skipped, %d resyncs" %
+          (parsed['frames'], parsed['scan_responses'], parsed['filtered'], parsed['dropped_bytes'], parsed['resyncs']))
+    print("Delivered:\t%d, %d copies from other dongles dropped" % (capture.unique, capture.duplicates))
+    print("Decoded:\t%s; %d malformed" % (', '.join("%d %s" % (n, name) for name, n in sorted(stats['decoded'].items()))
+                                          or "nothing", stats['malformed']))
+    print("Rows:\t\t%d to %s" % (stats['rows'], output.path or "nowhere"))
+    print("Throughput:\t%.0f scan responses/s, %.0f rows/s, %.2f MB/s" %
+          (parsed['scan_responses'] / wall, stats['rows'] / wall, replayer.bytes / 1e6 / wall))
+
+    if options.baseline:
+        if output.path is None:
+            print("No rows written, nothing to compare with %s" % options.baseline)
+            sys.exit(1)
+        try:
+            diff = CsvDiff(options.baseline, output.path)
+        except (IOError, ValueError) as e:
+            print("Can't compare with the baseline: %s" % e)
+            sys.exit(2)
+        print("\n".join(diff.report()))
+        if not diff.same():
+            sys.exit(1)
+
+
+def main(default_profile='all'):
+    global capture, writer, recorder, sources
+    signal.signal(signal.SIGINT, ctrl_c_handler)
+    options = parse_options(default_profile)
+
+    # display scan parameter summary, if not in quiet mode
+    if not options.quiet:
+        print_summary(options)
+
+    # open each serial port for BGAPI access and start it scanning
+    if options.replay:
+        ports = options.recording.names
+        sers = None
+    else:
+        ports = options.port.split(',')
+        sers = sources = [open_port(port, options) for port in ports]
+
+    # rows are buffered and written in batches, see lpcsb/output.py
+    # with several dongles each row also gets what every one of them heard
+    columns = PROFILES[options.profile].columns
+    header = [c.header for c in columns] + (["receiver_rssi"] if len(ports) > 1 else [])
+    output = RotatingCsvWriter(options.output, header, rotate_bytes=options.rotate_bytes,
+                               flush_rows=options.flush_rows, flush_secs=options.flush_secs)
+    sinks = []
+    if options.archive:
+        from lpcsb.archive import ParquetSink
+        sinks.append(ParquetSink(options.archive))
+    if options.sqlite:
+        sinks.append(SqliteSink(options.sqlite, batch_rows=options.flush_rows, batch_secs=options.flush_secs))
+    publisher = None
+    if options.publish:
+        try:
+            host, port, path = parse_address(options.publish)
+            publisher = Publisher(port=port, path=path, host=host, buffer=options.publish_buffer)
+        except socket.error as e:
+            print("Can't publish on %s: %s" % (options.publish, e))
+            sys.exit(2)
+        sinks.append(publisher)
+    if options.rollup:
+        sinks.append(RollupSink(options.rollup, batch_secs=options.flush_secs,
+                                on_window=publisher.rollup if publisher is not None else None))
+    if options.events:
+        sinks.append(EventSink(options.events, flush_secs=options.flush_secs))
+
+    # from here on the CSV and the sinks are only written by the writer thread
+    writer = SinkWorker(output, sinks, maxsize=options.queue_size, policy=options.backpressure)
+
+    # sequence numbers of every board, for dropping repeats and for --stats
+    tracker = SeqTracker()
+    scanner = Scanner(options, columns, writer, tracker)
+
+    # one reader thread per dongle; decoding and classification stay on this thread
+    if options.record:
+        recorder = Recorder(options.record, ports)
+    # controllers hand over only what our decoders can read
+    companies = set(d.company for d in DECODERS.values() if d.name in options.services)
+    capture = MultiCapture(sers, scanner.handle, names=ports, hold=options.dedup_hold,
+                           queue_size=options.queue_size, recorder=recorder, companies=companies)
+
+    # narrows the window while the boards' samples still get through
+    controller = None
+    if options.scan_target is not None:
+        def apply(interval, window):
+            for source in sources:
+                rescan(source, interval, window, options.active)
+        controller = ScanController(tracker, apply, options.interval, options.window, target=options.scan_target,
+                                    period=options.scan_period, min_duty=options.scan_min_duty)
+
+    def extra():
+        stats = {'capture': capture.stats(), 'writer': writer.stats(), 'scanner': scanner.stats()}
+        if controller is not None:
+            stats['scan'] = controller.stats()
+        if publisher is not None:
+            stats['publish'] = publisher.stats()
+        return stats
+
+    reporter = None
+    if options.stats or options.stats_http:
+        reporter = StatsReporter(tracker, path=options.stats, http_port=options.stats_http, interval=options.stats_secs,
+                                 extra=extra)
+    try:
+        if options.replay:
+            replay(options, capture, writer, output, scanner, reporter)
+            return
+
+        # poll() comes back at least every half second, so Ctrl-C is seen by then
+        while not interrupted:
+            capture.poll()
+            if reporter is not None:
+                reporter.tick()
+            if recorder is not None:
+                recorder.tick()
+            if controller is not None:
+                controller.tick()
+    finally:
+        shutdown()
+
+
+if __name__ == '__main__':
+    main()
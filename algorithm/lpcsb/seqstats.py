@@ -0,0 +1,292 @@
+""" Per-device sequence tracking and link statistics
+
+Every LPCSB sample carries a 16-bit sequence number, and the firmware
+advertises each sample more than once (2.5 s advertising interval against a
+5 s measurement period). SeqTracker follows the sequence of every
+(device, service) stream and classifies each packet:
+
+    NEW         a sample not seen before; any seqs skipped since the last
+                one are counted as lost
+    DUPLICATE   a seq already seen in the last DUPLICATE_SECS
+                (re-advertisement, or the same packet from another path)
+    LATE        an older seq that was counted as lost and turned up after all
+    RESET       the board restarted: seq went back to 0/1, or jumped
+                backwards further than reordering explains
+
+A restart is recognized before duplicates are, so a board that reboots
+soon after its last run doesn't have its new samples taken for repeats of
+the old ones.
+
+Differences are taken modulo 2**16, so the wrap from 65535 to 0 is an
+ordinary step.
+
+Alongside totals since start, each stream keeps one-minute buckets for the
+last `window` seconds: packets, samples, duplicates, lost, and two
+inter-arrival histograms (between any two packets, and between new
+samples). snapshot() returns all of it as a dict ready for json.dumps().
+
+StatsReporter writes that snapshot to a JSON file every `interval` seconds
+(replacing it atomically) and/or serves it at http://127.0.0.1:PORT/ . It
+registers with lpcsb.output, so tick_all() drives it and close_all() writes
+a last snapshot.
+"""
+
+import json
+import os
+import threading
+import time
+from collections import deque
+
+try:
+    from BaseHTTPServer import BaseHTTPRequestHandler, HTTPServer
+except ImportError:
+    from http.server import BaseHTTPRequestHandler, HTTPServer
+
+from lpcsb import output
+
+NEW, DUPLICATE, LATE, RESET = 'new', 'duplicate', 'late', 'reset'
+
+# Upper bin edges in seconds; the last bin is everything above
+HISTOGRAM_EDGES = (0.1, 0.25, 0.5, 1.0, 2.0, 3.0, 4.0, 6.0, 8.0, 12.0, 30.0, 60.0)
+
+# How far back a seq may be and still be a reordered/duplicate packet
+# rather than a reset
+REORDER_WINDOW = 64
+
+# How long after a seq was first seen a repeat still counts as a duplicate.
+# The firmware re-advertises a sample for one 5 s measurement period; later
+# repeats are a rebooted board counting up again
+DUPLICATE_SECS = 15
+
+BUCKET_SECS = 60
+
+
+def _bin(seconds):
+    for i, edge in enumerate(HISTOGRAM_EDGES):
+        if seconds <= edge:
+            return i
+    return len(HISTOGRAM_EDGES)
+
+
+class _Counts(object):
+    __slots__ = ('start', 'packets', 'samples', 'duplicates', 'lost', 'late', 'resets',
+                 'inter_arrival', 'sample_interval')
+
+    def __init__(self, start=0):
+        self.start = start
+        self.packets = self.samples = self.duplicates = 0
+        self.lost = self.late = self.resets = 0
+        self.inter_arrival = [0] * (len(HISTOGRAM_EDGES) + 1)
+        self.sample_interval = [0] * (len(HISTOGRAM_EDGES) + 1)
+
+    def add(self, other):
+        for name in ('packets', 'samples', 'duplicates', 'lost', 'late', 'resets'):
+            setattr(self, name, getattr(self, name) + getattr(other, name))
+        for i in range(len(self.inter_arrival)):
+            self.inter_arrival[i] += other.inter_arrival[i]
+            self.sample_interval[i] += other.sample_interval[i]
+
+    def as_dict(self):
+        # a late packet may land in a later bucket than the gap it fills
+        lost = max(0, self.lost - self.late)
+        expected = self.samples + lost
+        return {
+            'packets': self.packets,
+            'samples': self.samples,
+            'duplicates': self.duplicates,
+            'lost': lost,
+            'resets': self.resets,
+            'loss_rate': lost / float(expected) if expected else 0.0,
+            'duplicate_rate': self.duplicates / float(self.packets) if self.packets else 0.0,
+            'inter_arrival': self.inter_arrival,
+            'sample_interval': self.sample_interval,
+        }
+
+
+class _Stream(object):
+    def __init__(self):
+        self.last_seq = None
+        self.recent = deque(maxlen=REORDER_WINDOW)     # (seq, first seen), newest last
+        self.missing = set()                            # seqs counted as lost, recently
+        self.last_packet = None
+        self.last_sample = None
+        self.total = _Counts()
+        self.buckets = deque()
+
+
+class SeqTracker(object):
+    def __init__(self, window=600):
+        self.window = window
+        self.streams = {}
+
+    def update(self, device, service, seq, now=None):
+        """ Account for one packet and return NEW, DUPLICATE, LATE or RESET. """
+        if now is None:
+            now = time.time()
+        stream = self.streams.get((device, service))
+        if stream is None:
+            stream = self.streams[(device, service)] = _Stream()
+
+        bucket_start = int(now) - int(now) % BUCKET_SECS
+        buckets = stream.buckets
+        if not buckets or buckets[-1].start != bucket_start:
+            buckets.append(_Counts(bucket_start))
+            while buckets[0].start <= now - self.window - BUCKET_SECS:
+                buckets.popleft()
+        counts = (stream.total, buckets[-1])
+
+        if stream.last_packet is not None:
+            b = _bin(now - stream.last_packet)
+            for c in counts:
+                c.inter_arrival[b] += 1
+        stream.last_packet = now
+
+        kind = self._classify(stream, seq, now)
+        for c in counts:
+            c.packets += 1
+            if kind == DUPLICATE:
+                c.duplicates += 1
+            elif kind == LATE:
+                c.late += 1
+                c.samples += 1
+            else:
+                c.samples += 1
+                if kind == RESET:
+                    c.resets += 1
+
+        if kind == NEW and stream.last_sample is not None:
+            b = _bin(now - stream.last_sample)
+            for c in counts:
+                c.sample_interval[b] += 1
+        if kind in (NEW, RESET):
+            stream.last_sample = now
+        return kind
+
+    def _classify(self, stream, seq, now):
+        last = stream.last_seq
+        if last is None:
+            stream.last_seq = seq
+            stream.recent.append((seq, now))
+            return NEW
+
+        delta = (seq - last) & 0xFFFF
+        if seq <= 1 and delta > REORDER_WINDOW:
+            return self._reset(stream, seq, now)
+
+        for s, seen in stream.recent:
+            if s == seq and now - seen <= DUPLICATE_SECS:
+                return DUPLICATE
+
+        if 0 < delta < 0x8000:
+            # forward; everything skipped over is lost until it shows up
+            lost = delta - 1
+            for c in (stream.total, stream.buckets[-1]):
+                c.lost += lost
+            for i in range(1, min(lost, REORDER_WINDOW) + 1):
+                stream.missing.add((seq - i) & 0xFFFF)
+            if len(stream.missing) > 4 * REORDER_WINDOW:
+                stream.missing = set(s for s in stream.missing
+                                     if (seq - s) & 0xFFFF <= REORDER_WINDOW)
+            stream.last_seq = seq
+            stream.recent.append((seq, now))
+            return NEW
+
+        if seq in stream.missing and (last - seq) & 0xFFFF <= REORDER_WINDOW:
+            stream.missing.discard(seq)
+            stream.recent.append((seq, now))
+            return LATE
+
+        # backwards too far, or a seq seen before but too long ago
+        return self._reset(stream, seq, now)
+
+    def _reset(self, stream, seq, now):
+        stream.last_seq = seq
+        stream.recent.clear()
+        stream.recent.append((seq, now))
+        stream.missing.clear()
+        return RESET
+
+    def snapshot(self, now=None):
+        if now is None:
+            now = time.time()
+        devices = {}
+        for (device, service), stream in sorted(self.streams.items()):
+            rolling = _Counts()
+            for bucket in stream.buckets:
+                if bucket.start > now - self.window - BUCKET_SECS:
+                    rolling.add(bucket)
+            entry = {
+                'last_seq': stream.last_seq,
+                'last_seen': stream.last_packet,
+                'total': stream.total.as_dict(),
+                'rolling': rolling.as_dict(),
+            }
+            devices.setdefault(device, {})[service] = entry
+        return {
+            'time': now,
+            'window_secs': self.window,
+            'histogram_edges': list(HISTOGRAM_EDGES),
+            'devices': devices,
+        }
+
+
+class StatsReporter(object):
+    def __init__(self, tracker, path=None, http_port=None, interval=10.0, extra=None):
+        """ Publish tracker.snapshot() to `path` and/or on 127.0.0.1:`http_port`.
+        `extra()`, if given, returns a dict merged into each snapshot. """
+        self.tracker = tracker
+        self.path = path
+        self.interval = interval
+        self.extra = extra
+        self._text = '{}'
+        self._last = 0
+        self._server = None
+
+        if http_port is not None:
+            reporter = self
+
+            class Handler(BaseHTTPRequestHandler):
+                def do_GET(self):
+                    body = reporter._text.encode('utf-8')
+                    self.send_response(200)
+                    self.send_header('Content-Type', 'application/json')
+                    self.send_header('Content-Length', str(len(body)))
+                    self.end_headers()
+                    self.wfile.write(body)
+
+                def log_message(self, *args):
+                    pass
+
+            self._server = HTTPServer(('127.0.0.1', http_port), Handler)
+            thread = threading.Thread(target=self._server.serve_forever)
+            thread.daemon = True
+            thread.start()
+
+        self.publish()
+        output.register(self)
+
+    def publish(self):
+        self._last = time.time()
+        snapshot = self.tracker.snapshot(self._last)
+        if self.extra is not None:
+            snapshot.update(self.extra())
+        # swapped in whole, so the HTTP thread never sees half a snapshot
+        self._text = json.dumps(snapshot, indent=1, sort_keys=True)
+        if self.path:
+            tmp = self.path + '.tmp'
+            with open(tmp, 'w') as f:
+                f.write(self._text)
+            if os.name == 'nt' and os.path.exists(self.path):
+                os.remove(self.path)
+            os.rename(tmp, self.path)
+
+    def tick(self):
+        if time.time() - self._last >= self.interval:
+            self.publish()
+
+    def close(self):
+        self.publish()
+        if self._server is not None:
+            self._server.shutdown()
+            self._server = None
+        output.unregister(self)
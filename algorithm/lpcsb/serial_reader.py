@@ -0,0 +1,106 @@
+""" Bulk reader for a BGAPI serial port
+
+The scanners used to poll the port with
+
+    while (ser.inWaiting()): bgapi_parse(ord(ser.read()))
+    time.sleep(0.01)
+
+which costs a read call per byte and adds up to 10 ms of latency while still
+waking up 100 times a second on an idle port. BulkReader instead blocks until
+the port has data and then takes everything that is waiting in one read.
+
+On POSIX the port's file descriptor is waited on with select(). Where that is
+not possible (Windows COM ports, pyserial URL handlers) it falls back to a
+blocking one byte read with a timeout followed by a read of whatever else is
+queued, which is still two calls per burst instead of one per byte.
+"""
+
+import errno
+import os
+import select
+
+
+class BulkReader(object):
+    def __init__(self, ser, handler, timeout=0.5, max_read=4096):
+        """ Read from the pyserial port `ser` and hand each chunk to
+        `handler(data)` as a byte string. `timeout` bounds how long one call
+        to poll() may block, so the caller gets a chance to do periodic work.
+        """
+        self.ser = ser
+        self.handler = handler
+        self.timeout = timeout
+        self.max_read = max_read
+
+        self.reads = 0
+        self.bytes = 0
+
+        self._fd = None
+        try:
+            fd = ser.fileno()
+            if os.name == 'posix':
+                self._fd = fd
+        except (AttributeError, NotImplementedError, IOError, OSError, ValueError):
+            pass
+
+    def _waiting(self):
+        # pyserial 3 renamed inWaiting() to the in_waiting property
+        n = getattr(self.ser, 'in_waiting', None)
+        if n is None:
+            n = self.ser.inWaiting()
+        return n
+
+    def _read_fd(self):
+        try:
+            ready, _, _ = select.select([self._fd], [], [], self.timeout)
+        except (select.error, OSError) as e:
+            if e.args[0] == errno.EINTR:
+                return b''
+            raise
+        if not ready:
+            return b''
+        try:
+            return os.read(self._fd, self.max_read)
+        except OSError as e:
+            if e.errno in (errno.EAGAIN, errno.EINTR):
+                return b''
+            raise
+
+    def _read_blocking(self):
+        if self.ser.timeout != self.timeout:
+            self.ser.timeout = self.timeout
+        data = self.ser.read(1)
+        if data:
+            n = self._waiting()
+            if n:
+                data += self.ser.read(min(n, self.max_read))
+        return data
+
+    def poll(self):
+        """ Wait up to the timeout for data and pass all of it to the handler.
+        Returns the number of bytes handled, 0 on a timeout.
+        """
+        if self._fd is not None:
+            data = self._read_fd()
+        else:
+            data = self._read_blocking()
+
+        if data:
+            self.reads += 1
+            self.bytes += len(data)
+            self.handler(data)
+        return len(data)
+
+    def run(self):
+        """ Read until interrupted. """
+        while True:
+            self.poll()
+
+
+def byte_feeder(parse):
+    """ Adapt a parser that takes one integer byte at a time, like the
+    original bgapi_parse(), to the chunk handler BulkReader expects.
+    """
+    def feed(data):
+        for b in bytearray(data):
+            parse(b)
+    return feed
@@ -0,0 +1,131 @@
+""" SQLite store of LPCSB records
+
+For questions like "lux of LPCSB_1 between T1 and T2" without grepping
+CSVs. SqliteSink takes the same add() calls as lpcsb.archive.ParquetSink and
+keeps two tables:
+
+    raw_color    device, mac, time, seq, rssi, clear, red, green, blue,
+                 color_temp, lux                      (service 0x31)
+    light_type   device, mac, time, seq, rssi, light_type   (service 0x32, or
+                 the scanner's own classification of a raw sample)
+
+`time` is integer nanoseconds since the epoch (UTC). Both tables have a
+(device, time) index, so a time range for one board is an index range scan:
+
+    SELECT time, lux FROM raw_color
+     WHERE device = 'LPCSB_1' AND time BETWEEN ? AND ?
+
+The database runs in WAL mode with synchronous=NORMAL, so readers can query
+it while a scanner is writing, and a commit doesn't wait for a full fsync.
+Records are queued and inserted with executemany() in one transaction once
+`batch_rows` have queued up or `batch_secs` have passed, whichever comes
+first; call tick() from the main loop and close() (or
+lpcsb.output.close_all()) on the way out.
+"""
+
+import sqlite3
+import time
+
+from lpcsb import output
+
+SCHEMA = """
+CREATE TABLE IF NOT EXISTS raw_color (
+    device      TEXT NOT NULL,
+    mac         TEXT NOT NULL,
+    time        INTEGER NOT NULL,
+    seq         INTEGER NOT NULL,
+    rssi        INTEGER NOT NULL,
+    clear       INTEGER NOT NULL,
+    red         INTEGER NOT NULL,
+    green       INTEGER NOT NULL,
+    blue        INTEGER NOT NULL,
+    color_temp  INTEGER NOT NULL,
+    lux         INTEGER NOT NULL
+);
+CREATE INDEX IF NOT EXISTS raw_color_device_time ON raw_color (device, time);
+
+CREATE TABLE IF NOT EXISTS light_type (
+    device      TEXT NOT NULL,
+    mac         TEXT NOT NULL,
+    time        INTEGER NOT NULL,
+    seq         INTEGER NOT NULL,
+    rssi        INTEGER NOT NULL,
+    light_type  TEXT NOT NULL
+);
+CREATE INDEX IF NOT EXISTS light_type_device_time ON light_type (device, time);
+"""
+
+INSERT_RAW = "INSERT INTO raw_color VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)"
+INSERT_LIGHT = "INSERT INTO light_type VALUES (?, ?, ?, ?, ?, ?)"
+
+if hasattr(time, 'time_ns'):
+    _now_ns = time.time_ns
+else:
+    def _now_ns():
+        return int(time.time() * 1e9)
+
+
+class SqliteSink(object):
+    def __init__(self, path, batch_rows=500, batch_secs=1.0):
+        self.path = path
+        self.batch_rows = batch_rows
+        self.batch_secs = batch_secs
+        self.rows_written = 0
+        self.commits = 0
+
+        # Transactions are managed here, not by the sqlite3 module. Made
+        # here, used on the writer thread (lpcsb.pipeline) and closed once
+        # that has stopped, so never by two threads at once
+        self._db = sqlite3.connect(path, isolation_level=None, check_same_thread=False)
+        self._db.execute("PRAGMA journal_mode=WAL")
+        self._db.execute("PRAGMA synchronous=NORMAL")
+        self._db.executescript(SCHEMA)
+
+        self._raw = []
+        self._light = []
+        self._last_commit = time.time()
+        output.register(self)
+
+    def add(self, device, mac, seq, rssi, raw=None, light_type=None, time_ns=None):
+        """ One record. A RawColor in `raw` goes to raw_color, a light type
+        name to light_type; a classified raw sample goes to both. """
+        if time_ns is None:
+            time_ns = _now_ns()
+        if raw is not None:
+            self._raw.append((device, mac, time_ns, seq, rssi, raw.clear, raw.red, raw.green,
+                              raw.blue, raw.color_temp, raw.lux))
+        if light_type is not None:
+            self._light.append((device, mac, time_ns, seq, rssi, light_type))
+
+        if len(self._raw) + len(self._light) >= self.batch_rows or \
+           time.time() - self._last_commit >= self.batch_secs:
+            self.flush()
+
+    def tick(self):
+        """ Commit records that have waited long enough. Cheap to call often. """
+        if (self._raw or self._light) and time.time() - self._last_commit >= self.batch_secs:
+            self.flush()
+
+    def flush(self):
+        self._last_commit = time.time()
+        if not (self._raw or self._light):
+            return
+        db = self._db
+        db.execute("BEGIN")
+        if self._raw:
+            db.executemany(INSERT_RAW, self._raw)
+        if self._light:
+            db.executemany(INSERT_LIGHT, self._light)
+        db.execute("COMMIT")
+        self.rows_written += len(self._raw) + len(self._light)
+        self.commits += 1
+        self._raw = []
+        self._light = []
+
+    def close(self):
+        if self._db is None:
+            return
+        self.flush()
+        self._db.close()
+        self._db = None
+        output.unregister(self)
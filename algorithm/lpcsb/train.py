@@ -0,0 +1,434 @@
+""" Fit a light type model on labeled recordings
+
+The rules in classify.BulbRules (and the different ones in the Light ID
+firmware) were read off graphs by eye. This fits a small decision tree
+instead, on recordings of known bulbs, and writes it out for both sides:
+
+    python -m lpcsb.train [--depth N] [--holdout F] "20200301 LED.csv" "Sunlight 2.parquet" ...
+
+The bulb type comes from each file name, which must name exactly one of
+incandescent, fluorescent (or CFL), LED and sunlight (or daylight). The
+"LED Data" in the LED Data scanner's file names doesn't count. Inputs are
+scanner CSVs or archives, as for lpcsb.reclassify; each file is one
+session, so the drift starts again with every file.
+
+The features are whole numbers, computed the same way by
+classify.model_features(), by this tool and by the generated header, so
+the scanner and the firmware give exactly the labels reported here:
+
+    max_ratio min_ratio ratio_compare    as 'ratios', times MODEL_RATIO_SCALE
+    red_share green_share blue_share     channel / (red + green + blue), per mille
+    lux
+    drift                                largest change of red, green or blue since the board's reset
+
+Each bulb type weighs the same however long its recordings are. The last
+--holdout of every file is kept out of training; the confusion matrices
+for it (and for the RULES thresholds, for comparison) show how the model
+does on samples it hasn't seen. The tree is written as
+
+    --python  lpcsb/light_model.py    predict(features) for the 'model' classifier
+    --header  light_model.h           light_model_classify() for LPCSB_Light_ID,
+                                      built in with -DLIGHT_MODEL=1
+
+Splits are chosen among --bins quantiles of each feature, so fitting is a
+few histograms per tree node and millions of rows take seconds. Needs
+numpy and pyarrow.
+"""
+
+from __future__ import print_function
+
+import datetime
+import optparse
+import os
+import re
+import sys
+import time
+
+import numpy as np
+
+from lpcsb.classify import (RULES, DEFAULT_RULES, MODEL_FEATURES, MODEL_RATIO_SCALE, MODEL_RATIO_CAP)
+from lpcsb.decode import LIGHT_TYPE_NAMES
+from lpcsb.reclassify import (CHANNELS, LABELS, DriftState, color_ratios, drift, find_columns, read_batches,
+                              rule_labels, _numbers)
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+DEFAULT_PYTHON = os.path.join(HERE, 'light_model.py')
+DEFAULT_HEADER = os.path.join(HERE, '..', '..', 'software', 'apps', 'LPCSB_Light_ID', 'light_model.h')
+
+# label -> words in a file name that mean it
+NAME_WORDS = (
+    ("Incandescent", ('incandescent',)),
+    ("Fluorescent", ('fluorescent', 'cfl')),
+    ("LED", ('led',)),
+    ("Sunlight", ('sunlight', 'daylight', 'sun')),
+)
+
+# the firmware's light type codes, and their names in lpcsb_packet.h
+LIGHT_TYPE_CODES = dict((name, code) for code, name in LIGHT_TYPE_NAMES.items())
+LIGHT_TYPE_CODES["Unknown"] = 0x44
+LIGHT_TYPE_DEFINES = {
+    "Incandescent": "LPCSB_INCANDESCENT",
+    "LED": "LPCSB_LED",
+    "Fluorescent": "LPCSB_FLUORESCENT",
+    "Sunlight": "LPCSB_SUNLIGHT",
+    "Unknown": "LPCSB_UNKNOWN",
+}
+
+
+def label_from_name(path):
+    """ The bulb type a file name names, or ValueError. """
+    name = os.path.splitext(os.path.basename(path))[0].lower()
+    name = name.replace('led data', '')
+    words = set(re.findall('[a-z]+', name))
+    found = [label for label, keys in NAME_WORDS if words.intersection(keys)]
+    if len(found) != 1:
+        raise ValueError("%s: can't tell the bulb type from the name (%s)" %
+                         (path, "names %s" % ' and '.join(found) if found else "no bulb type in it"))
+    return found[0]
+
+
+def _ratio(a, b):
+    """ Vector version of classify._model_ratio(). """
+    with np.errstate(divide='ignore'):
+        ratio = np.where(b > 0, a * MODEL_RATIO_SCALE // np.maximum(b, 1), np.where(a > 0, MODEL_RATIO_CAP, MODEL_RATIO_SCALE))
+    return np.minimum(ratio, MODEL_RATIO_CAP)
+
+
+def model_features(red, green, blue, lux, net):
+    """ Vector version of classify.model_features(): (rows, features)
+    int64 from whole number channels and net drift. """
+    top = np.maximum(np.maximum(red, green), blue)
+    low = np.minimum(np.minimum(red, green), blue)
+    mid = red + green + blue - top - low
+    max_ratio = _ratio(top, mid)
+    min_ratio = _ratio(mid, low)
+    compare = _ratio(np.maximum(max_ratio, min_ratio), np.minimum(max_ratio, min_ratio))
+    total = red + green + blue
+    shares = [np.where(total > 0, c * 1000 // np.maximum(total, 1), 0) for c in (red, green, blue)]
+    drift_ = np.abs(net[:, 1:]).max(axis=1)
+    return np.column_stack([max_ratio, min_ratio, compare] + shares + [lux, drift_]).astype(np.int64)
+
+
+class Recording(object):
+    """ Features, rule labels and the label of one file. """
+
+    def __init__(self, path, label, features, rules):
+        self.path = path
+        self.label = label
+        self.features = features
+        self.rules = rules
+
+
+def load(path, chunk_rows=1 << 18):
+    """ Read one labeled recording. """
+    label = LABELS.index(label_from_name(path))
+    thresholds = RULES[DEFAULT_RULES]
+    state = DriftState()
+    features = []
+    rules = []
+    columns = None
+    for batch in read_batches(path, chunk_rows):
+        if columns is None:
+            columns = find_columns(batch.schema.names)
+        devices = batch.column(columns['device']).cast('string')
+        values = np.column_stack([_numbers(batch.column(columns[c])) for c in CHANNELS])
+        lux = _numbers(batch.column(columns['lux']))
+        seq = _numbers(batch.column(columns['seq']))
+        valid = ~np.isnan(values).any(axis=1) & ~np.isnan(lux) & devices.is_valid().to_numpy(zero_copy_only=False)
+        rows = np.flatnonzero(valid)
+        if len(rows) == 0:
+            continue
+        encoded = devices.dictionary_encode()
+        board = state.lookup(encoded.dictionary.to_pylist())[encoded.indices.to_numpy(zero_copy_only=False)[rows]]
+        net, _ = drift(board, rows, seq, values, state)
+
+        v = values[rows].astype(np.int64)
+        n = net[rows].astype(np.int64)
+        features.append(model_features(v[:, 1], v[:, 2], v[:, 3], lux[rows].astype(np.int64), n))
+        max_ratio, min_ratio, _, top, mid = color_ratios(*values[rows, 1:].T)
+        rules.append(rule_labels(values[rows, 1], values[rows, 2], values[rows, 3], lux[rows], net[rows],
+                                 max_ratio, min_ratio, top, mid, thresholds))
+    if not features:
+        raise ValueError("%s: no color samples" % path)
+    return Recording(path, label, np.concatenate(features), np.concatenate(rules))
+
+
+class Node(object):
+    """ A split (feature, threshold: left if value <= threshold) or a leaf
+    (label). `counts` are the weighted training rows per label. """
+
+    def __init__(self, counts, feature=None, threshold=None, left=None, right=None):
+        self.counts = counts
+        self.feature = feature
+        self.threshold = threshold
+        self.left = left
+        self.right = right
+
+    @property
+    def label(self):
+        return int(np.argmax(self.counts))
+
+    def predict(self, x):
+        """ Label index per row of `x`. """
+        if self.feature is None:
+            return np.full(len(x), self.label, dtype=np.int8)
+        out = np.empty(len(x), dtype=np.int8)
+        go_left = x[:, self.feature] <= self.threshold
+        out[go_left] = self.left.predict(x[go_left])
+        out[~go_left] = self.right.predict(x[~go_left])
+        return out
+
+    def leaves(self):
+        if self.feature is None:
+            return 1
+        return self.left.leaves() + self.right.leaves()
+
+    def prune(self):
+        """ Merge splits whose two sides say the same. """
+        if self.feature is None:
+            return self
+        self.left = self.left.prune()
+        self.right = self.right.prune()
+        if self.left.feature is None and self.right.feature is None and self.left.label == self.right.label:
+            return Node(self.counts)
+        return self
+
+
+def _gini(counts):
+    """ Weighted Gini impurity of each row of label counts, times its weight. """
+    total = counts.sum(axis=-1)
+    with np.errstate(divide='ignore', invalid='ignore'):
+        return np.where(total > 0, total - (counts * counts).sum(axis=-1) / total, 0.0)
+
+
+def fit_tree(x, y, weights, labels, depth=4, min_leaf=50, bins=64):
+    """ CART on binned features: at each node, the split with the lowest
+    weighted Gini impurity among `bins` quantile thresholds per feature.
+    `weights` is the weight of each label. """
+    edges = []
+    codes = []
+    sample = x[::max(1, len(x) // 250000)]
+    for f in range(x.shape[1]):
+        e = np.unique(np.quantile(sample[:, f], np.linspace(0, 1, bins + 1)[1:-1], method='lower'))
+        edges.append(e)
+        # bin and label in one number, so one bincount makes the histogram
+        codes.append((np.searchsorted(e, x[:, f], side='left') * labels + y).astype(np.int32))
+
+    def grow(index, level):
+        rows = np.bincount(y[index], minlength=labels)
+        counts = rows * weights
+        node = Node(counts)
+        if level == depth or np.count_nonzero(rows) < 2 or len(index) < 2 * min_leaf:
+            return node
+        best = None
+        for f in range(x.shape[1]):
+            nb = len(edges[f]) + 1
+            hist = np.bincount(codes[f][index], minlength=nb * labels).reshape(nb, labels)
+            left_rows = np.cumsum(hist.sum(axis=1))[:-1]
+            ok = (left_rows >= min_leaf) & (len(index) - left_rows >= min_leaf)
+            if not ok.any():
+                continue
+            left = np.cumsum(hist * weights, axis=0)[:-1]
+            impurity = np.where(ok, _gini(left) + _gini(counts - left), np.inf)
+            i = int(np.argmin(impurity))
+            if best is None or impurity[i] < best[0]:
+                best = (impurity[i], f, i)
+        if best is None or best[0] >= _gini(counts) - 1e-9 * counts.sum():
+            return node
+        _, f, i = best
+        go_left = codes[f][index] < (i + 1) * labels
+        node.feature = f
+        node.threshold = int(edges[f][i])
+        node.left = grow(index[go_left], level + 1)
+        node.right = grow(index[~go_left], level + 1)
+        return node
+
+    return grow(np.arange(len(y)), 0).prune()
+
+
+def confusion(truth, predicted, labels):
+    matrix = np.zeros((labels, labels), dtype=np.int64)
+    np.add.at(matrix, (truth, predicted), 1)
+    return matrix
+
+
+def print_confusion(title, matrix, used):
+    """ Rows are the true bulb types, columns what was predicted. """
+    total = matrix.sum()
+    print("%s: %.1f%% of %d right" % (title, 100.0 * np.trace(matrix) / max(total, 1), total))
+    names = [LABELS[i][:12] for i in range(len(LABELS))]
+    shown = [i for i in range(len(LABELS)) if i in used or matrix[:, i].any()]
+    print("  %-12s " % "true \\ said" + ''.join("%12s" % names[i] for i in shown) + "%9s" % "recall")
+    for i in used:
+        row = matrix[i]
+        print("  %-12s " % names[i] + ''.join("%12d" % row[j] for j in shown) +
+              "%8.1f%%" % (100.0 * row[i] / max(row.sum(), 1)))
+
+
+def describe(node, indent=''):
+    if node.feature is None:
+        return ["%s-> %s" % (indent, LABELS[node.label])]
+    lines = ["%sif %s <= %d:" % (indent, MODEL_FEATURES[node.feature], node.threshold)]
+    lines += describe(node.left, indent + '    ')
+    lines.append("%selse:" % indent)
+    lines += describe(node.right, indent + '    ')
+    return lines
+
+
+def python_module(tree, summary):
+    lines = ['""" Light type model, generated by lpcsb/train.py: regenerate it rather',
+             'than edit it. Used by the \'model\' classifier in lpcsb/classify.py.', '']
+    lines += summary
+    lines += ['"""', '', 'FEATURES = (%s)' % ', '.join("'%s'" % f for f in MODEL_FEATURES), '', '',
+              'def predict(features):',
+              '    """ Light type for a classify.model_features() tuple. """']
+    lines += ['    ' + line for line in _python_tree(tree, '')]
+    return '\n'.join(lines) + '\n'
+
+
+def _python_tree(node, indent):
+    if node.feature is None:
+        return ['%sreturn "%s"' % (indent, LABELS[node.label])]
+    lines = ['%sif features[%d] <= %d:  # %s' % (indent, node.feature, node.threshold, MODEL_FEATURES[node.feature])]
+    lines += _python_tree(node.left, indent + '    ')
+    lines.append('%selse:' % indent)
+    lines += _python_tree(node.right, indent + '    ')
+    return lines
+
+
+def c_header(tree, summary):
+    lines = ['#pragma once', '',
+             '// Light type model, generated by algorithm/lpcsb/train.py: regenerate it',
+             '// rather than edit it. The features and the tree match the scanner\'s',
+             '// \'model\' classifier (algorithm/lpcsb/classify.py) exactly.', '//']
+    lines += ['// ' + line if line else '//' for line in summary]
+    lines += ['', '#include <stdint.h>', '#include "lpcsb_packet.h"', '',
+              '#define LIGHT_MODEL_RATIO_SCALE %d' % MODEL_RATIO_SCALE,
+              '#define LIGHT_MODEL_RATIO_CAP   %d' % MODEL_RATIO_CAP, '',
+              '// a / b times LIGHT_MODEL_RATIO_SCALE, capped; 0 / 0 is 1',
+              'static inline uint32_t light_model_ratio (uint32_t a, uint32_t b) {',
+              '    uint32_t ratio;',
+              '    if(b == 0){',
+              '        return a ? LIGHT_MODEL_RATIO_CAP : LIGHT_MODEL_RATIO_SCALE;',
+              '    }',
+              '    ratio = a * LIGHT_MODEL_RATIO_SCALE / b;',
+              '    return ratio > LIGHT_MODEL_RATIO_CAP ? LIGHT_MODEL_RATIO_CAP : ratio;',
+              '}', '',
+              '// Light type code (as advertised in service 0x32) for one sample. drift is',
+              '// the largest change of red, green or blue since the last sample with',
+              '// packet number 1, after boot or a wrap of the counter.',
+              'static inline uint8_t light_model_classify (uint16_t red, uint16_t green, uint16_t blue,',
+              '                                            uint16_t lux, uint16_t drift) {',
+              '    uint32_t top = red > green ? red : green;',
+              '    uint32_t low = red < green ? red : green;',
+              '    uint32_t mid, total, features[%d];' % len(MODEL_FEATURES),
+              '    top = blue > top ? blue : top;',
+              '    low = blue < low ? blue : low;',
+              '    total = (uint32_t)red + green + blue;',
+              '    mid = total - top - low;',
+              '    features[0] = light_model_ratio(top, mid);',
+              '    features[1] = light_model_ratio(mid, low);',
+              '    features[2] = features[0] >= features[1] ? light_model_ratio(features[0], features[1])',
+              '                                             : light_model_ratio(features[1], features[0]);',
+              '    features[3] = total ? red * 1000 / total : 0;',
+              '    features[4] = total ? green * 1000 / total : 0;',
+              '    features[5] = total ? blue * 1000 / total : 0;',
+              '    features[6] = lux;',
+              '    features[7] = drift;', '']
+    lines += _c_tree(tree, '    ')
+    lines.append('}')
+    return '\n'.join(lines) + '\n'
+
+
+def _c_tree(node, indent):
+    if node.feature is None:
+        label = LABELS[node.label]
+        return ['%sreturn %s;' % (indent, LIGHT_TYPE_DEFINES[label])]
+    lines = ['%sif(features[%d] <= %d){ // %s' % (indent, node.feature, node.threshold, MODEL_FEATURES[node.feature])]
+    lines += _c_tree(node.left, indent + '    ')
+    lines.append('%s}' % indent)
+    lines.append('%selse{' % indent)
+    lines += _c_tree(node.right, indent + '    ')
+    lines.append('%s}' % indent)
+    return lines
+
+
+def main():
+    p = optparse.OptionParser(usage="%prog [options] RECORDING ...",
+                              description="Fit a decision tree light type model on recordings of known bulbs (named "
+                                          "by file name) and write it as a Python module and a firmware header")
+    p.add_option('--depth', type='int', default=4, help="Largest depth of the tree (default 4)")
+    p.add_option('--min-leaf', type='int', default=50, help="Fewest training rows on each side of a split (default 50)")
+    p.add_option('--bins', type='int', default=64, help="Candidate thresholds per feature (default 64)")
+    p.add_option('--holdout', type='float', default=0.2,
+                 help="Fraction at the end of every file to test on instead of training (default 0.2)")
+    p.add_option('--python', default=DEFAULT_PYTHON, help="Python module to write (default lpcsb/light_model.py)")
+    p.add_option('--header', default=DEFAULT_HEADER,
+                 help="C header to write (default software/apps/LPCSB_Light_ID/light_model.h)")
+    p.add_option('--dry-run', '-n', action='store_true', help="Report, but don't write the model")
+    options, args = p.parse_args()
+    if not args:
+        p.error("need at least one recording")
+    if not 0 <= options.holdout < 1:
+        p.error("--holdout must be at least 0 and less than 1")
+    if options.depth < 1 or options.min_leaf < 1 or not 2 <= options.bins <= 4096:
+        p.error("--depth and --min-leaf must be positive and --bins 2 to 4096")
+
+    start = time.time()
+    try:
+        recordings = [load(path) for path in args]
+    except (ValueError, IOError) as e:
+        print("error: %s" % e, file=sys.stderr)
+        sys.exit(1)
+    loaded = time.time()
+
+    train_x, train_y, test_x, test_y, test_rules = [], [], [], [], []
+    for r in recordings:
+        cut = int(round(len(r.features) * (1 - options.holdout)))
+        train_x.append(r.features[:cut])
+        train_y.append(np.full(cut, r.label, dtype=np.int64))
+        test_x.append(r.features[cut:])
+        test_y.append(np.full(len(r.features) - cut, r.label, dtype=np.int64))
+        test_rules.append(r.rules[cut:])
+        print("%-40s %-12s %9d samples" % (os.path.basename(r.path)[:40], LABELS[r.label], len(r.features)))
+    train_x, train_y = np.concatenate(train_x), np.concatenate(train_y)
+    test_x, test_y, test_rules = np.concatenate(test_x), np.concatenate(test_y), np.concatenate(test_rules)
+    used = sorted(set(r.label for r in recordings))
+    if len(used) < 2:
+        print("error: need recordings of at least two bulb types", file=sys.stderr)
+        sys.exit(1)
+
+    # every bulb type weighs the same
+    per_label = np.bincount(train_y, minlength=len(LABELS)).astype(np.float64)
+    weights = len(train_y) / (len(used) * np.maximum(per_label, 1))
+    tree = fit_tree(train_x, train_y, weights, len(LABELS), options.depth, options.min_leaf, options.bins)
+    fitted = time.time()
+
+    print("\n%d training samples, %d held out; read in %.1f s, fitted in %.1f s; %d leaves\n" %
+          (len(train_y), len(test_y), loaded - start, fitted - loaded, tree.leaves()))
+    print('\n'.join(describe(tree)))
+    print()
+    print_confusion("model, training samples", confusion(train_y, tree.predict(train_x), len(LABELS)), used)
+    if len(test_y):
+        test = confusion(test_y, tree.predict(test_x), len(LABELS))
+        print_confusion("model, held out samples", test, used)
+        print_confusion("rules version %s, held out samples" % DEFAULT_RULES,
+                        confusion(test_y, test_rules, len(LABELS)), used)
+
+    if options.dry_run:
+        return
+    summary = ["Trained %s on %d samples of %s from" %
+               (datetime.date.today().isoformat(), len(train_y), ', '.join(LABELS[i] for i in used))]
+    summary += ["    %s" % os.path.basename(r.path) for r in recordings]
+    if len(test_y):
+        summary.append("%.1f%% right on %d held out samples." % (100.0 * np.trace(test) / test.sum(), len(test_y)))
+    summary += [''] + describe(tree)
+    with open(options.python, 'w') as f:
+        f.write(python_module(tree, summary))
+    with open(options.header, 'w') as f:
+        f.write(c_header(tree, summary))
+    print("\nwrote %s and %s" % (options.python, options.header))
+
+
+if __name__ == '__main__':
+    main()
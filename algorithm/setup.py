@@ -0,0 +1,28 @@
+""" Builds lpcsb._fastdecode, the native batch decoder (see lpcsb/fastdecode.py):
+
+    python setup.py build_ext --inplace
+
+once for every Python the scanners run with. Everything else in lpcsb is
+plain Python and runs from the source tree, and without the extension
+lpcsb.fastdecode falls back to the Python parser.
+
+The payload layouts come from the firmware's headers, so the extension is
+built against software/apps/LPCSB_Light_ID.
+"""
+
+import os
+
+try:
+    from setuptools import setup, Extension
+except ImportError:
+    from distutils.core import setup, Extension
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+FIRMWARE = os.path.join(HERE, '..', 'software', 'apps', 'LPCSB_Light_ID')
+
+setup(name='lpcsb',
+      version='1.0',
+      description='LPCSB gateway and analysis tools',
+      packages=['lpcsb'],
+      ext_modules=[Extension('lpcsb._fastdecode', ['lpcsb/_fastdecode.c'], include_dirs=[FIRMWARE],
+                             extra_compile_args=['-O2'])])
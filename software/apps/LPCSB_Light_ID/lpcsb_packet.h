@@ -0,0 +1,54 @@
+#pragma once
+
+// LPCSB advertisement payloads. Each goes out as manufacturer specific data
+// under the UVA company identifier: service byte, then one of the structs
+// below (or a telemetry frame, see telemetry.h), multi-byte fields big endian.
+//
+// The gateway's native decoder (algorithm/lpcsb/_fastdecode.c) includes this
+// file too, so keep it to plain C and <stdint.h>, and keep every struct made
+// of bytes so it has the same layout on the nRF51 and on the host.
+
+#include <stdint.h>
+
+#define UVA_COMPANY_IDENTIFIER  0x02E0
+#define UVA_RAW_COLOR_SERVICE   0x31
+#define UVA_LIGHT_COLOR_SERVICE 0x32
+#define UVA_TELEMETRY_SERVICE   0x33
+
+// What every TCS34725 answers to the ID register, and so the sensorID byte
+// of every sample; telemetry has 0 there until the sensor has answered
+#define LPCSB_SENSOR_ID 0x44
+
+// LightType values, also what light_model.h returns
+#define LPCSB_INCANDESCENT 0x00
+#define LPCSB_LED          0x11
+#define LPCSB_FLUORESCENT  0x22
+#define LPCSB_SUNLIGHT     0x33
+#define LPCSB_UNKNOWN      0x44
+
+//Sensor values: Can only transmit bytes, not ints
+typedef struct {
+    uint8_t sensorID;
+    uint8_t clearTempL; //Leftmost byte
+    uint8_t clearTempR; //Rightmost byte
+    uint8_t redTempL;   //Leftmost byte
+    uint8_t redTempR;   //Rightmost byte
+    uint8_t greenTempL; //Leftmost byte
+    uint8_t greenTempR; //Rightmost byte
+    uint8_t blueTempL;  //Leftmost byte
+    uint8_t blueTempR;  //Rightmost byte
+    uint8_t colorTempL; //Leftmost byte
+    uint8_t colorTempR; //Rightmost byte
+    uint8_t luxL;       //Leftmost byte
+    uint8_t luxR;       //Rightmost byte
+    uint8_t packetNumL; //Packet number MSB
+    uint8_t packetNumR; //Packet number LSB
+} lpcsb_raw_color_t;
+
+//Identification:
+typedef struct {
+    uint8_t sensorID;
+    uint8_t LightType;  //Type of light: 0's = Incandescent, 1's = LED, 2's = Fluorescent, 3's = Sunlight, 4's = Unknown
+    uint8_t packetNumL; //Packet number MSB
+    uint8_t packetNumR; //Packet number LSB
+} lpcsb_light_type_t;
@@ -24,9 +24,12 @@
 #include "simple_ble.h"
 #include "simple_adv.h"
 #include "eddystone.h"
+#include "multi_adv.h"
 
 //Sensor Library
 #include "tcs3472REDO.h"
+#include "telemetry.h"
+#include "lpcsb_packet.h"
 
 /*********************/
 /***** LED Stuff *****/
@@ -63,32 +66,20 @@ float maxRatio;
 float minRatio;
 float ratioCompare;
 
-//Sensor values: Can only transmit bytes, not ints
-static struct {
-    uint8_t sensorID;
-    uint8_t clearTempL; //Leftmost byte
-    uint8_t clearTempR; //Rightmost byte
-    uint8_t redTempL;   //Leftmost byte
-    uint8_t redTempR;   //Rightmost byte
-    uint8_t greenTempL; //Leftmost byte
-    uint8_t greenTempR; //Rightmost byte
-    uint8_t blueTempL;  //Leftmost byte
-    uint8_t blueTempR;  //Rightmost byte
-    uint8_t colorTempL; //Leftmost byte
-    uint8_t colorTempR; //Rightmost byte
-    uint8_t luxL;       //Leftmost byte
-    uint8_t luxR;       //Rightmost byte
-    uint8_t packetNumL; //Packet number MSB
-    uint8_t packetNumR; //Packet number LSB
-} color_sensor_info = {0};
-
-//Identification:
-static struct {
-    uint8_t sensorID;
-    uint8_t LightType;  //Type of light: 0's = Incandescent, 1's = LED, 2's = Fluorescent, 3's = Sunlight, 4's = Unknown
-    uint8_t packetNumL; //Packet number MSB
-    uint8_t packetNumR; //Packet number LSB
-} light_type = {0};
+//Light type from the decision tree in light_model.h, written by
+//algorithm/lpcsb/train.py, instead of the rules in advertiseData()
+#ifndef LIGHT_MODEL
+#define LIGHT_MODEL 0
+#endif
+#if LIGHT_MODEL
+#include "light_model.h"
+static uint16_t firstRed, firstGreen, firstBlue;    //First sample since the packet number was 1, for the drift
+static bool haveFirstSample = false;
+#endif
+
+//Payloads as advertised, see lpcsb_packet.h
+static lpcsb_raw_color_t color_sensor_info = {0};
+static lpcsb_light_type_t light_type = {0};
 
 //Configuration indicators
 static struct{
@@ -105,19 +96,35 @@ static struct{
 #define BLE_ADVERTISING_ENABLED 1
 #define DEVICE_NAME             "LPCSB_TEST"
 #define COLOR_DATA_URL          "j2x.us/LPCSB"
-#define UVA_COMPANY_IDENTIFIER  0x02E0
-#define UVA_RAW_COLOR_SERVICE   0x31
-#define UVA_LIGHT_COLOR_SERVICE 0x32
 
 uint8_t color_data[1 + sizeof(color_sensor_info)];
 uint8_t light_data[1 + sizeof(light_type)];
+uint8_t telemetry_data[1 + TELEMETRY_FRAME_LEN];
+
+//Raw and classified data take turns on air, each for ADV_SLOT_MS at a time.
+//With a 1250 ms adv. interval each of them still goes out about twice per sample.
+//Telemetry changes slowly, so it gets one short slot for every 8 data slots.
+#define ADV_SLOT_MS          2500
+#define ADV_TELEMETRY_MS     1250
+#define ADV_RAW_WEIGHT       4
+#define ADV_LIGHT_WEIGHT     4
+#define ADV_TELEMETRY_WEIGHT 1
+static bool sample_ready = false;   //Until the first sample, only telemetry goes out
+
+//Ack mode: the gateway scans actively (scanner run with --active) and a scan
+//request for the payload on air counts as "received". That payload is then
+//dropped from the rotation, and once everything has been heard the radio
+//stays quiet until the next sample. Any active scanner counts, not just ours.
+#ifndef ADV_ACK_MODE
+#define ADV_ACK_MODE 0
+#endif
 
 // Intervals for advertising and connections
 static simple_ble_config_t ble_config = {
     .platform_id       = 0x40,              // used as 4th octect in device BLE address
     .device_id         = DEVICE_ID_DEFAULT,
     .adv_name          = DEVICE_NAME,       // used in advertisements if there is room
-    .adv_interval      = MSEC_TO_UNITS(2500, UNIT_0_625_MS), //Adv. interval of 5000 ms
+    .adv_interval      = MSEC_TO_UNITS(1250, UNIT_0_625_MS), //Adv. interval of 1250 ms
     .min_conn_interval = MSEC_TO_UNITS(500, UNIT_1_25_MS),
     .max_conn_interval = MSEC_TO_UNITS(1000, UNIT_1_25_MS)
 };
@@ -138,8 +145,22 @@ static void finish_reading_green (int16_t green);
 static void finish_reading_blue (int16_t blue);
 static void processData();
 static void advertiseData();
+static void adv_config_raw();
+static void adv_config_light();
+static void adv_config_telemetry();
 static void start_color_measuring();
 
+#if ADV_ACK_MODE
+//A gateway asked for our scan response, so it has the payload on air
+void ble_evt_scan_req_report(ble_evt_t* p_ble_evt){
+    multi_adv_configure_f current = multi_adv_get_current();
+
+    if(current != NULL){
+        multi_adv_set_active(current, false);
+    }
+}
+#endif
+
 /*************************************/
 /***** Reading and Config Methods ****/
 /*************************************/
@@ -147,6 +168,77 @@ static void start_color_measuring(){
     tcs34725_read_clear(finish_reading_clear);
 }
 
+//multi_adv configuration for the raw color data (service 0x31)
+static void adv_config_raw(){
+    ble_advdata_manuf_data_t DataSent;
+
+    if(!sample_ready){
+        adv_config_telemetry();
+        return;
+    }
+
+    DataSent.company_identifier = UVA_COMPANY_IDENTIFIER;
+    DataSent.data.p_data = color_data;
+    DataSent.data.size = sizeof(color_data);
+    simple_adv_manuf_data(&DataSent);
+}
+
+//multi_adv configuration for the identified light type (service 0x32)
+static void adv_config_light(){
+    ble_advdata_manuf_data_t DataSent;
+
+    if(!sample_ready){
+        adv_config_telemetry();
+        return;
+    }
+
+    DataSent.company_identifier = UVA_COMPANY_IDENTIFIER;
+    DataSent.data.p_data = light_data;
+    DataSent.data.size = sizeof(light_data);
+    simple_adv_manuf_data(&DataSent);
+}
+
+//multi_adv configuration for board health (service 0x33), read fresh each time
+static void adv_config_telemetry(){
+    ble_advdata_manuf_data_t DataSent;
+
+    telemetry_data[0] = UVA_TELEMETRY_SERVICE;
+    telemetry_build(color_sensor_info.sensorID, telemetry_data + 1);
+
+    DataSent.company_identifier = UVA_COMPANY_IDENTIFIER;
+    DataSent.data.p_data = telemetry_data;
+    DataSent.data.size = sizeof(telemetry_data);
+    simple_adv_manuf_data(&DataSent);
+}
+
+#if LIGHT_MODEL
+//Largest change of red, green or blue since the last sample with packet
+//number 1: after boot, and again every time the 16 bit counter wraps (about
+//every 3.8 days at 5 s). lpcsb.classify and lpcsb.reclassify restart the
+//drift on seq 1 too, so both sides compute the same feature.
+static uint16_t driftSinceReset(){
+    uint16_t drift = 0;
+    uint16_t change;
+
+    if(color_sensor_info.packetNumL == 0 && color_sensor_info.packetNumR == 1){
+        haveFirstSample = false;
+    }
+    if(!haveFirstSample){
+        firstRed = redData;
+        firstGreen = greenData;
+        firstBlue = blueData;
+        haveFirstSample = true;
+    }
+    change = redData > firstRed ? redData - firstRed : firstRed - redData;
+    drift = change > drift ? change : drift;
+    change = greenData > firstGreen ? greenData - firstGreen : firstGreen - greenData;
+    drift = change > drift ? change : drift;
+    change = blueData > firstBlue ? blueData - firstBlue : firstBlue - blueData;
+    drift = change > drift ? change : drift;
+    return drift;
+}
+#endif
+
 static void advertiseData(){
     //If the packet number bytes are at their max values:
     if(color_sensor_info.packetNumR >= 255 || light_type.packetNumR >= 255){
@@ -162,31 +254,34 @@ static void advertiseData(){
         light_type.packetNumL += 0;         //Leave the light type packet number MSB alone
     }
 
-    ble_advdata_manuf_data_t DataSent;
+    telemetry_count_sample();
 
     //Light type identification
+#if LIGHT_MODEL
+    light_type.LightType = light_model_classify(redData, greenData, blueData, luxData, driftSinceReset());
+#else
     if(redData >= greenData && redData >= blueData && maxRatio >= 1.1 && minRatio <= 1.1){
-        light_type.LightType = 0x00; //Incandescent
+        light_type.LightType = LPCSB_INCANDESCENT;
     }
     else if(ratioCompare <= 1.45 && luxData <= 2000){
-        light_type.LightType = 0x11; //LED
+        light_type.LightType = LPCSB_LED;
     }
     else if(ratioCompare <= 1.7 && luxData >= 2000){
-        light_type.LightType = 0x22; //Fluorescent
+        light_type.LightType = LPCSB_FLUORESCENT;
     }
     // else if(){} //Daylight characteristics haven't been identified yet
     else{
-        light_type.LightType = 0x44; //Unknown
+        light_type.LightType = LPCSB_UNKNOWN;
     }
+#endif
 
-    if(light_type.LightType == 0x44){ //If the type of light is unknown. Transmit the raw data
-        color_data[0] = UVA_RAW_COLOR_SERVICE;
-        memcpy(color_data + 1, &color_sensor_info, sizeof(color_sensor_info));
-
-        DataSent.company_identifier = UVA_COMPANY_IDENTIFIER;
-        DataSent.data.p_data = color_data;
-        DataSent.data.size = 1 + sizeof(color_data);
+    //Both payloads are always kept current; multi_adv rotates between them
+    color_data[0] = UVA_RAW_COLOR_SERVICE;
+    memcpy(color_data + 1, &color_sensor_info, sizeof(color_sensor_info));
+    light_data[0] = UVA_LIGHT_COLOR_SERVICE;
+    memcpy(light_data + 1, &light_type, sizeof(light_type));
 
+    if(light_type.LightType == LPCSB_UNKNOWN){ //If the type of light is unknown
         //Flash the LED very quickly 10 times
         for(int i = 0; i < 10; i++){
             led_toggle(LED);
@@ -195,14 +290,7 @@ static void advertiseData(){
             nrf_delay_ms(50);
         }
     }
-    else{   //The type of light has been identified! Transmit it
-        light_data[0] = UVA_LIGHT_COLOR_SERVICE;
-        memcpy(light_data + 1, &light_type, sizeof(light_data));
-
-        DataSent.company_identifier = UVA_COMPANY_IDENTIFIER;
-        DataSent.data.p_data = light_data;
-        DataSent.data.size = 1 + sizeof(light_data);
-
+    else{   //The type of light has been identified!
         //Flash the LED very quickly 10 times
         for(int i = 0; i < 10; i++){
             led_toggle(LED);
@@ -211,10 +299,16 @@ static void advertiseData(){
             nrf_delay_ms(250);
         }
     }
-    // Advertise name and data
-    // simple_adv_only_name();
-    simple_adv_manuf_data(&DataSent);
-    // eddystone_with_manuf_adv(COLOR_DATA_URL, &DataSent); //Transmit the data
+    // Advertise the new data. Whichever payload is on air is updated in place.
+    sample_ready = true;
+    multi_adv_refresh(adv_config_raw);
+    multi_adv_refresh(adv_config_light);
+#if ADV_ACK_MODE
+    // New sample, so nothing has been heard yet
+    multi_adv_set_active(adv_config_raw, true);
+    multi_adv_set_active(adv_config_light, true);
+    multi_adv_set_active(adv_config_telemetry, true);
+#endif
     led_on(LED);
     nrf_delay_ms(1000);
     led_off(LED);
@@ -399,6 +493,16 @@ int main(void) {
     led_on(LED);
     nrf_delay_ms(1000);
     simple_ble_init(&ble_config);
+    multi_adv_init(ADV_SLOT_MS);
+    multi_adv_register_weighted_config(adv_config_raw, ADV_RAW_WEIGHT, ADV_SLOT_MS);
+    multi_adv_register_weighted_config(adv_config_light, ADV_LIGHT_WEIGHT, ADV_SLOT_MS);
+    multi_adv_register_weighted_config(adv_config_telemetry, ADV_TELEMETRY_WEIGHT, ADV_TELEMETRY_MS);
+    telemetry_init();
+#if ADV_ACK_MODE
+    err_code = simple_ble_scan_req_report_enable();
+    APP_ERROR_CHECK(err_code);
+#endif
+    multi_adv_start();
     led_off(LED);
     nrf_delay_ms(1000);
 
@@ -159,6 +159,15 @@ void tcs34725_read_red_data ();
 void tcs34725_read_green_data ();
 void tcs34725_read_blue_data ();
 void tcs34725_read_clear_data ();
+static void tcs34725_twi_handler (ret_code_t result, void* p_user_data);
+
+// I2C error accounting for telemetry. A failed transaction is retried a few
+// times before the state machine moves on with whatever was read.
+#define TWI_MAX_RETRIES 3
+static app_twi_transaction_t const* pending_transaction = NULL;
+static uint8_t pending_retries = 0;
+static uint16_t twi_error_count = 0;
+static uint16_t twi_retry_count = 0;
 
 //***Functions***
 
@@ -180,6 +189,34 @@ void tcs34725_init (app_twi_t* twi_instance) {
     APP_ERROR_CHECK(err_code);
 }
 
+// Schedule a transaction and remember it in case it has to be retried
+static uint32_t tcs34725_schedule (app_twi_transaction_t const* transaction) {
+    pending_transaction = transaction;
+    pending_retries = 0;
+    return app_twi_schedule(twi, transaction);
+}
+
+// Called by app_twi at the end of every transaction
+static void tcs34725_twi_handler (ret_code_t result, void* p_user_data) {
+    if (result != NRF_SUCCESS) {
+        twi_error_count++;
+
+        if (pending_retries < TWI_MAX_RETRIES &&
+                app_twi_schedule(twi, pending_transaction) == NRF_SUCCESS) {
+            pending_retries++;
+            twi_retry_count++;
+            return;
+        }
+    }
+
+    tcs34725_event_handler();
+}
+
+void tcs34725_get_twi_stats (uint16_t* errors, uint16_t* retries) {
+    *errors = twi_error_count;
+    *retries = twi_retry_count;
+}
+
 //Read the ID of the sensor
 static void (*read_ID_callback)(int8_t) = NULL;
 void tcs34725_read_ID (void (*callback)(int8_t ID)) {
@@ -195,10 +232,10 @@ void tcs34725_read_ID (void (*callback)(int8_t ID)) {
     static app_twi_transaction_t const readID = {
         .p_transfers = READ_SENSOR,
         .number_of_transfers = READ_SENSOR_LEN,
-        .callback = tcs34725_event_handler,
+        .callback = tcs34725_twi_handler,
         .p_user_data = NULL,
     };
-    err_code = app_twi_schedule(twi, &readID);
+    err_code = tcs34725_schedule(&readID);
     APP_ERROR_CHECK(err_code);
 }
 
@@ -213,10 +250,10 @@ void tcs34725_Set_Int_Time(void (*callback)(void)){
     static app_twi_transaction_t const setIntTime = {
         .p_transfers = SET_INT_TIME,
         .number_of_transfers = INT_CMD_LEN,
-        .callback = tcs34725_event_handler,
+        .callback = tcs34725_twi_handler,
         .p_user_data = NULL,
     };
-    app_twi_schedule(twi, &setIntTime);
+    tcs34725_schedule(&setIntTime);
 }
 
 static void (*set_gain_callback)(void) = NULL;
@@ -230,10 +267,10 @@ void tcs34725_Set_Gain(void (*callback)(void)){
     static app_twi_transaction_t const setGain = {
         .p_transfers = SET_GAIN,
         .number_of_transfers = GAIN_CMD_LEN,
-        .callback = tcs34725_event_handler,
+        .callback = tcs34725_twi_handler,
         .p_user_data = NULL,
     };
-    app_twi_schedule(twi, &setGain);
+    tcs34725_schedule(&setGain);
 }
 
 //enable sensor
@@ -248,10 +285,10 @@ void tcs34725_sensor_enable (void (*callback)(void)) {
     static app_twi_transaction_t const power_on = {
         .p_transfers = POWER_ON_SENSOR,
         .number_of_transfers = POWER_ON_LEN,
-        .callback = tcs34725_event_handler,
+        .callback = tcs34725_twi_handler,
         .p_user_data = NULL,
     };
-    app_twi_schedule(twi, &power_on);
+    tcs34725_schedule(&power_on);
 }
 
 static void (*adc_enable_callback)(void) = NULL;
@@ -265,10 +302,10 @@ void tcs34725_adc_enable (void (*callback)(void)) {
     static app_twi_transaction_t const enable = {
         .p_transfers = ENABLE_SENSOR_ADC,
         .number_of_transfers = ENABLE_ADC_LEN,
-        .callback = tcs34725_event_handler,
+        .callback = tcs34725_twi_handler,
         .p_user_data = NULL,
     };
-    app_twi_schedule(twi, &enable);
+    tcs34725_schedule(&enable);
 }
 
 static void(*set_interrupt_callback)(void) = NULL;
@@ -282,7 +319,7 @@ void tcs34725_set_Interrupt(void (*callback)(void)){
     static app_twi_transaction_t const interruptSet = {
         .p_transfers = SET_INTERRUPT,
         .number_of_transfers = SET_INTERRUPT_LEN,
-        .callback = tcs34725_event_handler,
+        .callback = tcs34725_twi_handler,
         .p_user_data = NULL,
     };
 
@@ -296,7 +333,7 @@ void tcs34725_set_Interrupt(void (*callback)(void)){
     simple_adv_only_name();
     led_on(LED);
 
-    app_twi_schedule(twi, &interruptSet);
+    tcs34725_schedule(&interruptSet);
 }
 
 static void (*read_clear_callback)(int16_t) = NULL;
@@ -312,10 +349,10 @@ void tcs34725_read_clear (void (*callback)(int16_t clear)) {
     static app_twi_transaction_t const transaction = {
         .p_transfers = MEAS_CLEAR_TXFR,
         .number_of_transfers = MEAS_CLEAR_TXFR_LEN,
-        .callback = tcs34725_event_handler,
+        .callback = tcs34725_twi_handler,
         .p_user_data = NULL,
     };
-    err_code = app_twi_schedule(twi, &transaction);
+    err_code = tcs34725_schedule(&transaction);
     APP_ERROR_CHECK(err_code);
 }
 
@@ -333,10 +370,10 @@ void tcs34725_read_red (void (*callback)(int16_t red)) {
     static app_twi_transaction_t const transaction = {
         .p_transfers = MEAS_RED_TXFR,
         .number_of_transfers = MEAS_RED_TXFR_LEN,
-        .callback = tcs34725_event_handler,
+        .callback = tcs34725_twi_handler,
         .p_user_data = NULL,
     };
-    err_code = app_twi_schedule(twi, &transaction);
+    err_code = tcs34725_schedule(&transaction);
     APP_ERROR_CHECK(err_code);
 }
 
@@ -353,10 +390,10 @@ void tcs34725_read_green (void (*callback)(int16_t green)) {
     static app_twi_transaction_t const transaction = {
         .p_transfers = MEAS_GREEN_TXFR,
         .number_of_transfers = MEAS_GREEN_TXFR_LEN,
-        .callback = tcs34725_event_handler,
+        .callback = tcs34725_twi_handler,
         .p_user_data = NULL,
     };
-    err_code = app_twi_schedule(twi, &transaction);
+    err_code = tcs34725_schedule(&transaction);
     APP_ERROR_CHECK(err_code);
 }
 
@@ -373,10 +410,10 @@ void tcs34725_read_blue (void (*callback)(int16_t blue)) {
     static app_twi_transaction_t const transaction = {
         .p_transfers = MEAS_BLUE_TXFR,
         .number_of_transfers = MEAS_BLUE_TXFR_LEN,
-        .callback = tcs34725_event_handler,
+        .callback = tcs34725_twi_handler,
         .p_user_data = NULL,
     };
-    err_code = app_twi_schedule(twi, &transaction);
+    err_code = tcs34725_schedule(&transaction);
     APP_ERROR_CHECK(err_code);
 }
 
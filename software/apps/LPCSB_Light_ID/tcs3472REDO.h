@@ -23,6 +23,9 @@ uint16_t tcs34725_calculate_lux();
 
 void tcs34725_event_handler ();
 
+// I2C transactions that failed, and how many of those were retried
+void tcs34725_get_twi_stats(uint16_t* errors, uint16_t* retries);
+
 // I2C address of TCS34725
 #define TCS34725_ADDRESS  0x29
 
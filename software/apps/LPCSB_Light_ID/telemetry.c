@@ -0,0 +1,127 @@
+// LPCSB telemetry frame
+
+//Standard Libraries
+#include <stdbool.h>
+#include <stdint.h>
+
+//Nordic Libraries
+#include "app_error.h"
+#include "app_timer.h"
+#include "ble_radio_notification.h"
+#include "nrf.h"
+#include "nrf_soc.h"
+#include "simple_ble.h"
+
+#include "tcs3472REDO.h"
+#include "telemetry.h"
+
+// Pipeline counters
+static uint32_t radio_event_count = 0;
+static uint32_t sample_count = 0;
+
+// Uptime is accumulated from RTC1, which wraps every 512 s, so it has to be
+// sampled at least that often. Samples and telemetry frames both do.
+static uint32_t last_ticks = 0;
+static uint64_t uptime_ticks = 0;
+
+static void uptime_update (void) {
+    uint32_t now;
+    uint32_t diff;
+
+    app_timer_cnt_get(&now);
+    app_timer_cnt_diff_compute(now, last_ticks, &diff);
+    last_ticks = now;
+    uptime_ticks += diff;
+}
+
+// Counts radio activity, which is one event per advertisement when no
+// central is connected
+static void radio_notification_handler (bool radio_active) {
+    if (radio_active) {
+        radio_event_count++;
+    }
+}
+
+// Supply voltage from the ADC, measured against the 1.2 V bandgap with 1/3
+// prescaling. A single 10 bit conversion takes about 68 us.
+static uint16_t battery_read_mv (void) {
+    uint32_t result;
+
+    NRF_ADC->CONFIG = (ADC_CONFIG_RES_10bit << ADC_CONFIG_RES_Pos) |
+                      (ADC_CONFIG_INPSEL_SupplyOneThirdPrescaling << ADC_CONFIG_INPSEL_Pos) |
+                      (ADC_CONFIG_REFSEL_VBG << ADC_CONFIG_REFSEL_Pos) |
+                      (ADC_CONFIG_PSEL_Disabled << ADC_CONFIG_PSEL_Pos) |
+                      (ADC_CONFIG_EXTREFSEL_None << ADC_CONFIG_EXTREFSEL_Pos);
+    NRF_ADC->EVENTS_END = 0;
+    NRF_ADC->ENABLE = ADC_ENABLE_ENABLE_Enabled;
+
+    NRF_ADC->TASKS_START = 1;
+    while (!NRF_ADC->EVENTS_END);
+    NRF_ADC->EVENTS_END = 0;
+    result = NRF_ADC->RESULT;
+
+    NRF_ADC->TASKS_STOP = 1;
+    NRF_ADC->ENABLE = ADC_ENABLE_ENABLE_Disabled;
+
+    // 1023 counts = 1.2 V * 3
+    return (result * 3600) / 1023;
+}
+
+void telemetry_init (void) {
+    uint32_t err_code;
+
+    app_timer_cnt_get(&last_ticks);
+
+    err_code = ble_radio_notification_init(NRF_APP_PRIORITY_LOW,
+                                           NRF_RADIO_NOTIFICATION_DISTANCE_800US,
+                                           radio_notification_handler);
+    APP_ERROR_CHECK(err_code);
+}
+
+void telemetry_count_sample (void) {
+    sample_count++;
+    uptime_update();
+}
+
+void telemetry_build (uint8_t sensor_id, uint8_t* frame) {
+    uint16_t battery_mv;
+    int32_t temp_quarters = 0;
+    int16_t temperature;
+    uint32_t uptime_ds;
+    uint16_t twi_errors;
+    uint16_t twi_retries;
+
+    uptime_update();
+    uptime_ds = (uint32_t) ((uptime_ticks * 10) / (32768 / (APP_TIMER_PRESCALER + 1)));
+
+    battery_mv = battery_read_mv();
+
+    // 0.25 degree steps to 8.8 fixed point
+    sd_temp_get(&temp_quarters);
+    temperature = (int16_t) (temp_quarters * 64);
+
+    tcs34725_get_twi_stats(&twi_errors, &twi_retries);
+
+    frame[0]  = sensor_id;
+    frame[1]  = TELEMETRY_VERSION;
+    frame[2]  = battery_mv >> 8;
+    frame[3]  = battery_mv & 0xFF;
+    frame[4]  = (uint16_t) temperature >> 8;
+    frame[5]  = (uint16_t) temperature & 0xFF;
+    frame[6]  = uptime_ds >> 24;
+    frame[7]  = uptime_ds >> 16;
+    frame[8]  = uptime_ds >> 8;
+    frame[9]  = uptime_ds & 0xFF;
+    frame[10] = radio_event_count >> 24;
+    frame[11] = radio_event_count >> 16;
+    frame[12] = radio_event_count >> 8;
+    frame[13] = radio_event_count & 0xFF;
+    frame[14] = sample_count >> 24;
+    frame[15] = sample_count >> 16;
+    frame[16] = sample_count >> 8;
+    frame[17] = sample_count & 0xFF;
+    frame[18] = twi_errors >> 8;
+    frame[19] = twi_errors & 0xFF;
+    frame[20] = twi_retries >> 8;
+    frame[21] = twi_retries & 0xFF;
+}
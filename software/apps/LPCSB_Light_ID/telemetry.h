@@ -0,0 +1,30 @@
+#pragma once
+
+// LPCSB telemetry: supply voltage, temperature, uptime and pipeline counters,
+// advertised as UVA service 0x33 so boards can be checked without connecting.
+
+#include <stdint.h>
+
+#define TELEMETRY_VERSION 0x00
+
+// Frame layout after the service byte. Multi-byte fields are big endian,
+// like the color data.
+//   [0]      sensor ID
+//   [1]      frame version
+//   [2..3]   supply voltage, mV
+//   [4..5]   die temperature, signed 8.8 fixed point degrees C
+//   [6..9]   uptime, 0.1 s
+//   [10..13] radio events (advertisements) since boot
+//   [14..17] color samples taken since boot
+//   [18..19] failed I2C transactions
+//   [20..21] I2C retries
+#define TELEMETRY_FRAME_LEN 22
+
+// Call after simple_ble_init()
+void telemetry_init (void);
+
+// Call once for every completed color sample
+void telemetry_count_sample (void);
+
+// Take a fresh battery/temperature reading and fill in a frame
+void telemetry_build (uint8_t sensor_id, uint8_t* frame);
@@ -1,5 +1,5 @@
 /*
- * Eddystone URL advertisement
+ * Eddystone URL and TLM advertisements
  */
 
 // Standard Libraries
@@ -90,3 +90,48 @@ void eddystone_with_name (const char* url_str) {
 
     eddystone_adv(url_str, &srdata);
 }
+
+// Telemetry frame. Temperature is in signed 8.8 fixed point degrees C (or
+// PHYSWEB_TLM_NO_TEMP) and uptime is in units of 0.1 s. All fields go out
+// big endian.
+void eddystone_tlm_adv (uint16_t battery_mv, int16_t temperature,
+                        uint32_t adv_count, uint32_t uptime_ds,
+                        const ble_advdata_t* scan_response_data) {
+    uint32_t err_code;
+
+    ble_uuid_t PHYSWEB_SERVICE_UUID[] = {{PHYSWEB_SERVICE_ID, BLE_UUID_TYPE_BLE}};
+    ble_advdata_uuid_list_t PHYSWEB_SERVICE_LIST = {1, PHYSWEB_SERVICE_UUID};
+
+    uint8_t m_tlm_frame[14];
+    m_tlm_frame[0]  = PHYSWEB_TLM_TYPE;
+    m_tlm_frame[1]  = PHYSWEB_TLM_VERSION;
+    m_tlm_frame[2]  = battery_mv >> 8;
+    m_tlm_frame[3]  = battery_mv & 0xFF;
+    m_tlm_frame[4]  = (uint16_t) temperature >> 8;
+    m_tlm_frame[5]  = (uint16_t) temperature & 0xFF;
+    m_tlm_frame[6]  = adv_count >> 24;
+    m_tlm_frame[7]  = adv_count >> 16;
+    m_tlm_frame[8]  = adv_count >> 8;
+    m_tlm_frame[9]  = adv_count & 0xFF;
+    m_tlm_frame[10] = uptime_ds >> 24;
+    m_tlm_frame[11] = uptime_ds >> 16;
+    m_tlm_frame[12] = uptime_ds >> 8;
+    m_tlm_frame[13] = uptime_ds & 0xFF;
+
+    ble_advdata_service_data_t service_data;
+    service_data.service_uuid   = PHYSWEB_SERVICE_ID;
+    service_data.data.p_data    = m_tlm_frame;
+    service_data.data.size      = sizeof(m_tlm_frame);
+
+    ble_advdata_t advdata;
+    memset(&advdata, 0, sizeof(advdata));
+    advdata.flags                   = BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE;
+    advdata.p_service_data_array    = &service_data;
+    advdata.service_data_count      = 1;
+    advdata.uuids_complete          = PHYSWEB_SERVICE_LIST;
+
+    err_code = ble_advdata_set(&advdata, scan_response_data);
+    APP_ERROR_CHECK(err_code);
+
+    advertising_start();
+}
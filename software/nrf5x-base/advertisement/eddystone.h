@@ -7,11 +7,17 @@
 void eddystone_adv(const char*, const ble_advdata_t*);
 void eddystone_with_manuf_adv (const char* url_str, ble_advdata_manuf_data_t* manuf_specific_data);
 void eddystone_with_name (const char* url_str);
+void eddystone_tlm_adv (uint16_t battery_mv, int16_t temperature,
+                        uint32_t adv_count, uint32_t uptime_ds,
+                        const ble_advdata_t* scan_response_data);
 
 // Physical Web
 #define PHYSWEB_SERVICE_ID  0xFEAA
 #define PHYSWEB_URL_TYPE    0x10    // Denotes URLs (vs URIs or TLM data)
 #define PHYSWEB_TX_POWER    0xBA    // Tx Power. Measured at 1 m plus 41 dBm. (who cares)
+#define PHYSWEB_TLM_TYPE    0x20    // Denotes unencrypted TLM data
+#define PHYSWEB_TLM_VERSION 0x00
+#define PHYSWEB_TLM_NO_TEMP ((int16_t) 0x8000) // Temperature not supported
 
 #define PHYSWEB_URLSCHEME_HTTPWWW   0x00    // http://www.
 #define PHYSWEB_URLSCHEME_HTTPSWWW  0x01    // https://www.
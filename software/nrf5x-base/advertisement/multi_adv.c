@@ -1,17 +1,27 @@
 #include <stdint.h>
+#include <stdbool.h>
 
 #include "nrf_error.h"
 #include "nordic_common.h"
 #include "app_timer.h"
 
+#include "simple_ble.h"
 #include "multi_adv.h"
 
 // Keep track of the function calls that setup the various advertisements
-static multi_adv_configure_f adv_config_functions[MULTI_ADV_MAX_CONFIG_FUNCTIONS] = {NULL};
+static struct {
+	multi_adv_configure_f config;
+	uint8_t  weight;
+	int16_t  credit;       // weighted round robin state
+	uint32_t interval_ms;
+	bool     active;       // inactive slots are skipped until re-enabled
+} adv_configs[MULTI_ADV_MAX_CONFIG_FUNCTIONS] = {{NULL}};
 static uint8_t adv_config_len = 0;
 
 // Current index of advertisement to advertise.
 static uint8_t adv_config_index = 0;
+static uint8_t adv_running = 0;
+static uint8_t adv_idle = 0;         // running, but every slot is inactive
 
 // Save the switching interval
 static uint32_t multi_adv_interval_ms = 1000;
@@ -19,13 +29,55 @@ static uint32_t multi_adv_interval_ms = 1000;
 // Timer state
 APP_TIMER_DEF(multi_adv_timer);
 
-// Timer callback for when it's time to switch advertisements.
-static void multi_adv_timer_handler (void* p_context) {
-	// Increment the index
-	adv_config_index = (adv_config_index + 1) % adv_config_len;
+// Pick the next advertisement with smooth weighted round robin. Every slot
+// earns its weight in credit each turn and the richest one goes on air and
+// pays back the total. Weights 2 and 1 give A B A A B A, not A A B A A B.
+// Inactive slots take no part. Returns false if there is nothing to pick.
+static bool multi_adv_select_next () {
+	int16_t total = 0;
+	int16_t best = -1;
+	uint8_t i;
+
+	for (i=0; i<adv_config_len; i++) {
+		if (!adv_configs[i].active) {
+			continue;
+		}
+		adv_configs[i].credit += adv_configs[i].weight;
+		total += adv_configs[i].weight;
+		if (best < 0 || adv_configs[i].credit > adv_configs[best].credit) {
+			best = i;
+		}
+	}
+	if (best < 0) {
+		return false;
+	}
+	adv_configs[best].credit -= total;
+
+	adv_config_index = best;
+	return true;
+}
+
+// Put the next advertisement on air and schedule the switch after it. With
+// every slot inactive the radio goes quiet until one is enabled again.
+static uint32_t multi_adv_switch () {
+	if (!multi_adv_select_next()) {
+		adv_idle = 1;
+		advertising_stop();
+		return NRF_SUCCESS;
+	}
+	adv_idle = 0;
 
 	// Call that function to update the advertisement in the softdevice
-	adv_config_functions[adv_config_index]();
+	adv_configs[adv_config_index].config();
+
+	return app_timer_start(multi_adv_timer,
+	                       APP_TIMER_TICKS(adv_configs[adv_config_index].interval_ms, 0),
+	                       NULL);
+}
+
+// Timer callback for when it's time to switch advertisements.
+static void multi_adv_timer_handler (void* p_context) {
+	multi_adv_switch();
 }
 
 
@@ -36,8 +88,9 @@ uint32_t multi_adv_init (uint32_t switch_interval_ms) {
 	// Save this parameter
 	multi_adv_interval_ms = switch_interval_ms;
 
+	// Single shot so that every advertisement can have its own interval
 	err = app_timer_create(&multi_adv_timer,
-	                       APP_TIMER_MODE_REPEATED,
+	                       APP_TIMER_MODE_SINGLE_SHOT,
 	                       multi_adv_timer_handler);
 	return err;
 }
@@ -46,29 +99,92 @@ uint32_t multi_adv_init (uint32_t switch_interval_ms) {
 // This function takes a function that will configure the nRF with the new
 // advertisement.
 uint32_t multi_adv_register_config (multi_adv_configure_f config_function) {
+	return multi_adv_register_weighted_config(config_function, 1, 0);
+}
+
+uint32_t multi_adv_register_weighted_config (multi_adv_configure_f config_function,
+                                             uint8_t weight,
+                                             uint32_t interval_ms) {
 	// Check that we haven't hit max advertisements yet
 	if (adv_config_len == MULTI_ADV_MAX_CONFIG_FUNCTIONS) {
 		return NRF_ERROR_NO_MEM;
 	}
+	if (weight == 0) {
+		return NRF_ERROR_INVALID_PARAM;
+	}
 
 	// Add this as a advertisement configure function
-	adv_config_functions[adv_config_len] = config_function;
+	adv_configs[adv_config_len].config      = config_function;
+	adv_configs[adv_config_len].weight      = weight;
+	adv_configs[adv_config_len].credit      = 0;
+	adv_configs[adv_config_len].interval_ms = interval_ms ? interval_ms : multi_adv_interval_ms;
+	adv_configs[adv_config_len].active      = true;
 	adv_config_len++;
 
 	return NRF_SUCCESS;
 }
 
+// Only touches the softdevice advertising data, so advertising keeps running
+uint32_t multi_adv_refresh (multi_adv_configure_f config_function) {
+	uint8_t i;
+
+	for (i=0; i<adv_config_len; i++) {
+		if (adv_configs[i].config == config_function) {
+			if (adv_running && !adv_idle && i == adv_config_index) {
+				config_function();
+			}
+			return NRF_SUCCESS;
+		}
+	}
+	return NRF_ERROR_NOT_FOUND;
+}
+
+uint32_t multi_adv_set_active (multi_adv_configure_f config_function, bool active) {
+	uint8_t i;
+
+	for (i=0; i<adv_config_len; i++) {
+		if (adv_configs[i].config != config_function) {
+			continue;
+		}
+		if (adv_configs[i].active == active) {
+			return NRF_SUCCESS;
+		}
+		adv_configs[i].active = active;
+		adv_configs[i].credit = 0;
+
+		if (!adv_running) {
+			return NRF_SUCCESS;
+		}
+		if ((active && adv_idle) || (!active && i == adv_config_index)) {
+			// Don't wait out the slot, move on right away
+			app_timer_stop(multi_adv_timer);
+			return multi_adv_switch();
+		}
+		return NRF_SUCCESS;
+	}
+	return NRF_ERROR_NOT_FOUND;
+}
+
+multi_adv_configure_f multi_adv_get_current () {
+	if (!adv_running || adv_idle || adv_config_len == 0) {
+		return NULL;
+	}
+	return adv_configs[adv_config_index].config;
+}
+
 // Enable switching advertisements
 uint32_t multi_adv_start () {
-	uint32_t err;
+	if (adv_config_len == 0) {
+		return NRF_ERROR_INVALID_STATE;
+	}
 
-	err = app_timer_start(multi_adv_timer,
-	                      APP_TIMER_TICKS(multi_adv_interval_ms, 0),
-	                      NULL);
-	return err;
+	adv_running = 1;
+	return multi_adv_switch();
 }
 
 // Stop switching advertisements
 uint32_t multi_adv_stop () {
+	adv_running = 0;
+	adv_idle = 0;
 	return app_timer_stop(multi_adv_timer);
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
 
 // Max number of advertisements to iterate through
 #ifndef MULTI_ADV_MAX_CONFIG_FUNCTIONS
@@ -12,5 +13,26 @@ typedef void (*multi_adv_configure_f)();
 
 uint32_t multi_adv_init (uint32_t switch_interval_ms);
 uint32_t multi_adv_register_config (multi_adv_configure_f config_function);
+
+// Register an advertisement that is put on air `weight` times as often as a
+// weight 1 advertisement and stays there for `interval_ms` each time. An
+// interval of 0 uses the switch interval given to multi_adv_init().
+uint32_t multi_adv_register_weighted_config (multi_adv_configure_f config_function,
+                                             uint8_t weight,
+                                             uint32_t interval_ms);
+
+// Call after changing the data behind a registered advertisement. If it is on
+// air right now it is reconfigured in place, otherwise the new data goes out
+// the next time it comes around.
+uint32_t multi_adv_refresh (multi_adv_configure_f config_function);
+
+// Take an advertisement out of the rotation, or put it back. Slots start out
+// active. Disabling the one on air switches away from it immediately, and
+// with no active slots left advertising stops until one is enabled again.
+uint32_t multi_adv_set_active (multi_adv_configure_f config_function, bool active);
+
+// The advertisement on air right now, or NULL if none is.
+multi_adv_configure_f multi_adv_get_current ();
+
 uint32_t multi_adv_start ();
 uint32_t multi_adv_stop ();
@@ -0,0 +1,176 @@
+// Throughput and overhead benchmark for mbramfs.
+//
+// Built twice by the Tupfile: once linked against mbramfs.o and once against
+// the host C library, so the numbers can be compared. The mbramfs-only calls
+// are weak, which lets the libc build skip the ring checks and stats.
+//
+// Exits non-zero if any of the correctness checks fail.
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "../mbramfs.h"
+
+#pragma weak mbramfs_mkring
+#pragma weak mbramfs_stats
+
+#define LOOKUP_FILES   6
+#define RECORD_LEN     16
+#define FILE_LEN       8192
+#define ROUNDS         200
+
+static char prefix[40];
+static int failures = 0;
+
+static double now (void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report (const char* name, long ops, double start) {
+	double elapsed = now() - start;
+	printf("%-14s %10ld ops  %12.0f ops/sec\n", name, ops, ops / elapsed);
+}
+
+static void check (int cond, const char* what) {
+	if (!cond) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static void fname (char* buf, int i) {
+	snprintf(buf, 64, "%s.%d", prefix, i);
+}
+
+// A ring file must keep exactly the newest max_len bytes once it wraps
+static void test_ring (void) {
+	char name[64];
+	uint8_t buf[64];
+	uint32_t seq;
+	int num;
+	FILE* f;
+
+	fname(name, 100);
+	check(mbramfs_mkring(name, 1000) == 0, "mkring");
+
+	f = fopen(name, "a");
+	for (seq=0; seq<2000; seq++) {
+		fwrite(&seq, sizeof(seq), 1, f);
+	}
+	fclose(f);
+
+	f = fopen(name, "r");
+	num = fread(buf, sizeof(seq), 16, f);
+	memcpy(&seq, buf, sizeof(seq));
+	check(num == 16 && seq == 2000 - 1000/sizeof(seq), "ring keeps newest data");
+
+	fseek(f, -(long) sizeof(seq), SEEK_END);
+	num = fread(&seq, sizeof(seq), 1, f);
+	check(num == 1 && seq == 1999, "ring tail");
+	fclose(f);
+
+	remove(name);
+}
+
+int main (int argc, char** argv) {
+	uint8_t record[RECORD_LEN];
+	char names[LOOKUP_FILES][64];
+	long ops;
+	double start;
+	int i, r;
+	FILE* f;
+
+	snprintf(prefix, sizeof(prefix), "%s", argc > 1 ? argv[1] : "mbramfs_bench");
+	memset(record, 'x', sizeof(record));
+
+	if (mbramfs_mkring) {
+		test_ring();
+	}
+
+	// Name lookup: reopen a handful of existing files over and over
+	for (i=0; i<LOOKUP_FILES; i++) {
+		fname(names[i], i);
+		f = fopen(names[i], "w");
+		fclose(f);
+	}
+	ops = 0;
+	start = now();
+	for (r=0; r<ROUNDS*10; r++) {
+		for (i=0; i<LOOKUP_FILES; i++) {
+			f = fopen(names[i], "a");
+			check(f != NULL, "reopen");
+			fclose(f);
+			ops++;
+		}
+	}
+	report("open/close", ops, start);
+
+	// Small appends, the shape of a sensor log
+	ops = 0;
+	start = now();
+	for (r=0; r<ROUNDS; r++) {
+		f = fopen(names[0], "w");
+		for (i=0; i<FILE_LEN/RECORD_LEN; i++) {
+			ops += fwrite(record, RECORD_LEN, 1, f);
+		}
+		fclose(f);
+	}
+	report("write 16B", ops, start);
+	check(ops == (long) ROUNDS * (FILE_LEN/RECORD_LEN), "all writes fit");
+
+	// Sequential reads of the same records
+	ops = 0;
+	start = now();
+	for (r=0; r<ROUNDS; r++) {
+		f = fopen(names[0], "r");
+		while (fread(record, RECORD_LEN, 1, f) == 1) {
+			ops++;
+		}
+		fclose(f);
+	}
+	report("read 16B", ops, start);
+	check(ops == (long) ROUNDS * (FILE_LEN/RECORD_LEN), "all reads return");
+
+	// Random access
+	ops = 0;
+	start = now();
+	f = fopen(names[0], "r");
+	for (r=0; r<ROUNDS*(FILE_LEN/RECORD_LEN); r++) {
+		fseek(f, ((r * 7919) % (FILE_LEN/RECORD_LEN)) * RECORD_LEN, SEEK_SET);
+		ops += fread(record, RECORD_LEN, 1, f);
+	}
+	fclose(f);
+	report("seek+read 16B", ops, start);
+
+	if (mbramfs_stats) {
+		mbramfs_stats_t stats;
+		uint32_t used;
+
+		mbramfs_stats(&stats);
+		used = (stats.chunks_total - stats.chunks_free) * stats.chunk_size;
+		printf("arena %u B in %u x %u B chunks, %u free\n",
+		       stats.arena_bytes, stats.chunks_total, stats.chunk_size,
+		       stats.chunks_free);
+		printf("%u files, %u data bytes, %u bytes in chunks, %u metadata bytes\n",
+		       stats.files, stats.data_bytes, used, stats.meta_bytes);
+		printf("overhead %.1f%% of data\n",
+		       100.0 * (used - stats.data_bytes + stats.meta_bytes) / stats.data_bytes);
+	}
+
+	for (i=0; i<LOOKUP_FILES; i++) {
+		remove(names[i]);
+	}
+
+	// Leave one output behind for the build system
+	f = fopen(prefix, "w");
+	fwrite(record, 1, 1, f);
+	fclose(f);
+
+	return failures ? 1 : 0;
+}
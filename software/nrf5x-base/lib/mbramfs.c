@@ -1,4 +1,12 @@
 // Most Basic RAM Filesystem
+//
+// All file contents share one static arena that is split into fixed-size
+// chunks. A file is a linked chain of chunks, so it only takes as much RAM as
+// it has written (rounded up to a chunk) and can grow until the arena is full.
+// Names are found through a small chained hash table instead of a scan.
+//
+// Every size below can be overridden from the compiler command line, e.g.
+// -DMBRAMFS_ARENA_SIZE=4096 -DMBRAMFS_CHUNK_SIZE=128.
 
 #include <stdint.h>
 
@@ -11,29 +19,261 @@ typedef struct {
 	uint8_t flags;
 	uint32_t handle;
 	uint32_t index;
+	uint16_t chunk;      // last chunk this stream touched, to avoid re-walking
+	uint32_t chunk_base; // file offset of byte 0 of that chunk
+	uint32_t gen;        // file generation the cached chunk belongs to
 } FILE;
 
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
 
+#include "mbramfs.h"
+
+#ifndef MBRAMFS_ARENA_SIZE
+#define MBRAMFS_ARENA_SIZE        10240
+#endif
+#ifndef MBRAMFS_CHUNK_SIZE
+#define MBRAMFS_CHUNK_SIZE        256
+#endif
+#ifndef MBRAMFS_MAX_FILES
+#define MBRAMFS_MAX_FILES         8
+#endif
+#ifndef MBRAMFS_MAX_FILENAME_LEN
 #define MBRAMFS_MAX_FILENAME_LEN  128
-#define MBRAMFS_FILESIZE_IN_BYTES 5000
+#endif
+#ifndef MBRAMFS_NUM_FILE_POINTERS
 #define MBRAMFS_NUM_FILE_POINTERS 10
-#define MBRAMFS_NUM_FILES         2
-
+#endif
+#ifndef MBRAMFS_HASH_BUCKETS
+#define MBRAMFS_HASH_BUCKETS      16 // must be a power of two
+#endif
+
+#define MBRAMFS_NUM_CHUNKS (MBRAMFS_ARENA_SIZE / MBRAMFS_CHUNK_SIZE)
+#define MBRAMFS_NONE       0xFFFF
+
+#if MBRAMFS_NUM_CHUNKS < 1 || MBRAMFS_NUM_CHUNKS >= MBRAMFS_NONE
+#error "MBRAMFS_ARENA_SIZE / MBRAMFS_CHUNK_SIZE must be between 1 and 65534"
+#endif
+#if (MBRAMFS_HASH_BUCKETS & (MBRAMFS_HASH_BUCKETS - 1)) != 0
+#error "MBRAMFS_HASH_BUCKETS must be a power of two"
+#endif
+
+// Offsets stored below are absolute positions in the file's write history.
+// A ring file moves `start` forward as it drops old data, while the offsets
+// of the bytes that remain never change.
 typedef struct {
 	char name[MBRAMFS_MAX_FILENAME_LEN];
-	uint8_t buf[MBRAMFS_FILESIZE_IN_BYTES];
-	uint32_t len;
-} file_buf_t;
+	uint32_t hash;
+	uint32_t first_base; // offset of byte 0 of the first chunk
+	uint32_t start;      // offset of the first readable byte
+	uint32_t end;        // offset one past the last readable byte
+	uint32_t ring_len;   // 0 for a normal file, otherwise the max bytes kept
+	uint32_t gen;        // changes whenever chunks leave the chain
+	uint16_t first;      // chunk chain, MBRAMFS_NONE when empty
+	uint16_t last;
+	uint16_t next;       // next file in the same hash bucket
+	uint8_t  used;
+} file_node_t;
 
 
 // Allocate all files and FILE objects here.
-FILE              file_ptrs[MBRAMFS_NUM_FILE_POINTERS] = {{0, 0, 0}};
-static file_buf_t files[MBRAMFS_NUM_FILES] = {{{0}, {0}, 0}};
+FILE               file_ptrs[MBRAMFS_NUM_FILE_POINTERS] = {{0, 0, 0}};
+static file_node_t files[MBRAMFS_MAX_FILES];
+static uint16_t    buckets[MBRAMFS_HASH_BUCKETS];
+
+static uint8_t     arena[MBRAMFS_NUM_CHUNKS][MBRAMFS_CHUNK_SIZE];
+static uint16_t    chunk_next[MBRAMFS_NUM_CHUNKS];
+static uint16_t    free_head;
+static uint16_t    free_count;
 
 static unsigned short handle_cnt = 1;
+static uint32_t       gen_cnt = 1;
+static bool           initialized = false;
+
+
+// Static storage starts zeroed, so the free list and the empty markers have
+// to be set up on first use.
+static void mbramfs_init (void) {
+	int i;
+
+	for (i=0; i<MBRAMFS_NUM_CHUNKS; i++) {
+		chunk_next[i] = (i+1 < MBRAMFS_NUM_CHUNKS) ? i+1 : MBRAMFS_NONE;
+	}
+	free_head = 0;
+	free_count = MBRAMFS_NUM_CHUNKS;
+
+	for (i=0; i<MBRAMFS_HASH_BUCKETS; i++) {
+		buckets[i] = MBRAMFS_NONE;
+	}
+
+	initialized = true;
+}
+
+static uint16_t chunk_alloc (void) {
+	uint16_t chunk = free_head;
+
+	if (chunk != MBRAMFS_NONE) {
+		free_head = chunk_next[chunk];
+		chunk_next[chunk] = MBRAMFS_NONE;
+		free_count--;
+	}
+	return chunk;
+}
+
+static void chunk_free (uint16_t chunk) {
+	chunk_next[chunk] = free_head;
+	free_head = chunk;
+	free_count++;
+}
+
+// A name must fit in file_node_t.name with its '\0'. Longer names are
+// refused rather than cut short, which would make every name sharing the
+// stored prefix open the same file.
+static int name_fits (const char* fname) {
+	int i;
+
+	for (i=0; i<MBRAMFS_MAX_FILENAME_LEN; i++) {
+		if (fname[i] == '\0') return 1;
+	}
+	return 0;
+}
+
+// FNV-1a over the name
+static uint32_t name_hash (const char* fname) {
+	uint32_t hash = 2166136261u;
+	int i;
+
+	for (i=0; i<MBRAMFS_MAX_FILENAME_LEN-1 && fname[i]; i++) {
+		hash ^= (uint8_t) fname[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static int file_lookup (const char* fname, uint32_t hash) {
+	uint16_t i = buckets[hash & (MBRAMFS_HASH_BUCKETS-1)];
+
+	while (i != MBRAMFS_NONE) {
+		if (files[i].hash == hash &&
+		    strncmp(files[i].name, fname, MBRAMFS_MAX_FILENAME_LEN-1) == 0) {
+			return i;
+		}
+		i = files[i].next;
+	}
+	return -1;
+}
+
+static int file_create (const char* fname, uint32_t hash) {
+	uint16_t bucket = hash & (MBRAMFS_HASH_BUCKETS-1);
+	int i;
+
+	for (i=0; i<MBRAMFS_MAX_FILES; i++) {
+		if (!files[i].used) {
+			file_node_t* file = &files[i];
+
+			memset(file, 0, sizeof(file_node_t));
+			strncpy(file->name, fname, MBRAMFS_MAX_FILENAME_LEN-1);
+			file->hash  = hash;
+			file->first = MBRAMFS_NONE;
+			file->last  = MBRAMFS_NONE;
+			file->gen   = gen_cnt++;
+			file->used  = 1;
+
+			file->next = buckets[bucket];
+			buckets[bucket] = i;
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Free the oldest chunk of a file. The chunk bases stay contiguous, so an
+// empty chain simply restarts at the old chain's end.
+static void file_drop_first (file_node_t* file) {
+	uint16_t chunk = file->first;
+
+	file->first = chunk_next[chunk];
+	if (file->first == MBRAMFS_NONE) {
+		file->last = MBRAMFS_NONE;
+	}
+	chunk_free(chunk);
+
+	file->first_base += MBRAMFS_CHUNK_SIZE;
+	if (file->start < file->first_base) file->start = file->first_base;
+	if (file->end < file->start) file->end = file->start;
+	file->gen = gen_cnt++;
+}
+
+static void file_truncate (file_node_t* file) {
+	while (file->first != MBRAMFS_NONE) {
+		file_drop_first(file);
+	}
+	file->first_base = 0;
+	file->start = 0;
+	file->end = 0;
+}
+
+// Keep a ring file within its limit
+static void file_trim (file_node_t* file) {
+	if (file->ring_len == 0 || file->end - file->start <= file->ring_len) {
+		return;
+	}
+
+	file->start = file->end - file->ring_len;
+	while (file->first != MBRAMFS_NONE &&
+	       file->first_base + MBRAMFS_CHUNK_SIZE <= file->start) {
+		file_drop_first(file);
+	}
+}
+
+// Add a chunk to the end of a file. A ring file that finds the arena full
+// recycles its own oldest chunk rather than failing.
+static uint16_t file_grow (file_node_t* file) {
+	uint16_t chunk = chunk_alloc();
+
+	if (chunk == MBRAMFS_NONE && file->ring_len && file->first != MBRAMFS_NONE) {
+		file_drop_first(file);
+		chunk = chunk_alloc();
+	}
+	if (chunk == MBRAMFS_NONE) {
+		return MBRAMFS_NONE;
+	}
+
+	if (file->last == MBRAMFS_NONE) {
+		file->first = chunk;
+	} else {
+		chunk_next[file->last] = chunk;
+	}
+	file->last = chunk;
+	return chunk;
+}
+
+// Find the chunk holding file offset pos. Sequential reads and writes hit the
+// stream's cached chunk or its successor, so this is O(1) for them.
+static uint16_t stream_chunk (FILE* stream, file_node_t* file, uint32_t pos) {
+	uint16_t chunk;
+	uint32_t base;
+
+	if (stream->gen == file->gen && stream->chunk != MBRAMFS_NONE &&
+	    stream->chunk_base <= pos) {
+		chunk = stream->chunk;
+		base  = stream->chunk_base;
+	} else {
+		chunk = file->first;
+		base  = file->first_base;
+	}
+
+	while (chunk != MBRAMFS_NONE && pos >= base + MBRAMFS_CHUNK_SIZE) {
+		chunk = chunk_next[chunk];
+		base += MBRAMFS_CHUNK_SIZE;
+	}
+
+	stream->chunk      = chunk;
+	stream->chunk_base = base;
+	stream->gen        = file->gen;
+	return chunk;
+}
 
 
 FILE* fopen (const char* fname, const char* flags) {
@@ -44,6 +284,8 @@ FILE* fopen (const char* fname, const char* flags) {
 	int file_ptr_index;
 	int i;
 
+	if (!initialized) mbramfs_init();
+
 	// Find an open file handle
 	file_ptr_index = -1;
 	for (i=0; i<MBRAMFS_NUM_FILE_POINTERS; i++) {
@@ -74,15 +316,14 @@ FILE* fopen (const char* fname, const char* flags) {
 		append = 0;
 	}
 
-	// Determine if this file exists
-	int file_index = -1;
-	for (i=0; i<MBRAMFS_NUM_FILES; i++) {
-		if (strncmp(fname, files[i].name, MBRAMFS_MAX_FILENAME_LEN) == 0) {
-			file_index = i;
-			break;
-		}
+	if (!name_fits(fname)) {
+		return NULL;
 	}
 
+	// Determine if this file exists
+	uint32_t hash = name_hash(fname);
+	int file_index = file_lookup(fname, hash);
+
 	// Cannot read from a file that does not exist
 	if (read && file_index == -1) {
 		return NULL;
@@ -90,15 +331,7 @@ FILE* fopen (const char* fname, const char* flags) {
 
 	// May need to create new file
 	if (file_index == -1) {
-		// Find space for it
-		for (i=0; i<MBRAMFS_NUM_FILES; i++) {
-			if (files[i].name[0] == '\0') {
-				// This is free
-				file_index = i;
-				strncpy(files[i].name, fname, MBRAMFS_MAX_FILENAME_LEN);
-				break;
-			}
-		}
+		file_index = file_create(fname, hash);
 	}
 
 	// If we couldn't find this file or create it, error
@@ -106,22 +339,23 @@ FILE* fopen (const char* fname, const char* flags) {
 		return NULL;
 	}
 
-	FILE*       file_ptr = &file_ptrs[file_ptr_index];
-	file_buf_t* file = &files[file_index];
+	FILE*        file_ptr = &file_ptrs[file_ptr_index];
+	file_node_t* file = &files[file_index];
 
 	// Save which file this points to
 	file_ptr->index = file_index;
+	file_ptr->chunk = MBRAMFS_NONE;
 
 	// Writing a file makes it exist
 	if (read) {
-		file_ptr->fpos = 0;
+		file_ptr->fpos = file->start;
 		file_ptr->flags = _F_READ;
 	} else if (write) {
-		file->len = 0;
+		file_truncate(file);
 		file_ptr->fpos = 0;
 		file_ptr->flags = _F_WRIT;
 	} else if (append) {
-		file_ptr->fpos = file->len;
+		file_ptr->fpos = file->end;
 		file_ptr->flags = _F_WRIT;
 	}
 
@@ -131,67 +365,117 @@ FILE* fopen (const char* fname, const char* flags) {
 }
 
 size_t fread (void* ptr, size_t size, size_t count, FILE* stream) {
+	uint8_t* dst = ptr;
 	uint32_t copy_len = size*count;
-	uint32_t fptr = (uint32_t) stream->fpos;
-	file_buf_t* file = &files[stream->index];
+	uint32_t done = 0;
+	file_node_t* file = &files[stream->index];
 
-	if (!(stream->flags & _F_READ)) return 0;
+	if (!(stream->flags & _F_READ) || size == 0) return 0;
+
+	// A ring file may have dropped the data under us
+	if (stream->fpos < file->start) {
+		stream->fpos = file->start;
+	}
 
 	// Make sure we don't read past the end of the file
-	if (fptr + copy_len > file->len) {
-		copy_len = ((file->len - fptr) / size) * size;
+	if (stream->fpos + copy_len > file->end) {
+		copy_len = ((file->end - stream->fpos) / size) * size;
 	}
 
-	// memcpy the "file" to the user buffer and return how much we copied
-	memcpy(ptr, file->buf+fptr, copy_len);
+	// memcpy the "file" to the user buffer chunk by chunk
+	while (done < copy_len) {
+		uint16_t chunk = stream_chunk(stream, file, stream->fpos);
+		uint32_t offset = stream->fpos - stream->chunk_base;
+		uint32_t len = MBRAMFS_CHUNK_SIZE - offset;
+
+		if (len > copy_len - done) {
+			len = copy_len - done;
+		}
+
+		memcpy(dst+done, arena[chunk]+offset, len);
+		done += len;
+		stream->fpos += len;
+	}
 
-	stream->fpos += copy_len;
 	return copy_len / size;
 }
 
 size_t fwrite (const void* ptr, size_t size, size_t count, FILE* stream) {
+	const uint8_t* src = ptr;
 	uint32_t write_len = size*count;
-	uint32_t fptr = (uint32_t) stream->fpos;
-	file_buf_t* file = &files[stream->index];
+	uint32_t done = 0;
+	file_node_t* file = &files[stream->index];
+
+	if (!(stream->flags & _F_WRIT) || size == 0) return 0;
+
+	if (stream->fpos < file->start) {
+		stream->fpos = file->start;
+	}
+
+	while (done < write_len) {
+		uint16_t chunk = stream_chunk(stream, file, stream->fpos);
+
+		if (chunk == MBRAMFS_NONE) {
+			// At the end of the chain, which is always a chunk boundary
+			chunk = file_grow(file);
+			if (chunk == MBRAMFS_NONE) {
+				// Out of space
+				break;
+			}
+			stream->chunk      = chunk;
+			stream->chunk_base = stream->fpos;
+			stream->gen        = file->gen;
+		}
+
+		uint32_t offset = stream->fpos - stream->chunk_base;
+		uint32_t len = MBRAMFS_CHUNK_SIZE - offset;
+
+		if (len > write_len - done) {
+			len = write_len - done;
+		}
 
-	if (!(stream->flags & _F_WRIT)) return 0;
+		memcpy(arena[chunk]+offset, src+done, len);
+		done += len;
+		stream->fpos += len;
 
-	// Make sure we don't read off the end of the array
-	if (fptr + write_len > MBRAMFS_FILESIZE_IN_BYTES) {
-		write_len = ((MBRAMFS_FILESIZE_IN_BYTES - fptr) / size) * size;
+		if (stream->fpos > file->end) {
+			file->end = stream->fpos;
+			file_trim(file);
+		}
 	}
 
-	memcpy(file->buf+fptr, ptr, write_len);
-	stream->fpos += write_len;
-	file->len += write_len;
-	return write_len / size;
+	return done / size;
 }
 
 int fseek (FILE* f, long int offset, int origin) {
-	uint32_t fptr = (uint32_t) f->fpos;
-	file_buf_t* file = &files[f->index];
-	uint32_t new_position = 0;
+	file_node_t* file = &files[f->index];
+	int64_t new_position;
+
 	if (origin == SEEK_SET) {
 		// Offset from beginning of file
-		new_position = offset;
+		new_position = (int64_t) file->start + offset;
 	} else if (origin == SEEK_CUR) {
 		// From current position
-		new_position = offset + fptr;
+		new_position = (int64_t) f->fpos + offset;
+	} else if (origin == SEEK_END) {
+		new_position = (int64_t) file->end + offset;
+	} else {
+		return -1;
 	}
 
-	if (new_position > file->len) {
-		// Seek too far, past the end of the "file"
+	if (new_position < file->start || new_position > file->end) {
+		// Seek too far, outside of the "file"
 		return -1;
 	}
 
 	// Update internal pointer
-	f->fpos = new_position;
+	f->fpos = (uint32_t) new_position;
 	return 0;
 }
 
 void rewind (FILE* f) {
-	// Just need to reset our array index into the file buffer
-	f->fpos = 0;
+	// Just need to reset our index into the file
+	f->fpos = files[f->index].start;
 }
 
 int fclose (FILE* stream) {
@@ -199,15 +483,73 @@ int fclose (FILE* stream) {
 	return 0;
 }
 
-// "delete" file by adding it to the allocatable pool
+// "delete" file by returning its chunks and its slot to the allocatable pool
 int remove (const char* filename) {
+	if (!initialized) mbramfs_init();
+
+	if (!name_fits(filename)) {
+		return -1;
+	}
+
+	uint32_t hash = name_hash(filename);
+	int file_index = file_lookup(filename, hash);
+
+	if (file_index == -1) {
+		return -1;
+	}
+
+	// Unlink from the hash bucket
+	uint16_t* link = &buckets[hash & (MBRAMFS_HASH_BUCKETS-1)];
+	while (*link != file_index) {
+		link = &files[*link].next;
+	}
+	*link = files[file_index].next;
+
+	file_truncate(&files[file_index]);
+	memset(&files[file_index], 0, sizeof(file_node_t));
+	return 0;
+}
+
+int mbramfs_mkring (const char* fname, uint32_t max_len) {
+	if (!initialized) mbramfs_init();
+
+	if (!name_fits(fname)) {
+		return -1;
+	}
+
+	uint32_t hash = name_hash(fname);
+	int file_index = file_lookup(fname, hash);
+
+	if (file_index == -1) {
+		file_index = file_create(fname, hash);
+	}
+	if (file_index == -1) {
+		return -1;
+	}
+
+	files[file_index].ring_len = max_len;
+	file_trim(&files[file_index]);
+	return 0;
+}
+
+void mbramfs_stats (mbramfs_stats_t* stats) {
 	int i;
-	for (i=0; i<MBRAMFS_NUM_FILES; i++) {
-		if (strncmp(files[i].name, filename, MBRAMFS_MAX_FILENAME_LEN) == 0) {
-			memset(files[i].name, 0, MBRAMFS_MAX_FILENAME_LEN);
-			files[i].len = 0;
-			break;
+
+	if (!initialized) mbramfs_init();
+
+	stats->arena_bytes  = sizeof(arena);
+	stats->chunk_size   = MBRAMFS_CHUNK_SIZE;
+	stats->chunks_total = MBRAMFS_NUM_CHUNKS;
+	stats->chunks_free  = free_count;
+	stats->files        = 0;
+	stats->data_bytes   = 0;
+	stats->meta_bytes   = sizeof(file_ptrs) + sizeof(files) + sizeof(buckets) +
+	                      sizeof(chunk_next);
+
+	for (i=0; i<MBRAMFS_MAX_FILES; i++) {
+		if (files[i].used) {
+			stats->files++;
+			stats->data_bytes += files[i].end - files[i].start;
 		}
 	}
-	return 0;
 }
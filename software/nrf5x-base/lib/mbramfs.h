@@ -0,0 +1,41 @@
+#ifndef __MBRAMFS_H
+#define __MBRAMFS_H
+
+#include <stdint.h>
+
+/*******************************************************************************
+ * mbramfs replaces fopen/fread/fwrite/fseek/fclose/remove from stdio. This
+ * header only adds the calls that have no stdio equivalent, so it can be
+ * included next to the real <stdio.h>.
+ *
+ * USAGE
+ *
+ *   // keep the newest 2 kB of the log, dropping older data as it grows
+ *   mbramfs_mkring("log.txt", 2048);
+ *
+ *   FILE* f = fopen("log.txt", "a");
+ *   fwrite(line, 1, len, f);
+ *   fclose(f);
+ *
+ */
+
+typedef struct {
+	uint32_t arena_bytes;   // size of the shared file data arena
+	uint32_t chunk_size;    // files grow by this many bytes at a time
+	uint32_t chunks_total;
+	uint32_t chunks_free;
+	uint32_t files;         // files that currently exist
+	uint32_t data_bytes;    // readable bytes summed over all files
+	uint32_t meta_bytes;    // static bookkeeping RAM outside the arena
+} mbramfs_stats_t;
+
+// Make fname a ring file that never holds more than max_len bytes. Writes past
+// that drop the oldest data, a chunk at a time. Creates the file if needed.
+// Returns 0 on success, -1 if the file could not be created or its name is
+// longer than MBRAMFS_MAX_FILENAME_LEN - 1.
+int mbramfs_mkring (const char* fname, uint32_t max_len);
+
+// Fill in usage and overhead counters for the whole filesystem.
+void mbramfs_stats (mbramfs_stats_t* stats);
+
+#endif
@@ -118,6 +118,7 @@ void __attribute__((weak)) ble_evt_write(ble_evt_t* p_ble_evt);
 void __attribute__((weak)) ble_evt_rw_auth(ble_evt_t* p_ble_evt);
 void __attribute__((weak)) ble_evt_user_handler(ble_evt_t* p_ble_evt);
 void __attribute__((weak)) ble_evt_adv_report(ble_evt_t* p_ble_evt);
+void __attribute__((weak)) ble_evt_scan_req_report(ble_evt_t* p_ble_evt);
 void __attribute__((weak)) ble_error(uint32_t error_code);
 
 
@@ -319,6 +320,13 @@ static void on_ble_evt(ble_evt_t * p_ble_evt) {
               break;
             }
 
+        case BLE_GAP_EVT_SCAN_REQ_REPORT:
+            // only delivered after simple_ble_scan_req_report_enable()
+            if (ble_evt_scan_req_report) {
+                ble_evt_scan_req_report(p_ble_evt);
+            }
+            break;
+
         default:
             break;
     }
@@ -597,6 +605,20 @@ void __attribute__((weak)) advertising_stop(void) {
     }
 }
 
+// Ask the softdevice to report every scan request it answers. An active
+// scanner only sends these after hearing an advertisement, so they double as
+// a receive acknowledgement. The option can only be set while advertising is
+// stopped, so this stops it; call advertising_start() again afterwards.
+uint32_t simple_ble_scan_req_report_enable(void) {
+    ble_opt_t opt;
+
+    advertising_stop();
+
+    memset(&opt, 0, sizeof(opt));
+    opt.gap_opt.scan_req_report.enable = 1;
+    return sd_ble_opt_set(BLE_GAP_OPT_SCAN_REQ_REPORT, &opt);
+}
+
 void __attribute__((weak)) power_manage(void) {
     uint32_t err_code = sd_app_evt_wait();
     APP_ERROR_CHECK(err_code);
@@ -43,6 +43,7 @@ extern void ble_evt_write(ble_evt_t* p_ble_evt);
 extern void ble_evt_rw_auth(ble_evt_t* p_ble_evt);
 extern void ble_evt_user_handler(ble_evt_t* p_ble_evt);
 extern void ble_evt_adv_report(ble_evt_t* p_ble_evt);
+extern void ble_evt_scan_req_report(ble_evt_t* p_ble_evt);
 extern void ble_error(uint32_t error_code);
 
 // overwrite to change functionality
@@ -61,6 +62,9 @@ void advertising_start(void);
 void advertising_stop(void);
 void power_manage(void);
 
+// report scan requests through ble_evt_scan_req_report(). Stops advertising.
+uint32_t simple_ble_scan_req_report_enable(void);
+
 // call to initialize
 simple_ble_app_t* simple_ble_init(const simple_ble_config_t* conf);
 
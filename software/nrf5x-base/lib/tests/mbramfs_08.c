@@ -0,0 +1,62 @@
+
+#include <stdio.h>
+#include <string.h>
+
+int main (int argc, char** argv) {
+	char fname_a[64];
+	char fname_b[64];
+
+	FILE* fa;
+	FILE* fb;
+	char mydata_start[10] = "abcDEFghi";
+	char mydata_end[10];
+	int num = 0;
+	int total = 0;
+
+	snprintf(fname_a, sizeof(fname_a), "%s.a", argv[1]);
+	snprintf(fname_b, sizeof(fname_b), "%s.b", argv[1]);
+
+	// Interleave two files so their chunks end up mixed in the arena, and
+	// grow each one past a single chunk
+	fa = fopen(fname_a, "w");
+	fb = fopen(fname_b, "w");
+	for (int i=0; i<300; i++) {
+		fwrite(mydata_start, 1, 9, fa);
+		fwrite(mydata_start+i%9, 1, 1, fb);
+	}
+	fclose(fa);
+	fclose(fb);
+
+	fa = fopen(fname_a, "r");
+	while ((num = fread(mydata_end, 1, 7, fa)) > 0) {
+		total += num;
+	}
+	printf("Read %i bytes from a\n", total);
+
+	fseek(fa, 2698, SEEK_SET);
+	num = fread(mydata_end, 1, 5, fa);
+	printf("Read %i bytes: \n", num);
+	for (int i=0; i<num; i++) {
+		printf("%c\n", mydata_end[i]);
+	}
+	fclose(fa);
+
+	fb = fopen(fname_b, "r");
+	fseek(fb, 256, SEEK_SET);
+	num = fread(mydata_end, 1, 9, fb);
+	printf("Read %i bytes: \n", num);
+	for (int i=0; i<num; i++) {
+		printf("%c\n", mydata_end[i]);
+	}
+	fclose(fb);
+
+	remove(fname_a);
+	remove(fname_b);
+
+	// Do this to make the build system happy...
+	fa = fopen(argv[1], "w");
+	fwrite(mydata_start, 1, 10, fa);
+	fclose(fa);
+
+	return 0;
+}
@@ -17,6 +17,53 @@ document.addEventListener("deviceready", function () {
     }, failure);
   };
 
+  // scan until stopScan(), reporting every advertisement instead of once per
+  //  device, and pass on only those with manufacturer data from `company`.
+  //  The plugin can't filter on manufacturer data, so foreign devices are
+  //  dropped here before their advertisements get translated
+  bluetooth.startManufacturerScan = function(company, success, failure) {
+    var found = function (peripheral) {
+      if (manufacturer_id(peripheral) === company) {
+        translate_advertisement(peripheral, success);
+      }
+    };
+    if (ble.startScanWithOptions) {
+      ble.startScanWithOptions([], { reportDuplicates: true }, found, failure);
+    } else {
+      // older plugins; android reports duplicates anyway
+      ble.startScan([], found, failure);
+    }
+  };
+
+  // company identifier of the manufacturer specific data in an advertisement,
+  //  or undefined if there is none
+  manufacturer_id = function (peripheral) {
+    var advertising = peripheral.advertising;
+    var data;
+    if (navigator.platform.startsWith("iP")) {
+      if (!advertising.kCBAdvDataManufacturerData) {
+        return undefined;
+      }
+      data = new Uint8Array(advertising.kCBAdvDataManufacturerData);
+      return data.length >= 2 ? (data[0] | (data[1] << 8)) : undefined;
+    }
+
+    // android: walk the scan record as translate_advertisement does
+    data = new Uint8Array(advertising);
+    var index = 0;
+    while (index < data.length) {
+      var length = data[index];
+      if (length == 0) {
+        break;
+      }
+      if (data[index+1] == 0xFF && length >= 3 && index+3 < data.length) {
+        return data[index+2] | (data[index+3] << 8);
+      }
+      index += length + 1;
+    }
+    return undefined;
+  };
+
   // create a common advertisement interface between iOS and android
   //  This format follows the nodejs BLE library, noble
   //  https://github.com/sandeepmistry/noble#peripheral-discovered
@@ -34,8 +34,10 @@ var app = {
     onAppReady: function() {
         app.log("onAppReady");
 
-        // Setup update for last data time
-        setInterval(app.update_time_ago, 5000);
+        // Setup update for last data time, once, although resume comes back here
+        if (!timer) {
+            timer = setInterval(app.update_time_ago, 1000);
+        }
 
         if (typeof window.gateway != "undefined") {                               // if UI opened through Summon,
             deviceId = window.gateway.getDeviceId();                                // get device ID from Summon
@@ -55,57 +57,49 @@ var app = {
     // Bluetooth Enabled Callback
     onEnable: function() {
         app.log("onEnable");
-        // app.onPause();                                                              // halt any previously running BLE processes
-        bluetooth.startScan([], app.onDiscover, app.onAppReady);                          // start BLE scan; if device discovered, goto: onDiscover
+        bluetooth.stopScan();                                                          // halt a scan left running from before a resume
+        bluetooth.startManufacturerScan(lpcsb_parse.UVA_COMPANY_IDENTIFIER,            // one scan that stays up and reports every LPCSB advertisement;
+                app.onDiscover, app.onScanFailure);                                    //  if one is discovered, goto: onDiscover
         app.log("Searching for " + deviceName + " (" + deviceId + ").");
     },
+    // Scan Failure Callback
+    onScanFailure: function(reason) {
+        app.log("Scan failed (" + reason + "), restarting");
+        setTimeout(app.onEnable, 1000);
+    },
     // BLE Device Discovered Callback
     onDiscover: function(device) {
+        // Other LPCSBs get here too; the scan keeps running either way
         if (device.id == deviceId) {
-            app.log("Found " + deviceName + " (" + deviceId + ")!");
+            if (last_update == 0) {
+                app.log("Found " + deviceName + " (" + deviceId + ")!");
+            }
             app.onParseAdvData(device);
-        } else {
-            //app.log('Not Blink (' + device.id + ')');
-
-            // HACK:
-            bluetooth.stopScan();
-            bluetooth.startScan([], app.onDiscover, app.onAppReady);
         }
     },
-   onParseAdvData: function(device){
-        //Parse Advertised Data
-        var advertisement = device.advertisement;
-        app.log('Testing 1');
-        // Check this is something we can parse
-        if (advertisement.localName == 'LPCSB' &&
-                advertisement.manufacturerData) { 
-            var mandata = advertisement.manufacturerData.slice(4);
-	        app.log('Testing 2');
-            var clearData=String.fromCharCode(parseInt(mandata[0]))+String.fromCharCode(parseInt(mandata[1]));
-            var redData = String.fromCharCode(parseInt(mandata[2]))+String.fromCharCode(parseInt(mandata[3]));
-            var greenData = String.fromCharCode(parseInt(mandata[4]))+String.fromCharCode(parseInt(mandata[5]));
-            var blueData = String.fromCharCode(parseInt(mandata[6]))+String.fromCharCode(parseInt(mandata[7]));
-            var colTempData = String.fromCharCode(parseInt(mandata[8]))+String.fromCharCode(parseInt(mandata[9]));
-            var luxData = String.fromCharCode(parseInt(mandata[10]))+String.fromCharCode(parseInt(mandata[11]));
-            
-            last_update = Date.now();   // Save when we got this.
-			
-		    //check that it's a data packet
-		    app.log(clearData);
-	        document.getElementById("clearVal").innerHTML =clearData;
-            document.getElementById("redVal").innerHTML =redData;
-            document.getElementById("greenVal").innerHTML =greenData;
-            document.getElementById("blueVal").innerHTML =blueData;
-            document.getElementById("colorTempVal").innerHTML =colTempData;
-            document.getElementById("luxVal").innerHTML =luxData;
-
-            app.update_time_ago();
+    onParseAdvData: function(device){
+        //Parse Advertised Data, raw color (0x31) or light type (0x32)
+        var record = lpcsb_parse.decodeManufacturerData(device.advertisement.manufacturerData);
+        if (!record) {
+            // Not a payload we know, or a garbled one
+            return;
+        }
+
+        last_update = Date.now();   // Save when we got this.
 
+        document.getElementById("sensorIdVal").innerHTML = record.sensorID;
+        if (record.service == 'raw_color') {
+            document.getElementById("clearVal").innerHTML = record.clear;
+            document.getElementById("redVal").innerHTML = record.red;
+            document.getElementById("greenVal").innerHTML = record.green;
+            document.getElementById("blueVal").innerHTML = record.blue;
+            document.getElementById("colorTempVal").innerHTML = record.colorTemp;
+            document.getElementById("luxVal").innerHTML = record.lux;
         } else {
-            // Not a Color packet...
-            app.log('Advertisement was not LPCSB.');
+            document.getElementById("lightTypeVal").innerHTML = record.lightType;
         }
 
+        app.update_time_ago();
     },
     update_time_ago: function () {
         if (last_update > 0) {
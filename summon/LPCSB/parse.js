@@ -1,63 +1,95 @@
-/* Parse LPCSB advertisements */
+/* Parse LPCSB advertisements
+ *
+ * Shared by the gateway, which require()s this file and hands it noble
+ * advertisements, and the Summon UI, which loads it with a <script> tag
+ * and finds the same functions in window.lpcsb_parse.
+ *
+ * The payload is manufacturer specific data under the UVA company
+ * identifier (little endian, as on air): a service byte, then the struct
+ * from software/apps/LPCSB_Light_ID/lpcsb_packet.h with its multi-byte
+ * fields big endian. Decoded are raw color (0x31) and light type (0x32).
+ */
 
-var parse_advertisement = function (advertisement, cb) {
+(function (exports) {
+
+var UVA_COMPANY_IDENTIFIER = 0x02E0;
+var RAW_COLOR_SERVICE = 0x31;
+var LIGHT_TYPE_SERVICE = 0x32;
+
+// Every TCS34725 reports this ID; anything else means a garbled payload
+var LPCSB_SENSOR_ID = 0x44;
+
+var LIGHT_TYPE_NAMES = {
+    0x00: 'Incandescent',
+    0x11: 'LED',
+    0x22: 'Fluorescent',
+    0x33: 'Sunlight'
+};
+
+// Company identifier, service byte, then the payload
+var HEADER_LENGTH = 3;
+var RAW_COLOR_LENGTH = HEADER_LENGTH + 1 + 7*2;
+var LIGHT_TYPE_LENGTH = HEADER_LENGTH + 1 + 1 + 2;
+
+// Record from manufacturer data (company identifier first, as noble and
+//  bluetooth.js both hand it over), or null if it isn't a valid LPCSB
+//  payload. Takes a Buffer, a typed array or an array of bytes.
+var decode_manufacturer_data = function (data) {
+    if (!data || data.length < HEADER_LENGTH) {
+        return null;
+    }
+    if (!ArrayBuffer.isView(data)) {
+        data = new Uint8Array(data);
+    }
+    var view = new DataView(data.buffer, data.byteOffset, data.byteLength);
+    if (view.getUint16(0, true) != UVA_COMPANY_IDENTIFIER) {
+        return null;
+    }
 
-    if (advertisement.localName === 'LPCSB') {
-        if (advertisement.manufacturerData) {
-            // Need at least 3 bytes: Two for manufacturer ID and one for service ID.
-            if (advertisement.manufacturerData.length >= 3) {
-                // Check that manufacturer ID and service byte are correct
-                var manufacturer_id = advertisement.manufacturerData.readUIntLE(0, 2);
-                var service_id = advertisement.manufacturerData.readUInt8(2);
-                if (manufacturer_id == 0x02E0 && service_id == 0x31) {
-                    // OK! This looks like an LPCSB packet
-                    // Length should be at least header + version + 1 character
-                    if (advertisement.manufacturerData.length >= (3+1+1)) {
-                        var LPCSB = advertisement.manufacturerData.slice(3);
-
-                        //Sensor ID is first: ID = 0x44, shows that the sensor is connected properly.
-                        var sensorID = LPCSB.readUInt8(0);
-
-                        //Want Little Endian (I think, need to double check this)
-                        var clear=LPCSB.readUIntLE(1,2);    //Clear Data
-			            var red=LPCSB.readUIntLE(3,2);      //Red Data
-			            var green=LPCSB.readUIntLE(5,2);    //Green Data
-                        var blue=LPCSB.readUIntLE(7,2);     //Blue Data
-                        var colorTemp=LPCSB.readUIntLE(9,2);//Color Temp Data
-                        var lux=LPCSB.readUIntLE(11,2);     //Lux Data
-                        var out = {
-                            device: 'LPCSB',
-                            sensorID: sensorID,
-			                clear: clear,
-                            red: red,
-                            green: green,
-                            blue: blue,
-                            colorTemp: colorTemp,
-                            lux: lux
-			                // _meta: {
-                            //     room: room
-                            // },
-                        };
-
-                        cb(out);
-                        return;
-                    }
-                }
-            }
+    var service = view.getUint8(2);
+    if (service == RAW_COLOR_SERVICE && view.byteLength >= RAW_COLOR_LENGTH) {
+        if (view.getUint8(3) != LPCSB_SENSOR_ID) {
+            return null;
         }
+        return {
+            device: 'LPCSB',
+            service: 'raw_color',
+            sensorID: view.getUint8(3),
+            clear: view.getUint16(4),
+            red: view.getUint16(6),
+            green: view.getUint16(8),
+            blue: view.getUint16(10),
+            colorTemp: view.getUint16(12),
+            lux: view.getUint16(14),
+            seq: view.getUint16(16)
+        };
     }
+    if (service == LIGHT_TYPE_SERVICE && view.byteLength >= LIGHT_TYPE_LENGTH) {
+        if (view.getUint8(3) != LPCSB_SENSOR_ID) {
+            return null;
+        }
+        var light_type = view.getUint8(4);
+        return {
+            device: 'LPCSB',
+            service: 'light_type',
+            sensorID: view.getUint8(3),
+            lightType: LIGHT_TYPE_NAMES[light_type] || 'Unknown',
+            lightTypeCode: light_type,
+            seq: view.getUint16(5)
+        };
+    }
+    return null;
+};
 
-    cb(null);
-}
+// Calls cb with the record of an advertisement, or with null. Boards are
+//  recognized by their payload rather than their name, which is per build
+//  (LPCSB_TEST and so on) and may only be in the scan response.
+var parse_advertisement = function (advertisement, cb) {
+    cb(decode_manufacturer_data(advertisement.manufacturerData));
+};
 
-//function hex2a(hexx) {
-   // var hex = hexx.toString(); 
-    //var string = '';
-    //for (var i = 0; (i < hex.length && hex.substr(i, 2) !== '00'); i += 2)
-        //string += String.fromCharCode(parseInt(hex.substr(i, 2), 16));
-   // return string;
-//}
+exports.UVA_COMPANY_IDENTIFIER = UVA_COMPANY_IDENTIFIER;
+exports.decodeManufacturerData = decode_manufacturer_data;
+exports.parseAdvertisement = parse_advertisement;
 
-module.exports = {
-    parseAdvertisement: parse_advertisement
-};
\ No newline at end of file
+})(typeof module !== 'undefined' && module.exports ? module.exports : (window.lpcsb_parse = {}));